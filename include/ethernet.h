@@ -99,12 +99,13 @@ typedef struct _ETHERNET_UNTAGGED_HEADER {
 #define ETHERTYPE_ARP       0x0806
 #define ETHERTYPE_RARP      0x0835
 #define ETHERTYPE_TPID      0x8100
+#define ETHERTYPE_STPID     0x88A8
 #define ETHERTYPE_IPX       0xFFFF
 
 } ETHERNET_UNTAGGED_HEADER, *PETHERNET_UNTAGGED_HEADER;
 
 typedef struct _ETHERNET_TAG {
-    USHORT  ProtocolID;    // == ETHERTYPE_TPID
+    USHORT  ProtocolID;    // == ETHERTYPE_TPID or ETHERTYPE_STPID
     USHORT  ControlInformation;
 
 #define PACK_TAG_CONTROL_INFORMATION(_ControlInformation, _UserPriority, _CanonicalFormatId, _VlanId)   \
@@ -142,6 +143,10 @@ typedef union _ETHERNET_HEADER {
 #define ETHERNET_HEADER_IS_TAGGED(_Header)                          \
         ((_Header)->Untagged.TypeOrLength == NTOHS(ETHERTYPE_TPID))
 
+// 802.1ad (QinQ) outer service tag
+#define ETHERNET_HEADER_IS_SERVICE_TAGGED(_Header)                  \
+        ((_Header)->Untagged.TypeOrLength == NTOHS(ETHERTYPE_STPID))
+
 #define ETHERNET_HEADER_LENGTH(_Header)         \
         ETHERNET_HEADER_IS_TAGGED(_Header) ?    \
         sizeof (ETHERNET_TAGGED_HEADER) :       \
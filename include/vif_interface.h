@@ -364,6 +364,30 @@ typedef enum _XENVIF_VIF_STATISTIC {
     XENVIF_VIF_STATISTIC_COUNT
 } XENVIF_VIF_STATISTIC, *PXENVIF_VIF_STATISTIC;
 
+/*! \enum _XENVIF_VIF_LATENCY
+    \brief Latency intervals for which histograms are maintained
+*/
+typedef enum _XENVIF_VIF_LATENCY {
+    /*! Time from a packet being queued to its last request being posted */
+    XENVIF_TRANSMITTER_LATENCY_QUEUE_TO_POST = 0,
+    /*! Time from a packet's last request being posted to its last response */
+    XENVIF_TRANSMITTER_LATENCY_POST_TO_RESPONSE,
+    /*! Time from the last response to the packet being returned */
+    XENVIF_TRANSMITTER_LATENCY_RESPONSE_TO_COMPLETION,
+    /*! Time from a packet's last response to its indication */
+    XENVIF_RECEIVER_LATENCY_RESPONSE_TO_INDICATION,
+    XENVIF_VIF_LATENCY_COUNT
+} XENVIF_VIF_LATENCY, *PXENVIF_VIF_LATENCY;
+
+/*! \def XENVIF_VIF_LATENCY_BUCKET_COUNT
+    \brief The number of buckets in a latency histogram
+
+    Bucket 0 counts intervals of less than 1us. Bucket N (N > 0) counts
+    intervals of at least 2^(N-1)us and less than 2^Nus, except the last
+    bucket which counts all longer intervals.
+*/
+#define XENVIF_VIF_LATENCY_BUCKET_COUNT 32
+
 /*! \enum _XENVIF_MAC_FILTER_LEVEL
     \brief Filter level applied to packets
 */
@@ -385,9 +409,59 @@ typedef enum _XENVIF_VIF_CALLBACK_TYPE {
     /*! Queue a receive side packet at the subscriber */
     XENVIF_RECEIVER_QUEUE_PACKET,
     /*! Notify the subscriber of a MAC (link) state has change */
-    XENVIF_MAC_STATE_CHANGE
+    XENVIF_MAC_STATE_CHANGE,
+    /*! Queue a batch of receive side packets at the subscriber */
+    XENVIF_RECEIVER_QUEUE_PACKETS
 } XENVIF_VIF_CALLBACK_TYPE, *PXENVIF_VIF_CALLBACK_TYPE;
 
+/*! \struct _XENVIF_RECEIVER_PACKET_DESCRIPTOR
+    \brief Receive side packet passed to the subscriber in a batch
+    (see \ref XENVIF_RECEIVER_QUEUE_PACKETS)
+*/
+typedef struct _XENVIF_RECEIVER_PACKET_DESCRIPTOR {
+    /*! The initial MDL of the packet */
+    PMDL                            Mdl;
+    /*! The offset of the packet data in the initial MDL */
+    ULONG                           Offset;
+    /*! The total length of the packet */
+    ULONG                           Length;
+    /*! Packet checksum flags */
+    XENVIF_PACKET_CHECKSUM_FLAGS    Flags;
+    /*! The TCP MSS (used only if OffloadOptions.OffloadIpVersion[4|6]LargePacket is set) */
+    USHORT                          MaximumSegmentSize;
+    /*! The VLAN TCI (used only if OffloadOptions.OffloadTagManipulation is set) */
+    USHORT                          TagControlInformation;
+    /*! Header information for the packet */
+    PXENVIF_PACKET_INFO             Info;
+    /*! Hash information for the packet */
+    PXENVIF_PACKET_HASH             Hash;
+    /*! Cookie that should be passed to XENVIF_RECEIVER_RETURN_PACKET method */
+    PVOID                           Cookie;
+} XENVIF_RECEIVER_PACKET_DESCRIPTOR, *PXENVIF_RECEIVER_PACKET_DESCRIPTOR;
+
+/*! \struct _XENVIF_TRANSMITTER_PACKET_DESCRIPTOR
+    \brief Transmit side packet passed to the provider in a batch
+    (see \ref XENVIF_VIF_TRANSMITTER_QUEUE_PACKETS)
+*/
+typedef struct _XENVIF_TRANSMITTER_PACKET_DESCRIPTOR {
+    /*! The initial MDL of the packet */
+    PMDL                            Mdl;
+    /*! The offset of the packet data in the initial MDL */
+    ULONG                           Offset;
+    /*! The total length of the packet */
+    ULONG                           Length;
+    /*! The requested offload options for this packet */
+    XENVIF_VIF_OFFLOAD_OPTIONS      OffloadOptions;
+    /*! The TCP MSS (used only if OffloadOptions.OffloadIpVersion[4|6]LargePacket is set) */
+    USHORT                          MaximumSegmentSize;
+    /*! The VLAN TCI (used only if OffloadOptions.OffloadTagManipulation is set) */
+    USHORT                          TagControlInformation;
+    /*! Hash information for the packet */
+    XENVIF_PACKET_HASH              Hash;
+    /*! A cookie that will be passed to the XENVIF_TRANSMITTER_RETURN_PACKET callback */
+    PVOID                           Cookie;
+} XENVIF_TRANSMITTER_PACKET_DESCRIPTOR, *PXENVIF_TRANSMITTER_PACKET_DESCRIPTOR;
+
 /*! \typedef XENVIF_VIF_ACQUIRE
     \brief Acquire a reference to the VIF interface
 
@@ -434,6 +508,13 @@ typedef VOID
 
     \b XENVIF_MAC_STATE_CHANGE:
     No additional arguments
+
+    \b XENVIF_RECEIVER_QUEUE_PACKETS (version 9 onwards, replaces
+    XENVIF_RECEIVER_QUEUE_PACKET):
+    \param Index The index of the queue on which the packets were received
+    \param Packet An array of \ref _XENVIF_RECEIVER_PACKET_DESCRIPTOR
+    \param Count The number of entries in \a Packet
+    \param More A flag to indicate whether more packets will be queued for the same CPU
 */
 typedef VOID
 (*XENVIF_VIF_CALLBACK)(
@@ -491,6 +572,24 @@ typedef NTSTATUS
     OUT PULONGLONG              Value
     );
 
+/*! \typedef XENVIF_VIF_QUERY_LATENCY_HISTOGRAM
+    \brief Query a latency histogram, summed across all shared rings
+
+    Histograms are zeroed when the vif device object is created. They
+    are not zeroed by this call or by any vif state change.
+
+    \param Interface The interface header
+    \param Latency The interval in \ref _XENVIF_VIF_LATENCY
+    \param Bucket Buffer of XENVIF_VIF_LATENCY_BUCKET_COUNT entries to
+    receive the histogram
+*/
+typedef NTSTATUS
+(*XENVIF_VIF_QUERY_LATENCY_HISTOGRAM)(
+    IN  PINTERFACE          Interface,
+    IN  XENVIF_VIF_LATENCY  Latency,
+    OUT PULONGLONG          Bucket
+    );
+
 /*! \typedef XENVIF_VIF_QUERY_RING_COUNT
     \brief Query the number of shared rings between frontend
     and backend
@@ -504,6 +603,23 @@ typedef VOID
     OUT PULONG      Count
     );
 
+/*! \typedef XENVIF_VIF_SET_ACTIVE_RING_COUNT
+    \brief Set how many of the shared rings are used
+
+    Transmit queue selection and the receive hash mapping are folded
+    onto the first \a Count rings. The remaining rings stay connected
+    so anything already queued on them drains normally.
+
+    \param Interface The interface header
+    \param Count The number of rings to use, between 1 and the value
+    returned by \ref XENVIF_VIF_QUERY_RING_COUNT
+*/
+typedef NTSTATUS
+(*XENVIF_VIF_SET_ACTIVE_RING_COUNT)(
+    IN  PINTERFACE  Interface,
+    IN  ULONG       Count
+    );
+
 /*! \typedef XENVIF_VIF_UPDATE_HASH_MAPPING
     \brief Update the mapping of hash to transmitter/receiver ring
 
@@ -574,6 +690,25 @@ typedef NTSTATUS
     IN  PVOID                       Cookie
     );
 
+/*! \typedef XENVIF_VIF_TRANSMITTER_QUEUE_PACKETS
+    \brief Queue a batch of packets at the provider's transmit side
+
+    Packets are queued in array order. If a packet cannot be queued then
+    neither it nor any later packet in the array is queued.
+
+    \param Interface The interface header
+    \param Packet An array of \ref _XENVIF_TRANSMITTER_PACKET_DESCRIPTOR
+    \param Count The number of entries in \a Packet
+    \param Queued Buffer to receive the number of packets queued
+*/
+typedef NTSTATUS
+(*XENVIF_VIF_TRANSMITTER_QUEUE_PACKETS)(
+    IN  PINTERFACE                              Interface,
+    IN  PXENVIF_TRANSMITTER_PACKET_DESCRIPTOR   Packet,
+    IN  ULONG                                   Count,
+    OUT PULONG                                  Queued
+    );
+
 /*! \typedef XENVIF_VIF_TRANSMITTER_QUERY_OFFLOAD_OPTIONS
     \brief Query the available set of transmit side offload options
 
@@ -928,7 +1063,44 @@ struct _XENVIF_VIF_INTERFACE_V8 {
     XENVIF_VIF_MAC_QUERY_FILTER_LEVEL               MacQueryFilterLevel;
 };
 
-typedef struct _XENVIF_VIF_INTERFACE_V8 XENVIF_VIF_INTERFACE, *PXENVIF_VIF_INTERFACE;
+/*! \struct _XENVIF_VIF_INTERFACE_V9
+    \brief VIF interface version 9
+    \ingroup interfaces
+*/
+struct _XENVIF_VIF_INTERFACE_V9 {
+    INTERFACE                                       Interface;
+    XENVIF_VIF_ACQUIRE                              Acquire;
+    XENVIF_VIF_RELEASE                              Release;
+    XENVIF_VIF_ENABLE                               Enable;
+    XENVIF_VIF_DISABLE                              Disable;
+    XENVIF_VIF_QUERY_STATISTIC                      QueryStatistic;
+    XENVIF_VIF_QUERY_RING_COUNT                     QueryRingCount;
+    XENVIF_VIF_UPDATE_HASH_MAPPING                  UpdateHashMapping;
+    XENVIF_VIF_RECEIVER_RETURN_PACKET               ReceiverReturnPacket;
+    XENVIF_VIF_RECEIVER_SET_OFFLOAD_OPTIONS         ReceiverSetOffloadOptions;
+    XENVIF_VIF_RECEIVER_SET_BACKFILL_SIZE           ReceiverSetBackfillSize;
+    XENVIF_VIF_RECEIVER_QUERY_RING_SIZE             ReceiverQueryRingSize;
+    XENVIF_VIF_RECEIVER_SET_HASH_ALGORITHM          ReceiverSetHashAlgorithm;
+    XENVIF_VIF_RECEIVER_QUERY_HASH_CAPABILITIES     ReceiverQueryHashCapabilities;
+    XENVIF_VIF_RECEIVER_UPDATE_HASH_PARAMETERS      ReceiverUpdateHashParameters;
+    XENVIF_VIF_TRANSMITTER_QUEUE_PACKET             TransmitterQueuePacket;
+    XENVIF_VIF_TRANSMITTER_QUERY_OFFLOAD_OPTIONS    TransmitterQueryOffloadOptions;
+    XENVIF_VIF_TRANSMITTER_QUERY_LARGE_PACKET_SIZE  TransmitterQueryLargePacketSize;
+    XENVIF_VIF_TRANSMITTER_QUERY_RING_SIZE          TransmitterQueryRingSize;
+    XENVIF_VIF_MAC_QUERY_STATE                      MacQueryState;
+    XENVIF_VIF_MAC_QUERY_MAXIMUM_FRAME_SIZE         MacQueryMaximumFrameSize;
+    XENVIF_VIF_MAC_QUERY_PERMANENT_ADDRESS          MacQueryPermanentAddress;
+    XENVIF_VIF_MAC_QUERY_CURRENT_ADDRESS            MacQueryCurrentAddress;
+    XENVIF_VIF_MAC_QUERY_MULTICAST_ADDRESSES        MacQueryMulticastAddresses;
+    XENVIF_VIF_MAC_SET_MULTICAST_ADDRESSES          MacSetMulticastAddresses;
+    XENVIF_VIF_MAC_SET_FILTER_LEVEL                 MacSetFilterLevel;
+    XENVIF_VIF_MAC_QUERY_FILTER_LEVEL               MacQueryFilterLevel;
+    XENVIF_VIF_QUERY_LATENCY_HISTOGRAM              QueryLatencyHistogram;
+    XENVIF_VIF_TRANSMITTER_QUEUE_PACKETS            TransmitterQueuePackets;
+    XENVIF_VIF_SET_ACTIVE_RING_COUNT                SetActiveRingCount;
+};
+
+typedef struct _XENVIF_VIF_INTERFACE_V9 XENVIF_VIF_INTERFACE, *PXENVIF_VIF_INTERFACE;
 
 /*! \def XENVIF_VIF
     \brief Macro at assist in method invocation
@@ -939,6 +1111,6 @@ typedef struct _XENVIF_VIF_INTERFACE_V8 XENVIF_VIF_INTERFACE, *PXENVIF_VIF_INTER
 #endif  // _WINDLL
 
 #define XENVIF_VIF_INTERFACE_VERSION_MIN    6
-#define XENVIF_VIF_INTERFACE_VERSION_MAX    8
+#define XENVIF_VIF_INTERFACE_VERSION_MAX    9
 
 #endif  // _XENVIF_INTERFACE_H
@@ -70,6 +70,35 @@ __AccumulateChecksum(
     *Accumulator = Current;
 }
 
+// Offset is the position of BaseVa within the data being summed. A
+// chunk that starts at an odd offset has its bytes in the opposite
+// halves of each word, so its partial sum is byte-swapped before being
+// added in (see RFC 1071, section 2).
+static FORCEINLINE VOID
+__AccumulateChecksumAt(
+    IN OUT  PULONG  Accumulator,
+    IN      PUCHAR  BaseVa,
+    IN      ULONG   ByteCount,
+    IN      ULONG   Offset
+    )
+{
+    ULONG           Partial;
+    ULONG           Current;
+
+    Partial = 0;
+    __AccumulateChecksum(&Partial, BaseVa, ByteCount);
+
+    if (Offset & 1)
+        Partial = ((Partial & 0xFF) << 8) | (Partial >> 8);
+
+    Current = *Accumulator + Partial;
+
+    while ((Current >> 16) != 0)
+        Current = (Current & 0xFFFF) + (Current >> 16);
+
+    *Accumulator = Current;
+}
+
 VOID
 AccumulateChecksum(
     IN OUT  PULONG  Accumulator,
@@ -80,6 +109,17 @@ AccumulateChecksum(
     __AccumulateChecksum(Accumulator, BaseVa, ByteCount);
 }
 
+VOID
+AccumulateChecksumAt(
+    IN OUT  PULONG  Accumulator,
+    IN      PVOID   BaseVa,
+    IN      ULONG   ByteCount,
+    IN      ULONG   Offset
+    )
+{
+    __AccumulateChecksumAt(Accumulator, BaseVa, ByteCount, Offset);
+}
+
 BOOLEAN
 ChecksumVerify(
     IN  USHORT  Calculated,
@@ -100,6 +140,73 @@ ChecksumVerify(
     return (Accumulator == 0xFFFF) ? TRUE : FALSE;
 }
 
+//
+// The update functions below take the checksum and the old and new
+// field values exactly as they appear in the header (i.e. in network
+// byte order) and return the checksum that would result from a full
+// recalculation after the field has been replaced.
+//
+static FORCEINLINE USHORT
+__ChecksumUpdateUshort(
+    IN  USHORT  Checksum,
+    IN  USHORT  Old,
+    IN  USHORT  New
+    )
+{
+    ULONG       Accumulator;
+
+    // See RFC 1624, section 3: HC' = ~(~HC + ~m + m')
+    Accumulator = (USHORT)~Checksum;
+    Accumulator += (USHORT)~Old;
+    Accumulator += New;
+
+    while ((Accumulator >> 16) != 0)
+        Accumulator = (Accumulator & 0xFFFF) + (Accumulator >> 16);
+
+    return (USHORT)~Accumulator;
+}
+
+USHORT
+ChecksumUpdateUshort(
+    IN  USHORT  Checksum,
+    IN  USHORT  Old,
+    IN  USHORT  New
+    )
+{
+    return __ChecksumUpdateUshort(Checksum, Old, New);
+}
+
+USHORT
+ChecksumUpdateUlong(
+    IN  USHORT  Checksum,
+    IN  ULONG   Old,
+    IN  ULONG   New
+    )
+{
+    // One's complement addition is commutative so the order in which
+    // the two halves are folded in does not matter
+    Checksum = __ChecksumUpdateUshort(Checksum,
+                                      (USHORT)(Old & 0xFFFF),
+                                      (USHORT)(New & 0xFFFF));
+
+    return __ChecksumUpdateUshort(Checksum,
+                                  (USHORT)(Old >> 16),
+                                  (USHORT)(New >> 16));
+}
+
+USHORT
+ChecksumUpdateLength(
+    IN  USHORT  Checksum,
+    IN  USHORT  OldLength,
+    IN  USHORT  NewLength
+    )
+{
+    // Lengths are passed in host byte order
+    return __ChecksumUpdateUshort(Checksum,
+                                  HTONS(OldLength),
+                                  HTONS(NewLength));
+}
+
 static FORCEINLINE USHORT
 __ChecksumIpVersion4PseudoHeader(
     IN  PIPV4_ADDRESS   SourceAddress,
@@ -281,6 +388,7 @@ ChecksumTcpPacket(
     PMDL                        Mdl;
     ULONG                       Offset;
     ULONG                       Length;
+    ULONG                       Done;
 
     ASSERT(Info->IpHeader.Length != 0);
     IpHeader = (PIP_HEADER)(StartVa + Info->IpHeader.Offset);
@@ -323,6 +431,7 @@ ChecksumTcpPacket(
     Length -= Info->TcpOptions.Length;
     Length = __min(Length, Payload->Length);
 
+    Done = 0;
     while (Length != 0) {
         PUCHAR  BaseVa;
         ULONG   ByteCount;
@@ -337,9 +446,10 @@ ChecksumTcpPacket(
         ByteCount -= Offset;
         ByteCount = __min(ByteCount, Length);
 
-        __AccumulateChecksum(&Accumulator, BaseVa, ByteCount);
+        __AccumulateChecksumAt(&Accumulator, BaseVa, ByteCount, Done);
 
         Length -= ByteCount;
+        Done += ByteCount;
 
         Mdl = Mdl->Next;
         Offset = 0;
@@ -366,6 +476,7 @@ ChecksumUdpPacket(
     PMDL                        Mdl;
     ULONG                       Offset;
     ULONG                       Length;
+    ULONG                       Done;
 
     ASSERT(Info->IpHeader.Length != 0);
     IpHeader = (PIP_HEADER)(StartVa + Info->IpHeader.Offset);
@@ -402,6 +513,7 @@ ChecksumUdpPacket(
     Length -= Info->UdpHeader.Length;
     Length = __min(Length, Payload->Length);
 
+    Done = 0;
     while (Length != 0) {
         PUCHAR  BaseVa;
         ULONG   ByteCount;
@@ -416,9 +528,10 @@ ChecksumUdpPacket(
         ByteCount -= Offset;
         ByteCount = __min(ByteCount, Length);
 
-        __AccumulateChecksum(&Accumulator, BaseVa, ByteCount);
+        __AccumulateChecksumAt(&Accumulator, BaseVa, ByteCount, Done);
 
         Length -= ByteCount;
+        Done += ByteCount;
 
         Mdl = Mdl->Next;
         Offset = 0;
@@ -41,6 +41,14 @@ AccumulateChecksum(
     IN      ULONG   ByteCount
     );
 
+extern VOID
+AccumulateChecksumAt(
+    IN OUT  PULONG  Accumulator,
+    IN      PVOID   MappedSystemVa,
+    IN      ULONG   ByteCount,
+    IN      ULONG   Offset
+    );
+
 extern USHORT
 ChecksumIpVersion4Header(
     IN  PUCHAR              StartVa,
@@ -91,4 +99,25 @@ ChecksumVerify(
     IN  USHORT  Embedded
     );
 
+extern USHORT
+ChecksumUpdateUshort(
+    IN  USHORT  Checksum,
+    IN  USHORT  Old,
+    IN  USHORT  New
+    );
+
+extern USHORT
+ChecksumUpdateUlong(
+    IN  USHORT  Checksum,
+    IN  ULONG   Old,
+    IN  ULONG   New
+    );
+
+extern USHORT
+ChecksumUpdateLength(
+    IN  USHORT  Checksum,
+    IN  USHORT  OldLength,
+    IN  USHORT  NewLength
+    );
+
 #endif  // _XENVIF_CHECKSUM_H
@@ -60,6 +60,9 @@ RtlRandomEx (
 
 #define MAXNAMELEN  128
 
+// Enough for a complete hash configuration to be in flight at once
+#define XENVIF_CONTROLLER_MAXIMUM_REQUESTS  8
+
 struct _XENVIF_CONTROLLER {
     PXENVIF_FRONTEND                    Frontend;
     KSPIN_LOCK                          Lock;
@@ -72,8 +75,10 @@ struct _XENVIF_CONTROLLER {
     ULONG                               Events;
     BOOLEAN                             Connected;
     USHORT                              RequestId;
-    struct xen_netif_ctrl_request       Request;
-    struct xen_netif_ctrl_response      Response;
+    struct xen_netif_ctrl_request       Request[XENVIF_CONTROLLER_MAXIMUM_REQUESTS];
+    struct xen_netif_ctrl_response      Response[XENVIF_CONTROLLER_MAXIMUM_REQUESTS];
+    ULONG                               Count;
+    ULONG                               Pending;
     XENBUS_GNTTAB_INTERFACE             GnttabInterface;
     XENBUS_EVTCHN_INTERFACE             EvtchnInterface;
     XENBUS_STORE_INTERFACE              StoreInterface;
@@ -146,14 +151,13 @@ __ControllerSend(
                          Controller->Channel);
 }
 
-VOID
+static VOID
 ControllerPoll(
     IN  PXENVIF_CONTROLLER          Controller
     )
 {
     RING_IDX                        rsp_prod;
     RING_IDX                        rsp_cons;
-    struct xen_netif_ctrl_response  *rsp;
 
     KeMemoryBarrier();
 
@@ -162,13 +166,27 @@ ControllerPoll(
 
     KeMemoryBarrier();
 
-    if (rsp_cons == rsp_prod)
-        return;
+    while (rsp_cons != rsp_prod) {
+        struct xen_netif_ctrl_response  *rsp;
+        ULONG                           Index;
+
+        rsp = RING_GET_RESPONSE(&Controller->Front, rsp_cons);
+        rsp_cons++;
 
-    rsp = RING_GET_RESPONSE(&Controller->Front, rsp_cons);
-    rsp_cons++;
+        // Responses may not come back in the order the requests were
+        // made so match them up by id
+        for (Index = 0; Index < Controller->Count; Index++) {
+            if (rsp->id != Controller->Request[Index].id)
+                continue;
 
-    Controller->Response = *rsp;
+            Controller->Response[Index] = *rsp;
+            Controller->Pending--;
+            break;
+        }
+
+        if (Index == Controller->Count)
+            Warning("unexpected response (id = %u)\n", rsp->id);
+    }
 
     KeMemoryBarrier();
 
@@ -177,7 +195,7 @@ ControllerPoll(
 }
 
 static NTSTATUS
-ControllerPutRequest(
+__ControllerPutRequest(
     IN  PXENVIF_CONTROLLER          Controller,
     IN  USHORT                      Type,
     IN  ULONG                       Data0,
@@ -185,9 +203,9 @@ ControllerPutRequest(
     IN  ULONG                       Data2
     )
 {
+    struct xen_netif_ctrl_request   *Request;
     RING_IDX                        req_prod;
     struct xen_netif_ctrl_request   *req;
-    BOOLEAN                         Notify;
     NTSTATUS                        status;
 
     status = STATUS_NOT_SUPPORTED;
@@ -195,30 +213,54 @@ ControllerPutRequest(
         goto fail1;
 
     status = STATUS_INSUFFICIENT_RESOURCES;
-    if (RING_FULL(&Controller->Front))
+    if (Controller->Count == XENVIF_CONTROLLER_MAXIMUM_REQUESTS ||
+        RING_FULL(&Controller->Front))
         goto fail2;
 
-    Controller->Request.type = Type;
+    Request = &Controller->Request[Controller->Count];
+
+    Request->type = Type;
 
-    Controller->Request.id = Controller->RequestId++;
-    if (Controller->Request.id == 0) // Make sure we skip zero
-        Controller->Request.id = Controller->RequestId++;
+    Request->id = Controller->RequestId++;
+    if (Request->id == 0) // Make sure we skip zero
+        Request->id = Controller->RequestId++;
 
-    Controller->Request.data[0] = Data0;
-    Controller->Request.data[1] = Data1;
-    Controller->Request.data[2] = Data2;
+    Request->data[0] = Data0;
+    Request->data[1] = Data1;
+    Request->data[2] = Data2;
 
     req_prod = Controller->Front.req_prod_pvt;
 
     req = RING_GET_REQUEST(&Controller->Front, req_prod);
     req_prod++;
 
-    *req = Controller->Request;
+    *req = *Request;
 
     KeMemoryBarrier();
 
     Controller->Front.req_prod_pvt = req_prod;
 
+    Controller->Count++;
+    Controller->Pending++;
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("fail2\n");
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
+static VOID
+__ControllerPushRequests(
+    IN  PXENVIF_CONTROLLER  Controller
+    )
+{
+    BOOLEAN                 Notify;
+
 #pragma warning (push)
 #pragma warning (disable:4244)
 
@@ -229,16 +271,28 @@ ControllerPutRequest(
 
     if (Notify)
         __ControllerSend(Controller);
+}
 
-    return STATUS_SUCCESS;
+static NTSTATUS
+ControllerPutRequest(
+    IN  PXENVIF_CONTROLLER          Controller,
+    IN  USHORT                      Type,
+    IN  ULONG                       Data0,
+    IN  ULONG                       Data1,
+    IN  ULONG                       Data2
+    )
+{
+    NTSTATUS                        status;
 
-fail2:
-    Error("fail2\n");
+    ASSERT3U(Controller->Count, ==, 0);
 
-fail1:
-    Error("fail1 (%08x)\n", status);
+    status = __ControllerPutRequest(Controller, Type, Data0, Data1, Data2);
+    if (!NT_SUCCESS(status))
+        return status;
 
-    return status;
+    __ControllerPushRequests(Controller);
+
+    return STATUS_SUCCESS;
 }
 
 #define TIME_US(_us)        ((_us) * 10)
@@ -247,10 +301,9 @@ fail1:
 
 #define XENVIF_CONTROLLER_POLL_PERIOD 100 // ms
 
-static NTSTATUS
-ControllerGetResponse(
-    IN  PXENVIF_CONTROLLER          Controller,
-    OUT PULONG                      Data OPTIONAL
+static VOID
+__ControllerWaitForResponses(
+    IN  PXENVIF_CONTROLLER          Controller
     )
 {
     LARGE_INTEGER                   Timeout;
@@ -268,7 +321,7 @@ ControllerGetResponse(
         ControllerPoll(Controller);
         KeMemoryBarrier();
 
-        if (Controller->Response.id == Controller->Request.id)
+        if (Controller->Pending == 0)
             break;
 
         status = XENBUS_EVTCHN(Wait,
@@ -279,10 +332,27 @@ ControllerGetResponse(
         if (status == STATUS_TIMEOUT)
             __ControllerSend(Controller);
     }
+}
 
-    ASSERT3U(Controller->Response.type, ==, Controller->Request.type);
+static NTSTATUS
+__ControllerGetResponse(
+    IN  PXENVIF_CONTROLLER          Controller,
+    IN  ULONG                       Index,
+    OUT PULONG                      Data OPTIONAL
+    )
+{
+    struct xen_netif_ctrl_request   *Request;
+    struct xen_netif_ctrl_response  *Response;
+    NTSTATUS                        status;
 
-    switch (Controller->Response.status) {
+    ASSERT3U(Index, <, Controller->Count);
+    Request = &Controller->Request[Index];
+    Response = &Controller->Response[Index];
+
+    ASSERT3U(Response->id, ==, Request->id);
+    ASSERT3U(Response->type, ==, Request->type);
+
+    switch (Response->status) {
     case XEN_NETIF_CTRL_STATUS_SUCCESS:
         status = STATUS_SUCCESS;
         break;
@@ -305,12 +375,41 @@ ControllerGetResponse(
     }
 
     if (NT_SUCCESS(status) && Data != NULL)
-        *Data = Controller->Response.data;
+        *Data = Response->data;
+
+    return status;
+}
+
+static VOID
+__ControllerResetRequests(
+    IN  PXENVIF_CONTROLLER  Controller
+    )
+{
+    ASSERT3U(Controller->Pending, ==, 0);
+
+    RtlZeroMemory(Controller->Request,
+                  sizeof (struct xen_netif_ctrl_request) * Controller->Count);
+    RtlZeroMemory(Controller->Response,
+                  sizeof (struct xen_netif_ctrl_response) * Controller->Count);
+
+    Controller->Count = 0;
+}
+
+static NTSTATUS
+ControllerGetResponse(
+    IN  PXENVIF_CONTROLLER          Controller,
+    OUT PULONG                      Data OPTIONAL
+    )
+{
+    NTSTATUS                        status;
+
+    ASSERT3U(Controller->Count, ==, 1);
+
+    __ControllerWaitForResponses(Controller);
 
-    RtlZeroMemory(&Controller->Request,
-                  sizeof (struct xen_netif_ctrl_request));
-    RtlZeroMemory(&Controller->Response,
-                  sizeof (struct xen_netif_ctrl_response));
+    status = __ControllerGetResponse(Controller, 0, Data);
+
+    __ControllerResetRequests(Controller);
 
     return status;
 }
@@ -395,8 +494,7 @@ ControllerConnect(
     )
 {
     PXENVIF_FRONTEND            Frontend;
-    PCHAR                       Buffer;
-    BOOLEAN                     Feature;
+    ULONG                       Feature;
     PFN_NUMBER                  Pfn;
     CHAR                        Name[MAXNAMELEN];
     ULONG                       Index;
@@ -422,23 +520,10 @@ ControllerConnect(
     if (!NT_SUCCESS(status))
         goto fail4;
 
-    status = XENBUS_STORE(Read,
-                          &Controller->StoreInterface,
-                          NULL,
-                          FrontendGetBackendPath(Frontend),
-                          "feature-ctrl-ring",
-                          &Buffer);
-    if (!NT_SUCCESS(status)) {
-        Feature = FALSE;
-    } else {
-        Feature = (BOOLEAN)strtol(Buffer, NULL, 2);
-
-        XENBUS_STORE(Free,
-                     &Controller->StoreInterface,
-                     Buffer);
-    }
-
-    if (!Feature)
+    (VOID) FrontendGetBackendFeature(Frontend,
+                                     XENVIF_FRONTEND_FEATURE_CTRL_RING,
+                                     &Feature);
+    if (Feature == 0)
         goto done;
 
     status = RtlStringCbPrintfA(Name,
@@ -1155,3 +1240,207 @@ fail1:
 
     return status;
 }
+
+NTSTATUS
+ControllerSetHash(
+    IN  PXENVIF_CONTROLLER  Controller,
+    IN  ULONG               Algorithm,
+    IN  ULONG               Flags,
+    IN  PUCHAR              Key,
+    IN  ULONG               KeySize,
+    IN  PULONG              Mapping,
+    IN  ULONG               Size
+    )
+{
+    PXENVIF_FRONTEND        Frontend;
+    PMDL                    KeyMdl;
+    PMDL                    MappingMdl;
+    PXENBUS_GNTTAB_ENTRY    KeyEntry;
+    PXENBUS_GNTTAB_ENTRY    MappingEntry;
+    PUCHAR                  Buffer;
+    ULONG                   Index;
+    NTSTATUS                status;
+
+    Frontend = Controller->Frontend;
+
+    __ControllerAcquireLock(Controller);
+
+    status = STATUS_INVALID_PARAMETER;
+    if (KeySize > PAGE_SIZE ||
+        Size * sizeof (ULONG) > PAGE_SIZE)
+        goto fail1;
+
+    KeyMdl = __AllocatePage();
+
+    status = STATUS_NO_MEMORY;
+    if (KeyMdl == NULL)
+        goto fail2;
+
+    ASSERT(KeyMdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+    Buffer = KeyMdl->MappedSystemVa;
+    ASSERT(Buffer != NULL);
+
+    RtlCopyMemory(Buffer, Key, KeySize);
+
+    MappingMdl = __AllocatePage();
+
+    status = STATUS_NO_MEMORY;
+    if (MappingMdl == NULL)
+        goto fail3;
+
+    ASSERT(MappingMdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+    Buffer = MappingMdl->MappedSystemVa;
+    ASSERT(Buffer != NULL);
+
+    RtlCopyMemory(Buffer, Mapping, Size * sizeof (ULONG));
+
+    status = XENBUS_GNTTAB(PermitForeignAccess,
+                           &Controller->GnttabInterface,
+                           Controller->GnttabCache,
+                           TRUE,
+                           FrontendGetBackendDomain(Frontend),
+                           MmGetMdlPfnArray(KeyMdl)[0],
+                           FALSE,
+                           &KeyEntry);
+    if (!NT_SUCCESS(status))
+        goto fail4;
+
+    status = XENBUS_GNTTAB(PermitForeignAccess,
+                           &Controller->GnttabInterface,
+                           Controller->GnttabCache,
+                           TRUE,
+                           FrontendGetBackendDomain(Frontend),
+                           MmGetMdlPfnArray(MappingMdl)[0],
+                           FALSE,
+                           &MappingEntry);
+    if (!NT_SUCCESS(status))
+        goto fail5;
+
+    // The backend processes requests in ring order so the whole
+    // configuration can be queued up before waiting for any of it.
+    ASSERT3U(Controller->Count, ==, 0);
+
+    status = __ControllerPutRequest(Controller,
+                                    XEN_NETIF_CTRL_TYPE_SET_HASH_ALGORITHM,
+                                    Algorithm,
+                                    0,
+                                    0);
+    if (!NT_SUCCESS(status))
+        goto done;
+
+    status = __ControllerPutRequest(Controller,
+                                    XEN_NETIF_CTRL_TYPE_SET_HASH_MAPPING_SIZE,
+                                    Size,
+                                    0,
+                                    0);
+    if (!NT_SUCCESS(status))
+        goto done;
+
+    status = __ControllerPutRequest(Controller,
+                                    XEN_NETIF_CTRL_TYPE_SET_HASH_MAPPING,
+                                    XENBUS_GNTTAB(GetReference,
+                                                  &Controller->GnttabInterface,
+                                                  MappingEntry),
+                                    Size,
+                                    0);
+    if (!NT_SUCCESS(status))
+        goto done;
+
+    status = __ControllerPutRequest(Controller,
+                                    XEN_NETIF_CTRL_TYPE_SET_HASH_KEY,
+                                    XENBUS_GNTTAB(GetReference,
+                                                  &Controller->GnttabInterface,
+                                                  KeyEntry),
+                                    KeySize,
+                                    0);
+    if (!NT_SUCCESS(status))
+        goto done;
+
+    status = __ControllerPutRequest(Controller,
+                                    XEN_NETIF_CTRL_TYPE_SET_HASH_FLAGS,
+                                    Flags,
+                                    0,
+                                    0);
+
+done:
+    // Anything that made it onto the ring must be seen through, even
+    // if the batch could not be completed
+    if (Controller->Count != 0) {
+        __ControllerPushRequests(Controller);
+        __ControllerWaitForResponses(Controller);
+
+        for (Index = 0; Index < Controller->Count; Index++) {
+            NTSTATUS    ResponseStatus;
+
+            ResponseStatus = __ControllerGetResponse(Controller, Index, NULL);
+            if (NT_SUCCESS(status) && !NT_SUCCESS(ResponseStatus)) {
+                Error("request %u (type %u) failed\n",
+                      Index,
+                      Controller->Request[Index].type);
+                status = ResponseStatus;
+            }
+        }
+
+        __ControllerResetRequests(Controller);
+    }
+
+    if (!NT_SUCCESS(status))
+        goto fail6;
+
+    (VOID) XENBUS_GNTTAB(RevokeForeignAccess,
+                         &Controller->GnttabInterface,
+                         Controller->GnttabCache,
+                         TRUE,
+                         MappingEntry);
+
+    (VOID) XENBUS_GNTTAB(RevokeForeignAccess,
+                         &Controller->GnttabInterface,
+                         Controller->GnttabCache,
+                         TRUE,
+                         KeyEntry);
+
+    __FreePage(MappingMdl);
+    __FreePage(KeyMdl);
+
+    __ControllerReleaseLock(Controller);
+
+    return STATUS_SUCCESS;
+
+fail6:
+    Error("fail6\n");
+
+    (VOID) XENBUS_GNTTAB(RevokeForeignAccess,
+                         &Controller->GnttabInterface,
+                         Controller->GnttabCache,
+                         TRUE,
+                         MappingEntry);
+
+fail5:
+    Error("fail5\n");
+
+    (VOID) XENBUS_GNTTAB(RevokeForeignAccess,
+                         &Controller->GnttabInterface,
+                         Controller->GnttabCache,
+                         TRUE,
+                         KeyEntry);
+
+fail4:
+    Error("fail4\n");
+
+    __FreePage(MappingMdl);
+
+fail3:
+    Error("fail3\n");
+
+    __FreePage(KeyMdl);
+
+fail2:
+    Error("fail2\n");
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    __ControllerReleaseLock(Controller);
+
+    return status;
+}
@@ -122,5 +122,15 @@ ControllerSetHashMapping(
     IN  ULONG               Offset
     );
 
+extern NTSTATUS
+ControllerSetHash(
+    IN  PXENVIF_CONTROLLER  Controller,
+    IN  ULONG               Algorithm,
+    IN  ULONG               Flags,
+    IN  PUCHAR              Key,
+    IN  ULONG               KeySize,
+    IN  PULONG              Mapping,
+    IN  ULONG               Size
+    );
 
 #endif  // _XENVIF_CONTROLLER_H
@@ -56,8 +56,6 @@ typedef struct _XENVIF_FRONTEND_STATISTICS {
     ULONGLONG   Value[XENVIF_VIF_STATISTIC_COUNT];
 } XENVIF_FRONTEND_STATISTICS, *PXENVIF_FRONTEND_STATISTICS;
 
-#define XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE   128
-
 typedef struct _XENVIF_FRONTEND_HASH {
     XENVIF_PACKET_HASH_ALGORITHM    Algorithm;
     ULONG                           Flags;
@@ -66,6 +64,112 @@ typedef struct _XENVIF_FRONTEND_HASH {
     ULONG                           Size;
 } XENVIF_FRONTEND_HASH, *PXENVIF_FRONTEND_HASH;
 
+typedef struct _XENVIF_FRONTEND_REBALANCE {
+    ULONG           Interval;
+    ULONG           Threshold;
+    ULONG           Maximum;
+    PXENVIF_THREAD  Thread;
+    ULONG           Sample[XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE];
+    ULONGLONG       Load[XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE];
+    ULONG           Mapping[XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE];
+    ULONG           Holdoff[XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE];
+    PULONGLONG      QueueLoad;
+    ULONG           Count;
+} XENVIF_FRONTEND_REBALANCE, *PXENVIF_FRONTEND_REBALANCE;
+
+// One thread checks every ring's progress each Period seconds. When a
+// transmit ring stops, the thread is woken and re-checks every
+// StallTimeout milliseconds until no ring remains stopped.
+typedef struct _XENVIF_FRONTEND_WATCHDOG {
+    ULONG           Period;
+    ULONG           StallTimeout;
+    PXENVIF_THREAD  Thread;
+    LONG            Armed;
+    ULONG           Checks;
+} XENVIF_FRONTEND_WATCHDOG, *PXENVIF_FRONTEND_WATCHDOG;
+
+#define XENVIF_FRONTEND_WATCHDOG_PERIOD         30  // s
+#define XENVIF_FRONTEND_WATCHDOG_STALL_TIMEOUT  10  // ms
+
+typedef enum _XENVIF_FRONTEND_PHASE {
+    XENVIF_FRONTEND_PHASE_SUSPEND = 0,
+    XENVIF_FRONTEND_PHASE_CLOSE,
+    XENVIF_FRONTEND_PHASE_PREPARE,
+    XENVIF_FRONTEND_PHASE_MAC,
+    XENVIF_FRONTEND_PHASE_RECEIVER,
+    XENVIF_FRONTEND_PHASE_TRANSMITTER,
+    XENVIF_FRONTEND_PHASE_CONTROLLER,
+    XENVIF_FRONTEND_PHASE_STORE,
+    XENVIF_FRONTEND_PHASE_BACKEND,
+    XENVIF_FRONTEND_PHASE_ENABLE,
+    XENVIF_FRONTEND_PHASE_COUNT
+} XENVIF_FRONTEND_PHASE, *PXENVIF_FRONTEND_PHASE;
+
+typedef struct _XENVIF_FRONTEND_RESUME {
+    BOOLEAN         Active;
+    ULONG           Count;
+    LARGE_INTEGER   Frequency;
+    LARGE_INTEGER   Start;
+    LARGE_INTEGER   Last;
+    ULONGLONG       Time[XENVIF_FRONTEND_PHASE_COUNT];
+    ULONGLONG       Total;
+    ULONG           Attempts;
+} XENVIF_FRONTEND_RESUME, *PXENVIF_FRONTEND_RESUME;
+
+typedef struct _XENVIF_FRONTEND_AFFINITY {
+    PROCESSOR_NUMBER    ProcNumber;
+    ULONG               Node;
+} XENVIF_FRONTEND_AFFINITY, *PXENVIF_FRONTEND_AFFINITY;
+
+typedef enum _XENVIF_FRONTEND_ADDRESS_FAMILY {
+    XENVIF_FRONTEND_ADDRESS_IPV4 = 0,
+    XENVIF_FRONTEND_ADDRESS_IPV6,
+    XENVIF_FRONTEND_ADDRESS_FAMILY_COUNT
+} XENVIF_FRONTEND_ADDRESS_FAMILY, *PXENVIF_FRONTEND_ADDRESS_FAMILY;
+
+typedef struct _XENVIF_FRONTEND_ADDRESS {
+    LIST_ENTRY      ListEntry;
+    SOCKADDR_INET   Address;
+    ULONG           Slot;
+    BOOLEAN         Dirty;
+    BOOLEAN         Stale;
+} XENVIF_FRONTEND_ADDRESS, *PXENVIF_FRONTEND_ADDRESS;
+
+typedef struct _XENVIF_FRONTEND_ADDRESS_DELTA {
+    LIST_ENTRY              ListEntry;
+    MIB_NOTIFICATION_TYPE   Type;
+    NET_IFINDEX             InterfaceIndex;
+    SOCKADDR_INET           Address;
+} XENVIF_FRONTEND_ADDRESS_DELTA, *PXENVIF_FRONTEND_ADDRESS_DELTA;
+
+#define XENVIF_FRONTEND_ADDRESS_BUCKET_COUNT    64
+
+// Each family keeps its addresses in a dense slot array so that the
+// store key ipv4/N or ipv6/N for an address only changes when another
+// address is removed and the last slot is moved down to fill the gap.
+typedef struct _XENVIF_FRONTEND_ADDRESS_TABLE {
+    LIST_ENTRY                  Bucket[XENVIF_FRONTEND_ADDRESS_BUCKET_COUNT];
+    PXENVIF_FRONTEND_ADDRESS    *Slot[XENVIF_FRONTEND_ADDRESS_FAMILY_COUNT];
+    ULONG                       Size[XENVIF_FRONTEND_ADDRESS_FAMILY_COUNT];
+    ULONG                       Count[XENVIF_FRONTEND_ADDRESS_FAMILY_COUNT];
+    ULONG                       Written[XENVIF_FRONTEND_ADDRESS_FAMILY_COUNT];
+    LIST_ENTRY                  Delta;
+    BOOLEAN                     Resync;
+    BOOLEAN                     Rewrite;
+    ULONG                       Changes;
+    ULONG                       Resyncs;
+} XENVIF_FRONTEND_ADDRESS_TABLE, *PXENVIF_FRONTEND_ADDRESS_TABLE;
+
+typedef struct _XENVIF_FRONTEND_FEATURES {
+    KSPIN_LOCK                  Lock;
+    KEVENT                      Event;
+    PXENBUS_STORE_WATCH         Watch[XENVIF_FRONTEND_FEATURE_COUNT];
+    ULONG                       Present;
+    ULONG                       Value[XENVIF_FRONTEND_FEATURE_COUNT];
+    ULONG                       Reads;
+    ULONG                       Invalidations;
+} XENVIF_FRONTEND_FEATURES, *PXENVIF_FRONTEND_FEATURES;
+
 struct _XENVIF_FRONTEND {
     PXENVIF_PDO                 Pdo;
     PCHAR                       Path;
@@ -78,8 +182,12 @@ struct _XENVIF_FRONTEND {
 
     PCHAR                       BackendPath;
     USHORT                      BackendDomain;
+    XENVIF_FRONTEND_FEATURES    Features;
     ULONG                       MaxQueues;
+    PXENVIF_FRONTEND_AFFINITY   Affinity;
     ULONG                       NumQueues;
+    ULONG                       ActiveQueues;
+    ULONG                       RequestedActiveQueues;
     BOOLEAN                     Split;
     ULONG                       DisableToeplitz;
 
@@ -103,10 +211,12 @@ struct _XENVIF_FRONTEND {
     PXENVIF_THREAD              MibThread;
     CHAR                        Alias[IF_MAX_STRING_SIZE + 1];
     NET_IFINDEX                 InterfaceIndex;
-    PSOCKADDR_INET              AddressTable;
-    ULONG                       AddressCount;
+    XENVIF_FRONTEND_ADDRESS_TABLE   AddressTable;
 
     XENVIF_FRONTEND_HASH        Hash;
+    XENVIF_FRONTEND_REBALANCE   Rebalance;
+    XENVIF_FRONTEND_RESUME      Resume;
+    XENVIF_FRONTEND_WATCHDOG    Watchdog;
 };
 
 static const PCHAR
@@ -272,6 +382,129 @@ FrontendGetMaxQueues(
     return __FrontendGetMaxQueues(Frontend);
 }
 
+static ULONG
+__FrontendGetProcessorNode(
+    IN  PPROCESSOR_NUMBER   ProcNumber
+    )
+{
+    USHORT                  Highest;
+    USHORT                  Node;
+
+    Highest = KeQueryHighestNodeNumber();
+
+    for (Node = 0; Node <= Highest; Node++) {
+        GROUP_AFFINITY  Affinity;
+
+        KeQueryNodeActiveAffinity(Node, &Affinity, NULL);
+
+        if (Affinity.Group == ProcNumber->Group &&
+            (Affinity.Mask & ((KAFFINITY)1 << ProcNumber->Number)) != 0)
+            return Node;
+    }
+
+    return 0;
+}
+
+static NTSTATUS
+FrontendSetAffinity(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    HANDLE                  ParametersKey;
+    PANSI_STRING            Map;
+    ULONG                   Count;
+    ULONG                   Entry;
+    ULONG                   Index;
+    NTSTATUS                status;
+
+    Frontend->Affinity = __FrontendAllocate(sizeof (XENVIF_FRONTEND_AFFINITY) *
+                                            Frontend->MaxQueues);
+
+    status = STATUS_NO_MEMORY;
+    if (Frontend->Affinity == NULL)
+        goto fail1;
+
+    Count = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+    ParametersKey = DriverGetParametersKey();
+
+    // FrontendRingProcessorMap is a REG_MULTI_SZ with one processor
+    // index per ring; rings beyond the end of the map, or with an
+    // invalid entry, fall back to the processor with the same index.
+    status = RegistryQuerySzValue(ParametersKey,
+                                  "FrontendRingProcessorMap",
+                                  NULL,
+                                  &Map);
+    if (!NT_SUCCESS(status))
+        Map = NULL;
+
+    Entry = 0;
+    for (Index = 0; Index < Frontend->MaxQueues; Index++) {
+        PXENVIF_FRONTEND_AFFINITY   Affinity = &Frontend->Affinity[Index];
+        ULONG                       Processor;
+
+        Processor = Index;
+
+        if (Map != NULL && Map[Entry].Buffer != NULL) {
+            ULONG   Value = strtoul(Map[Entry].Buffer, NULL, 0);
+
+            if (Value < Count)
+                Processor = Value;
+            else
+                Warning("%s: RING[%u]: INVALID PROCESSOR %u\n",
+                        __FrontendGetPath(Frontend),
+                        Index,
+                        Value);
+
+            Entry++;
+        }
+
+        status = KeGetProcessorNumberFromIndex(Processor,
+                                               &Affinity->ProcNumber);
+        ASSERT(NT_SUCCESS(status));
+
+        Affinity->Node = __FrontendGetProcessorNode(&Affinity->ProcNumber);
+
+        Info("%s: RING[%u] -> CPU %u:%u NODE %u\n",
+             __FrontendGetPath(Frontend),
+             Index,
+             Affinity->ProcNumber.Group,
+             Affinity->ProcNumber.Number,
+             Affinity->Node);
+    }
+
+    if (Map != NULL)
+        RegistryFreeSzValue(Map);
+
+    return STATUS_SUCCESS;
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
+VOID
+FrontendGetRingProcessor(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  ULONG               Index,
+    OUT PPROCESSOR_NUMBER   ProcNumber
+    )
+{
+    ASSERT3U(Index, <, Frontend->MaxQueues);
+    *ProcNumber = Frontend->Affinity[Index].ProcNumber;
+}
+
+ULONG
+FrontendGetRingNode(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  ULONG               Index
+    )
+{
+    ASSERT3U(Index, <, Frontend->MaxQueues);
+    return Frontend->Affinity[Index].Node;
+}
+
 PCHAR
 FrontendFormatPath(
     IN  PXENVIF_FRONTEND    Frontend,
@@ -527,83 +760,269 @@ found:
     return STATUS_SUCCESS;
 }
 
+static FORCEINLINE XENVIF_FRONTEND_ADDRESS_FAMILY
+__FrontendGetAddressFamily(
+    IN  const SOCKADDR_INET *Address
+    )
+{
+    ASSERT(Address->si_family == AF_INET ||
+           Address->si_family == AF_INET6);
+
+    return (Address->si_family == AF_INET) ?
+           XENVIF_FRONTEND_ADDRESS_IPV4 :
+           XENVIF_FRONTEND_ADDRESS_IPV6;
+}
+
+static FORCEINLINE PUCHAR
+__FrontendGetAddressBytes(
+    IN  const SOCKADDR_INET *Address,
+    OUT PULONG              Length
+    )
+{
+    if (Address->si_family == AF_INET) {
+        *Length = IPV4_ADDRESS_LENGTH;
+        return (PUCHAR)&Address->Ipv4.sin_addr.s_addr;
+    }
+
+    ASSERT3U(Address->si_family, ==, AF_INET6);
+
+    *Length = IPV6_ADDRESS_LENGTH;
+    return (PUCHAR)&Address->Ipv6.sin6_addr.s6_addr;
+}
+
+static FORCEINLINE ULONG
+__FrontendHashAddress(
+    IN  const SOCKADDR_INET *Address
+    )
+{
+    PUCHAR                  Byte;
+    ULONG                   Length;
+    ULONG                   Index;
+    ULONG                   Hash;
+
+    Byte = __FrontendGetAddressBytes(Address, &Length);
+
+    // FNV-1a
+    Hash = 2166136261;
+    for (Index = 0; Index < Length; Index++) {
+        Hash ^= Byte[Index];
+        Hash *= 16777619;
+    }
+
+    return Hash % XENVIF_FRONTEND_ADDRESS_BUCKET_COUNT;
+}
+
+static PXENVIF_FRONTEND_ADDRESS
+FrontendLookupAddress(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  const SOCKADDR_INET *Address
+    )
+{
+    PXENVIF_FRONTEND_ADDRESS_TABLE  Table = &Frontend->AddressTable;
+    PLIST_ENTRY                     Bucket;
+    PLIST_ENTRY                     ListEntry;
+    PUCHAR                          Byte;
+    ULONG                           Length;
+
+    Bucket = &Table->Bucket[__FrontendHashAddress(Address)];
+    Byte = __FrontendGetAddressBytes(Address, &Length);
+
+    for (ListEntry = Bucket->Flink;
+         ListEntry != Bucket;
+         ListEntry = ListEntry->Flink) {
+        PXENVIF_FRONTEND_ADDRESS    Entry;
+
+        Entry = CONTAINING_RECORD(ListEntry,
+                                  XENVIF_FRONTEND_ADDRESS,
+                                  ListEntry);
+
+        if (Entry->Address.si_family != Address->si_family)
+            continue;
+
+        if (RtlEqualMemory(__FrontendGetAddressBytes(&Entry->Address,
+                                                     &Length),
+                           Byte,
+                           Length))
+            return Entry;
+    }
+
+    return NULL;
+}
+
 static NTSTATUS
 FrontendInsertAddress(
     IN  PXENVIF_FRONTEND    Frontend,
     IN  const SOCKADDR_INET *Address
     )
 {
-    ULONG                   Index;
-    PSOCKADDR_INET          Table;
-    NTSTATUS                status;
+    PXENVIF_FRONTEND_ADDRESS_TABLE  Table = &Frontend->AddressTable;
+    XENVIF_FRONTEND_ADDRESS_FAMILY  Family;
+    PXENVIF_FRONTEND_ADDRESS        Entry;
+    NTSTATUS                        status;
 
-    Trace("====>\n");
+    Entry = FrontendLookupAddress(Frontend, Address);
+    if (Entry != NULL) {
+        Entry->Stale = FALSE;
+        goto done;
+    }
 
-    for (Index = 0; Index < Frontend->AddressCount; Index++) {
-        if (Frontend->AddressTable[Index].si_family != Address->si_family)
-            continue;
+    Family = __FrontendGetAddressFamily(Address);
 
-        if (Address->si_family == AF_INET) {
-            if (RtlEqualMemory(&Address->Ipv4.sin_addr.s_addr,
-                               &Frontend->AddressTable[Index].Ipv4.sin_addr.s_addr,
-                                 IPV4_ADDRESS_LENGTH))
-                goto done;
-        } else {
-            ASSERT3U(Address->si_family, ==, AF_INET6);
+    // Grow the slot array geometrically so that inserts are amortized O(1)
+    if (Table->Count[Family] == Table->Size[Family]) {
+        PXENVIF_FRONTEND_ADDRESS    *Slot;
+        ULONG                       Size;
+
+        Size = (Table->Size[Family] != 0) ? Table->Size[Family] * 2 : 8;
+        Slot = __FrontendAllocate(sizeof (PXENVIF_FRONTEND_ADDRESS) * Size);
+
+        status = STATUS_NO_MEMORY;
+        if (Slot == NULL)
+            goto fail1;
 
-            if (RtlEqualMemory(&Address->Ipv6.sin6_addr.s6_addr,
-                               &Frontend->AddressTable[Index].Ipv6.sin6_addr.s6_addr,
-                               IPV6_ADDRESS_LENGTH))
-                goto done;
+        if (Table->Size[Family] != 0) {
+            RtlCopyMemory(Slot,
+                          Table->Slot[Family],
+                          sizeof (PXENVIF_FRONTEND_ADDRESS) * Table->Count[Family]);
+            __FrontendFree(Table->Slot[Family]);
         }
+
+        Table->Slot[Family] = Slot;
+        Table->Size[Family] = Size;
     }
 
-    // We have an address we've not seen before so grow the table
-    Table = __FrontendAllocate(sizeof (SOCKADDR_INET) * (Frontend->AddressCount + 1));
+    Entry = __FrontendAllocate(sizeof (XENVIF_FRONTEND_ADDRESS));
 
     status = STATUS_NO_MEMORY;
-    if (Table == NULL)
-        goto fail1;
+    if (Entry == NULL)
+        goto fail2;
 
-    RtlCopyMemory(Table, Frontend->AddressTable, sizeof (SOCKADDR_INET) * Frontend->AddressCount);
+    Entry->Address = *Address;
+    Entry->Slot = Table->Count[Family]++;
+    Entry->Dirty = TRUE;
 
-    if (Frontend->AddressCount != 0)
-        __FrontendFree(Frontend->AddressTable);
+    Table->Slot[Family][Entry->Slot] = Entry;
+    InsertTailList(&Table->Bucket[__FrontendHashAddress(Address)],
+                   &Entry->ListEntry);
 
-    Table[Frontend->AddressCount++] = *Address;
-    Frontend->AddressTable = Table;
+    Table->Changes++;
 
 done:
-    Trace("<====\n");
-
     return STATUS_SUCCESS;
 
+fail2:
+    Error("fail2\n");
+
 fail1:
     Error("fail1 (%08x)\n", status);
 
     return status;
 }
 
-static NTSTATUS
-FrontendProcessAddressTable(
+static VOID
+FrontendRemoveAddress(
     IN  PXENVIF_FRONTEND            Frontend,
-    IN  PMIB_UNICASTIPADDRESS_TABLE Table
+    IN  PXENVIF_FRONTEND_ADDRESS    Entry
+    )
+{
+    PXENVIF_FRONTEND_ADDRESS_TABLE  Table = &Frontend->AddressTable;
+    XENVIF_FRONTEND_ADDRESS_FAMILY  Family;
+    PXENVIF_FRONTEND_ADDRESS        Last;
+
+    Family = __FrontendGetAddressFamily(&Entry->Address);
+
+    ASSERT(Table->Count[Family] != 0);
+    ASSERT3P(Table->Slot[Family][Entry->Slot], ==, Entry);
+
+    // Keep the slots dense by moving the last entry into the gap
+    Last = Table->Slot[Family][--Table->Count[Family]];
+    if (Last != Entry) {
+        Last->Slot = Entry->Slot;
+        Last->Dirty = TRUE;
+
+        Table->Slot[Family][Last->Slot] = Last;
+    }
+    Table->Slot[Family][Table->Count[Family]] = NULL;
+
+    RemoveEntryList(&Entry->ListEntry);
+    __FrontendFree(Entry);
+
+    Table->Changes++;
+}
+
+static VOID
+FrontendInitializeAddressTable(
+    IN  PXENVIF_FRONTEND            Frontend
     )
 {
+    PXENVIF_FRONTEND_ADDRESS_TABLE  Table = &Frontend->AddressTable;
     ULONG                           Index;
-    NTSTATUS                        status;
 
-    UNREFERENCED_PARAMETER(Frontend);
+    for (Index = 0; Index < XENVIF_FRONTEND_ADDRESS_BUCKET_COUNT; Index++)
+        InitializeListHead(&Table->Bucket[Index]);
+
+    InitializeListHead(&Table->Delta);
+    Table->Resync = TRUE;
+}
+
+static VOID
+FrontendDiscardAddressDelta(
+    IN  PLIST_ENTRY List
+    )
+{
+    while (!IsListEmpty(List)) {
+        PLIST_ENTRY                     ListEntry;
+        PXENVIF_FRONTEND_ADDRESS_DELTA  Delta;
+
+        ListEntry = RemoveHeadList(List);
+        Delta = CONTAINING_RECORD(ListEntry,
+                                  XENVIF_FRONTEND_ADDRESS_DELTA,
+                                  ListEntry);
+        __FrontendFree(Delta);
+    }
+}
+
+static VOID
+FrontendFlushAddressTable(
+    IN  PXENVIF_FRONTEND            Frontend
+    )
+{
+    PXENVIF_FRONTEND_ADDRESS_TABLE  Table = &Frontend->AddressTable;
+    XENVIF_FRONTEND_ADDRESS_FAMILY  Family;
+
+    FrontendDiscardAddressDelta(&Table->Delta);
 
-    if (Frontend->AddressCount != 0) {
-        __FrontendFree(Frontend->AddressTable);
+    for (Family = 0; Family < XENVIF_FRONTEND_ADDRESS_FAMILY_COUNT; Family++) {
+        while (Table->Count[Family] != 0)
+            FrontendRemoveAddress(Frontend,
+                                  Table->Slot[Family][Table->Count[Family] - 1]);
 
-        Frontend->AddressTable = NULL;
-        Frontend->AddressCount = 0;
+        if (Table->Size[Family] != 0) {
+            __FrontendFree(Table->Slot[Family]);
+
+            Table->Slot[Family] = NULL;
+            Table->Size[Family] = 0;
+        }
     }
+}
 
-    for (Index = 0; Index < Table->NumEntries; Index++) {
-        PMIB_UNICASTIPADDRESS_ROW   Row = &Table->Table[Index];
+static NTSTATUS
+FrontendProcessAddressTable(
+    IN  PXENVIF_FRONTEND            Frontend,
+    IN  PMIB_UNICASTIPADDRESS_TABLE MibTable
+    )
+{
+    PXENVIF_FRONTEND_ADDRESS_TABLE  Table = &Frontend->AddressTable;
+    XENVIF_FRONTEND_ADDRESS_FAMILY  Family;
+    ULONG                           Index;
+    NTSTATUS                        status;
+
+    for (Family = 0; Family < XENVIF_FRONTEND_ADDRESS_FAMILY_COUNT; Family++)
+        for (Index = 0; Index < Table->Count[Family]; Index++)
+            Table->Slot[Family][Index]->Stale = TRUE;
+
+    for (Index = 0; Index < MibTable->NumEntries; Index++) {
+        PMIB_UNICASTIPADDRESS_ROW   Row = &MibTable->Table[Index];
 
         if (Row->InterfaceIndex != Frontend->InterfaceIndex)
             continue;
@@ -617,6 +1036,20 @@ FrontendProcessAddressTable(
             goto fail1;
     }
 
+    // Walk down so that entries moved into a gap have already been checked
+    for (Family = 0; Family < XENVIF_FRONTEND_ADDRESS_FAMILY_COUNT; Family++) {
+        Index = Table->Count[Family];
+
+        while (Index-- != 0) {
+            PXENVIF_FRONTEND_ADDRESS    Entry = Table->Slot[Family][Index];
+
+            if (Entry->Stale)
+                FrontendRemoveAddress(Frontend, Entry);
+        }
+    }
+
+    Table->Resyncs++;
+
     return STATUS_SUCCESS;
 
 fail1:
@@ -625,6 +1058,53 @@ fail1:
     return status;
 }
 
+static NTSTATUS
+FrontendProcessAddressDelta(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  PLIST_ENTRY         List
+    )
+{
+    NTSTATUS                status;
+
+    status = STATUS_SUCCESS;
+
+    while (!IsListEmpty(List)) {
+        PLIST_ENTRY                     ListEntry;
+        PXENVIF_FRONTEND_ADDRESS_DELTA  Delta;
+        PXENVIF_FRONTEND_ADDRESS        Entry;
+
+        ListEntry = RemoveHeadList(List);
+        Delta = CONTAINING_RECORD(ListEntry,
+                                  XENVIF_FRONTEND_ADDRESS_DELTA,
+                                  ListEntry);
+
+        if (Delta->InterfaceIndex != Frontend->InterfaceIndex)
+            goto next;
+
+        switch (Delta->Type) {
+        case MibAddInstance:
+        case MibParameterNotification:
+            if (NT_SUCCESS(status))
+                status = FrontendInsertAddress(Frontend, &Delta->Address);
+            break;
+
+        case MibDeleteInstance:
+            Entry = FrontendLookupAddress(Frontend, &Delta->Address);
+            if (Entry != NULL)
+                FrontendRemoveAddress(Frontend, Entry);
+            break;
+
+        default:
+            break;
+        }
+
+next:
+        __FrontendFree(Delta);
+    }
+
+    return status;
+}
+
 static NTSTATUS
 FrontendDumpAlias(
     IN  PXENVIF_FRONTEND    Frontend
@@ -662,16 +1142,91 @@ fail1:
     return status;
 }
 
+static NTSTATUS
+FrontendDumpAddress(
+    IN  PXENVIF_FRONTEND            Frontend,
+    IN  PXENBUS_STORE_TRANSACTION   Transaction,
+    IN  PXENVIF_FRONTEND_ADDRESS    Entry
+    )
+{
+    NTSTATUS                        status;
+
+    switch (Entry->Address.si_family) {
+    case AF_INET: {
+        IPV4_ADDRESS    Address;
+        CHAR            Node[sizeof ("ipv4/XXXXXXXXXX")];
+
+        RtlCopyMemory(Address.Byte,
+                      &Entry->Address.Ipv4.sin_addr.s_addr,
+                      IPV4_ADDRESS_LENGTH);
+
+        status = RtlStringCbPrintfA(Node,
+                                    sizeof (Node),
+                                    "ipv4/%u",
+                                    Entry->Slot);
+        ASSERT(NT_SUCCESS(status));
+
+        status = XENBUS_STORE(Printf,
+                              &Frontend->StoreInterface,
+                              Transaction,
+                              __FrontendGetPrefix(Frontend),
+                              Node,
+                              "%u.%u.%u.%u",
+                              Address.Byte[0],
+                              Address.Byte[1],
+                              Address.Byte[2],
+                              Address.Byte[3]);
+        break;
+    }
+    case AF_INET6: {
+        IPV6_ADDRESS    Address;
+        CHAR            Node[sizeof ("ipv6/XXXXXXXXXX")];
+
+        RtlCopyMemory(Address.Byte,
+                      &Entry->Address.Ipv6.sin6_addr.s6_addr,
+                      IPV6_ADDRESS_LENGTH);
+
+        status = RtlStringCbPrintfA(Node,
+                                    sizeof (Node),
+                                    "ipv6/%u",
+                                    Entry->Slot);
+        ASSERT(NT_SUCCESS(status));
+
+        status = XENBUS_STORE(Printf,
+                              &Frontend->StoreInterface,
+                              Transaction,
+                              __FrontendGetPrefix(Frontend),
+                              Node,
+                              "%04x:%04x:%04x:%04x:%04x:%04x:%04x:%04x",
+                              NTOHS(Address.Word[0]),
+                              NTOHS(Address.Word[1]),
+                              NTOHS(Address.Word[2]),
+                              NTOHS(Address.Word[3]),
+                              NTOHS(Address.Word[4]),
+                              NTOHS(Address.Word[5]),
+                              NTOHS(Address.Word[6]),
+                              NTOHS(Address.Word[7]));
+        break;
+    }
+    default:
+        ASSERT(FALSE);
+        status = STATUS_INVALID_PARAMETER;
+        break;
+    }
+
+    return status;
+}
+
 static NTSTATUS
 FrontendDumpAddressTable(
-    IN  PXENVIF_FRONTEND        Frontend
+    IN  PXENVIF_FRONTEND            Frontend
     )
 {
-    PXENBUS_STORE_TRANSACTION   Transaction;
-    ULONG                       Index;
-    ULONG                       IpVersion4Count;
-    ULONG                       IpVersion6Count;
-    NTSTATUS                    status;
+    PXENVIF_FRONTEND_ADDRESS_TABLE  Table = &Frontend->AddressTable;
+    PXENBUS_STORE_TRANSACTION       Transaction;
+    XENVIF_FRONTEND_ADDRESS_FAMILY  Family;
+    ULONG                           Index;
+    NTSTATUS                        status;
 
     Trace("====>\n");
 
@@ -681,99 +1236,69 @@ FrontendDumpAddressTable(
     if (!NT_SUCCESS(status))
         goto fail1;
 
-    status = XENBUS_STORE(Remove,
-                          &Frontend->StoreInterface,
-                          Transaction,
-                          __FrontendGetPrefix(Frontend),
-                          "ipv4");
-    if (!NT_SUCCESS(status) &&
-        status != STATUS_OBJECT_NAME_NOT_FOUND)
-        goto fail2;
+    // After a (re)connect the store contents are unknown so start afresh
+    if (Table->Rewrite) {
+        status = XENBUS_STORE(Remove,
+                              &Frontend->StoreInterface,
+                              Transaction,
+                              __FrontendGetPrefix(Frontend),
+                              "ipv4");
+        if (!NT_SUCCESS(status) &&
+            status != STATUS_OBJECT_NAME_NOT_FOUND)
+            goto fail2;
 
-    status = XENBUS_STORE(Remove,
-                          &Frontend->StoreInterface,
-                          Transaction,
-                          __FrontendGetPrefix(Frontend),
-                          "ipv6");
-    if (!NT_SUCCESS(status) &&
-        status != STATUS_OBJECT_NAME_NOT_FOUND)
-        goto fail3;
+        status = XENBUS_STORE(Remove,
+                              &Frontend->StoreInterface,
+                              Transaction,
+                              __FrontendGetPrefix(Frontend),
+                              "ipv6");
+        if (!NT_SUCCESS(status) &&
+            status != STATUS_OBJECT_NAME_NOT_FOUND)
+            goto fail3;
 
-    IpVersion4Count = 0;
-    IpVersion6Count = 0;
+        for (Family = 0; Family < XENVIF_FRONTEND_ADDRESS_FAMILY_COUNT; Family++) {
+            Table->Written[Family] = 0;
 
-    for (Index = 0; Index < Frontend->AddressCount; Index++) {
-        switch (Frontend->AddressTable[Index].si_family) {
-        case AF_INET: {
-            IPV4_ADDRESS    Address;
-            CHAR            Node[sizeof ("ipv4/XXXXXXXXXX")];
+            for (Index = 0; Index < Table->Count[Family]; Index++)
+                Table->Slot[Family][Index]->Dirty = TRUE;
+        }
+    }
 
-            RtlCopyMemory(Address.Byte,
-                          &Frontend->AddressTable[Index].Ipv4.sin_addr.s_addr,
-                          IPV4_ADDRESS_LENGTH);
+    for (Family = 0; Family < XENVIF_FRONTEND_ADDRESS_FAMILY_COUNT; Family++) {
+        for (Index = 0; Index < Table->Count[Family]; Index++) {
+            PXENVIF_FRONTEND_ADDRESS    Entry = Table->Slot[Family][Index];
 
-            status = RtlStringCbPrintfA(Node,
-                                        sizeof (Node),
-                                        "ipv4/%u",
-                                        IpVersion4Count);
-            ASSERT(NT_SUCCESS(status));
-            if (!NT_SUCCESS(status))
+            if (!Entry->Dirty)
                 continue;
 
-            status = XENBUS_STORE(Printf,
-                                  &Frontend->StoreInterface,
-                                  Transaction,
-                                  __FrontendGetPrefix(Frontend),
-                                  Node,
-                                  "%u.%u.%u.%u",
-                                  Address.Byte[0],
-                                  Address.Byte[1],
-                                  Address.Byte[2],
-                                  Address.Byte[3]);
+            status = FrontendDumpAddress(Frontend, Transaction, Entry);
             if (!NT_SUCCESS(status))
                 goto fail4;
-
-            IpVersion4Count++;
-            break;
         }
-        case AF_INET6: {
-            IPV6_ADDRESS    Address;
-            CHAR            Node[sizeof ("ipv6/XXXXXXXXXX")];
 
-            RtlCopyMemory(Address.Byte,
-                          &Frontend->AddressTable[Index].Ipv6.sin6_addr.s6_addr,
-                          IPV6_ADDRESS_LENGTH);
+        // Remove the keys of any slots that have been vacated
+        for (Index = Table->Count[Family];
+             Index < Table->Written[Family];
+             Index++) {
+            CHAR    Node[sizeof ("ipv6/XXXXXXXXXX")];
 
             status = RtlStringCbPrintfA(Node,
                                         sizeof (Node),
-                                        "ipv6/%u",
-                                        IpVersion6Count);
+                                        "%s/%u",
+                                        (Family == XENVIF_FRONTEND_ADDRESS_IPV4) ?
+                                        "ipv4" :
+                                        "ipv6",
+                                        Index);
             ASSERT(NT_SUCCESS(status));
-            if (!NT_SUCCESS(status))
-                continue;
 
-            status = XENBUS_STORE(Printf,
+            status = XENBUS_STORE(Remove,
                                   &Frontend->StoreInterface,
                                   Transaction,
                                   __FrontendGetPrefix(Frontend),
-                                  Node,
-                                  "%04x:%04x:%04x:%04x:%04x:%04x:%04x:%04x",
-                                  NTOHS(Address.Word[0]),
-                                  NTOHS(Address.Word[1]),
-                                  NTOHS(Address.Word[2]),
-                                  NTOHS(Address.Word[3]),
-                                  NTOHS(Address.Word[4]),
-                                  NTOHS(Address.Word[5]),
-                                  NTOHS(Address.Word[6]),
-                                  NTOHS(Address.Word[7]));
-            if (!NT_SUCCESS(status))
-                goto fail4;
-
-            IpVersion6Count++;
-            break;
-        }
-        default:
-            break;
+                                  Node);
+            if (!NT_SUCCESS(status) &&
+                status != STATUS_OBJECT_NAME_NOT_FOUND)
+                goto fail5;
         }
     }
 
@@ -781,10 +1306,24 @@ FrontendDumpAddressTable(
                           &Frontend->StoreInterface,
                           Transaction,
                           TRUE);
+    if (!NT_SUCCESS(status))
+        goto fail1;
+
+    for (Family = 0; Family < XENVIF_FRONTEND_ADDRESS_FAMILY_COUNT; Family++) {
+        Table->Written[Family] = Table->Count[Family];
+
+        for (Index = 0; Index < Table->Count[Family]; Index++)
+            Table->Slot[Family][Index]->Dirty = FALSE;
+    }
+
+    Table->Rewrite = FALSE;
 
     Trace("<====\n");
 
-    return status;
+    return STATUS_SUCCESS;
+
+fail5:
+    Error("fail5\n");
 
 fail4:
     Error("fail4\n");
@@ -803,6 +1342,9 @@ fail2:
 fail1:
     Error("fail1 (%08x)\n", status);
 
+    // We no longer know what the store holds
+    Table->Rewrite = TRUE;
+
     return status;
 }
 
@@ -814,9 +1356,35 @@ FrontendIpAddressChange(
     )
 {
     PXENVIF_FRONTEND                Frontend = Context;
+    PXENVIF_FRONTEND_ADDRESS_TABLE  Table = &Frontend->AddressTable;
+    PXENVIF_FRONTEND_ADDRESS_DELTA  Delta;
+    KIRQL                           Irql;
+
+    if (Row != NULL &&
+        Row->Address.si_family != AF_INET &&
+        Row->Address.si_family != AF_INET6)
+        return;
 
-    UNREFERENCED_PARAMETER(Row);
-    UNREFERENCED_PARAMETER(NotificationType);
+    Delta = (Row != NULL &&
+             NotificationType != MibInitialNotification) ?
+            __FrontendAllocate(sizeof (XENVIF_FRONTEND_ADDRESS_DELTA)) :
+            NULL;
+
+    KeAcquireSpinLock(&Frontend->Lock, &Irql);
+
+    // Queue the change so that only the delta needs to be applied. If
+    // there is nothing to queue then fall back to fetching the whole table.
+    if (Delta != NULL) {
+        Delta->Type = NotificationType;
+        Delta->InterfaceIndex = Row->InterfaceIndex;
+        Delta->Address = Row->Address;
+
+        InsertTailList(&Table->Delta, &Delta->ListEntry);
+    } else {
+        Table->Resync = TRUE;
+    }
+
+    KeReleaseSpinLock(&Frontend->Lock, Irql);
 
     ThreadWake(Frontend->MibThread);
 }
@@ -841,6 +1409,7 @@ FrontendMib(
     VOID                (*__FreeMibTable)(PVOID);
     NTSTATUS            (*__CancelMibChangeNotify2)(HANDLE);
     HANDLE              Handle;
+    KIRQL               Irql;
     NTSTATUS            status;
 
     Trace("====>\n");
@@ -888,7 +1457,9 @@ FrontendMib(
     for (;;) { 
         PMIB_IF_TABLE2              IfTable;
         PMIB_UNICASTIPADDRESS_TABLE UnicastIpAddressTable;
-        KIRQL                       Irql;
+        NET_IFINDEX                 InterfaceIndex;
+        LIST_ENTRY                  List;
+        BOOLEAN                     Resync;
 
         Trace("waiting...\n");
 
@@ -911,23 +1482,59 @@ FrontendMib(
         if (!NT_SUCCESS(status))
             goto loop;
 
+        InterfaceIndex = Frontend->InterfaceIndex;
+
         status = FrontendProcessInterfaceTable(Frontend,
                                                IfTable);
-        if (!NT_SUCCESS(status))
-            goto loop;
+        if (!NT_SUCCESS(status)) {
+            // Without an interface there is nothing to apply changes to
+            KeAcquireSpinLock(&Frontend->Lock, &Irql);
+            FrontendDiscardAddressDelta(&Frontend->AddressTable.Delta);
+            Frontend->AddressTable.Resync = TRUE;
+            KeReleaseSpinLock(&Frontend->Lock, Irql);
 
-        status = __GetUnicastIpAddressTable(AF_UNSPEC,
-                                            &UnicastIpAddressTable);
-        if (!NT_SUCCESS(status))
             goto loop;
+        }
 
-        status = FrontendProcessAddressTable(Frontend,
-                                             UnicastIpAddressTable);
-        if (!NT_SUCCESS(status))
-            goto loop;
+        KeAcquireSpinLock(&Frontend->Lock, &Irql);
+
+        if (Frontend->InterfaceIndex != InterfaceIndex)
+            Frontend->AddressTable.Resync = TRUE;
+
+        Resync = Frontend->AddressTable.Resync;
+        Frontend->AddressTable.Resync = FALSE;
+
+        InitializeListHead(&List);
+        while (!IsListEmpty(&Frontend->AddressTable.Delta))
+            InsertTailList(&List,
+                           RemoveHeadList(&Frontend->AddressTable.Delta));
+
+        KeReleaseSpinLock(&Frontend->Lock, Irql);
+
+        // Only this thread modifies the buckets and slots so they can be
+        // updated (and allocated) without holding the lock. A full table
+        // supersedes any queued deltas.
+        if (Resync) {
+            status = __GetUnicastIpAddressTable(AF_UNSPEC,
+                                                &UnicastIpAddressTable);
+            if (!NT_SUCCESS(status))
+                UnicastIpAddressTable = NULL;
+
+            status = (UnicastIpAddressTable != NULL) ?
+                     FrontendProcessAddressTable(Frontend,
+                                                 UnicastIpAddressTable) :
+                     STATUS_UNSUCCESSFUL;
+
+            FrontendDiscardAddressDelta(&List);
+        } else {
+            status = FrontendProcessAddressDelta(Frontend, &List);
+        }
 
         KeAcquireSpinLock(&Frontend->Lock, &Irql);
 
+        if (!NT_SUCCESS(status))
+            Frontend->AddressTable.Resync = TRUE;
+
         if (Frontend->State == FRONTEND_CONNECTED ||
             Frontend->State == FRONTEND_ENABLED) {
             (VOID) FrontendDumpAlias(Frontend);
@@ -944,16 +1551,13 @@ loop:
             __FreeMibTable(IfTable);
     }
 
-    if (Frontend->AddressCount != 0) {
-        __FrontendFree(Frontend->AddressTable);
-
-        Frontend->AddressTable = NULL;
-        Frontend->AddressCount = 0;
-    }
-
     status = __CancelMibChangeNotify2(Handle);
     ASSERT(NT_SUCCESS(status));
 
+    KeAcquireSpinLock(&Frontend->Lock, &Irql);
+    FrontendFlushAddressTable(Frontend);
+    KeReleaseSpinLock(&Frontend->Lock, Irql);
+
     Trace("<====\n");
 
     return STATUS_SUCCESS;
@@ -1188,42 +1792,42 @@ fail1:
 
 VOID
 FrontendAdvertiseIpAddresses(
-    IN  PXENVIF_FRONTEND    Frontend
+    IN  PXENVIF_FRONTEND            Frontend
     )
 {
-    PXENVIF_TRANSMITTER     Transmitter;
-    KIRQL                   Irql;
-    ULONG                   Index;
+    PXENVIF_FRONTEND_ADDRESS_TABLE  Table = &Frontend->AddressTable;
+    PXENVIF_TRANSMITTER             Transmitter;
+    KIRQL                           Irql;
+    ULONG                           Index;
 
     Transmitter = FrontendGetTransmitter(Frontend);
 
     KeAcquireSpinLock(&Frontend->Lock, &Irql);
 
-    for (Index = 0; Index < Frontend->AddressCount; Index++) {
-        switch (Frontend->AddressTable[Index].si_family) {
-        case AF_INET: {
-            IPV4_ADDRESS    Address;
+    for (Index = 0; Index < Table->Count[XENVIF_FRONTEND_ADDRESS_IPV4]; Index++) {
+        PXENVIF_FRONTEND_ADDRESS    Entry;
+        IPV4_ADDRESS                Address;
 
-            RtlCopyMemory(Address.Byte,
-                          &Frontend->AddressTable[Index].Ipv4.sin_addr.s_addr,
-                          IPV4_ADDRESS_LENGTH);
+        Entry = Table->Slot[XENVIF_FRONTEND_ADDRESS_IPV4][Index];
 
-            TransmitterQueueArp(Transmitter, &Address);
-            break;
-        }
-        case AF_INET6: {
-            IPV6_ADDRESS    Address;
+        RtlCopyMemory(Address.Byte,
+                      &Entry->Address.Ipv4.sin_addr.s_addr,
+                      IPV4_ADDRESS_LENGTH);
 
-            RtlCopyMemory(Address.Byte,
-                          &Frontend->AddressTable[Index].Ipv6.sin6_addr.s6_addr,
-                          IPV6_ADDRESS_LENGTH);
+        TransmitterQueueArp(Transmitter, &Address);
+    }
 
-            TransmitterQueueNeighbourAdvertisement(Transmitter, &Address);
-            break;
-        }
-        default:
-            ASSERT(FALSE);
-        }
+    for (Index = 0; Index < Table->Count[XENVIF_FRONTEND_ADDRESS_IPV6]; Index++) {
+        PXENVIF_FRONTEND_ADDRESS    Entry;
+        IPV6_ADDRESS                Address;
+
+        Entry = Table->Slot[XENVIF_FRONTEND_ADDRESS_IPV6][Index];
+
+        RtlCopyMemory(Address.Byte,
+                      &Entry->Address.Ipv6.sin6_addr.s6_addr,
+                      IPV6_ADDRESS_LENGTH);
+
+        TransmitterQueueNeighbourAdvertisement(Transmitter, &Address);
     }
 
     KeReleaseSpinLock(&Frontend->Lock, Irql);
@@ -1363,87 +1967,421 @@ FrontendWaitForBackendXenbusStateChange(
     if (!NT_SUCCESS(status))
         Watch = NULL;
 
-    KeQuerySystemTime(&Start);
-    TimeDelta = 0;
+    KeQuerySystemTime(&Start);
+    TimeDelta = 0;
+
+    Timeout.QuadPart = 0;
+
+    while (*State == Old && TimeDelta < 120000) {
+        PCHAR           Buffer;
+        LARGE_INTEGER   Now;
+
+        if (Watch != NULL) {
+            ULONG   Attempt = 0;
+
+            while (++Attempt < 1000) {
+                status = KeWaitForSingleObject(&Event,
+                                               Executive,
+                                               KernelMode,
+                                               FALSE,
+                                               &Timeout);
+                if (status != STATUS_TIMEOUT)
+                    break;
+
+                // We are waiting for a watch event at DISPATCH_LEVEL so
+                // it is our responsibility to poll the store ring.
+                XENBUS_STORE(Poll,
+                             &Frontend->StoreInterface);
+
+                KeStallExecutionProcessor(1000);   // 1ms
+            }
+
+            KeClearEvent(&Event);
+        }
+
+        status = XENBUS_STORE(Read,
+                              &Frontend->StoreInterface,
+                              NULL,
+                              __FrontendGetBackendPath(Frontend),
+                              "state",
+                              &Buffer);
+        if (!NT_SUCCESS(status)) {
+            *State = XenbusStateUnknown;
+        } else {
+            *State = (XenbusState)strtol(Buffer, NULL, 10);
+
+            XENBUS_STORE(Free,
+                         &Frontend->StoreInterface,
+                         Buffer);
+        }
+
+        KeQuerySystemTime(&Now);
+
+        TimeDelta = (Now.QuadPart - Start.QuadPart) / 10000ull;
+    }
+
+    if (Watch != NULL)
+        (VOID) XENBUS_STORE(WatchRemove,
+                            &Frontend->StoreInterface,
+                            Watch);
+
+    Trace("%s: <==== (%s)\n",
+          __FrontendGetBackendPath(Frontend),
+          XenbusStateName(*State));
+}
+
+static VOID
+FrontendReleaseBackend(
+    IN      PXENVIF_FRONTEND    Frontend
+    )
+{
+    Trace("=====>\n");
+
+    ASSERT(Frontend->BackendDomain != DOMID_INVALID);
+    ASSERT(Frontend->BackendPath != NULL);
+
+    Frontend->BackendDomain = DOMID_INVALID;
+
+    XENBUS_STORE(Free,
+                 &Frontend->StoreInterface,
+                 Frontend->BackendPath);
+    Frontend->BackendPath = NULL;
+
+    Trace("<=====\n");
+}
+
+static const PCHAR
+FrontendFeatureName(
+    IN  XENVIF_FRONTEND_FEATURE Feature
+    )
+{
+#define _FEATURE_NAME(_Feature, _Name)              \
+    case  XENVIF_FRONTEND_FEATURE_ ## _Feature:     \
+        return _Name;
+
+    switch (Feature) {
+    _FEATURE_NAME(GSO_TCPV4, "feature-gso-tcpv4");
+    _FEATURE_NAME(GSO_TCPV6, "feature-gso-tcpv6");
+    _FEATURE_NAME(NO_CSUM_OFFLOAD, "feature-no-csum-offload");
+    _FEATURE_NAME(IPV6_CSUM_OFFLOAD, "feature-ipv6-csum-offload");
+    _FEATURE_NAME(SPLIT_EVENT_CHANNELS, "feature-split-event-channels");
+    _FEATURE_NAME(MULTI_QUEUE_MAX_QUEUES, "multi-queue-max-queues");
+    _FEATURE_NAME(CTRL_RING, "feature-ctrl-ring");
+    _FEATURE_NAME(DYNAMIC_MULTICAST_CONTROL, "feature-dynamic-multicast-control");
+    default:
+        break;
+    }
+
+    return "INVALID";
+
+#undef  _FEATURE_NAME
+}
+
+static NTSTATUS
+FrontendReadFeatures(
+    IN  PXENVIF_FRONTEND        Frontend
+    )
+{
+    PXENVIF_FRONTEND_FEATURES   Features = &Frontend->Features;
+    ULONG                       Present;
+    ULONG                       Value[XENVIF_FRONTEND_FEATURE_COUNT];
+    ULONG                       Attempt;
+    KIRQL                       Irql;
+    NTSTATUS                    status;
+
+    Present = 0;
+
+    // Read all the keys in one transaction so the snapshot is consistent
+    Attempt = 0;
+    do {
+        PXENBUS_STORE_TRANSACTION   Transaction;
+        XENVIF_FRONTEND_FEATURE     Feature;
+
+        status = XENBUS_STORE(TransactionStart,
+                              &Frontend->StoreInterface,
+                              &Transaction);
+        if (!NT_SUCCESS(status))
+            break;
+
+        Present = 0;
+        RtlZeroMemory(Value, sizeof (Value));
+
+        for (Feature = 0; Feature < XENVIF_FRONTEND_FEATURE_COUNT; Feature++) {
+            PCHAR   Buffer;
+
+            status = XENBUS_STORE(Read,
+                                  &Frontend->StoreInterface,
+                                  Transaction,
+                                  __FrontendGetBackendPath(Frontend),
+                                  FrontendFeatureName(Feature),
+                                  &Buffer);
+            if (!NT_SUCCESS(status))
+                continue;
+
+            // Everything apart from the queue count is a flag
+            Value[Feature] = (Feature == XENVIF_FRONTEND_FEATURE_MULTI_QUEUE_MAX_QUEUES) ?
+                             (ULONG)strtoul(Buffer, NULL, 10) :
+                             (ULONG)strtol(Buffer, NULL, 2);
+            Present |= 1u << Feature;
+
+            XENBUS_STORE(Free,
+                         &Frontend->StoreInterface,
+                         Buffer);
+        }
+
+        status = XENBUS_STORE(TransactionEnd,
+                              &Frontend->StoreInterface,
+                              Transaction,
+                              TRUE);
+        if (status != STATUS_RETRY || ++Attempt > 10)
+            break;
+    } while (status == STATUS_RETRY);
+
+    if (!NT_SUCCESS(status))
+        goto fail1;
+
+    KeAcquireSpinLock(&Features->Lock, &Irql);
+
+    Features->Present = Present;
+    RtlCopyMemory(Features->Value, Value, sizeof (Value));
+    Features->Reads++;
+
+    KeReleaseSpinLock(&Features->Lock, Irql);
+
+    return STATUS_SUCCESS;
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    return status;
+}
+
+static NTSTATUS
+FrontendAcquireFeatures(
+    IN  PXENVIF_FRONTEND        Frontend
+    )
+{
+    PXENVIF_FRONTEND_FEATURES   Features = &Frontend->Features;
+    XENVIF_FRONTEND_FEATURE     Feature;
+    NTSTATUS                    status;
+
+    KeClearEvent(&Features->Event);
+
+    // Only a change to one of the feature keys invalidates the snapshot;
+    // the backend updates others (e.g. state) far more often
+    for (Feature = 0; Feature < XENVIF_FRONTEND_FEATURE_COUNT; Feature++) {
+        status = XENBUS_STORE(WatchAdd,
+                              &Frontend->StoreInterface,
+                              __FrontendGetBackendPath(Frontend),
+                              FrontendFeatureName(Feature),
+                              &Features->Event,
+                              &Features->Watch[Feature]);
+        if (!NT_SUCCESS(status))
+            goto fail1;
+    }
+
+    status = FrontendReadFeatures(Frontend);
+    if (!NT_SUCCESS(status))
+        goto fail2;
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("fail2\n");
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    while (Feature != 0) {
+        --Feature;
+
+        (VOID) XENBUS_STORE(WatchRemove,
+                            &Frontend->StoreInterface,
+                            Features->Watch[Feature]);
+        Features->Watch[Feature] = NULL;
+    }
+
+    return status;
+}
+
+static VOID
+FrontendReleaseFeatures(
+    IN  PXENVIF_FRONTEND        Frontend
+    )
+{
+    PXENVIF_FRONTEND_FEATURES   Features = &Frontend->Features;
+    XENVIF_FRONTEND_FEATURE     Feature;
+    KIRQL                       Irql;
+
+    for (Feature = 0; Feature < XENVIF_FRONTEND_FEATURE_COUNT; Feature++) {
+        ASSERT(Features->Watch[Feature] != NULL);
+        (VOID) XENBUS_STORE(WatchRemove,
+                            &Frontend->StoreInterface,
+                            Features->Watch[Feature]);
+        Features->Watch[Feature] = NULL;
+    }
+
+    KeClearEvent(&Features->Event);
+
+    KeAcquireSpinLock(&Features->Lock, &Irql);
+
+    Features->Present = 0;
+    RtlZeroMemory(Features->Value, sizeof (Features->Value));
+
+    KeReleaseSpinLock(&Features->Lock, Irql);
+}
+
+BOOLEAN
+FrontendGetBackendFeature(
+    IN  PXENVIF_FRONTEND        Frontend,
+    IN  XENVIF_FRONTEND_FEATURE Feature,
+    OUT PULONG                  Value
+    )
+{
+    PXENVIF_FRONTEND_FEATURES   Features = &Frontend->Features;
+    BOOLEAN                     Present;
+    KIRQL                       Irql;
+
+    ASSERT3U(Feature, <, XENVIF_FRONTEND_FEATURE_COUNT);
+
+    // Only go to the store if the backend has written something since
+    // the snapshot was taken
+    if (Features->Watch[0] != NULL && KeReadStateEvent(&Features->Event)) {
+        KeClearEvent(&Features->Event);
+        Features->Invalidations++;
+
+        (VOID) FrontendReadFeatures(Frontend);
+    }
+
+    KeAcquireSpinLock(&Features->Lock, &Irql);
+
+    Present = (Features->Present & (1u << Feature)) ? TRUE : FALSE;
+    *Value = (Present) ? Features->Value[Feature] : 0;
+
+    KeReleaseSpinLock(&Features->Lock, Irql);
+
+    return Present;
+}
+
+static const PCHAR
+FrontendPhaseName(
+    IN  XENVIF_FRONTEND_PHASE   Phase
+    )
+{
+#define _PHASE_NAME(_Phase)                 \
+    case  XENVIF_FRONTEND_PHASE_ ## _Phase: \
+        return #_Phase;
+
+    switch (Phase) {
+    _PHASE_NAME(SUSPEND);
+    _PHASE_NAME(CLOSE);
+    _PHASE_NAME(PREPARE);
+    _PHASE_NAME(MAC);
+    _PHASE_NAME(RECEIVER);
+    _PHASE_NAME(TRANSMITTER);
+    _PHASE_NAME(CONTROLLER);
+    _PHASE_NAME(STORE);
+    _PHASE_NAME(BACKEND);
+    _PHASE_NAME(ENABLE);
+    default:
+        break;
+    }
+
+    return "INVALID";
+
+#undef  _PHASE_NAME
+}
 
-    Timeout.QuadPart = 0;
+static FORCEINLINE ULONGLONG
+__FrontendResumeMicroseconds(
+    IN  PXENVIF_FRONTEND_RESUME Resume,
+    IN  LARGE_INTEGER           From,
+    IN  LARGE_INTEGER           To
+    )
+{
+    return ((ULONGLONG)(To.QuadPart - From.QuadPart) * 1000000ull) /
+           (ULONGLONG)Resume->Frequency.QuadPart;
+}
 
-    while (*State == Old && TimeDelta < 120000) {
-        PCHAR           Buffer;
-        LARGE_INTEGER   Now;
+static FORCEINLINE VOID
+__FrontendResumeStart(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    PXENVIF_FRONTEND_RESUME Resume = &Frontend->Resume;
 
-        if (Watch != NULL) {
-            ULONG   Attempt = 0;
+    RtlZeroMemory(Resume->Time, sizeof (Resume->Time));
+    Resume->Total = 0;
+    Resume->Attempts = 0;
 
-            while (++Attempt < 1000) {
-                status = KeWaitForSingleObject(&Event,
-                                               Executive,
-                                               KernelMode,
-                                               FALSE,
-                                               &Timeout);
-                if (status != STATUS_TIMEOUT)
-                    break;
+    Resume->Start = KeQueryPerformanceCounter(&Resume->Frequency);
+    Resume->Last = Resume->Start;
+    Resume->Active = TRUE;
+}
 
-                // We are waiting for a watch event at DISPATCH_LEVEL so
-                // it is our responsibility to poll the store ring.
-                XENBUS_STORE(Poll,
-                             &Frontend->StoreInterface);
+static FORCEINLINE VOID
+__FrontendResumeMark(
+    IN  PXENVIF_FRONTEND        Frontend,
+    IN  XENVIF_FRONTEND_PHASE   Phase
+    )
+{
+    PXENVIF_FRONTEND_RESUME     Resume = &Frontend->Resume;
+    LARGE_INTEGER               Now;
 
-                KeStallExecutionProcessor(1000);   // 1ms
-            }
+    if (!Resume->Active)
+        return;
 
-            KeClearEvent(&Event);
-        }
+    Now = KeQueryPerformanceCounter(NULL);
 
-        status = XENBUS_STORE(Read,
-                              &Frontend->StoreInterface,
-                              NULL,
-                              __FrontendGetBackendPath(Frontend),
-                              "state",
-                              &Buffer);
-        if (!NT_SUCCESS(status)) {
-            *State = XenbusStateUnknown;
-        } else {
-            *State = (XenbusState)strtol(Buffer, NULL, 10);
+    // Phases may run more than once (e.g. PREPARE) so accumulate
+    Resume->Time[Phase] += __FrontendResumeMicroseconds(Resume,
+                                                        Resume->Last,
+                                                        Now);
+    Resume->Last = Now;
+}
 
-            XENBUS_STORE(Free,
-                         &Frontend->StoreInterface,
-                         Buffer);
-        }
+static FORCEINLINE VOID
+__FrontendResumeComplete(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    PXENVIF_FRONTEND_RESUME Resume = &Frontend->Resume;
+    XENVIF_FRONTEND_PHASE   Phase;
 
-        KeQuerySystemTime(&Now);
+    if (!Resume->Active)
+        return;
 
-        TimeDelta = (Now.QuadPart - Start.QuadPart) / 10000ull;
-    }
+    Resume->Total = __FrontendResumeMicroseconds(Resume,
+                                                 Resume->Start,
+                                                 Resume->Last);
+    Resume->Active = FALSE;
+    Resume->Count++;
 
-    if (Watch != NULL)
-        (VOID) XENBUS_STORE(WatchRemove,
-                            &Frontend->StoreInterface,
-                            Watch);
+    Info("%s: %lluus (%u store attempt(s))\n",
+         __FrontendGetPath(Frontend),
+         Resume->Total,
+         Resume->Attempts);
 
-    Trace("%s: <==== (%s)\n",
-          __FrontendGetBackendPath(Frontend),
-          XenbusStateName(*State));
+    for (Phase = 0; Phase < XENVIF_FRONTEND_PHASE_COUNT; Phase++)
+        Info("%s: - %s %lluus\n",
+             __FrontendGetPath(Frontend),
+             FrontendPhaseName(Phase),
+             Resume->Time[Phase]);
 }
 
-static VOID
-FrontendReleaseBackend(
-    IN      PXENVIF_FRONTEND    Frontend
+static FORCEINLINE VOID
+__FrontendResumeAbort(
+    IN  PXENVIF_FRONTEND    Frontend
     )
 {
-    Trace("=====>\n");
-
-    ASSERT(Frontend->BackendDomain != DOMID_INVALID);
-    ASSERT(Frontend->BackendPath != NULL);
+    PXENVIF_FRONTEND_RESUME Resume = &Frontend->Resume;
 
-    Frontend->BackendDomain = DOMID_INVALID;
+    if (!Resume->Active)
+        return;
 
-    XENBUS_STORE(Free,
-                 &Frontend->StoreInterface,
-                 Frontend->BackendPath);
-    Frontend->BackendPath = NULL;
+    Resume->Active = FALSE;
 
-    Trace("<=====\n");
+    Info("%s: abandoned\n", __FrontendGetPath(Frontend));
 }
 
 static VOID
@@ -1504,6 +2442,8 @@ FrontendClose(
 
     XENBUS_STORE(Release, &Frontend->StoreInterface);
 
+    __FrontendResumeMark(Frontend, XENVIF_FRONTEND_PHASE_CLOSE);
+
     Trace("<====\n");
 }
 
@@ -1579,6 +2519,8 @@ FrontendPrepare(
     if (!NT_SUCCESS(status))
         goto fail4;
 
+    __FrontendResumeMark(Frontend, XENVIF_FRONTEND_PHASE_PREPARE);
+
     Trace("<====\n");
     return STATUS_SUCCESS;
 
@@ -1739,6 +2681,7 @@ FrontendDebugCallback(
 {
     PXENVIF_FRONTEND        Frontend = Argument;
     XENVIF_VIF_STATISTIC    Name;
+    ULONG                   Index;
 
     UNREFERENCED_PARAMETER(Crashing);
 
@@ -1747,6 +2690,87 @@ FrontendDebugCallback(
                  "PATH: %s\n",
                  __FrontendGetPath(Frontend));
 
+    XENBUS_DEBUG(Printf,
+                 &Frontend->DebugInterface,
+                 "QUEUES: %u/%u ACTIVE\n",
+                 Frontend->ActiveQueues,
+                 Frontend->NumQueues);
+
+    XENBUS_DEBUG(Printf,
+                 &Frontend->DebugInterface,
+                 "FEATURES: Reads = %u Invalidations = %u\n",
+                 Frontend->Features.Reads,
+                 Frontend->Features.Invalidations);
+
+    for (Index = 0; Index < XENVIF_FRONTEND_FEATURE_COUNT; Index++) {
+        if ((Frontend->Features.Present & (1u << Index)) == 0)
+            continue;
+
+        XENBUS_DEBUG(Printf,
+                     &Frontend->DebugInterface,
+                     " - %s = %u\n",
+                     FrontendFeatureName(Index),
+                     Frontend->Features.Value[Index]);
+    }
+
+    if (Frontend->Rebalance.Interval != 0)
+        XENBUS_DEBUG(Printf,
+                     &Frontend->DebugInterface,
+                     "REBALANCE: %ums (Threshold = %u%% Maximum = %u) Count = %u\n",
+                     Frontend->Rebalance.Interval,
+                     Frontend->Rebalance.Threshold,
+                     Frontend->Rebalance.Maximum,
+                     Frontend->Rebalance.Count);
+
+    XENBUS_DEBUG(Printf,
+                 &Frontend->DebugInterface,
+                 "WATCHDOG: %us (StallTimeout = %ums) Checks = %u\n",
+                 Frontend->Watchdog.Period,
+                 Frontend->Watchdog.StallTimeout,
+                 Frontend->Watchdog.Checks);
+
+    XENBUS_DEBUG(Printf,
+                 &Frontend->DebugInterface,
+                 "ADDRESSES: IPV4 = %u IPV6 = %u (Changes = %u Resyncs = %u)\n",
+                 Frontend->AddressTable.Count[XENVIF_FRONTEND_ADDRESS_IPV4],
+                 Frontend->AddressTable.Count[XENVIF_FRONTEND_ADDRESS_IPV6],
+                 Frontend->AddressTable.Changes,
+                 Frontend->AddressTable.Resyncs);
+
+    if (Frontend->Resume.Count != 0) {
+        XENVIF_FRONTEND_PHASE   Phase;
+
+        XENBUS_DEBUG(Printf,
+                     &Frontend->DebugInterface,
+                     "RESUME: Count = %u Last = %lluus (%u store attempt(s))\n",
+                     Frontend->Resume.Count,
+                     Frontend->Resume.Total,
+                     Frontend->Resume.Attempts);
+
+        for (Phase = 0; Phase < XENVIF_FRONTEND_PHASE_COUNT; Phase++)
+            XENBUS_DEBUG(Printf,
+                         &Frontend->DebugInterface,
+                         " - %12s %lluus\n",
+                         FrontendPhaseName(Phase),
+                         Frontend->Resume.Time[Phase]);
+    }
+
+    XENBUS_DEBUG(Printf,
+                 &Frontend->DebugInterface,
+                 "AFFINITY:\n");
+
+    for (Index = 0; Index < Frontend->NumQueues; Index++) {
+        PXENVIF_FRONTEND_AFFINITY   Affinity = &Frontend->Affinity[Index];
+
+        XENBUS_DEBUG(Printf,
+                     &Frontend->DebugInterface,
+                     " - [%u] CPU %u:%u NODE %u\n",
+                     Index,
+                     Affinity->ProcNumber.Group,
+                     Affinity->ProcNumber.Number,
+                     Affinity->Node);
+    }
+
     XENBUS_DEBUG(Printf,
                  &Frontend->DebugInterface,
                  "STATISTICS:\n");
@@ -1769,30 +2793,42 @@ FrontendSetNumQueues(
     IN  PXENVIF_FRONTEND    Frontend
     )
 {
-    PCHAR                   Buffer;
     ULONG                   BackendMaxQueues;
+    HANDLE                  ParametersKey;
+    ULONG                   FrontendActiveQueues;
     NTSTATUS                status;
 
-    status = XENBUS_STORE(Read,
-                          &Frontend->StoreInterface,
-                          NULL,
-                          __FrontendGetBackendPath(Frontend),
-                          "multi-queue-max-queues",
-                          &Buffer);
-    if (NT_SUCCESS(status)) {
-        BackendMaxQueues = (ULONG)strtoul(Buffer, NULL, 10);
-
-        XENBUS_STORE(Free,
-                     &Frontend->StoreInterface,
-                     Buffer);
-    } else {
+    if (!FrontendGetBackendFeature(Frontend,
+                                   XENVIF_FRONTEND_FEATURE_MULTI_QUEUE_MAX_QUEUES,
+                                   &BackendMaxQueues))
         BackendMaxQueues = 1;
-    }
 
     Frontend->NumQueues = __min(__FrontendGetMaxQueues(Frontend),
                                 BackendMaxQueues);
 
-    Info("%s: %u\n", __FrontendGetPath(Frontend), Frontend->NumQueues);
+    // All rings are always connected, but only a subset of them need
+    // be active. The active count can then be changed at run time
+    // without a reconnect.
+    Frontend->ActiveQueues = Frontend->NumQueues;
+
+    ParametersKey = DriverGetParametersKey();
+
+    status = RegistryQueryDwordValue(ParametersKey,
+                                     "FrontendActiveQueues",
+                                     &FrontendActiveQueues);
+    if (NT_SUCCESS(status) &&
+        FrontendActiveQueues != 0 &&
+        FrontendActiveQueues < Frontend->ActiveQueues)
+        Frontend->ActiveQueues = FrontendActiveQueues;
+
+    // A count set at run time outlives the connection
+    if (Frontend->RequestedActiveQueues != 0)
+        Frontend->ActiveQueues = __min(Frontend->RequestedActiveQueues,
+                                       Frontend->NumQueues);
+
+    Info("%s: %u (%u active)\n", __FrontendGetPath(Frontend),
+         Frontend->NumQueues,
+         Frontend->ActiveQueues);
 }
 
 static FORCEINLINE ULONG
@@ -1811,29 +2847,33 @@ FrontendGetNumQueues(
     return __FrontendGetNumQueues(Frontend);
 }
 
+static FORCEINLINE ULONG
+__FrontendGetActiveQueues(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    return Frontend->ActiveQueues;
+}
+
+ULONG
+FrontendGetActiveQueues(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    return __FrontendGetActiveQueues(Frontend);
+}
+
 static VOID
 FrontendSetSplit(
     IN  PXENVIF_FRONTEND    Frontend
     )
 {
-    PCHAR                   Buffer;
-    NTSTATUS                status;
+    ULONG                   Split;
 
-    status = XENBUS_STORE(Read,
-                          &Frontend->StoreInterface,
-                          NULL,
-                          __FrontendGetBackendPath(Frontend),
-                          "feature-split-event-channels",
-                          &Buffer);
-    if (NT_SUCCESS(status)) {
-        Frontend->Split = (BOOLEAN)strtol(Buffer, NULL, 2);
-
-        XENBUS_STORE(Free,
-                     &Frontend->StoreInterface,
-                     Buffer);
-    } else {
-        Frontend->Split = FALSE;
-    }
+    (VOID) FrontendGetBackendFeature(Frontend,
+                                     XENVIF_FRONTEND_FEATURE_SPLIT_EVENT_CHANNELS,
+                                     &Split);
+    Frontend->Split = (Split != 0) ? TRUE : FALSE;
 
     Info("%s: %s\n", __FrontendGetPath(Frontend),
          (Frontend->Split) ? "TRUE" : "FALSE");
@@ -1855,6 +2895,14 @@ FrontendIsSplit(
     return __FrontendIsSplit(Frontend);
 }
 
+BOOLEAN
+FrontendIsRebalancing(
+    IN  PXENVIF_FRONTEND    Frontend
+    )
+{
+    return (Frontend->Rebalance.Interval != 0) ? TRUE : FALSE;
+}
+
 static FORCEINLINE NTSTATUS
 __FrontendUpdateHash(
     PXENVIF_FRONTEND        Frontend,
@@ -1863,73 +2911,103 @@ __FrontendUpdateHash(
 {
     PXENVIF_CONTROLLER      Controller;
     ULONG                   Zero = 0;
+    ULONG                   Active[XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE];
     ULONG                   Size;
     PULONG                  Mapping;
     ULONG                   Flags;
+    ULONG                   Index;
     NTSTATUS                status;
 
     Controller = __FrontendGetController(Frontend);
 
     switch (Hash->Algorithm) {
-    case XENVIF_PACKET_HASH_ALGORITHM_NONE:
-        Size = 1;
-        Mapping = &Zero;
-        Flags = 0;
-        break;
-
     case XENVIF_PACKET_HASH_ALGORITHM_TOEPLITZ:
         Size = Hash->Size;
-        Mapping = Hash->Mapping;
         Flags = Hash->Flags;
+
+        if (__FrontendGetActiveQueues(Frontend) ==
+            __FrontendGetNumQueues(Frontend)) {
+            Mapping = Hash->Mapping;
+            break;
+        }
+
+        // Fold any buckets that refer to inactive queues back onto the
+        // active ones so that the backend stops using them.
+        ASSERT3U(Size, <=, XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE);
+        for (Index = 0; Index < Size; Index++)
+            Active[Index] = Hash->Mapping[Index] %
+                            __FrontendGetActiveQueues(Frontend);
+
+        Mapping = Active;
         break;
 
     case XENVIF_PACKET_HASH_ALGORITHM_UNSPECIFIED:
+        // If the backend is left to its own devices it will use all the
+        // queues so, if some are inactive, steer everything to queue 0.
+        if (__FrontendGetActiveQueues(Frontend) ==
+            __FrontendGetNumQueues(Frontend)) {
+            (VOID) ControllerSetHashAlgorithm(Controller,
+                                              XEN_NETIF_CTRL_HASH_ALGORITHM_NONE);
+            goto done;
+        }
+
+        // FALLTHRU
+    case XENVIF_PACKET_HASH_ALGORITHM_NONE:
+        Size = 1;
+        Mapping = &Zero;
+        Flags = 0;
+        break;
+
     default:
         (VOID) ControllerSetHashAlgorithm(Controller,
                                           XEN_NETIF_CTRL_HASH_ALGORITHM_NONE);
         goto done;
     }
 
-    status = ControllerSetHashAlgorithm(Controller,
-                                        XEN_NETIF_CTRL_HASH_ALGORITHM_TOEPLITZ);
+    status = ControllerSetHash(Controller,
+                               XEN_NETIF_CTRL_HASH_ALGORITHM_TOEPLITZ,
+                               Flags,
+                               Hash->Key,
+                               XENVIF_VIF_HASH_KEY_SIZE,
+                               Mapping,
+                               Size);
     if (!NT_SUCCESS(status))
         goto fail1;
 
-    status = ControllerSetHashMappingSize(Controller, Size);
-    if (!NT_SUCCESS(status))
-        goto fail2;
-
-    status = ControllerSetHashMapping(Controller, Mapping, Size, 0);
-    if (!NT_SUCCESS(status))
-        goto fail3;
-
-    status = ControllerSetHashKey(Controller, Hash->Key, XENVIF_VIF_HASH_KEY_SIZE);
-    if (!NT_SUCCESS(status))
-        goto fail4;
-
-    status = ControllerSetHashFlags(Controller, Flags);
-    if (!NT_SUCCESS(status))
-        goto fail5;
-
 done:
     return STATUS_SUCCESS;
 
-fail5:
-    Error("fail5\n");
+fail1:
+    Error("fail1 (%08x)\n", status);
 
-fail4:
-    Error("fail4\n");
+    return status;
+}
 
-fail3:
-    Error("fail3\n");
+// The rebalancer works on its own copy of the mapping so that it never
+// alters the table set through the interface. Whenever the backend is
+// given a new mapping, or the rings are (re-)connected and so restart
+// their counters from zero, the copy and the load baselines are reset.
+static VOID
+__FrontendResetRebalance(
+    IN  PXENVIF_FRONTEND        Frontend
+    )
+{
+    PXENVIF_FRONTEND_REBALANCE  Rebalance = &Frontend->Rebalance;
 
-fail2:
-    Error("fail2\n");
+    if (Rebalance->Interval == 0)
+        return;
 
-fail1:
-    Error("fail1 (%08x)\n", status);
+    RtlCopyMemory(Rebalance->Mapping,
+                  Frontend->Hash.Mapping,
+                  sizeof (Rebalance->Mapping));
+    RtlZeroMemory(Rebalance->Holdoff, sizeof (Rebalance->Holdoff));
 
-    return status;
+    RtlZeroMemory(Rebalance->Sample, sizeof (Rebalance->Sample));
+
+    ReceiverQueryHashLoad(__FrontendGetReceiver(Frontend),
+                          Rebalance->Sample);
+    TransmitterQueryHashLoad(__FrontendGetTransmitter(Frontend),
+                             Rebalance->Sample);
 }
 
 NTSTATUS
@@ -1983,6 +3061,7 @@ FrontendSetHashAlgorithm(
         goto fail2;
 
     Frontend->Hash = Hash;
+    __FrontendResetRebalance(Frontend);
 
     KeReleaseSpinLock(&Frontend->Lock, Irql);
 
@@ -2065,6 +3144,7 @@ FrontendSetHashMapping(
         goto fail2;
 
     Frontend->Hash = Hash;
+    __FrontendResetRebalance(Frontend);
 
     KeReleaseSpinLock(&Frontend->Lock, Irql);
 
@@ -2102,6 +3182,7 @@ FrontendSetHashKey(
         goto fail1;
 
     Frontend->Hash = Hash;
+    __FrontendResetRebalance(Frontend);
 
     KeReleaseSpinLock(&Frontend->Lock, Irql);
 
@@ -2140,18 +3221,74 @@ FrontendSetHashTypes(
     if (Types & (1 << XENVIF_PACKET_HASH_TYPE_IPV6_TCP))
         Flags |= XEN_NETIF_CTRL_HASH_TYPE_IPV6_TCP;
 
-    Hash.Flags = Flags;
+    Hash.Flags = Flags;
+
+    status = __FrontendUpdateHash(Frontend, &Hash);
+    if (!NT_SUCCESS(status))
+        goto fail1;
+
+    Frontend->Hash = Hash;
+    __FrontendResetRebalance(Frontend);
+
+    KeReleaseSpinLock(&Frontend->Lock, Irql);
+
+    return STATUS_SUCCESS;
+
+fail1:
+    Error("fail1 (%08x)\n", status);
+
+    KeReleaseSpinLock(&Frontend->Lock, Irql);
+
+    return status;
+}
+
+NTSTATUS
+FrontendSetActiveQueues(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  ULONG               Count
+    )
+{
+    KIRQL                   Irql;
+    ULONG                   ActiveQueues;
+    NTSTATUS                status;
+
+    KeAcquireSpinLock(&Frontend->Lock, &Irql);
+
+    status = STATUS_INVALID_PARAMETER;
+    if (Count == 0 || Count > __FrontendGetNumQueues(Frontend))
+        goto fail1;
+
+    ActiveQueues = Frontend->ActiveQueues;
+    if (Count == ActiveQueues)
+        goto done;
+
+    Frontend->ActiveQueues = Count;
 
-    status = __FrontendUpdateHash(Frontend, &Hash);
+    // Inactive rings stay connected so anything already queued on them
+    // (in either direction) simply drains as normal.
+    status = __FrontendUpdateHash(Frontend, &Frontend->Hash);
     if (!NT_SUCCESS(status))
-        goto fail1;
+        goto fail2;
 
-    Frontend->Hash = Hash;
+    __FrontendResetRebalance(Frontend);
+
+    Info("%s: %u -> %u\n", __FrontendGetPath(Frontend),
+         ActiveQueues,
+         Count);
+
+done:
+    // Keep the count across reconnects
+    Frontend->RequestedActiveQueues = Count;
 
     KeReleaseSpinLock(&Frontend->Lock, Irql);
 
     return STATUS_SUCCESS;
 
+fail2:
+    Error("fail2\n");
+
+    Frontend->ActiveQueues = ActiveQueues;
+
 fail1:
     Error("fail1 (%08x)\n", status);
 
@@ -2167,18 +3304,24 @@ FrontendGetQueue(
     IN  ULONG                           Value
     )
 {
+    PULONG                              Mapping;
     ULONG                               Queue;
 
     switch (Algorithm) {
     case XENVIF_PACKET_HASH_ALGORITHM_NONE:
     case XENVIF_PACKET_HASH_ALGORITHM_UNSPECIFIED:
-        Queue = Value % __FrontendGetNumQueues(Frontend);
+        Queue = Value % __FrontendGetActiveQueues(Frontend);
         break;
 
     case XENVIF_PACKET_HASH_ALGORITHM_TOEPLITZ:
+        Mapping = (Frontend->Rebalance.Interval != 0) ?
+                  Frontend->Rebalance.Mapping :
+                  Frontend->Hash.Mapping;
+
         Queue = (Frontend->Hash.Size != 0) ?
-                Frontend->Hash.Mapping[Value % Frontend->Hash.Size] :
+                Mapping[Value % Frontend->Hash.Size] :
                 0;
+        Queue %= __FrontendGetActiveQueues(Frontend);
         break;
 
     default:
@@ -2190,6 +3333,260 @@ FrontendGetQueue(
     return Queue;
 }
 
+#define XENVIF_FRONTEND_REBALANCE_HOLDOFF   10
+
+static VOID
+__FrontendRebalanceHashMapping(
+    IN  PXENVIF_FRONTEND        Frontend
+    )
+{
+    PXENVIF_FRONTEND_REBALANCE  Rebalance = &Frontend->Rebalance;
+    PXENVIF_FRONTEND_HASH       Hash = &Frontend->Hash;
+    PULONG                      Mapping = Rebalance->Mapping;
+    PULONGLONG                  Load = Rebalance->Load;
+    ULONG                       Sample[XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE];
+    ULONG                       ActiveQueues;
+    ULONG                       Index;
+    ULONG                       Moved;
+    NTSTATUS                    status;
+
+    RtlZeroMemory(Sample, sizeof (Sample));
+
+    ReceiverQueryHashLoad(__FrontendGetReceiver(Frontend), Sample);
+    TransmitterQueryHashLoad(__FrontendGetTransmitter(Frontend), Sample);
+
+    // Turn the cumulative counts into the load seen since last time. The
+    // counters are 32-bit and wrap so the difference is taken modulo 2^32.
+    for (Index = 0; Index < XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE; Index++) {
+        Load[Index] = (ULONG)(Sample[Index] - Rebalance->Sample[Index]);
+        Rebalance->Sample[Index] = Sample[Index];
+
+        if (Rebalance->Holdoff[Index] != 0)
+            --Rebalance->Holdoff[Index];
+    }
+
+    ActiveQueues = __FrontendGetActiveQueues(Frontend);
+
+    if (Hash->Algorithm != XENVIF_PACKET_HASH_ALGORITHM_TOEPLITZ ||
+        Hash->Size == 0 ||
+        ActiveQueues < 2)
+        return;
+
+    // Load is accumulated by hash value modulo the maximum mapping size
+    // so it can only be folded onto mappings whose size is a factor
+    if (XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE % Hash->Size != 0)
+        return;
+
+    for (Index = Hash->Size;
+         Index < XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE;
+         Index++)
+        Load[Index % Hash->Size] += Load[Index];
+
+    RtlZeroMemory(Rebalance->QueueLoad, sizeof (ULONGLONG) * Frontend->MaxQueues);
+
+    for (Index = 0; Index < Hash->Size; Index++)
+        Rebalance->QueueLoad[Mapping[Index] % ActiveQueues] += Load[Index];
+
+    for (Moved = 0; Moved < Rebalance->Maximum; Moved++) {
+        ULONG       Hot;
+        ULONG       Cold;
+        ULONGLONG   Gap;
+        ULONG       Bucket;
+        ULONGLONG   Benefit;
+        ULONG       Queue;
+
+        Hot = Cold = 0;
+        for (Queue = 1; Queue < ActiveQueues; Queue++) {
+            if (Rebalance->QueueLoad[Queue] > Rebalance->QueueLoad[Hot])
+                Hot = Queue;
+            if (Rebalance->QueueLoad[Queue] < Rebalance->QueueLoad[Cold])
+                Cold = Queue;
+        }
+
+        Gap = Rebalance->QueueLoad[Hot] - Rebalance->QueueLoad[Cold];
+
+        // Hysteresis: leave small imbalances alone
+        if (Gap == 0 ||
+            Gap * 100 <= Rebalance->QueueLoad[Hot] * Rebalance->Threshold)
+            break;
+
+        // Moving a bucket with load L reduces the imbalance between the
+        // two queues only if L < Gap, and by most when L is Gap / 2.
+        Bucket = Hash->Size;
+        Benefit = 0;
+        for (Index = 0; Index < Hash->Size; Index++) {
+            ULONGLONG   Value;
+
+            if (Mapping[Index] % ActiveQueues != Hot ||
+                Rebalance->Holdoff[Index] != 0 ||
+                Load[Index] == 0 ||
+                Load[Index] >= Gap)
+                continue;
+
+            Value = __min(Load[Index], Gap - Load[Index]);
+            if (Value > Benefit) {
+                Bucket = Index;
+                Benefit = Value;
+            }
+        }
+
+        if (Bucket == Hash->Size)
+            break;
+
+        Queue = Mapping[Bucket];
+        Mapping[Bucket] = Cold;
+
+        status = ControllerSetHashMapping(__FrontendGetController(Frontend),
+                                          &Mapping[Bucket],
+                                          1,
+                                          Bucket);
+        if (!NT_SUCCESS(status)) {
+            Mapping[Bucket] = Queue;
+            break;
+        }
+
+        Rebalance->QueueLoad[Hot] -= Load[Bucket];
+        Rebalance->QueueLoad[Cold] += Load[Bucket];
+        Rebalance->Holdoff[Bucket] = XENVIF_FRONTEND_REBALANCE_HOLDOFF;
+        Rebalance->Count++;
+
+        Trace("%s: [%u]: %u -> %u\n",
+              __FrontendGetPath(Frontend),
+              Bucket,
+              Hot,
+              Cold);
+    }
+}
+
+#define TIME_US(_us)        ((_us) * 10)
+#define TIME_MS(_ms)        (TIME_US((_ms) * 1000))
+#define TIME_S(_s)          (TIME_MS((_s) * 1000))
+#define TIME_RELATIVE(_t)   (-(_t))
+
+static DECLSPEC_NOINLINE NTSTATUS
+FrontendRebalance(
+    IN  PXENVIF_THREAD  Self,
+    IN  PVOID           Context
+    )
+{
+    PXENVIF_FRONTEND    Frontend = Context;
+    PKEVENT             Event;
+    LARGE_INTEGER       Timeout;
+
+    Trace("%s: ====>\n", __FrontendGetPath(Frontend));
+
+    Event = ThreadGetEvent(Self);
+
+    Timeout.QuadPart = TIME_RELATIVE(TIME_MS(Frontend->Rebalance.Interval));
+
+    for (;;) {
+        KIRQL   Irql;
+
+        (VOID) KeWaitForSingleObject(Event,
+                                     Executive,
+                                     KernelMode,
+                                     FALSE,
+                                     &Timeout);
+        KeClearEvent(Event);
+
+        if (ThreadIsAlerted(Self))
+            break;
+
+        KeAcquireSpinLock(&Frontend->Lock, &Irql);
+
+        if (Frontend->State == FRONTEND_ENABLED)
+            __FrontendRebalanceHashMapping(Frontend);
+
+        KeReleaseSpinLock(&Frontend->Lock, Irql);
+    }
+
+    Trace("%s: <====\n", __FrontendGetPath(Frontend));
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS
+FrontendWatchdog(
+    IN  PXENVIF_THREAD          Self,
+    IN  PVOID                   Context
+    )
+{
+    PXENVIF_FRONTEND            Frontend = Context;
+    PXENVIF_FRONTEND_WATCHDOG   Watchdog = &Frontend->Watchdog;
+    PKEVENT                     Event;
+    ULONGLONG                   Due;
+    BOOLEAN                     Stopped;
+
+    Trace("%s: ====>\n", __FrontendGetPath(Frontend));
+
+    Event = ThreadGetEvent(Self);
+
+    Due = KeQueryInterruptTime() + TIME_S((ULONGLONG)Watchdog->Period);
+    Stopped = FALSE;
+
+    for (;;) {
+        LARGE_INTEGER   Timeout;
+        ULONGLONG       Now;
+
+        Now = KeQueryInterruptTime();
+
+        if (Stopped)
+            Timeout.QuadPart = TIME_RELATIVE(TIME_MS((LONGLONG)Watchdog->StallTimeout));
+        else
+            Timeout.QuadPart = TIME_RELATIVE((Due > Now) ? (LONGLONG)(Due - Now) : 0);
+
+        (VOID) KeWaitForSingleObject(Event,
+                                     Executive,
+                                     KernelMode,
+                                     FALSE,
+                                     &Timeout);
+        KeClearEvent(Event);
+
+        if (ThreadIsAlerted(Self))
+            break;
+
+        // Disarm before sampling so that a ring stopping behind the
+        // scan wakes us again
+        (VOID) InterlockedExchange(&Watchdog->Armed, 0);
+
+        if (Watchdog->StallTimeout != 0) {
+            Stopped = TransmitterCheckStall(__FrontendGetTransmitter(Frontend));
+            if (Stopped)
+                (VOID) InterlockedExchange(&Watchdog->Armed, 1);
+        }
+
+        Now = KeQueryInterruptTime();
+        if (Now < Due)
+            continue;
+
+        TransmitterWatchdog(__FrontendGetTransmitter(Frontend));
+        ReceiverWatchdog(__FrontendGetReceiver(Frontend));
+
+        Watchdog->Checks++;
+        Due = Now + TIME_S((ULONGLONG)Watchdog->Period);
+    }
+
+    Trace("%s: <====\n", __FrontendGetPath(Frontend));
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FrontendWakeWatchdog(
+    IN  PXENVIF_FRONTEND        Frontend
+    )
+{
+    PXENVIF_FRONTEND_WATCHDOG   Watchdog = &Frontend->Watchdog;
+
+    if (Watchdog->StallTimeout == 0)
+        return;
+
+    // Only the first stop needs to wake the thread; it keeps polling
+    // for as long as any ring remains stopped
+    if (InterlockedExchange(&Watchdog->Armed, 1) == 0)
+        ThreadWake(Watchdog->Thread);
+}
+
 static NTSTATUS
 FrontendConnect(
     IN  PXENVIF_FRONTEND    Frontend
@@ -2214,24 +3611,36 @@ FrontendConnect(
     if (!NT_SUCCESS(status))
         goto fail2;
 
-    status = MacConnect(__FrontendGetMac(Frontend));
+    status = FrontendAcquireFeatures(Frontend);
     if (!NT_SUCCESS(status))
         goto fail3;
 
+    status = MacConnect(__FrontendGetMac(Frontend));
+    if (!NT_SUCCESS(status))
+        goto fail4;
+
+    __FrontendResumeMark(Frontend, XENVIF_FRONTEND_PHASE_MAC);
+
     FrontendSetNumQueues(Frontend);
     FrontendSetSplit(Frontend);
 
     status = ReceiverConnect(__FrontendGetReceiver(Frontend));
     if (!NT_SUCCESS(status))
-        goto fail4;
+        goto fail5;
+
+    __FrontendResumeMark(Frontend, XENVIF_FRONTEND_PHASE_RECEIVER);
 
     status = TransmitterConnect(__FrontendGetTransmitter(Frontend));
     if (!NT_SUCCESS(status))
-        goto fail5;
+        goto fail6;
+
+    __FrontendResumeMark(Frontend, XENVIF_FRONTEND_PHASE_TRANSMITTER);
 
     status = ControllerConnect(__FrontendGetController(Frontend));
     if (!NT_SUCCESS(status))
-        goto fail6;
+        goto fail7;
+
+    __FrontendResumeMark(Frontend, XENVIF_FRONTEND_PHASE_CONTROLLER);
 
     Attempt = 0;
     do {
@@ -2285,8 +3694,11 @@ abort:
         break;
     } while (status == STATUS_RETRY);
 
+    Frontend->Resume.Attempts += Attempt + 1;
+    __FrontendResumeMark(Frontend, XENVIF_FRONTEND_PHASE_STORE);
+
     if (!NT_SUCCESS(status))
-        goto fail7;
+        goto fail8;
 
     State = XenbusStateUnknown;
     while (State != XenbusStateConnected) {
@@ -2325,41 +3737,51 @@ abort:
 
     status = STATUS_UNSUCCESSFUL;
     if (State != XenbusStateConnected)
-        goto fail8;
+        goto fail9;
+
+    __FrontendResumeMark(Frontend, XENVIF_FRONTEND_PHASE_BACKEND);
 
     ControllerEnable(__FrontendGetController(Frontend));
 
+    // The backend may have a fresh store so re-write all addresses
+    Frontend->AddressTable.Rewrite = TRUE;
     ThreadWake(Frontend->MibThread);
 
     Trace("<====\n");
     return STATUS_SUCCESS;
 
+fail9:
+    Error("fail9\n");
+
 fail8:
     Error("fail8\n");
 
+    ControllerDisconnect(__FrontendGetController(Frontend));
+
 fail7:
     Error("fail7\n");
 
-    ControllerDisconnect(__FrontendGetController(Frontend));
+    TransmitterDisconnect(__FrontendGetTransmitter(Frontend));
 
 fail6:
     Error("fail6\n");
 
-    TransmitterDisconnect(__FrontendGetTransmitter(Frontend));
+    ReceiverDisconnect(__FrontendGetReceiver(Frontend));
 
 fail5:
     Error("fail5\n");
 
-    ReceiverDisconnect(__FrontendGetReceiver(Frontend));
-
-fail4:
-    Error("fail4\n");
-
     MacDisconnect(__FrontendGetMac(Frontend));
 
     Frontend->Split = FALSE;
+    Frontend->ActiveQueues = 0;
     Frontend->NumQueues = 0;
 
+fail4:
+    Error("fail4\n");
+
+    FrontendReleaseFeatures(Frontend);
+
 fail3:
     Error("fail3\n");
 
@@ -2395,8 +3817,11 @@ FrontendDisconnect(
     MacDisconnect(__FrontendGetMac(Frontend));
 
     Frontend->Split = FALSE;
+    Frontend->ActiveQueues = 0;
     Frontend->NumQueues = 0;
 
+    FrontendReleaseFeatures(Frontend);
+
     XENBUS_DEBUG(Deregister,
                  &Frontend->DebugInterface,
                  Frontend->DebugCallback);
@@ -2432,8 +3857,13 @@ FrontendEnable(
     if (!NT_SUCCESS(status))
         goto fail4;
 
+    __FrontendResetRebalance(Frontend);
+
     (VOID) FrontendNotifyMulticastAddresses(Frontend, TRUE);
 
+    __FrontendResumeMark(Frontend, XENVIF_FRONTEND_PHASE_ENABLE);
+    __FrontendResumeComplete(Frontend);
+
     Trace("<====\n");
     return STATUS_SUCCESS;
 
@@ -2455,6 +3885,8 @@ fail2:
 fail1:
     Error("fail1 (%08x)\n", status);
 
+    __FrontendResumeAbort(Frontend);
+
     return status;
 }
 
@@ -2621,6 +4053,11 @@ FrontendSetState(
              FrontendStateName(Frontend->State));
     }
 
+    // A failed transition may leave resume timing running, and a later
+    // enable would then report a bogus resume
+    if (Failed)
+        __FrontendResumeAbort(Frontend);
+
     KeReleaseSpinLock(&Frontend->Lock, Irql);
 
     Info("%s: <=====\n", __FrontendGetPath(Frontend));
@@ -2666,7 +4103,14 @@ FrontendSuspendCallbackLate(
 {
     PXENVIF_FRONTEND    Frontend = Argument;
 
+    // Only an enabled frontend is brought back by VifSuspendCallbackLate()
+    // so there is nothing to time otherwise
+    if (Frontend->State == FRONTEND_ENABLED)
+        __FrontendResumeStart(Frontend);
+
     __FrontendSuspend(Frontend);
+    __FrontendResumeMark(Frontend, XENVIF_FRONTEND_PHASE_SUSPEND);
+
     __FrontendResume(Frontend);
 }
 
@@ -2800,6 +4244,11 @@ FrontendInitialize(
     PCHAR                   Prefix;
     HANDLE                  ParametersKey;
     ULONG                   FrontendDisableToeplitz;
+    ULONG                   FrontendRebalanceInterval;
+    ULONG                   FrontendRebalanceThreshold;
+    ULONG                   FrontendRebalanceMaximum;
+    ULONG                   FrontendWatchdogPeriod;
+    ULONG                   FrontendWatchdogStallTimeout;
     NTSTATUS                status;
 
     Trace("====>\n");
@@ -2849,6 +4298,11 @@ FrontendInitialize(
 
     KeInitializeSpinLock(&(*Frontend)->Lock);
 
+    KeInitializeSpinLock(&(*Frontend)->Features.Lock);
+    KeInitializeEvent(&(*Frontend)->Features.Event, NotificationEvent, FALSE);
+
+    FrontendInitializeAddressTable(*Frontend);
+
     (*Frontend)->Online = TRUE;
 
     FdoGetDebugInterface(PdoGetFdo(Pdo), &(*Frontend)->DebugInterface);
@@ -2868,31 +4322,78 @@ FrontendInitialize(
     if (NT_SUCCESS(status))
         (*Frontend)->DisableToeplitz = FrontendDisableToeplitz;
 
-    status = MacInitialize(*Frontend, &(*Frontend)->Mac);
+    (*Frontend)->Rebalance.Interval = 0;
+    (*Frontend)->Rebalance.Threshold = 25;
+    (*Frontend)->Rebalance.Maximum = 1;
+
+    status = RegistryQueryDwordValue(ParametersKey,
+                                     "FrontendRebalanceInterval",
+                                     &FrontendRebalanceInterval);
+    if (NT_SUCCESS(status))
+        (*Frontend)->Rebalance.Interval = FrontendRebalanceInterval;
+
+    status = RegistryQueryDwordValue(ParametersKey,
+                                     "FrontendRebalanceThreshold",
+                                     &FrontendRebalanceThreshold);
+    if (NT_SUCCESS(status) && FrontendRebalanceThreshold <= 100)
+        (*Frontend)->Rebalance.Threshold = FrontendRebalanceThreshold;
+
+    status = RegistryQueryDwordValue(ParametersKey,
+                                     "FrontendRebalanceMaximum",
+                                     &FrontendRebalanceMaximum);
+    if (NT_SUCCESS(status))
+        (*Frontend)->Rebalance.Maximum = FrontendRebalanceMaximum;
+
+    (*Frontend)->Watchdog.Period = XENVIF_FRONTEND_WATCHDOG_PERIOD;
+    (*Frontend)->Watchdog.StallTimeout = XENVIF_FRONTEND_WATCHDOG_STALL_TIMEOUT;
+
+    status = RegistryQueryDwordValue(ParametersKey,
+                                     "FrontendWatchdogPeriod",
+                                     &FrontendWatchdogPeriod);
+    if (NT_SUCCESS(status) && FrontendWatchdogPeriod != 0)
+        (*Frontend)->Watchdog.Period = FrontendWatchdogPeriod;
+
+    status = RegistryQueryDwordValue(ParametersKey,
+                                     "FrontendWatchdogStallTimeout",
+                                     &FrontendWatchdogStallTimeout);
+    if (NT_SUCCESS(status))
+        (*Frontend)->Watchdog.StallTimeout = FrontendWatchdogStallTimeout;
+
+    status = FrontendSetAffinity(*Frontend);
     if (!NT_SUCCESS(status))
         goto fail6;
 
-    status = ReceiverInitialize(*Frontend, &(*Frontend)->Receiver);
+    status = MacInitialize(*Frontend, &(*Frontend)->Mac);
     if (!NT_SUCCESS(status))
         goto fail7;
 
-    status = TransmitterInitialize(*Frontend, &(*Frontend)->Transmitter);
+    status = ReceiverInitialize(*Frontend, &(*Frontend)->Receiver);
     if (!NT_SUCCESS(status))
         goto fail8;
 
-    status = ControllerInitialize(*Frontend, &(*Frontend)->Controller);
+    status = TransmitterInitialize(*Frontend, &(*Frontend)->Transmitter);
     if (!NT_SUCCESS(status))
         goto fail9;
 
+    status = ControllerInitialize(*Frontend, &(*Frontend)->Controller);
+    if (!NT_SUCCESS(status))
+        goto fail10;
+
     KeInitializeEvent(&(*Frontend)->EjectEvent, NotificationEvent, FALSE);
 
     status = ThreadCreate(FrontendEject, *Frontend, &(*Frontend)->EjectThread);
     if (!NT_SUCCESS(status))
-        goto fail10;
+        goto fail11;
 
     status = ThreadCreate(FrontendMib, *Frontend, &(*Frontend)->MibThread);
     if (!NT_SUCCESS(status))
-        goto fail11;
+        goto fail12;
+
+    status = ThreadCreate(FrontendWatchdog,
+                          *Frontend,
+                          &(*Frontend)->Watchdog.Thread);
+    if (!NT_SUCCESS(status))
+        goto fail13;
 
     (*Frontend)->StatisticsCount = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
     (*Frontend)->Statistics = __FrontendAllocate(sizeof (XENVIF_FRONTEND_STATISTICS) *
@@ -2900,53 +4401,98 @@ FrontendInitialize(
 
     status = STATUS_NO_MEMORY;
     if ((*Frontend)->Statistics == NULL)
-        goto fail12;
+        goto fail14;
+
+    if ((*Frontend)->Rebalance.Interval != 0) {
+        (*Frontend)->Rebalance.QueueLoad = __FrontendAllocate(sizeof (ULONGLONG) *
+                                                              (*Frontend)->MaxQueues);
+
+        status = STATUS_NO_MEMORY;
+        if ((*Frontend)->Rebalance.QueueLoad == NULL)
+            goto fail15;
+
+        status = ThreadCreate(FrontendRebalance,
+                              *Frontend,
+                              &(*Frontend)->Rebalance.Thread);
+        if (!NT_SUCCESS(status))
+            goto fail16;
+    }
 
     Trace("<====\n");
 
     return STATUS_SUCCESS;
 
-fail12:
-    Error("fail12\n");
+fail16:
+    Error("fail16\n");
+
+    __FrontendFree((*Frontend)->Rebalance.QueueLoad);
+    (*Frontend)->Rebalance.QueueLoad = NULL;
+
+fail15:
+    Error("fail15\n");
+
+    __FrontendFree((*Frontend)->Statistics);
+    (*Frontend)->Statistics = NULL;
+    (*Frontend)->StatisticsCount = 0;
+
+fail14:
+    Error("fail14\n");
+
+    ThreadAlert((*Frontend)->Watchdog.Thread);
+    ThreadJoin((*Frontend)->Watchdog.Thread);
+    (*Frontend)->Watchdog.Thread = NULL;
+
+fail13:
+    Error("fail13\n");
 
     ThreadAlert((*Frontend)->MibThread);
     ThreadJoin((*Frontend)->MibThread);
     (*Frontend)->MibThread = NULL;
 
-fail11:
-    Error("fail11\n");
+fail12:
+    Error("fail12\n");
 
     ThreadAlert((*Frontend)->EjectThread);
     ThreadJoin((*Frontend)->EjectThread);
     (*Frontend)->EjectThread = NULL;
 
-fail10:
-    Error("fail10\n");
+fail11:
+    Error("fail11\n");
 
     RtlZeroMemory(&(*Frontend)->EjectEvent, sizeof (KEVENT));
 
     ControllerTeardown(__FrontendGetController(*Frontend));
     (*Frontend)->Controller = NULL;
 
-fail9:
+fail10:
     TransmitterTeardown(__FrontendGetTransmitter(*Frontend));
     (*Frontend)->Transmitter = NULL;
 
-fail8:
-    Error("fail8\n");
+fail9:
+    Error("fail9\n");
 
     ReceiverTeardown(__FrontendGetReceiver(*Frontend));
     (*Frontend)->Receiver = NULL;
 
-fail7:
-    Error("fail7\n");
+fail8:
+    Error("fail8\n");
 
     MacTeardown(__FrontendGetMac(*Frontend));
     (*Frontend)->Mac = NULL;
 
+fail7:
+    Error("fail7\n");
+
+    __FrontendFree((*Frontend)->Affinity);
+    (*Frontend)->Affinity = NULL;
+
 fail6:
     Error("fail6\n");
 
+    RtlZeroMemory(&(*Frontend)->Watchdog, sizeof (XENVIF_FRONTEND_WATCHDOG));
+
+    RtlZeroMemory(&(*Frontend)->Rebalance, sizeof (XENVIF_FRONTEND_REBALANCE));
+
     (*Frontend)->DisableToeplitz = 0;
 
     RtlZeroMemory(&(*Frontend)->Hash, sizeof (XENVIF_FRONTEND_HASH));
@@ -2963,6 +4509,11 @@ fail6:
 
     (*Frontend)->Online = FALSE;
 
+    RtlZeroMemory(&(*Frontend)->AddressTable,
+                  sizeof (XENVIF_FRONTEND_ADDRESS_TABLE));
+
+    RtlZeroMemory(&(*Frontend)->Features, sizeof (XENVIF_FRONTEND_FEATURES));
+
     RtlZeroMemory(&(*Frontend)->Lock, sizeof (KSPIN_LOCK));
 
     (*Frontend)->BackendDomain = 0;
@@ -3008,20 +4559,29 @@ FrontendTeardown(
 
     ASSERT(Frontend->State == FRONTEND_UNKNOWN);
 
+    if (Frontend->Rebalance.Interval != 0) {
+        ThreadAlert(Frontend->Rebalance.Thread);
+        ThreadJoin(Frontend->Rebalance.Thread);
+        Frontend->Rebalance.Thread = NULL;
+
+        __FrontendFree(Frontend->Rebalance.QueueLoad);
+        Frontend->Rebalance.QueueLoad = NULL;
+    }
+
     __FrontendFree(Frontend->Statistics);
     Frontend->Statistics = NULL;
     Frontend->StatisticsCount = 0;
 
+    ThreadAlert(Frontend->Watchdog.Thread);
+    ThreadJoin(Frontend->Watchdog.Thread);
+    Frontend->Watchdog.Thread = NULL;
+
     ThreadAlert(Frontend->MibThread);
     ThreadJoin(Frontend->MibThread);
     Frontend->MibThread = NULL;
 
-    if (Frontend->AddressCount != 0) {
-        __FrontendFree(Frontend->AddressTable);
-
-        Frontend->AddressTable = NULL;
-        Frontend->AddressCount = 0;
-    }
+    RtlZeroMemory(&Frontend->AddressTable,
+                  sizeof (XENVIF_FRONTEND_ADDRESS_TABLE));
 
     RtlZeroMemory(Frontend->Alias, sizeof (Frontend->Alias));
     Frontend->InterfaceIndex = 0;
@@ -3044,9 +4604,19 @@ FrontendTeardown(
     MacTeardown(__FrontendGetMac(Frontend));
     Frontend->Mac = NULL;
 
+    __FrontendFree(Frontend->Affinity);
+    Frontend->Affinity = NULL;
+
+    RtlZeroMemory(&Frontend->Resume, sizeof (XENVIF_FRONTEND_RESUME));
+
+    RtlZeroMemory(&Frontend->Watchdog, sizeof (XENVIF_FRONTEND_WATCHDOG));
+
+    RtlZeroMemory(&Frontend->Rebalance, sizeof (XENVIF_FRONTEND_REBALANCE));
+
     Frontend->DisableToeplitz = 0;
 
     RtlZeroMemory(&Frontend->Hash, sizeof (XENVIF_FRONTEND_HASH));
+    Frontend->RequestedActiveQueues = 0;
     Frontend->MaxQueues = 0;
 
     RtlZeroMemory(&Frontend->StoreInterface,
@@ -3060,6 +4630,8 @@ FrontendTeardown(
 
     Frontend->Online = FALSE;
 
+    RtlZeroMemory(&Frontend->Features, sizeof (XENVIF_FRONTEND_FEATURES));
+
     RtlZeroMemory(&Frontend->Lock, sizeof (KSPIN_LOCK));
 
     Frontend->BackendDomain = 0;
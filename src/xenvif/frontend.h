@@ -47,6 +47,8 @@
 
 typedef struct _XENVIF_FRONTEND XENVIF_FRONTEND, *PXENVIF_FRONTEND;
 
+#define XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE   128
+
 typedef enum _XENVIF_FRONTEND_STATE {
     FRONTEND_UNKNOWN,
     FRONTEND_CLOSED,
@@ -55,6 +57,18 @@ typedef enum _XENVIF_FRONTEND_STATE {
     FRONTEND_ENABLED
 } XENVIF_FRONTEND_STATE, *PXENVIF_FRONTEND_STATE;
 
+typedef enum _XENVIF_FRONTEND_FEATURE {
+    XENVIF_FRONTEND_FEATURE_GSO_TCPV4 = 0,
+    XENVIF_FRONTEND_FEATURE_GSO_TCPV6,
+    XENVIF_FRONTEND_FEATURE_NO_CSUM_OFFLOAD,
+    XENVIF_FRONTEND_FEATURE_IPV6_CSUM_OFFLOAD,
+    XENVIF_FRONTEND_FEATURE_SPLIT_EVENT_CHANNELS,
+    XENVIF_FRONTEND_FEATURE_MULTI_QUEUE_MAX_QUEUES,
+    XENVIF_FRONTEND_FEATURE_CTRL_RING,
+    XENVIF_FRONTEND_FEATURE_DYNAMIC_MULTICAST_CONTROL,
+    XENVIF_FRONTEND_FEATURE_COUNT
+} XENVIF_FRONTEND_FEATURE, *PXENVIF_FRONTEND_FEATURE;
+
 __drv_requiresIRQL(PASSIVE_LEVEL)
 extern NTSTATUS
 FrontendInitialize(
@@ -118,11 +132,35 @@ FrontendGetMaxQueues(
     IN  PXENVIF_FRONTEND    Frontend
     );
 
+extern VOID
+FrontendGetRingProcessor(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  ULONG               Index,
+    OUT PPROCESSOR_NUMBER   ProcNumber
+    );
+
+extern ULONG
+FrontendGetRingNode(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  ULONG               Index
+    );
+
 extern ULONG
 FrontendGetNumQueues(
     IN  PXENVIF_FRONTEND    Frontend
     );
 
+extern ULONG
+FrontendGetActiveQueues(
+    IN  PXENVIF_FRONTEND    Frontend
+    );
+
+extern NTSTATUS
+FrontendSetActiveQueues(
+    IN  PXENVIF_FRONTEND    Frontend,
+    IN  ULONG               Count
+    );
+
 extern BOOLEAN
 FrontendIsSplit(
     IN  PXENVIF_FRONTEND    Frontend
@@ -133,6 +171,11 @@ FrontendIsSplit(
     IN  PXENVIF_FRONTEND    Frontend
     );
 
+extern BOOLEAN
+FrontendIsRebalancing(
+    IN  PXENVIF_FRONTEND    Frontend
+    );
+
 extern PCHAR
 FrontendFormatPath(
     IN  PXENVIF_FRONTEND    Frontend,
@@ -244,4 +287,16 @@ FrontendGetQueue(
     IN  ULONG                           Index
     );
 
+extern VOID
+FrontendWakeWatchdog(
+    IN  PXENVIF_FRONTEND    Frontend
+    );
+
+extern BOOLEAN
+FrontendGetBackendFeature(
+    IN  PXENVIF_FRONTEND        Frontend,
+    IN  XENVIF_FRONTEND_FEATURE Feature,
+    OUT PULONG                  Value
+    );
+
 #endif  // _XENVIF_FRONTEND_H
@@ -505,21 +505,29 @@ __ParseEthernetHeader(
     IsLLC = FALSE;
 
     TypeOrLength = NTOHS(Header->Untagged.TypeOrLength);
-    if (TypeOrLength == ETHERTYPE_TPID) {
-        ULONG Extra;
+    if (TypeOrLength == ETHERTYPE_STPID) {
+        // An 802.1ad service tag may be followed by an 802.1Q tag
+        if (!Pullup(Argument,
+                    StartVa + Offset,
+                    Payload,
+                    sizeof (ETHERNET_TAG)))
+            goto fail2;
+
+        Offset += sizeof (ETHERNET_TAG);
 
-        Extra = sizeof (ETHERNET_TAGGED_HEADER) -
-                sizeof (ETHERNET_UNTAGGED_HEADER);
+        TypeOrLength = NTOHS(*(PUSHORT)(StartVa + Offset - sizeof (USHORT)));
+    }
 
+    if (TypeOrLength == ETHERTYPE_TPID) {
         if (!Pullup(Argument,
                     StartVa + Offset,
                     Payload,
-                    Extra))
-            goto fail2;
+                    sizeof (ETHERNET_TAG)))
+            goto fail3;
 
-        Offset += Extra;
+        Offset += sizeof (ETHERNET_TAG);
 
-        TypeOrLength = NTOHS(Header->Tagged.TypeOrLength);
+        TypeOrLength = NTOHS(*(PUSHORT)(StartVa + Offset - sizeof (USHORT)));
     }
 
     if (TypeOrLength <= ETHERNET_MTU)
@@ -563,6 +571,7 @@ __ParseEthernetHeader(
 
     return status;
 
+fail3:
 fail2:
 fail1:
     Info->EthernetHeader.Offset = 0;
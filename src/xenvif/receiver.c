@@ -53,6 +53,7 @@
 #include "vif.h"
 #include "receiver.h"
 #include "thread.h"
+#include "tracelog.h"
 #include "driver.h"
 #include "dbg_print.h"
 #include "assert.h"
@@ -72,10 +73,38 @@ typedef struct _XENVIF_RECEIVER_HASH {
     ULONG                           Types;
 } XENVIF_RECEIVER_HASH, *PXENVIF_RECEIVER_HASH;
 
+typedef enum _XENVIF_RECEIVER_MODE {
+    XENVIF_RECEIVER_MODE_SPLIT = 0,     // Poll in a DPC, indicate from a threaded DPC
+    XENVIF_RECEIVER_MODE_INLINE,        // Poll and indicate in a DPC
+    XENVIF_RECEIVER_MODE_THREADED,      // Poll and indicate in a threaded DPC
+    XENVIF_RECEIVER_MODE_WORKER,        // Poll and indicate in a dedicated thread
+    XENVIF_RECEIVER_MODE_COUNT
+} XENVIF_RECEIVER_MODE, *PXENVIF_RECEIVER_MODE;
+
 #define XENVIF_RECEIVER_RING_SIZE   (__CONST_RING_SIZE(netif_rx, PAGE_SIZE))
 
 #define XENVIF_RECEIVER_MAXIMUM_FRAGMENT_ID (XENVIF_RECEIVER_RING_SIZE - 1)
 
+// Maximum number of packets handed to the VIF in one indication
+#define XENVIF_RECEIVER_BATCH_SIZE  16
+
+// Maximum number of slots reserved, granted and posted together
+#define XENVIF_RECEIVER_FILL_BATCH_SIZE 32
+
+// Bounds on the size of a header split buffer
+#define XENVIF_RECEIVER_MINIMUM_HEADER_SIZE 128
+#define XENVIF_RECEIVER_MAXIMUM_HEADER_SIZE (PAGE_SIZE / 2)
+
+#define XENVIF_RECEIVER_CACHE_LINE_SIZE 64
+
+// Header split buffers are carved from whole pages so none can cross a
+// page boundary. Each buffer holds a reference on its page, as does the
+// ring while it is still carving from it.
+typedef struct _XENVIF_RECEIVER_HEADER_PAGE {
+    PMDL    Mdl;
+    LONG    References;
+} XENVIF_RECEIVER_HEADER_PAGE, *PXENVIF_RECEIVER_HEADER_PAGE;
+
 typedef struct _XENVIF_RECEIVER_RING {
     PXENVIF_RECEIVER            Receiver;
     ULONG                       Index;
@@ -83,6 +112,7 @@ typedef struct _XENVIF_RECEIVER_RING {
     KSPIN_LOCK                  Lock;
     PXENBUS_CACHE               PacketCache;
     PXENBUS_CACHE               FragmentCache;
+    PXENBUS_CACHE               HeaderCache;
     PXENBUS_GNTTAB_CACHE        GnttabCache;
     PMDL                        Mdl;
     netif_rx_front_ring_t       Front;
@@ -102,12 +132,48 @@ typedef struct _XENVIF_RECEIVER_RING {
     XENVIF_VIF_OFFLOAD_OPTIONS  OffloadOptions;
     ULONG                       BackfillSize;
     PXENBUS_DEBUG_CALLBACK      DebugCallback;
-    PXENVIF_THREAD              WatchdogThread;
+    RING_IDX                    WatchdogRspProd;
+    RING_IDX                    WatchdogRspCons;
     PLIST_ENTRY                 PacketQueue;
     KDPC                        QueueDpc;
     ULONG                       QueueDpcs;
     LIST_ENTRY                  PacketComplete;
     XENVIF_RECEIVER_HASH        Hash;
+    BOOLEAN                     Rebalancing;
+    ULONG                       HashLoad[XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE];
+    PXENVIF_TRACE_LOG           TraceLog;
+    ULONGLONG                   Latency[XENVIF_VIF_LATENCY_BUCKET_COUNT];
+    XENVIF_RECEIVER_MODE        Mode;
+    PXENVIF_THREAD              WorkerThread;
+    LONGLONG                    Signalled;
+    ULONG                       Runs;
+    ULONGLONG                   DispatchTime;
+    ULONGLONG                   RunTime;
+    ULONGLONG                   PacketsUntagged;
+    ULONGLONG                   PacketsTagged;
+    ULONGLONG                   PacketsDoubleTagged;
+    ULONGLONG                   HeadersSplit;
+    ULONGLONG                   HeadersExpanded;
+    KSPIN_LOCK                  HeaderLock;
+    PXENVIF_RECEIVER_HEADER_PAGE    HeaderPage;
+    ULONG                       HeaderPageOffset;
+    struct _XENVIF_RECEIVER_PACKET  *Recycled;
+    ULONGLONG                   RecycleHits;
+    ULONGLONG                   RecycleMisses;
+    ULONGLONG                   ChecksumsVerified;
+    ULONGLONG                   ChecksumsCompleted;
+    ULONGLONG                   ChecksumsSkipped;
+    // Loans are made by the ring but returned from any CPU, and pages
+    // are recycled from any CPU but only consumed by the ring, so pad
+    // each of these onto a cache line of its own. The ring is not
+    // allocated cache aligned so the padding is a full line.
+    UCHAR                       __Pad0[XENVIF_RECEIVER_CACHE_LINE_SIZE];
+    LONG                        Loaned;
+    UCHAR                       __Pad1[XENVIF_RECEIVER_CACHE_LINE_SIZE];
+    LONG                        Returned;
+    UCHAR                       __Pad2[XENVIF_RECEIVER_CACHE_LINE_SIZE];
+    PVOID                       RecycleStack;
+    LONG                        RecycleCount;
 } XENVIF_RECEIVER_RING, *PXENVIF_RECEIVER_RING;
 
 typedef struct _XENVIF_RECEIVER_PACKET {
@@ -120,19 +186,31 @@ typedef struct _XENVIF_RECEIVER_PACKET {
     USHORT                          MaximumSegmentSize;
     USHORT                          TagControlInformation;
     PXENVIF_RECEIVER_RING           Ring;
+    LONGLONG                        ResponseTime;
     MDL                             Mdl;
     PFN_NUMBER                      __Pfn;
     PMDL                            SystemMdl;
+    PUCHAR                          Buffer;     // Header split only
+    PXENVIF_RECEIVER_HEADER_PAGE    HeaderPage; // Header split only
+    ULONG                           Size;
+    struct _XENVIF_RECEIVER_PACKET  *RecycleNext;
 } XENVIF_RECEIVER_PACKET, *PXENVIF_RECEIVER_PACKET;
 
+// Argument to ReceiverRingPullupHeader. Data below FilledVa is already
+// in place, having been pulled up by an earlier parse.
+typedef struct _XENVIF_RECEIVER_PULLUP {
+    PXENVIF_RECEIVER_PACKET Packet;
+    PUCHAR                  FilledVa;
+    BOOLEAN                 Overflow;
+} XENVIF_RECEIVER_PULLUP, *PXENVIF_RECEIVER_PULLUP;
+
 struct _XENVIF_RECEIVER {
     PXENVIF_FRONTEND                Frontend;
     XENBUS_CACHE_INTERFACE          CacheInterface;
     XENBUS_GNTTAB_INTERFACE         GnttabInterface;
     XENBUS_EVTCHN_INTERFACE         EvtchnInterface;
     PXENVIF_RECEIVER_RING           *Ring;
-    LONG                            Loaned;
-    LONG                            Returned;
+    LONG                            Waiting;
     KEVENT                          Event;
     ULONG                           CalculateChecksums;
     ULONG                           AllowGsoPackets;
@@ -140,6 +218,11 @@ struct _XENVIF_RECEIVER {
     ULONG                           DisableIpVersion6Gso;
     ULONG                           IpAlignOffset;
     ULONG                           AlwaysPullup;
+    ULONG                           HeaderSplitSize;
+    ULONG                           FillThreshold;
+    ULONG                           TraceLogSize;
+    XENVIF_RECEIVER_MODE            Mode;
+    LARGE_INTEGER                   Frequency;
     XENBUS_STORE_INTERFACE          StoreInterface;
     XENBUS_DEBUG_INTERFACE          DebugInterface;
     PXENBUS_DEBUG_CALLBACK          DebugCallback;
@@ -176,11 +259,23 @@ __ReceiverPacketMdlInit(
 #pragma warning(disable:28145) // modifying struct MDL
 
     Packet->Mdl.Size = sizeof (MDL) + sizeof (PFN_NUMBER);
-    Packet->Mdl.MdlFlags = Mdl->MdlFlags;
 
-    ASSERT(Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
-    Packet->Mdl.StartVa = Mdl->StartVa;
-    Packet->Mdl.MappedSystemVa = Mdl->MappedSystemVa;
+    if (Packet->Buffer != NULL) {
+        // Header buffers lie within the page described by SystemMdl
+        Packet->Mdl.MdlFlags = Mdl->MdlFlags;
+
+        ASSERT(Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+        ASSERT3P(PAGE_ALIGN(Packet->Buffer), ==, Mdl->MappedSystemVa);
+        Packet->Mdl.StartVa = Mdl->StartVa;
+        Packet->Mdl.ByteOffset = BYTE_OFFSET(Packet->Buffer);
+        Packet->Mdl.MappedSystemVa = Packet->Buffer;
+    } else {
+        Packet->Mdl.MdlFlags = Mdl->MdlFlags;
+
+        ASSERT(Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+        Packet->Mdl.StartVa = Mdl->StartVa;
+        Packet->Mdl.MappedSystemVa = Mdl->MappedSystemVa;
+    }
 
 #pragma warning(pop)
 }
@@ -198,13 +293,15 @@ ReceiverPacketCtor(
 
     ASSERT(IsZeroMemory(Packet, sizeof (XENVIF_RECEIVER_PACKET)));
 
-    Mdl = __AllocatePage();
+    Mdl = __AllocatePageOnNode(FrontendGetRingNode(Ring->Receiver->Frontend,
+                                                   Ring->Index));
 
     status = STATUS_NO_MEMORY;
     if (Mdl == NULL)
         goto fail1;
 
     Packet->SystemMdl = Mdl;
+    Packet->Size = PAGE_SIZE;
 
     __ReceiverPacketMdlInit(Packet);
 
@@ -235,6 +332,8 @@ ReceiverPacketDtor(
     ASSERT3P(Packet->Ring, ==, Ring);
     Packet->Ring = NULL;
 
+    Packet->Size = 0;
+
     Mdl = Packet->SystemMdl;
     Packet->SystemMdl = NULL;
 
@@ -245,6 +344,127 @@ ReceiverPacketDtor(
     ASSERT(IsZeroMemory(Packet, sizeof (XENVIF_RECEIVER_PACKET)));
 }
 
+static FORCEINLINE VOID
+__ReceiverHeaderPageRelease(
+    IN  PXENVIF_RECEIVER_HEADER_PAGE    Page
+    )
+{
+    if (InterlockedDecrement(&Page->References) != 0)
+        return;
+
+    __FreePage(Page->Mdl);
+    Page->Mdl = NULL;
+
+    ASSERT(IsZeroMemory(Page, sizeof (XENVIF_RECEIVER_HEADER_PAGE)));
+    __ReceiverFree(Page);
+}
+
+static NTSTATUS
+ReceiverHeaderCtor(
+    IN  PVOID                       Argument,
+    IN  PVOID                       Object
+    )
+{
+    PXENVIF_RECEIVER_RING           Ring = Argument;
+    PXENVIF_RECEIVER                Receiver;
+    PXENVIF_RECEIVER_PACKET         Packet = Object;
+    PXENVIF_RECEIVER_HEADER_PAGE    Page;
+    KIRQL                           Irql;
+    NTSTATUS                        status;
+
+    Receiver = Ring->Receiver;
+
+    ASSERT(IsZeroMemory(Packet, sizeof (XENVIF_RECEIVER_PACKET)));
+
+    KeAcquireSpinLock(&Ring->HeaderLock, &Irql);
+
+    Page = Ring->HeaderPage;
+
+    if (Page == NULL ||
+        Ring->HeaderPageOffset + Receiver->HeaderSplitSize > PAGE_SIZE) {
+        if (Page != NULL) {
+            Ring->HeaderPage = NULL;
+            __ReceiverHeaderPageRelease(Page);
+        }
+
+        Page = __ReceiverAllocate(sizeof (XENVIF_RECEIVER_HEADER_PAGE));
+
+        status = STATUS_NO_MEMORY;
+        if (Page == NULL)
+            goto fail1;
+
+        Page->Mdl = __AllocatePageOnNode(FrontendGetRingNode(Receiver->Frontend,
+                                                             Ring->Index));
+        if (Page->Mdl == NULL)
+            goto fail2;
+
+        Page->References = 1;
+
+        Ring->HeaderPage = Page;
+        Ring->HeaderPageOffset = 0;
+    }
+
+    Packet->Buffer = (PUCHAR)Page->Mdl->MappedSystemVa + Ring->HeaderPageOffset;
+    Ring->HeaderPageOffset += Receiver->HeaderSplitSize;
+
+    Packet->HeaderPage = Page;
+    (VOID) InterlockedIncrement(&Page->References);
+
+    KeReleaseSpinLock(&Ring->HeaderLock, Irql);
+
+    Packet->SystemMdl = Page->Mdl;
+    Packet->Size = Receiver->HeaderSplitSize;
+
+    __ReceiverPacketMdlInit(Packet);
+
+    Packet->__Pfn = MmGetMdlPfnArray(Page->Mdl)[0];
+
+    Packet->Ring = Ring;
+
+    return STATUS_SUCCESS;
+
+fail2:
+    Error("fail2\n");
+
+    __ReceiverFree(Page);
+
+fail1:
+    KeReleaseSpinLock(&Ring->HeaderLock, Irql);
+
+    Error("fail1 (%08x)\n", status);
+
+    ASSERT(IsZeroMemory(Packet, sizeof (XENVIF_RECEIVER_PACKET)));
+
+    return status;
+}
+
+static VOID
+ReceiverHeaderDtor(
+    IN  PVOID                       Argument,
+    IN  PVOID                       Object
+    )
+{
+    PXENVIF_RECEIVER_RING           Ring = Argument;
+    PXENVIF_RECEIVER_PACKET         Packet = Object;
+    PXENVIF_RECEIVER_HEADER_PAGE    Page;
+
+    ASSERT3P(Packet->Ring, ==, Ring);
+    Packet->Ring = NULL;
+
+    Packet->Size = 0;
+    Packet->SystemMdl = NULL;
+    Packet->Buffer = NULL;
+
+    Page = Packet->HeaderPage;
+    Packet->HeaderPage = NULL;
+
+    __ReceiverHeaderPageRelease(Page);
+
+    RtlZeroMemory(&Packet->Mdl, sizeof (MDL) + sizeof (PFN_NUMBER));
+
+    ASSERT(IsZeroMemory(Packet, sizeof (XENVIF_RECEIVER_PACKET)));
+}
+
 static FORCEINLINE PXENVIF_RECEIVER_PACKET
 __ReceiverRingGetPacket(
     IN  PXENVIF_RECEIVER_RING   Ring,
@@ -269,6 +489,61 @@ __ReceiverRingGetPacket(
     return Packet;
 }
 
+static FORCEINLINE BOOLEAN
+__ReceiverRingRecyclePacket(
+    IN  PXENVIF_RECEIVER_RING   Ring,
+    IN  PXENVIF_RECEIVER_PACKET Packet
+    )
+{
+    PXENVIF_RECEIVER_PACKET     Old;
+
+    ASSERT3P(Packet->RecycleNext, ==, NULL);
+
+    // There is no point holding more pages than the ring can use
+    if (InterlockedIncrement(&Ring->RecycleCount) > XENVIF_RECEIVER_RING_SIZE) {
+        (VOID) InterlockedDecrement(&Ring->RecycleCount);
+        return FALSE;
+    }
+
+    do {
+        Old = Ring->RecycleStack;
+
+        Packet->RecycleNext = Old;
+    } while (InterlockedCompareExchangePointer(&Ring->RecycleStack, (PVOID)Packet, (PVOID)Old) != Old);
+
+    return TRUE;
+}
+
+// Only ReceiverRingFill (and teardown) consume recycled pages, so the
+// stack is only ever popped by grabbing all of it.
+static FORCEINLINE PXENVIF_RECEIVER_PACKET
+__ReceiverRingGetRecycledPacket(
+    IN  PXENVIF_RECEIVER_RING   Ring
+    )
+{
+    PXENVIF_RECEIVER_PACKET     Packet;
+
+    Packet = Ring->Recycled;
+    if (Packet == NULL) {
+        Packet = InterlockedExchangePointer(&Ring->RecycleStack, NULL);
+        if (Packet == NULL) {
+            Ring->RecycleMisses++;
+            return NULL;
+        }
+    }
+
+    Ring->Recycled = Packet->RecycleNext;
+    Packet->RecycleNext = NULL;
+
+    (VOID) InterlockedDecrement(&Ring->RecycleCount);
+    Ring->RecycleHits++;
+
+    ASSERT(IsZeroMemory(&Packet->Info, sizeof (XENVIF_PACKET_INFO)));
+    ASSERT3P(Packet->Ring, ==, Ring);
+
+    return Packet;
+}
+
 static FORCEINLINE VOID
 __ReceiverRingPutPacket(
     IN  PXENVIF_RECEIVER_RING   Ring,
@@ -290,21 +565,68 @@ __ReceiverRingPutPacket(
     Packet->Flags.Value = 0;
     Packet->MaximumSegmentSize = 0;
     Packet->TagControlInformation = 0;
+    Packet->ResponseTime = 0;
 
     RtlZeroMemory(&Packet->Info, sizeof (XENVIF_PACKET_INFO));
     RtlZeroMemory(&Packet->Hash, sizeof (XENVIF_PACKET_HASH));
 
+    if (Packet->Buffer == NULL) {
+        // A recycled page only needs the fields that the receive path
+        // changes restoring
+        ASSERT(Packet->Mdl.MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+
+        Packet->Mdl.Next = NULL;
+        Packet->Mdl.ByteOffset = 0;
+        Packet->Mdl.ByteCount = 0;
+        Packet->Mdl.MappedSystemVa = Packet->Mdl.StartVa;
+
+        if (__ReceiverRingRecyclePacket(Ring, Packet))
+            return;
+    }
+
     RtlZeroMemory(&Packet->Mdl, sizeof (MDL));
 
     __ReceiverPacketMdlInit(Packet);
 
     XENBUS_CACHE(Put,
                  &Receiver->CacheInterface,
-                 Ring->PacketCache,
+                 (Packet->Buffer != NULL) ? Ring->HeaderCache : Ring->PacketCache,
                  Packet,
                  Locked);
 }
 
+// Get a packet to hold the parsed headers. This is a small header
+// buffer if header split is enabled and one is available, otherwise a
+// full page.
+static FORCEINLINE PXENVIF_RECEIVER_PACKET
+__ReceiverRingGetHeader(
+    IN  PXENVIF_RECEIVER_RING   Ring
+    )
+{
+    PXENVIF_RECEIVER            Receiver;
+    PXENVIF_RECEIVER_PACKET     Packet;
+
+    Receiver = Ring->Receiver;
+
+    if (Ring->HeaderCache == NULL)
+        return __ReceiverRingGetPacket(Ring, FALSE);
+
+    Packet = XENBUS_CACHE(Get,
+                          &Receiver->CacheInterface,
+                          Ring->HeaderCache,
+                          FALSE);
+    if (Packet == NULL)
+        return __ReceiverRingGetPacket(Ring, FALSE);
+
+    ASSERT(IsZeroMemory(&Packet->Info, sizeof (XENVIF_PACKET_INFO)));
+    ASSERT3P(Packet->Ring, ==, Ring);
+    ASSERT(Packet->Buffer != NULL);
+
+    Ring->HeadersSplit++;
+
+    return Packet;
+}
+
 static FORCEINLINE PMDL
 __ReceiverRingGetMdl(
     IN  PXENVIF_RECEIVER_RING   Ring,
@@ -399,6 +721,32 @@ __ReceiverRingPutFragment(
                  TRUE);
 }
 
+// Slide the MAC addresses up over the tag using a fixed-size move.
+// All three words are loaded before any is stored so the overlap
+// does not matter.
+static FORCEINLINE VOID
+__ReceiverRingStripTag(
+    IN  PETHERNET_HEADER    EthernetHeader
+    )
+{
+    ULONG UNALIGNED         *Source;
+    ULONG UNALIGNED         *Destination;
+    ULONG                   Word[3];
+
+    C_ASSERT(FIELD_OFFSET(ETHERNET_TAGGED_HEADER, Tag) == sizeof (Word));
+
+    Source = (ULONG UNALIGNED *)EthernetHeader;
+    Destination = (ULONG UNALIGNED *)((PUCHAR)EthernetHeader + sizeof (ETHERNET_TAG));
+
+    Word[0] = Source[0];
+    Word[1] = Source[1];
+    Word[2] = Source[2];
+
+    Destination[0] = Word[0];
+    Destination[1] = Word[1];
+    Destination[2] = Word[2];
+}
+
 static DECLSPEC_NOINLINE VOID
 ReceiverRingProcessTag(
     IN  PXENVIF_RECEIVER_RING    Ring,
@@ -409,7 +757,6 @@ ReceiverRingProcessTag(
     ULONG                        PayloadLength;
     PUCHAR                       BaseVa;
     PETHERNET_HEADER             EthernetHeader;
-    ULONG                        Offset;
 
     Info = &Packet->Info;
 
@@ -424,16 +771,26 @@ ReceiverRingProcessTag(
     ASSERT(Info->EthernetHeader.Length != 0);
     EthernetHeader = (PETHERNET_HEADER)(BaseVa + Info->EthernetHeader.Offset);
 
-    if (!ETHERNET_HEADER_IS_TAGGED(EthernetHeader) ||
-        Ring->OffloadOptions.OffloadTagManipulation == 0)
+    // A double tagged (802.1ad) frame cannot be described by a single
+    // tag control information value so it is always passed up in-band
+    if (ETHERNET_HEADER_IS_SERVICE_TAGGED(EthernetHeader)) {
+        Ring->PacketsDoubleTagged++;
+        return;
+    }
+
+    if (!ETHERNET_HEADER_IS_TAGGED(EthernetHeader)) {
+        Ring->PacketsUntagged++;
+        return;
+    }
+
+    Ring->PacketsTagged++;
+
+    if (Ring->OffloadOptions.OffloadTagManipulation == 0)
         return;
 
     Packet->TagControlInformation = NTOHS(EthernetHeader->Tagged.Tag.ControlInformation);
 
-    Offset = FIELD_OFFSET(ETHERNET_TAGGED_HEADER, Tag);
-    RtlMoveMemory((PUCHAR)EthernetHeader + sizeof (ETHERNET_TAG),
-                  (PUCHAR)EthernetHeader,
-                  Offset);
+    __ReceiverRingStripTag(EthernetHeader);
 
     // Fix up the packet information
     BaseVa += sizeof (ETHERNET_TAG);
@@ -469,6 +826,35 @@ ReceiverRingProcessTag(
     ASSERT3U(PayloadLength, ==, Packet->Length - Info->Length);
 }
 
+// The checksum field is only incomplete if the backend set
+// NETRXF_csum_blank. A packet that is merely NETRXF_data_validated
+// already carries the correct value, so there is nothing to fill in.
+static FORCEINLINE BOOLEAN
+__ReceiverRingNeedChecksumValue(
+    IN  PXENVIF_RECEIVER_RING   Ring,
+    IN  uint16_t                flags
+    )
+{
+    PXENVIF_RECEIVER            Receiver;
+
+    Receiver = Ring->Receiver;
+
+    if (!Ring->OffloadOptions.NeedChecksumValue &&
+        Receiver->CalculateChecksums == 0)
+        return FALSE;
+
+    if (~flags & NETRXF_data_validated)
+        return FALSE;
+
+    if (~flags & NETRXF_csum_blank) {
+        Ring->ChecksumsSkipped++;
+        return FALSE;
+    }
+
+    Ring->ChecksumsCompleted++;
+    return TRUE;
+}
+
 static DECLSPEC_NOINLINE VOID
 ReceiverRingProcessChecksum(
     IN  PXENVIF_RECEIVER_RING   Ring,
@@ -567,6 +953,8 @@ ReceiverRingProcessChecksum(
                 Calculated = ChecksumPseudoHeader(BaseVa, Info);
                 Calculated = ChecksumTcpPacket(BaseVa, Info, Calculated, &Payload);
 
+                Ring->ChecksumsVerified++;
+
                 if (ChecksumVerify(Calculated, Embedded))
                     Packet->Flags.TcpChecksumSucceeded = 1;
                 else
@@ -576,9 +964,7 @@ ReceiverRingProcessChecksum(
             Packet->Flags.TcpChecksumNotValidated = 1;
         }
         
-        if ((Ring->OffloadOptions.NeedChecksumValue ||
-             Receiver->CalculateChecksums != 0) &&
-            (flags & NETRXF_data_validated)) {
+        if (__ReceiverRingNeedChecksumValue(Ring, flags)) {
             USHORT  Calculated;
 
             Calculated = ChecksumPseudoHeader(BaseVa, Info);
@@ -618,6 +1004,8 @@ ReceiverRingProcessChecksum(
                     Calculated = ChecksumPseudoHeader(BaseVa, Info);
                     Calculated = ChecksumUdpPacket(BaseVa, Info, Calculated, &Payload);
 
+                    Ring->ChecksumsVerified++;
+
                     if (ChecksumVerify(Calculated, Embedded))
                         Packet->Flags.UdpChecksumSucceeded = 1;
                     else
@@ -628,9 +1016,7 @@ ReceiverRingProcessChecksum(
             Packet->Flags.UdpChecksumNotValidated = 1;
         }
 
-        if ((Ring->OffloadOptions.NeedChecksumValue ||
-             Receiver->CalculateChecksums != 0) &&
-            (flags & NETRXF_data_validated)) {
+        if (__ReceiverRingNeedChecksumValue(Ring, flags)) {
             USHORT  Calculated;
 
             Calculated = ChecksumPseudoHeader(BaseVa, Info);
@@ -699,6 +1085,43 @@ fail1:
     return FALSE;
 }
 
+// Pull headers into a packet, failing if they would overrun its buffer
+static BOOLEAN
+ReceiverRingPullupHeader(
+    IN      PVOID                   Argument,
+    IN      PUCHAR                  DestinationVa,
+    IN OUT  PXENVIF_PACKET_PAYLOAD  Payload,
+    IN      ULONG                   Length
+    )
+{
+    PXENVIF_RECEIVER_PULLUP         Pullup = Argument;
+    PXENVIF_RECEIVER_PACKET         Packet = Pullup->Packet;
+    PUCHAR                          BaseVa;
+
+    ASSERT(Packet->Mdl.MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+    BaseVa = Packet->Mdl.MappedSystemVa;
+    ASSERT(BaseVa != NULL);
+
+    if (DestinationVa < Pullup->FilledVa) {
+        ULONG   Filled;
+
+        Filled = (ULONG)__min(Length, (ULONG_PTR)(Pullup->FilledVa - DestinationVa));
+
+        DestinationVa += Filled;
+        Length -= Filled;
+
+        if (Length == 0)
+            return TRUE;
+    }
+
+    if (DestinationVa + Length > BaseVa + Packet->Size) {
+        Pullup->Overflow = TRUE;
+        return FALSE;
+    }
+
+    return ReceiverRingPullup(Packet->Ring, DestinationVa, Payload, Length);
+}
+
 static FORCEINLINE VOID
 __ReceiverRingPullupPacket(
     IN  PXENVIF_RECEIVER_RING   Ring,
@@ -717,7 +1140,7 @@ __ReceiverRingPullupPacket(
     Payload.Offset = 0;
     Payload.Length = Packet->Length - Packet->Mdl.ByteCount;
 
-    Length = __min(Payload.Length, PAGE_SIZE - Packet->Mdl.ByteCount);
+    Length = __min(Payload.Length, Packet->Size - Packet->Mdl.ByteCount);
 
     Packet->Mdl.Next = NULL;
 
@@ -730,6 +1153,43 @@ __ReceiverRingPullupPacket(
     }
 }
 
+// Move headers out of a header split buffer into a full page so that
+// the whole packet can be pulled up behind them
+static FORCEINLINE PXENVIF_RECEIVER_PACKET
+__ReceiverRingExpandHeader(
+    IN  PXENVIF_RECEIVER_RING   Ring,
+    IN  PXENVIF_RECEIVER_PACKET Packet
+    )
+{
+    PXENVIF_RECEIVER_PACKET     New;
+
+    ASSERT(Packet->Buffer != NULL);
+
+    New = __ReceiverRingGetPacket(Ring, FALSE);
+    if (New == NULL)
+        return NULL;
+
+    RtlCopyMemory(New,
+                  Packet,
+                  FIELD_OFFSET(XENVIF_RECEIVER_PACKET, Mdl));
+
+    ASSERT(Packet->Mdl.MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+    ASSERT(New->Mdl.MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+    RtlCopyMemory(New->Mdl.MappedSystemVa,
+                  Packet->Mdl.MappedSystemVa,
+                  Packet->Mdl.ByteCount);
+
+    New->Mdl.ByteCount = Packet->Mdl.ByteCount;
+    New->Mdl.Next = Packet->Mdl.Next;
+    Packet->Mdl.Next = NULL;
+
+    __ReceiverRingPutPacket(Ring, Packet, FALSE);
+
+    Ring->HeadersExpanded++;
+
+    return New;
+}
+
 static FORCEINLINE PXENVIF_RECEIVER_PACKET
 __ReceiverRingBuildSegment(
     IN  PXENVIF_RECEIVER_RING   Ring,
@@ -793,12 +1253,25 @@ __ReceiverRingBuildSegment(
     if (IpHeader->Version == 4) {
         USHORT  PacketID;
         USHORT  PacketLength;
+        USHORT  Checksum;
+
+        Checksum = IpHeader->Version4.Checksum;
+
+        PacketID = IpHeader->Version4.PacketID;
+        IpHeader->Version4.PacketID = HTONS(NTOHS(PacketID) + 1);
 
-        PacketID = NTOHS(IpHeader->Version4.PacketID);
-        IpHeader->Version4.PacketID = HTONS(PacketID + 1);
+        Checksum = ChecksumUpdateUshort(Checksum,
+                                        PacketID,
+                                        IpHeader->Version4.PacketID);
 
         PacketLength = NTOHS(IpHeader->Version4.PacketLength);
         IpHeader->Version4.PacketLength = HTONS(PacketLength - (USHORT)SegmentSize);
+
+        Checksum = ChecksumUpdateLength(Checksum,
+                                        PacketLength,
+                                        PacketLength - (USHORT)SegmentSize);
+
+        IpHeader->Version4.Checksum = Checksum;
     } else {
         USHORT  PayloadLength;
 
@@ -826,8 +1299,12 @@ __ReceiverRingBuildSegment(
                        Info->TcpOptions.Length + 
                        SegmentSize;
 
+        // The header was copied with a valid checksum so it only needs
+        // adjusting for the change in length
+        IpHeader->Version4.Checksum = ChecksumUpdateLength(IpHeader->Version4.Checksum,
+                                                           NTOHS(IpHeader->Version4.PacketLength),
+                                                           (USHORT)PacketLength);
         IpHeader->Version4.PacketLength = HTONS((USHORT)PacketLength);
-        IpHeader->Version4.Checksum = ChecksumIpVersion4Header(BaseVa, Info);
     } else {
         ULONG   PayloadLength;
 
@@ -985,6 +1462,10 @@ ReceiverRingProcessLargePacket(
                  Info->TcpHeader.Length -
                  Info->IpOptions.Length - 
                  Info->IpHeader.Length;
+
+        // Calculate the header checksum once here. Each segment (and
+        // the remainder) then only needs an incremental update.
+        IpHeader->Version4.Checksum = ChecksumIpVersion4Header(InfoVa, Info);
     } else {
         USHORT  PayloadLength;
 
@@ -1040,8 +1521,6 @@ ReceiverRingProcessLargePacket(
                      Info->TcpHeader.Length -
                      Info->IpOptions.Length - 
                      Info->IpHeader.Length);
-
-            IpHeader->Version4.Checksum = ChecksumIpVersion4Header(InfoVa, Info);
         } else {
             USHORT  PayloadLength;
 
@@ -1136,9 +1615,21 @@ ReceiverRingProcessStandardPacket(
     // in different fragments. All these tests seem to use IPX packets
     // and, in practice, little else uses LLC so pull up all LLC
     // packets into a single fragment.
-    if (Info->LLCSnapHeader.Length != 0 || Receiver->AlwaysPullup != 0)
+    if (Info->LLCSnapHeader.Length != 0 || Receiver->AlwaysPullup != 0) {
+        if (Packet->Buffer != NULL) {
+            PXENVIF_RECEIVER_PACKET New;
+
+            New = __ReceiverRingExpandHeader(Ring, Packet);
+
+            status = STATUS_NO_MEMORY;
+            if (New == NULL)
+                goto fail2;
+
+            Packet = New;
+        }
+
         __ReceiverRingPullupPacket(Ring, Packet);
-    else if (Payload.Mdl != NULL && Payload.Mdl->ByteOffset < Ring->BackfillSize) {
+    } else if (Payload.Mdl != NULL && Payload.Mdl->ByteOffset < Ring->BackfillSize) {
         PMDL    Mdl;
         PUCHAR  BaseVa;
 
@@ -1215,6 +1706,7 @@ ReceiverRingProcessPacket(
     ULONG                           Length;
     XENVIF_PACKET_PAYLOAD           Payload;
     PXENVIF_RECEIVER_PACKET         New;
+    XENVIF_RECEIVER_PULLUP          Pullup;
     PXENVIF_PACKET_INFO             Info;
     PUCHAR                          BaseVa;
     PETHERNET_HEADER                EthernetHeader;
@@ -1236,7 +1728,7 @@ ReceiverRingProcessPacket(
     // Get a new packet structure that will just contain the header after
     // parsing. We need to preserve metadata from the original.
 
-    New = __ReceiverRingGetPacket(Ring, FALSE);
+    New = __ReceiverRingGetHeader(Ring);
 
     status = STATUS_NO_MEMORY;
     if (New == NULL) {
@@ -1265,7 +1757,52 @@ ReceiverRingProcessPacket(
 
     Info = &Packet->Info;
 
-    status = ParsePacket(BaseVa, ReceiverRingPullup, Ring, &Payload, Info);
+    Pullup.Packet = Packet;
+    Pullup.FilledVa = BaseVa;
+    Pullup.Overflow = FALSE;
+
+    status = ParsePacket(BaseVa, ReceiverRingPullupHeader, &Pullup, &Payload, Info);
+
+    // If the headers did not fit in a header split buffer then move
+    // what has been pulled up so far into a full page and parse again
+    if (!NT_SUCCESS(status) && Pullup.Overflow) {
+        ULONG   Filled;
+
+        ASSERT(Packet->Buffer != NULL);
+
+        Filled = Length - Payload.Length;
+        Packet->Mdl.ByteCount += Filled;
+
+        New = __ReceiverRingExpandHeader(Ring, Packet);
+
+        status = STATUS_NO_MEMORY;
+        if (New == NULL) {
+            FrontendIncrementStatistic(Frontend,
+                                       XENVIF_RECEIVER_FRONTEND_ERRORS,
+                                       1);
+            goto fail2;
+        }
+
+        Packet = New;
+
+        ASSERT(Packet->Mdl.MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+        BaseVa = Packet->Mdl.MappedSystemVa;
+        ASSERT(BaseVa != NULL);
+
+        BaseVa += Packet->Offset;
+
+        Packet->Mdl.ByteCount = Packet->Offset;
+
+        Info = &Packet->Info;
+        RtlZeroMemory(Info, sizeof (XENVIF_PACKET_INFO));
+
+        Pullup.Packet = Packet;
+        Pullup.FilledVa = BaseVa + Filled;
+        Pullup.Overflow = FALSE;
+
+        status = ParsePacket(BaseVa, ReceiverRingPullupHeader, &Pullup, &Payload, Info);
+    }
+
     if (!NT_SUCCESS(status)) {
         FrontendIncrementStatistic(Frontend,
                                    XENVIF_RECEIVER_FRONTEND_ERRORS,
@@ -1332,11 +1869,14 @@ __ReceiverRingSwizzle(
     IN  PXENVIF_RECEIVER_RING   Ring
     )
 {
-    PXENVIF_RECEIVER            Receiver;
-    PXENVIF_FRONTEND            Frontend;
-    PXENVIF_VIF_CONTEXT         Context;
-    LIST_ENTRY                  List;
-    PLIST_ENTRY                 ListEntry;
+    PXENVIF_RECEIVER                    Receiver;
+    PXENVIF_FRONTEND                    Frontend;
+    PXENVIF_VIF_CONTEXT                 Context;
+    LIST_ENTRY                          List;
+    PLIST_ENTRY                         ListEntry;
+    LONGLONG                            Now;
+    XENVIF_RECEIVER_PACKET_DESCRIPTOR   Batch[XENVIF_RECEIVER_BATCH_SIZE];
+    ULONG                               Count;
 
     Receiver = Ring->Receiver;
     Frontend = Receiver->Frontend;
@@ -1373,13 +1913,17 @@ __ReceiverRingSwizzle(
         ReceiverRingProcessPacket(Ring, Packet);
     }
 
+    Now = KeQueryPerformanceCounter(NULL).QuadPart;
+    Count = 0;
+
     while (!IsListEmpty(&Ring->PacketComplete)) {
-        PXENVIF_RECEIVER_PACKET Packet;
-        PXENVIF_PACKET_INFO     Info;
-        PUCHAR                  BaseVa;
-        PETHERNET_HEADER        EthernetHeader;
-        PETHERNET_ADDRESS       DestinationAddress;
-        ETHERNET_ADDRESS_TYPE   Type;
+        PXENVIF_RECEIVER_PACKET             Packet;
+        PXENVIF_RECEIVER_PACKET_DESCRIPTOR  Descriptor;
+        PXENVIF_PACKET_INFO                 Info;
+        PUCHAR                              BaseVa;
+        PETHERNET_HEADER                    EthernetHeader;
+        PETHERNET_ADDRESS                   DestinationAddress;
+        ETHERNET_ADDRESS_TYPE               Type;
 
         ListEntry = RemoveHeadList(&Ring->PacketComplete);
         ASSERT3P(ListEntry, !=, &Ring->PacketComplete);
@@ -1524,21 +2068,44 @@ __ReceiverRingSwizzle(
                                        XENVIF_RECEIVER_UDP_CHECKSUM_NOT_VALIDATED,
                                        1);
 
-        (VOID) InterlockedIncrement(&Receiver->Loaned);
+        // This runs from the poll DPC, the worker thread or the queue DPC
+        // depending on the ring mode, so the counter is interlocked
+        if (Packet->ResponseTime != 0 && Now >= Packet->ResponseTime) {
+            ULONGLONG   Microseconds;
+            ULONG       Bucket;
+
+            Microseconds = ((ULONGLONG)(Now - Packet->ResponseTime) * 1000000ull) /
+                           (ULONGLONG)Receiver->Frequency.QuadPart;
+
+            Bucket = __Log2Bucket(Microseconds, XENVIF_VIF_LATENCY_BUCKET_COUNT);
+            (VOID) InterlockedIncrement64((LONG64 *)&Ring->Latency[Bucket]);
+        }
 
-        VifReceiverQueuePacket(Context,
-                               Ring->Index,
-                               &Packet->Mdl,
-                               Packet->Offset,
-                               Packet->Length,
-                               Packet->Flags,
-                               Packet->MaximumSegmentSize,
-                               Packet->TagControlInformation,
-                               &Packet->Info,
-                               &Packet->Hash,
-                               !IsListEmpty(&Ring->PacketComplete) ? TRUE : FALSE,
-                               Packet);
+        (VOID) InterlockedIncrement(&Ring->Loaned);
+
+        Descriptor = &Batch[Count++];
+
+        Descriptor->Mdl = &Packet->Mdl;
+        Descriptor->Offset = Packet->Offset;
+        Descriptor->Length = Packet->Length;
+        Descriptor->Flags = Packet->Flags;
+        Descriptor->MaximumSegmentSize = Packet->MaximumSegmentSize;
+        Descriptor->TagControlInformation = Packet->TagControlInformation;
+        Descriptor->Info = &Packet->Info;
+        Descriptor->Hash = &Packet->Hash;
+        Descriptor->Cookie = Packet;
+
+        if (Count == ARRAYSIZE(Batch) || IsListEmpty(&Ring->PacketComplete)) {
+            VifReceiverQueuePackets(Context,
+                                    Ring->Index,
+                                    Batch,
+                                    Count,
+                                    !IsListEmpty(&Ring->PacketComplete) ? TRUE : FALSE);
+            Count = 0;
+        }
     }
+
+    ASSERT3U(Count, ==, 0);
 }
 
 static FORCEINLINE VOID
@@ -1608,6 +2175,11 @@ __ReceiverRingStop(
     IN  PXENVIF_RECEIVER_RING   Ring
     )
 {
+    if (!Ring->Stopped)
+        __TraceLogWrite(Ring->TraceLog,
+                        XENVIF_TRACE_EVENT_STOPPED,
+                        Ring->RequestsPosted);
+
     Ring->Stopped = TRUE;
 }
 
@@ -1616,6 +2188,11 @@ __ReceiverRingStart(
     IN  PXENVIF_RECEIVER_RING   Ring
     )
 {
+    if (Ring->Stopped)
+        __TraceLogWrite(Ring->TraceLog,
+                        XENVIF_TRACE_EVENT_STARTED,
+                        Ring->RequestsPosted);
+
     Ring->Stopped = FALSE;
 }
 
@@ -1662,10 +2239,15 @@ __ReceiverRingSend(
     if (!Locked)
         __ReceiverRingAcquireLock(Ring);
 
-    if (Ring->Connected)
+    if (Ring->Connected) {
+        __TraceLogWrite(Ring->TraceLog,
+                        XENVIF_TRACE_EVENT_NOTIFY,
+                        Ring->RequestsPosted);
+
         (VOID) XENBUS_EVTCHN(Send,
                              &Receiver->EvtchnInterface,
                              Ring->Channel);
+    }
 
     if (!Locked)
         __ReceiverRingReleaseLock(Ring);
@@ -1783,6 +2365,10 @@ __ReceiverRingPushRequests(
 
 #pragma warning (pop)
 
+    __TraceLogWrite(Ring->TraceLog,
+                    XENVIF_TRACE_EVENT_PUSH,
+                    Ring->RequestsPosted - Ring->RequestsPushed);
+
     if (Notify)
         __ReceiverRingSend(Ring, TRUE);
 
@@ -1810,43 +2396,72 @@ ReceiverRingFill(
     KeMemoryBarrier();
 
     while (req_prod - rsp_cons < RING_SIZE(&Ring->Front)) {
-        PXENVIF_RECEIVER_PACKET     Packet;
-        PXENVIF_RECEIVER_FRAGMENT   Fragment;
-        netif_rx_request_t          *req;
-        uint16_t                    id;
-
-        Packet = __ReceiverRingGetPacket(Ring, TRUE);
-
-        if (Packet == NULL) {
-            __ReceiverRingStop(Ring);
-            break;
+        PXENVIF_RECEIVER_PACKET     Packet[XENVIF_RECEIVER_FILL_BATCH_SIZE];
+        PXENVIF_RECEIVER_FRAGMENT   Fragment[XENVIF_RECEIVER_FILL_BATCH_SIZE];
+        ULONG                       Count;
+        ULONG                       Reserved;
+        ULONG                       Granted;
+        ULONG                       Index;
+
+        Count = __min(RING_SIZE(&Ring->Front) - (req_prod - rsp_cons),
+                      XENVIF_RECEIVER_FILL_BATCH_SIZE);
+
+        // Reserve a batch of pages...
+        for (Reserved = 0; Reserved < Count; Reserved++) {
+            Packet[Reserved] = __ReceiverRingGetRecycledPacket(Ring);
+            if (Packet[Reserved] == NULL)
+                Packet[Reserved] = __ReceiverRingGetPacket(Ring, TRUE);
+
+            if (Packet[Reserved] == NULL) {
+                __ReceiverRingStop(Ring);
+                break;
+            }
         }
 
-        Fragment = __ReceiverRingPreparePacket(Ring, Packet);
-        
-        if (Fragment == NULL) {
-            __ReceiverRingPutPacket(Ring, Packet, TRUE);
-            break;
+        // ...grant them all...
+        for (Granted = 0; Granted < Reserved; Granted++) {
+            Fragment[Granted] = __ReceiverRingPreparePacket(Ring,
+                                                            Packet[Granted]);
+            if (Fragment[Granted] == NULL)
+                break;
         }
 
-        req = RING_GET_REQUEST(&Ring->Front, req_prod);
-        id = (uint16_t)(req_prod & (RING_SIZE(&Ring->Front) - 1));
+        for (Index = Granted; Index < Reserved; Index++)
+            __ReceiverRingPutPacket(Ring, Packet[Index], TRUE);
+
+        // ...and then write all the requests
+        for (Index = 0; Index < Granted; Index++) {
+            netif_rx_request_t  *req;
+            uint16_t            id;
 
-        req_prod++;
-        Ring->RequestsPosted++;
+            req = RING_GET_REQUEST(&Ring->Front, req_prod);
+            id = (uint16_t)(req_prod & (RING_SIZE(&Ring->Front) - 1));
 
-        req->id = id;
-        req->gref = XENBUS_GNTTAB(GetReference,
-                                  &Receiver->GnttabInterface,
-                                  Fragment->Entry);
+            req_prod++;
 
-        ASSERT3U(id, <=, XENVIF_RECEIVER_MAXIMUM_FRAGMENT_ID);
-        ASSERT3P(Ring->Pending[id], ==, NULL);
-        Ring->Pending[id] = Fragment;
+            req->id = id;
+            req->gref = XENBUS_GNTTAB(GetReference,
+                                      &Receiver->GnttabInterface,
+                                      Fragment[Index]->Entry);
+
+            ASSERT3U(id, <=, XENVIF_RECEIVER_MAXIMUM_FRAGMENT_ID);
+            ASSERT3P(Ring->Pending[id], ==, NULL);
+            Ring->Pending[id] = Fragment[Index];
+        }
+
+        Ring->RequestsPosted += Granted;
+
+        if (Granted < Count)
+            break;
     }
 
     KeMemoryBarrier();
 
+    if (req_prod != Ring->Front.req_prod_pvt)
+        __TraceLogWrite(Ring->TraceLog,
+                        XENVIF_TRACE_EVENT_POST,
+                        req_prod - Ring->Front.req_prod_pvt);
+
     Ring->Front.req_prod_pvt = req_prod;
 
     __ReceiverRingPushRequests(Ring);
@@ -1893,6 +2508,29 @@ __ReceiverRingEmpty(
     }
 }
 
+static FORCEINLINE const CHAR *
+__ReceiverModeName(
+    IN  XENVIF_RECEIVER_MODE    Mode
+    )
+{
+#define _RECEIVER_MODE_NAME(_Mode)      \
+    case XENVIF_RECEIVER_MODE_ ## _Mode:    \
+        return #_Mode;
+
+    switch (Mode) {
+    _RECEIVER_MODE_NAME(SPLIT);
+    _RECEIVER_MODE_NAME(INLINE);
+    _RECEIVER_MODE_NAME(THREADED);
+    _RECEIVER_MODE_NAME(WORKER);
+    default:
+        break;
+    }
+
+    return "UNKNOWN";
+
+#undef  _RECEIVER_MODE_NAME
+}
+
 static VOID
 ReceiverRingDebugCallback(
     IN  PVOID                   Argument,
@@ -1902,8 +2540,7 @@ ReceiverRingDebugCallback(
     PXENVIF_RECEIVER_RING       Ring = Argument;
     PXENVIF_RECEIVER            Receiver;
     PXENVIF_FRONTEND            Frontend;
-
-    UNREFERENCED_PARAMETER(Crashing);
+    ULONG                       Bucket;
 
     Receiver = Ring->Receiver;
     Frontend = Receiver->Frontend;
@@ -1921,6 +2558,45 @@ ReceiverRingDebugCallback(
                  "QueueDpcs = %lu\n",
                  Ring->QueueDpcs);
 
+    XENBUS_DEBUG(Printf,
+                 &Receiver->DebugInterface,
+                 "Loaned = %d Returned = %d Outstanding = %d\n",
+                 Ring->Loaned,
+                 Ring->Returned,
+                 Ring->Loaned - Ring->Returned);
+
+    XENBUS_DEBUG(Printf,
+                 &Receiver->DebugInterface,
+                 "PacketsUntagged = %llu PacketsTagged = %llu PacketsDoubleTagged = %llu\n",
+                 Ring->PacketsUntagged,
+                 Ring->PacketsTagged,
+                 Ring->PacketsDoubleTagged);
+
+    if (Ring->HeaderCache != NULL)
+        XENBUS_DEBUG(Printf,
+                     &Receiver->DebugInterface,
+                     "HeaderSplitSize = %u HeadersSplit = %llu HeadersExpanded = %llu\n",
+                     Receiver->HeaderSplitSize,
+                     Ring->HeadersSplit,
+                     Ring->HeadersExpanded);
+
+    XENBUS_DEBUG(Printf,
+                 &Receiver->DebugInterface,
+                 "RecycleCount = %d RecycleHits = %llu RecycleMisses = %llu (%llu%%)\n",
+                 Ring->RecycleCount,
+                 Ring->RecycleHits,
+                 Ring->RecycleMisses,
+                 (Ring->RecycleHits + Ring->RecycleMisses != 0) ?
+                 (Ring->RecycleHits * 100) / (Ring->RecycleHits + Ring->RecycleMisses) :
+                 0ull);
+
+    XENBUS_DEBUG(Printf,
+                 &Receiver->DebugInterface,
+                 "ChecksumsVerified = %llu ChecksumsCompleted = %llu ChecksumsSkipped = %llu\n",
+                 Ring->ChecksumsVerified,
+                 Ring->ChecksumsCompleted,
+                 Ring->ChecksumsSkipped);
+
     // Dump front ring
     XENBUS_DEBUG(Printf,
                  &Receiver->DebugInterface,
@@ -1953,6 +2629,33 @@ ReceiverRingDebugCallback(
                  FrontendIsSplit(Frontend) ? "RX" : "COMBINED",
                  Ring->Events,
                  Ring->PollDpcs);
+
+    XENBUS_DEBUG(Printf,
+                 &Receiver->DebugInterface,
+                 "MODE: %s Runs = %u DispatchTime = %lluus RunTime = %lluus\n",
+                 __ReceiverModeName(Ring->Mode),
+                 Ring->Runs,
+                 Ring->DispatchTime,
+                 Ring->RunTime);
+
+    XENBUS_DEBUG(Printf,
+                 &Receiver->DebugInterface,
+                 "RESPONSE_TO_INDICATION:\n");
+
+    // Bucket N counts intervals below 2^N us
+    for (Bucket = 0; Bucket < XENVIF_VIF_LATENCY_BUCKET_COUNT; Bucket++) {
+        if (Ring->Latency[Bucket] == 0)
+            continue;
+
+        XENBUS_DEBUG(Printf,
+                     &Receiver->DebugInterface,
+                     "- %s%uus: %llu\n",
+                     (Bucket == XENVIF_VIF_LATENCY_BUCKET_COUNT - 1) ? ">=" : "<",
+                     (Bucket == XENVIF_VIF_LATENCY_BUCKET_COUNT - 1) ? 1u << (Bucket - 1) : 1u << Bucket,
+                     Ring->Latency[Bucket]);
+    }
+
+    __TraceLogDump(Ring->TraceLog, &Receiver->DebugInterface, Crashing);
 }
 
 static FORCEINLINE VOID
@@ -1965,6 +2668,8 @@ __ReceiverRingQueuePacket(
     PLIST_ENTRY                 Old;
     PLIST_ENTRY                 New;
 
+    Packet->ResponseTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
     ListEntry = &Packet->ListEntry;
 
     do {
@@ -2179,6 +2884,10 @@ ReceiverRingPoll(
                     if (Info & (1 << XEN_NETIF_EXTRA_TYPE_HASH)) {
                         ASSERT3U(Hash.Algorithm, ==, XENVIF_PACKET_HASH_ALGORITHM_TOEPLITZ);
 
+                        if (Ring->Rebalancing)
+                            Ring->HashLoad[Hash.Value % XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE] +=
+                                Packet->Length;
+
                         if (Hash.Algorithm == Ring->Hash.Algorithm &&
                             ((1u << Hash.Type) & Ring->Hash.Types))
                             Packet->Hash = Hash;
@@ -2211,13 +2920,22 @@ ReceiverRingPoll(
 
         KeMemoryBarrier();
 
+        __TraceLogWrite(Ring->TraceLog,
+                        XENVIF_TRACE_EVENT_RESPONSE,
+                        rsp_cons - Ring->Front.rsp_cons);
+
         Ring->Front.rsp_cons = rsp_cons;
     }
 
-    if (!__ReceiverRingIsStopped(Ring))
+    // Only refill once enough slots have been freed to be worth a batch
+    if (!__ReceiverRingIsStopped(Ring) &&
+        RING_SIZE(&Ring->Front) - (Ring->Front.req_prod_pvt - Ring->Front.rsp_cons) >=
+        Receiver->FillThreshold)
         ReceiverRingFill(Ring);
 
-    if (Ring->PacketQueue != NULL &&
+    // In other modes the caller indicates once it has dropped the lock
+    if (Ring->Mode == XENVIF_RECEIVER_MODE_SPLIT &&
+        Ring->PacketQueue != NULL &&
         KeInsertQueueDpc(&Ring->QueueDpc, NULL, NULL))
         Ring->QueueDpcs++;
 
@@ -2245,27 +2963,28 @@ __ReceiverRingUnmask(
                           Force);
 }
 
-__drv_functionClass(KDEFERRED_ROUTINE)
-__drv_maxIRQL(DISPATCH_LEVEL)
-__drv_minIRQL(DISPATCH_LEVEL)
-__drv_requiresIRQL(DISPATCH_LEVEL)
-__drv_sameIRQL
 static VOID
-ReceiverRingPollDpc(
-    IN  PKDPC               Dpc,
-    IN  PVOID               Context,
-    IN  PVOID               Argument1,
-    IN  PVOID               Argument2
+ReceiverRingService(
+    IN  PXENVIF_RECEIVER_RING   Ring
     )
 {
-    PXENVIF_RECEIVER_RING   Ring = Context;
-    ULONG                   Count;
+    PXENVIF_RECEIVER            Receiver;
+    LARGE_INTEGER               Start;
+    LARGE_INTEGER               End;
+    LONGLONG                    Signalled;
+    KIRQL                       Irql;
+    ULONG                       Count;
 
-    UNREFERENCED_PARAMETER(Dpc);
-    UNREFERENCED_PARAMETER(Argument1);
-    UNREFERENCED_PARAMETER(Argument2);
+    Receiver = Ring->Receiver;
 
-    ASSERT(Ring != NULL);
+    Start = KeQueryPerformanceCounter(NULL);
+
+    __TraceLogWrite(Ring->TraceLog,
+                    XENVIF_TRACE_EVENT_DPC_ENTRY,
+                    Ring->PollDpcs);
+
+    // Threaded DPCs and the worker thread may run below DISPATCH_LEVEL
+    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
 
     Count = 0;
 
@@ -2278,48 +2997,59 @@ ReceiverRingPollDpc(
                                  (Count > XENVIF_RECEIVER_RING_SIZE)))
             break;
     }
-}
 
-KSERVICE_ROUTINE    ReceiverRingEvtchnCallback;
+    KeLowerIrql(Irql);
 
-BOOLEAN
-ReceiverRingEvtchnCallback(
-    IN  PKINTERRUPT             InterruptObject,
-    IN  PVOID                   Argument
-    )
-{
-    PXENVIF_RECEIVER_RING       Ring = Argument;
-    PXENVIF_RECEIVER            Receiver;
-    PXENVIF_FRONTEND            Frontend;
+    if (Ring->Mode != XENVIF_RECEIVER_MODE_SPLIT)
+        __ReceiverRingSwizzle(Ring);
 
-    UNREFERENCED_PARAMETER(InterruptObject);
+    __TraceLogWrite(Ring->TraceLog,
+                    XENVIF_TRACE_EVENT_DPC_EXIT,
+                    Count);
 
-    ASSERT(Ring != NULL);
+    End = KeQueryPerformanceCounter(NULL);
 
-    Ring->Events++;
+    Signalled = InterlockedExchange64(&Ring->Signalled, 0);
+    if (Signalled != 0 && Start.QuadPart >= Signalled)
+        Ring->DispatchTime += ((ULONGLONG)(Start.QuadPart - Signalled) * 1000000ull) /
+                              (ULONGLONG)Receiver->Frequency.QuadPart;
 
-    if (KeInsertQueueDpc(&Ring->PollDpc, NULL, NULL))
-        Ring->PollDpcs++;
+    Ring->RunTime += ((ULONGLONG)(End.QuadPart - Start.QuadPart) * 1000000ull) /
+                     (ULONGLONG)Receiver->Frequency.QuadPart;
+    Ring->Runs++;
+}
 
-    Receiver = Ring->Receiver;
-    Frontend = Receiver->Frontend;
+__drv_functionClass(KDEFERRED_ROUTINE)
+__drv_maxIRQL(DISPATCH_LEVEL)
+__drv_minIRQL(PASSIVE_LEVEL)
+__drv_sameIRQL
+static VOID
+ReceiverRingPollDpc(
+    IN  PKDPC               Dpc,
+    IN  PVOID               Context,
+    IN  PVOID               Argument1,
+    IN  PVOID               Argument2
+    )
+{
+    PXENVIF_RECEIVER_RING   Ring = Context;
 
-    if (!FrontendIsSplit(Frontend))
-        TransmitterNotify(FrontendGetTransmitter(Frontend),
-                          Ring->Index);
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(Argument1);
+    UNREFERENCED_PARAMETER(Argument2);
 
-    return TRUE;
-}
+    ASSERT(Ring != NULL);
 
-#define TIME_US(_us)        ((_us) * 10)
-#define TIME_MS(_ms)        (TIME_US((_ms) * 1000))
-#define TIME_S(_s)          (TIME_MS((_s) * 1000))
-#define TIME_RELATIVE(_t)   (-(_t))
+    // The event channel callback cannot wake a thread directly
+    if (Ring->Mode == XENVIF_RECEIVER_MODE_WORKER) {
+        ThreadWake(Ring->WorkerThread);
+        return;
+    }
 
-#define XENVIF_RECEIVER_WATCHDOG_PERIOD 30
+    ReceiverRingService(Ring);
+}
 
 static NTSTATUS
-ReceiverRingWatchdog(
+ReceiverRingWorker(
     IN  PXENVIF_THREAD      Self,
     IN  PVOID               Context
     )
@@ -2327,10 +3057,7 @@ ReceiverRingWatchdog(
     PXENVIF_RECEIVER_RING   Ring = Context;
     PROCESSOR_NUMBER        ProcNumber;
     GROUP_AFFINITY          Affinity;
-    LARGE_INTEGER           Timeout;
-    RING_IDX                rsp_prod;
-    RING_IDX                rsp_cons;
-    NTSTATUS                status;
+    PKEVENT                 Event;
 
     Trace("====>\n");
 
@@ -2341,71 +3068,76 @@ ReceiverRingWatchdog(
         //
         // The following functions don't work before Windows 7
         //
-        status = KeGetProcessorNumberFromIndex(Ring->Index, &ProcNumber);
-        ASSERT(NT_SUCCESS(status));
+        FrontendGetRingProcessor(Ring->Receiver->Frontend,
+                                 Ring->Index,
+                                 &ProcNumber);
 
         Affinity.Group = ProcNumber.Group;
         Affinity.Mask = (KAFFINITY)1 << ProcNumber.Number;
         KeSetSystemGroupAffinityThread(&Affinity, NULL);
     }
 
-    Timeout.QuadPart = TIME_RELATIVE(TIME_S(XENVIF_RECEIVER_WATCHDOG_PERIOD));
-
-    rsp_prod = 0;
-    rsp_cons = 0;
-
-    for (;;) { 
-        PKEVENT Event;
-        KIRQL   Irql;
-
-        Event = ThreadGetEvent(Self);
+    Event = ThreadGetEvent(Self);
 
+    for (;;) {
         (VOID) KeWaitForSingleObject(Event,
                                      Executive,
                                      KernelMode,
                                      FALSE,
-                                     &Timeout);
+                                     NULL);
         KeClearEvent(Event);
 
         if (ThreadIsAlerted(Self))
             break;
 
-        KeRaiseIrql(DISPATCH_LEVEL, &Irql);
-        __ReceiverRingAcquireLock(Ring);
+        ReceiverRingService(Ring);
+    }
+
+    Trace("<====\n");
+
+    return STATUS_SUCCESS;
+}
 
-        if (Ring->Enabled) {
-            KeMemoryBarrier();
+KSERVICE_ROUTINE    ReceiverRingEvtchnCallback;
 
-            if (Ring->Shared->rsp_prod != rsp_prod &&
-                Ring->Front.rsp_cons == rsp_cons) {
-                PXENVIF_RECEIVER    Receiver;
+BOOLEAN
+ReceiverRingEvtchnCallback(
+    IN  PKINTERRUPT             InterruptObject,
+    IN  PVOID                   Argument
+    )
+{
+    PXENVIF_RECEIVER_RING       Ring = Argument;
+    PXENVIF_RECEIVER            Receiver;
+    PXENVIF_FRONTEND            Frontend;
 
-                Receiver = Ring->Receiver;
+    UNREFERENCED_PARAMETER(InterruptObject);
 
-                XENBUS_DEBUG(Trigger,
-                             &Receiver->DebugInterface,
-                             Ring->DebugCallback);
+    ASSERT(Ring != NULL);
 
-                // Try to move things along
-                __ReceiverRingTrigger(Ring, TRUE);
-                __ReceiverRingSend(Ring, TRUE);
-            }
+    Ring->Events++;
 
-            KeMemoryBarrier();
+    (VOID) InterlockedCompareExchange64(&Ring->Signalled,
+                                        KeQueryPerformanceCounter(NULL).QuadPart,
+                                        0);
 
-            rsp_prod = Ring->Shared->rsp_prod;
-            rsp_cons = Ring->Front.rsp_cons;
-        }
+    if (KeInsertQueueDpc(&Ring->PollDpc, NULL, NULL))
+        Ring->PollDpcs++;
 
-        __ReceiverRingReleaseLock(Ring);
-        KeLowerIrql(Irql);
-    }
+    Receiver = Ring->Receiver;
+    Frontend = Receiver->Frontend;
 
-    Trace("<====\n");
+    if (!FrontendIsSplit(Frontend))
+        TransmitterNotify(FrontendGetTransmitter(Frontend),
+                          Ring->Index);
 
-    return STATUS_SUCCESS;
+    return TRUE;
 }
 
+#define TIME_US(_us)        ((_us) * 10)
+#define TIME_MS(_ms)        (TIME_US((_ms) * 1000))
+#define TIME_S(_s)          (TIME_MS((_s) * 1000))
+#define TIME_RELATIVE(_t)   (-(_t))
+
 static FORCEINLINE NTSTATUS
 __ReceiverRingInitialize(
     IN  PXENVIF_RECEIVER        Receiver,
@@ -2426,9 +3158,12 @@ __ReceiverRingInitialize(
         goto fail1;
 
     KeInitializeSpinLock(&(*Ring)->Lock);
+    KeInitializeSpinLock(&(*Ring)->HeaderLock);
 
     (*Ring)->Receiver = Receiver;
     (*Ring)->Index = Index;
+    (*Ring)->Mode = Receiver->Mode;
+    (*Ring)->Rebalancing = FrontendIsRebalancing(Frontend);
 
     (*Ring)->Path = FrontendFormatPath(Frontend, Index);
     if ((*Ring)->Path == NULL)
@@ -2436,7 +3171,10 @@ __ReceiverRingInitialize(
 
     InitializeListHead(&(*Ring)->PacketComplete);
 
-    KeInitializeDpc(&(*Ring)->PollDpc, ReceiverRingPollDpc, *Ring);
+    if ((*Ring)->Mode == XENVIF_RECEIVER_MODE_THREADED)
+        KeInitializeThreadedDpc(&(*Ring)->PollDpc, ReceiverRingPollDpc, *Ring);
+    else
+        KeInitializeDpc(&(*Ring)->PollDpc, ReceiverRingPollDpc, *Ring);
 
     status = RtlStringCbPrintfA(Name,
                                 sizeof (Name),
@@ -2490,16 +3228,92 @@ __ReceiverRingInitialize(
     if (!NT_SUCCESS(status))
         goto fail6;
 
-    status = ThreadCreate(ReceiverRingWatchdog,
-                          *Ring,
-                          &(*Ring)->WatchdogThread);
-    if (!NT_SUCCESS(status))
-        goto fail7;
+    if (Receiver->HeaderSplitSize != 0) {
+        status = RtlStringCbPrintfA(Name,
+                                    sizeof (Name),
+                                    "%s_receiver_header",
+                                    (*Ring)->Path);
+        if (!NT_SUCCESS(status))
+            goto fail7;
+
+        for (Index = 0; Name[Index] != '\0'; Index++)
+            if (Name[Index] == '/')
+                Name[Index] = '_';
+
+        status = XENBUS_CACHE(Create,
+                              &Receiver->CacheInterface,
+                              Name,
+                              sizeof (XENVIF_RECEIVER_PACKET),
+                              0,
+                              0,
+                              ReceiverHeaderCtor,
+                              ReceiverHeaderDtor,
+                              ReceiverRingAcquireLock,
+                              ReceiverRingReleaseLock,
+                              *Ring,
+                              &(*Ring)->HeaderCache);
+        if (!NT_SUCCESS(status))
+            goto fail8;
+    }
+
+    (*Ring)->Mdl = __AllocatePageOnNode(FrontendGetRingNode(Frontend,
+                                                            (*Ring)->Index));
+
+    status = STATUS_NO_MEMORY;
+    if ((*Ring)->Mdl == NULL)
+        goto fail9;
+
+    if (Receiver->TraceLogSize != 0) {
+        (*Ring)->TraceLog = __TraceLogCreate(Receiver->TraceLogSize);
+
+        status = STATUS_NO_MEMORY;
+        if ((*Ring)->TraceLog == NULL)
+            goto fail10;
+    }
+
+    if ((*Ring)->Mode == XENVIF_RECEIVER_MODE_WORKER) {
+        status = ThreadCreate(ReceiverRingWorker,
+                              *Ring,
+                              &(*Ring)->WorkerThread);
+        if (!NT_SUCCESS(status))
+            goto fail11;
+    }
 
     KeInitializeThreadedDpc(&(*Ring)->QueueDpc, ReceiverRingQueueDpc, *Ring);
 
     return STATUS_SUCCESS;
 
+fail11:
+    Error("fail11\n");
+
+    __TraceLogDestroy((*Ring)->TraceLog);
+    (*Ring)->TraceLog = NULL;
+
+fail10:
+    Error("fail10\n");
+
+    __FreePage((*Ring)->Mdl);
+    (*Ring)->Mdl = NULL;
+
+fail9:
+    Error("fail9\n");
+
+    if ((*Ring)->HeaderCache != NULL) {
+        XENBUS_CACHE(Destroy,
+                     &Receiver->CacheInterface,
+                     (*Ring)->HeaderCache);
+        (*Ring)->HeaderCache = NULL;
+    }
+
+    if ((*Ring)->HeaderPage != NULL) {
+        __ReceiverHeaderPageRelease((*Ring)->HeaderPage);
+        (*Ring)->HeaderPage = NULL;
+    }
+    (*Ring)->HeaderPageOffset = 0;
+
+fail8:
+    Error("fail8\n");
+
 fail7:
     Error("fail7\n");
 
@@ -2535,9 +3349,12 @@ fail3:
 fail2:
     Error("fail2\n");
 
+    (*Ring)->Rebalancing = FALSE;
+    (*Ring)->Mode = 0;
     (*Ring)->Index = 0;
     (*Ring)->Receiver = NULL;
 
+    RtlZeroMemory(&(*Ring)->HeaderLock, sizeof (KSPIN_LOCK));
     RtlZeroMemory(&(*Ring)->Lock, sizeof (KSPIN_LOCK));
 
     ASSERT(IsZeroMemory(*Ring, sizeof (XENVIF_RECEIVER_RING)));
@@ -2588,12 +3405,6 @@ __ReceiverRingConnect(
     if (!NT_SUCCESS(status))
         goto fail2;
 
-    Ring->Mdl = __AllocatePage();
-
-    status = STATUS_NO_MEMORY;
-    if (Ring->Mdl == NULL)
-        goto fail3;
-
     ASSERT(Ring->Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
     Ring->Shared = Ring->Mdl->MappedSystemVa;
     ASSERT(Ring->Shared != NULL);
@@ -2613,14 +3424,14 @@ __ReceiverRingConnect(
                            FALSE,
                            &Ring->Entry);
     if (!NT_SUCCESS(status))
-        goto fail4;
+        goto fail3;
 
     status = RtlStringCbPrintfA(Name,
                                 sizeof (Name),
                                 __MODULE__ "|RECEIVER[%u]",
                                 Ring->Index);
     if (!NT_SUCCESS(status))
-        goto fail5;
+        goto fail4;
 
     ASSERT(!Ring->Connected);
 
@@ -2634,10 +3445,9 @@ __ReceiverRingConnect(
 
     status = STATUS_UNSUCCESSFUL;
     if (Ring->Channel == NULL)
-        goto fail6;
+        goto fail5;
 
-    status = KeGetProcessorNumberFromIndex(Ring->Index, &ProcNumber);
-    ASSERT(NT_SUCCESS(status));
+    FrontendGetRingProcessor(Frontend, Ring->Index, &ProcNumber);
 
     KeSetTargetProcessorDpcEx(&Ring->PollDpc, &ProcNumber);
 
@@ -2662,17 +3472,16 @@ __ReceiverRingConnect(
                           Ring,
                           &Ring->DebugCallback);
     if (!NT_SUCCESS(status))
-        goto fail7;
+        goto fail6;
 
-    status = KeGetProcessorNumberFromIndex(Ring->Index, &ProcNumber);
-    ASSERT(NT_SUCCESS(status));
+    FrontendGetRingProcessor(Frontend, Ring->Index, &ProcNumber);
 
     KeSetTargetProcessorDpcEx(&Ring->QueueDpc, &ProcNumber);
 
     return STATUS_SUCCESS;
 
-fail7:
-    Error("fail7\n");
+fail6:
+    Error("fail6\n");
 
     Ring->Connected = FALSE;
 
@@ -2683,12 +3492,12 @@ fail7:
 
     Ring->Events = 0;
 
-fail6:
-    Error("fail6\n");
-
 fail5:
     Error("fail5\n");
 
+fail4:
+    Error("fail4\n");
+
     (VOID) XENBUS_GNTTAB(RevokeForeignAccess,
                          &Receiver->GnttabInterface,
                          Ring->GnttabCache,
@@ -2696,18 +3505,13 @@ fail5:
                          Ring->Entry);
     Ring->Entry = NULL;
 
-fail4:
-    Error("fail4\n");
+fail3:
+    Error("fail3\n");
 
     RtlZeroMemory(&Ring->Front, sizeof (netif_rx_front_ring_t));
     RtlZeroMemory(Ring->Shared, PAGE_SIZE);
 
     Ring->Shared = NULL;
-    __FreePage(Ring->Mdl);
-    Ring->Mdl = NULL;
-
-fail3:
-    Error("fail3\n");
 
     XENBUS_GNTTAB(DestroyCache,
                   &Receiver->GnttabInterface,
@@ -2847,8 +3651,13 @@ __ReceiverRingDisable(
     Ring->Enabled = FALSE;
     Ring->Stopped = FALSE;
 
-    if (KeInsertQueueDpc(&Ring->QueueDpc, NULL, NULL))
-        Ring->QueueDpcs++;
+    // Flush out anything still waiting to be indicated
+    if (Ring->Mode == XENVIF_RECEIVER_MODE_SPLIT) {
+        if (KeInsertQueueDpc(&Ring->QueueDpc, NULL, NULL))
+            Ring->QueueDpcs++;
+    } else if (KeInsertQueueDpc(&Ring->PollDpc, NULL, NULL)) {
+        Ring->PollDpcs++;
+    }
 
     __ReceiverRingReleaseLock(Ring);
 
@@ -2906,8 +3715,6 @@ __ReceiverRingDisconnect(
     RtlZeroMemory(Ring->Shared, PAGE_SIZE);
 
     Ring->Shared = NULL;
-    __FreePage(Ring->Mdl);
-    Ring->Mdl = NULL;
 
     XENBUS_GNTTAB(DestroyCache,
                   &Receiver->GnttabInterface,
@@ -2926,6 +3733,58 @@ __ReceiverRingTeardown(
     Receiver = Ring->Receiver;
     Frontend = Receiver->Frontend;
 
+    if (Ring->Mode == XENVIF_RECEIVER_MODE_WORKER) {
+        ThreadAlert(Ring->WorkerThread);
+        ThreadJoin(Ring->WorkerThread);
+        Ring->WorkerThread = NULL;
+    }
+
+    Ring->Signalled = 0;
+    Ring->Runs = 0;
+    Ring->DispatchTime = 0;
+    Ring->RunTime = 0;
+
+    ASSERT3S(Ring->Returned, ==, Ring->Loaned);
+    Ring->Loaned = 0;
+    Ring->Returned = 0;
+
+    Ring->PacketsUntagged = 0;
+    Ring->PacketsTagged = 0;
+    Ring->PacketsDoubleTagged = 0;
+
+    Ring->HeadersSplit = 0;
+    Ring->HeadersExpanded = 0;
+
+    // Hand any recycled pages back to the cache before it is destroyed
+    for (;;) {
+        PXENVIF_RECEIVER_PACKET Packet;
+
+        Packet = __ReceiverRingGetRecycledPacket(Ring);
+        if (Packet == NULL)
+            break;
+
+        RtlZeroMemory(&Packet->Mdl, sizeof (MDL));
+
+        __ReceiverPacketMdlInit(Packet);
+
+        XENBUS_CACHE(Put,
+                     &Receiver->CacheInterface,
+                     Ring->PacketCache,
+                     Packet,
+                     FALSE);
+    }
+
+    ASSERT3S(Ring->RecycleCount, ==, 0);
+    ASSERT3P(Ring->Recycled, ==, NULL);
+    Ring->RecycleHits = 0;
+    Ring->RecycleMisses = 0;
+
+    Ring->ChecksumsVerified = 0;
+    Ring->ChecksumsCompleted = 0;
+    Ring->ChecksumsSkipped = 0;
+
+    RtlZeroMemory(Ring->HashLoad, sizeof (Ring->HashLoad));
+    RtlZeroMemory(Ring->Latency, sizeof (Ring->Latency));
     RtlZeroMemory(&Ring->Hash, sizeof (XENVIF_RECEIVER_HASH));
     RtlZeroMemory(&Ring->PollDpc, sizeof (KDPC));
 
@@ -2935,9 +3794,30 @@ __ReceiverRingTeardown(
     KeFlushQueuedDpcs();
     RtlZeroMemory(&Ring->QueueDpc, sizeof (KDPC));
 
-    ThreadAlert(Ring->WatchdogThread);
-    ThreadJoin(Ring->WatchdogThread);
-    Ring->WatchdogThread = NULL;
+    Ring->WatchdogRspProd = 0;
+    Ring->WatchdogRspCons = 0;
+
+    __TraceLogDestroy(Ring->TraceLog);
+    Ring->TraceLog = NULL;
+
+    __FreePage(Ring->Mdl);
+    Ring->Mdl = NULL;
+
+    Ring->Rebalancing = FALSE;
+    Ring->Mode = 0;
+
+    if (Ring->HeaderCache != NULL) {
+        XENBUS_CACHE(Destroy,
+                     &Receiver->CacheInterface,
+                     Ring->HeaderCache);
+        Ring->HeaderCache = NULL;
+    }
+
+    if (Ring->HeaderPage != NULL) {
+        __ReceiverHeaderPageRelease(Ring->HeaderPage);
+        Ring->HeaderPage = NULL;
+    }
+    Ring->HeaderPageOffset = 0;
 
     XENBUS_CACHE(Destroy,
                  &Receiver->CacheInterface,
@@ -2958,6 +3838,7 @@ __ReceiverRingTeardown(
     Ring->Index = 0;
     Ring->Receiver = NULL;
 
+    RtlZeroMemory(&Ring->HeaderLock, sizeof (KSPIN_LOCK));
     RtlZeroMemory(&Ring->Lock, sizeof (KSPIN_LOCK));
 
     ASSERT(IsZeroMemory(Ring, sizeof (XENVIF_RECEIVER_RING)));
@@ -2998,6 +3879,35 @@ __ReceiverRingSetBackfillSize(
     KeLowerIrql(Irql);
 }
 
+static LONG
+ReceiverGetOutstanding(
+    IN  PXENVIF_RECEIVER    Receiver
+    )
+{
+    PXENVIF_FRONTEND        Frontend;
+    LONG                    Outstanding;
+    ULONG                   Index;
+
+    Frontend = Receiver->Frontend;
+
+    Outstanding = 0;
+
+    for (Index = 0; Index < FrontendGetMaxQueues(Frontend); Index++) {
+        PXENVIF_RECEIVER_RING   Ring = Receiver->Ring[Index];
+        LONG                    Returned;
+
+        if (Ring == NULL)
+            break;
+
+        Returned = Ring->Returned;
+        KeMemoryBarrier();
+
+        Outstanding += Ring->Loaned - Returned;
+    }
+
+    return Outstanding;
+}
+
 static VOID
 ReceiverDebugCallback(
     IN  PVOID           Argument,
@@ -3010,9 +3920,9 @@ ReceiverDebugCallback(
 
     XENBUS_DEBUG(Printf,
                  &Receiver->DebugInterface,
-                 "Loaned = %d Returned = %d\n",
-                 Receiver->Loaned,
-                 Receiver->Returned);
+                 "Outstanding = %d [%s]\n",
+                 ReceiverGetOutstanding(Receiver),
+                 (Receiver->Waiting != 0) ? "WAITING" : "IDLE");
 }
 
 NTSTATUS
@@ -3040,6 +3950,10 @@ ReceiverInitialize(
     (*Receiver)->DisableIpVersion6Gso = 0;
     (*Receiver)->IpAlignOffset = 0;
     (*Receiver)->AlwaysPullup = 0;
+    (*Receiver)->HeaderSplitSize = 0;
+    (*Receiver)->FillThreshold = XENVIF_RECEIVER_FILL_BATCH_SIZE;
+    (*Receiver)->TraceLogSize = 0;
+    (*Receiver)->Mode = XENVIF_RECEIVER_MODE_SPLIT;
 
     if (ParametersKey != NULL) {
         ULONG   ReceiverCalculateChecksums;
@@ -3048,6 +3962,10 @@ ReceiverInitialize(
         ULONG   ReceiverDisableIpVersion6Gso;
         ULONG   ReceiverIpAlignOffset;
         ULONG   ReceiverAlwaysPullup;
+        ULONG   ReceiverHeaderSplitSize;
+        ULONG   ReceiverFillThreshold;
+        ULONG   ReceiverTraceLogSize;
+        ULONG   ReceiverRingMode;
 
         status = RegistryQueryDwordValue(ParametersKey,
                                          "ReceiverCalculateChecksums",
@@ -3084,8 +4002,50 @@ ReceiverInitialize(
                                          &ReceiverAlwaysPullup);
         if (NT_SUCCESS(status))
             (*Receiver)->AlwaysPullup = ReceiverAlwaysPullup;
+
+        status = RegistryQueryDwordValue(ParametersKey,
+                                         "ReceiverHeaderSplitSize",
+                                         &ReceiverHeaderSplitSize);
+        if (NT_SUCCESS(status) && ReceiverHeaderSplitSize != 0) {
+            ReceiverHeaderSplitSize = __max(ReceiverHeaderSplitSize,
+                                            XENVIF_RECEIVER_MINIMUM_HEADER_SIZE);
+            ReceiverHeaderSplitSize = __min(ReceiverHeaderSplitSize,
+                                            XENVIF_RECEIVER_MAXIMUM_HEADER_SIZE);
+
+            // Round up to a whole number of cache lines
+            ReceiverHeaderSplitSize = (ReceiverHeaderSplitSize +
+                                       SYSTEM_CACHE_ALIGNMENT_SIZE - 1) &
+                                      ~(SYSTEM_CACHE_ALIGNMENT_SIZE - 1);
+
+            (*Receiver)->HeaderSplitSize = ReceiverHeaderSplitSize;
+        }
+
+        status = RegistryQueryDwordValue(ParametersKey,
+                                         "ReceiverFillThreshold",
+                                         &ReceiverFillThreshold);
+        if (NT_SUCCESS(status))
+            (*Receiver)->FillThreshold = __min(ReceiverFillThreshold,
+                                               XENVIF_RECEIVER_RING_SIZE / 2);
+
+        status = RegistryQueryDwordValue(ParametersKey,
+                                         "ReceiverTraceLogSize",
+                                         &ReceiverTraceLogSize);
+        if (NT_SUCCESS(status))
+            (*Receiver)->TraceLogSize = ReceiverTraceLogSize;
+
+        status = RegistryQueryDwordValue(ParametersKey,
+                                         "ReceiverRingMode",
+                                         &ReceiverRingMode);
+        if (NT_SUCCESS(status) && ReceiverRingMode < XENVIF_RECEIVER_MODE_COUNT)
+            (*Receiver)->Mode = ReceiverRingMode;
     }
 
+    // Pulling up every packet defeats the point of a small header buffer
+    if ((*Receiver)->AlwaysPullup != 0)
+        (*Receiver)->HeaderSplitSize = 0;
+
+    (VOID) KeQueryPerformanceCounter(&(*Receiver)->Frequency);
+
     KeInitializeEvent(&(*Receiver)->Event, NotificationEvent, FALSE);
 
     FdoGetDebugInterface(PdoGetFdo(FrontendGetPdo(Frontend)),
@@ -3178,6 +4138,11 @@ fail2:
     (*Receiver)->DisableIpVersion6Gso = 0;
     (*Receiver)->IpAlignOffset = 0;
     (*Receiver)->AlwaysPullup = 0;
+    (*Receiver)->HeaderSplitSize = 0;
+    (*Receiver)->FillThreshold = 0;
+    (*Receiver)->TraceLogSize = 0;
+    (*Receiver)->Mode = 0;
+    (*Receiver)->Frequency.QuadPart = 0;
 
     ASSERT(IsZeroMemory(*Receiver, sizeof (XENVIF_RECEIVER)));
     __ReceiverFree(*Receiver);
@@ -3570,9 +4535,7 @@ ReceiverTeardown(
     ASSERT3U(KeGetCurrentIrql(), ==, PASSIVE_LEVEL);
     KeFlushQueuedDpcs();
 
-    ASSERT3U(Receiver->Returned, ==, Receiver->Loaned);
-    Receiver->Loaned = 0;
-    Receiver->Returned = 0;
+    ASSERT3S(Receiver->Waiting, ==, 0);
 
     Index = FrontendGetMaxQueues(Frontend);
     while (--Index >= 0) {
@@ -3612,6 +4575,11 @@ ReceiverTeardown(
     Receiver->DisableIpVersion6Gso = 0;
     Receiver->IpAlignOffset = 0;
     Receiver->AlwaysPullup = 0;
+    Receiver->HeaderSplitSize = 0;
+    Receiver->FillThreshold = 0;
+    Receiver->TraceLogSize = 0;
+    Receiver->Mode = 0;
+    Receiver->Frequency.QuadPart = 0;
 
     ASSERT(IsZeroMemory(Receiver, sizeof (XENVIF_RECEIVER)));
     __ReceiverFree(Receiver);
@@ -3701,16 +4669,18 @@ ReceiverReturnPacket(
 
     KeMemoryBarrier();
 
-    Returned = InterlockedIncrement(&Receiver->Returned);
+    Returned = InterlockedIncrement(&Ring->Returned);
 
     // Make sure Loaned is not sampled before Returned
     KeMemoryBarrier();
 
-    Loaned = Receiver->Loaned;
+    Loaned = Ring->Loaned;
 
     ASSERT3S(Loaned - Returned, >=, 0);
 
-    KeSetEvent(&Receiver->Event, 0, FALSE);
+    // A waiter only needs to re-check once a ring has drained
+    if (Loaned == Returned && Receiver->Waiting != 0)
+        KeSetEvent(&Receiver->Event, 0, FALSE);
 }
 
 #define XENVIF_RECEIVER_PACKET_WAIT_PERIOD 10
@@ -3721,8 +4691,7 @@ ReceiverWaitForPackets(
     )
 {
     PXENVIF_FRONTEND        Frontend;
-    LONG                    Loaned;
-    LONG                    Returned;
+    LONG                    Outstanding;
     LARGE_INTEGER           Timeout;
 
     ASSERT3U(KeGetCurrentIrql(), <, DISPATCH_LEVEL);
@@ -3732,17 +4701,25 @@ ReceiverWaitForPackets(
 
     Trace("%s: ====>\n", FrontendGetPath(Frontend));
 
-    Returned = Receiver->Returned;
-    Loaned = Receiver->Loaned;
-    ASSERT3S(Loaned - Returned, >=, 0);
+    KeClearEvent(&Receiver->Event);
+
+    // Make sure Waiting is visible before the counters are sampled
+    (VOID) InterlockedExchange(&Receiver->Waiting, 1);
 
     Timeout.QuadPart = TIME_RELATIVE(TIME_S(XENVIF_RECEIVER_PACKET_WAIT_PERIOD));
 
-    while (Returned != Loaned) {
-        Info("%s: (Loaned = %d Returned = %d)\n",
+    // The event only cuts a wait short when a ring drains; log what is
+    // still outstanding at least every period until everything is back
+    for (;;) {
+        Outstanding = ReceiverGetOutstanding(Receiver);
+        ASSERT3S(Outstanding, >=, 0);
+
+        if (Outstanding == 0)
+            break;
+
+        Info("%s: (Outstanding = %d)\n",
              FrontendGetPath(Frontend),
-             Loaned,
-             Returned);
+             Outstanding);
 
         (VOID) KeWaitForSingleObject(&Receiver->Event,
                                      Executive,
@@ -3750,17 +4727,13 @@ ReceiverWaitForPackets(
                                      FALSE,
                                      &Timeout);
         KeClearEvent(&Receiver->Event);
-
-        Returned = Receiver->Returned;
-        KeMemoryBarrier();
-
-        ASSERT3S(Loaned, ==, Receiver->Loaned);
     }
 
-    Info("%s: (Loaned = %d Returned = %d)\n",
+    (VOID) InterlockedExchange(&Receiver->Waiting, 0);
+
+    Info("%s: (Outstanding = %d)\n",
          FrontendGetPath(Frontend),
-         Loaned,
-         Returned);
+         Outstanding);
 
     Trace("%s: <====\n", FrontendGetPath(Frontend));
 }
@@ -3791,6 +4764,116 @@ ReceiverSend(
     __ReceiverRingSend(Ring, FALSE);
 }
 
+VOID
+ReceiverQueryHashLoad(
+    IN      PXENVIF_RECEIVER    Receiver,
+    IN OUT  PULONG              Load
+    )
+{
+    PXENVIF_FRONTEND            Frontend;
+    LONG                        Index;
+
+    Frontend = Receiver->Frontend;
+
+    for (Index = 0;
+         Index < (LONG)FrontendGetNumQueues(Frontend);
+         ++Index) {
+        PXENVIF_RECEIVER_RING   Ring;
+        ULONG                   Bucket;
+
+        Ring = Receiver->Ring[Index];
+        if (Ring == NULL)
+            break;
+
+        // The counters are 32-bit so an unlocked read cannot tear. They
+        // wrap, so callers must only ever compare samples modulo 2^32.
+        for (Bucket = 0;
+             Bucket < XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE;
+             Bucket++)
+            Load[Bucket] += Ring->HashLoad[Bucket];
+    }
+}
+
+VOID
+ReceiverQueryLatencyHistogram(
+    IN      PXENVIF_RECEIVER    Receiver,
+    IN      XENVIF_VIF_LATENCY  Latency,
+    IN OUT  PULONGLONG          Histogram
+    )
+{
+    PXENVIF_FRONTEND            Frontend;
+    LONG                        Index;
+
+    ASSERT3U(Latency, ==, XENVIF_RECEIVER_LATENCY_RESPONSE_TO_INDICATION);
+    UNREFERENCED_PARAMETER(Latency);
+
+    Frontend = Receiver->Frontend;
+
+    for (Index = 0;
+         Index < (LONG)FrontendGetNumQueues(Frontend);
+         ++Index) {
+        PXENVIF_RECEIVER_RING   Ring;
+        ULONG                   Bucket;
+
+        Ring = Receiver->Ring[Index];
+        if (Ring == NULL)
+            break;
+
+        for (Bucket = 0;
+             Bucket < XENVIF_VIF_LATENCY_BUCKET_COUNT;
+             Bucket++)
+            Histogram[Bucket] += Ring->Latency[Bucket];
+    }
+}
+
+VOID
+ReceiverWatchdog(
+    IN  PXENVIF_RECEIVER    Receiver
+    )
+{
+    PXENVIF_FRONTEND        Frontend;
+    LONG                    Index;
+
+    Frontend = Receiver->Frontend;
+
+    for (Index = 0;
+         Index < (LONG)FrontendGetNumQueues(Frontend);
+         ++Index) {
+        PXENVIF_RECEIVER_RING   Ring;
+        KIRQL                   Irql;
+
+        Ring = Receiver->Ring[Index];
+        if (Ring == NULL)
+            break;
+
+        KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+        __ReceiverRingAcquireLock(Ring);
+
+        if (Ring->Enabled) {
+            KeMemoryBarrier();
+
+            if (Ring->Shared->rsp_prod != Ring->WatchdogRspProd &&
+                Ring->Front.rsp_cons == Ring->WatchdogRspCons) {
+                XENBUS_DEBUG(Trigger,
+                             &Receiver->DebugInterface,
+                             Ring->DebugCallback);
+
+                // Try to move things along
+                __ReceiverRingTrigger(Ring, TRUE);
+                __ReceiverRingSend(Ring, TRUE);
+            }
+
+            KeMemoryBarrier();
+
+            Ring->WatchdogRspProd = Ring->Shared->rsp_prod;
+            Ring->WatchdogRspCons = Ring->Front.rsp_cons;
+        }
+
+        __ReceiverRingReleaseLock(Ring);
+        KeLowerIrql(Irql);
+    }
+}
+
 NTSTATUS
 ReceiverSetHashAlgorithm(
     IN  PXENVIF_RECEIVER                Receiver,
@@ -118,6 +118,24 @@ ReceiverSend(
     IN  ULONG               Index
     );
 
+extern VOID
+ReceiverQueryHashLoad(
+    IN      PXENVIF_RECEIVER    Receiver,
+    IN OUT  PULONG              Load
+    );
+
+extern VOID
+ReceiverQueryLatencyHistogram(
+    IN      PXENVIF_RECEIVER    Receiver,
+    IN      XENVIF_VIF_LATENCY  Latency,
+    IN OUT  PULONGLONG          Histogram
+    );
+
+extern VOID
+ReceiverWatchdog(
+    IN  PXENVIF_RECEIVER    Receiver
+    );
+
 NTSTATUS
 ReceiverSetHashAlgorithm(
     IN  PXENVIF_RECEIVER                Receiver,
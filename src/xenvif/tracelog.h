@@ -0,0 +1,275 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, 
+ * with or without modification, are permitted provided 
+ * that the following conditions are met:
+ * 
+ * *   Redistributions of source code must retain the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above 
+ *     copyright notice, this list of conditions and the 
+ *     following disclaimer in the documentation and/or other 
+ *     materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND 
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR 
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING 
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF 
+ * SUCH DAMAGE.
+ */
+
+#ifndef _XENVIF_TRACELOG_H
+#define _XENVIF_TRACELOG_H
+
+#include <ntddk.h>
+#include <debug_interface.h>
+
+#include "assert.h"
+#include "util.h"
+
+// A lock-free, fixed-size binary event log. Writers claim a record with a
+// single interlocked increment so a log may be shared between the DPC,
+// the ring lock holder and the completion paths without serialization.
+// When the log wraps the oldest records are overwritten.
+
+typedef enum _XENVIF_TRACE_EVENT {
+    XENVIF_TRACE_EVENT_INVALID = 0,
+    XENVIF_TRACE_EVENT_POST,
+    XENVIF_TRACE_EVENT_PUSH,
+    XENVIF_TRACE_EVENT_NOTIFY,
+    XENVIF_TRACE_EVENT_RESPONSE,
+    XENVIF_TRACE_EVENT_DPC_ENTRY,
+    XENVIF_TRACE_EVENT_DPC_EXIT,
+    XENVIF_TRACE_EVENT_STOPPED,
+    XENVIF_TRACE_EVENT_STARTED,
+    XENVIF_TRACE_EVENT_COUNT
+} XENVIF_TRACE_EVENT, *PXENVIF_TRACE_EVENT;
+
+typedef struct _XENVIF_TRACE_RECORD {
+    ULONG64 Timestamp;
+    USHORT  Event;
+    USHORT  Processor;
+    ULONG   Value;
+} XENVIF_TRACE_RECORD, *PXENVIF_TRACE_RECORD;
+
+C_ASSERT(sizeof (XENVIF_TRACE_RECORD) == 16);
+
+typedef struct _XENVIF_TRACE_LOG {
+    ULONG               Mask;
+    LARGE_INTEGER       Frequency;
+    LARGE_INTEGER       Counter;
+    ULONG64             Timestamp;
+    volatile LONG       Index;
+    XENVIF_TRACE_RECORD Record[1];
+} XENVIF_TRACE_LOG, *PXENVIF_TRACE_LOG;
+
+#define XENVIF_TRACE_LOG_TAG    'GOLT'
+
+#define XENVIF_TRACE_LOG_MAXIMUM_SIZE   (1 << 16)
+
+static FORCEINLINE PXENVIF_TRACE_LOG
+__TraceLogCreate(
+    IN  ULONG           Size
+    )
+{
+    PXENVIF_TRACE_LOG   Log;
+    ULONG               Count;
+
+    if (Size == 0)
+        return NULL;
+
+    Size = __min(Size, XENVIF_TRACE_LOG_MAXIMUM_SIZE);
+
+    // Round up to a power of two so the index can simply be masked
+    for (Count = 1; Count < Size; Count <<= 1)
+        ;
+
+    Log = __AllocatePoolWithTag(NonPagedPool,
+                                FIELD_OFFSET(XENVIF_TRACE_LOG, Record) +
+                                (sizeof (XENVIF_TRACE_RECORD) * Count),
+                                XENVIF_TRACE_LOG_TAG);
+    if (Log == NULL)
+        return NULL;
+
+    Log->Mask = Count - 1;
+
+    // Keep a reference point so timestamps can be scaled when decoding
+    Log->Counter = KeQueryPerformanceCounter(&Log->Frequency);
+    Log->Timestamp = ReadTimeStampCounter();
+
+    return Log;
+}
+
+static FORCEINLINE VOID
+__TraceLogDestroy(
+    IN  PXENVIF_TRACE_LOG   Log
+    )
+{
+    if (Log == NULL)
+        return;
+
+    __FreePoolWithTag(Log, XENVIF_TRACE_LOG_TAG);
+}
+
+static FORCEINLINE VOID
+__TraceLogWrite(
+    IN  PXENVIF_TRACE_LOG   Log,
+    IN  XENVIF_TRACE_EVENT  Event,
+    IN  ULONG               Value
+    )
+{
+    PXENVIF_TRACE_RECORD    Record;
+    ULONG                   Index;
+
+    if (Log == NULL)
+        return;
+
+    Index = (ULONG)InterlockedIncrement(&Log->Index) - 1;
+    Record = &Log->Record[Index & Log->Mask];
+
+    // Invalidate the record while it is re-written so that a concurrent
+    // dump does not decode a torn entry
+    Record->Event = XENVIF_TRACE_EVENT_INVALID;
+    KeMemoryBarrier();
+
+    Record->Timestamp = ReadTimeStampCounter();
+    Record->Processor = (USHORT)KeGetCurrentProcessorNumberEx(NULL);
+    Record->Value = Value;
+    KeMemoryBarrier();
+    Record->Event = (USHORT)Event;
+}
+
+static FORCEINLINE const CHAR *
+__TraceEventName(
+    IN  USHORT  Event
+    )
+{
+#define _TRACE_EVENT_NAME(_Event)       \
+    case XENVIF_TRACE_EVENT_ ## _Event: \
+        return #_Event;
+
+    switch (Event) {
+    _TRACE_EVENT_NAME(POST);
+    _TRACE_EVENT_NAME(PUSH);
+    _TRACE_EVENT_NAME(NOTIFY);
+    _TRACE_EVENT_NAME(RESPONSE);
+    _TRACE_EVENT_NAME(DPC_ENTRY);
+    _TRACE_EVENT_NAME(DPC_EXIT);
+    _TRACE_EVENT_NAME(STOPPED);
+    _TRACE_EVENT_NAME(STARTED);
+    default:
+        break;
+    }
+
+    return "INVALID";
+
+#undef  _TRACE_EVENT_NAME
+}
+
+// Only the most recent records are printed when crashing so that the
+// dump does not hold up writing the crash dump
+#define XENVIF_TRACE_LOG_CRASH_RECORDS  32
+
+// Print the log as a timeline, oldest record first, with each record's
+// offset from the first and from its predecessor in microseconds.
+// Records from different CPUs may be slightly out of order so the
+// offsets are signed.
+static FORCEINLINE VOID
+__TraceLogDump(
+    IN  PXENVIF_TRACE_LOG       Log,
+    IN  PXENBUS_DEBUG_INTERFACE DebugInterface,
+    IN  BOOLEAN                 Crashing
+    )
+{
+    LARGE_INTEGER               Counter;
+    ULONG64                     Timestamp;
+    ULONG64                     Microseconds;
+    ULONG64                     TicksPerMicrosecond;
+    ULONG                       Count;
+    ULONG                       End;
+    ULONG                       Start;
+    ULONG                       Index;
+    ULONG64                     First;
+    ULONG64                     Previous;
+
+    if (Log == NULL)
+        return;
+
+    Counter = KeQueryPerformanceCounter(NULL);
+    Timestamp = ReadTimeStampCounter();
+
+    // Derive the TSC rate from the performance counter elapsed since
+    // the log was created
+    Counter.QuadPart -= Log->Counter.QuadPart;
+    Timestamp -= Log->Timestamp;
+
+    Microseconds = ((Counter.QuadPart / Log->Frequency.QuadPart) * 1000000ull) +
+                   (((Counter.QuadPart % Log->Frequency.QuadPart) * 1000000ull) /
+                    Log->Frequency.QuadPart);
+
+    TicksPerMicrosecond = (Microseconds != 0) ? Timestamp / Microseconds : 0;
+    if (TicksPerMicrosecond == 0)
+        TicksPerMicrosecond = 1;
+
+    Count = Log->Mask + 1;
+    if (Crashing)
+        Count = __min(Count, XENVIF_TRACE_LOG_CRASH_RECORDS);
+
+    // The index wraps so always walk back a whole window; slots that
+    // have never been written are still invalid and are skipped
+    End = (ULONG)Log->Index;
+    Start = End - Count;
+
+    XENBUS_DEBUG(Printf,
+                 DebugInterface,
+                 "TRACE: %u slot(s) (%llu ticks/us)\n",
+                 Count,
+                 TicksPerMicrosecond);
+
+    First = 0;
+    Previous = 0;
+
+    for (Index = Start; Index != End; Index++) {
+        PXENVIF_TRACE_RECORD    Record = &Log->Record[Index & Log->Mask];
+        LONGLONG                Offset;
+        LONGLONG                Delta;
+
+        if (Record->Event == XENVIF_TRACE_EVENT_INVALID)
+            continue;
+
+        if (First == 0) {
+            First = Record->Timestamp;
+            Previous = Record->Timestamp;
+        }
+
+        Offset = (LONGLONG)(Record->Timestamp - First) /
+                 (LONGLONG)TicksPerMicrosecond;
+        Delta = (LONGLONG)(Record->Timestamp - Previous) /
+                (LONGLONG)TicksPerMicrosecond;
+
+        XENBUS_DEBUG(Printf,
+                     DebugInterface,
+                     " - %10lldus (%s%lldus) CPU%u %s %u\n",
+                     Offset,
+                     (Delta < 0) ? "-" : "+",
+                     (Delta < 0) ? -Delta : Delta,
+                     Record->Processor,
+                     __TraceEventName(Record->Event),
+                     Record->Value);
+
+        Previous = Record->Timestamp;
+    }
+}
+
+#endif  // _XENVIF_TRACELOG_H
@@ -53,6 +53,7 @@
 #include "mac.h"
 #include "vif.h"
 #include "thread.h"
+#include "tracelog.h"
 #include "registry.h"
 #include "dbg_print.h"
 #include "assert.h"
@@ -82,15 +83,24 @@ typedef struct _XENVIF_TRANSMITTER_PACKET {
     XENVIF_PACKET_PAYLOAD                       Payload;
     XENVIF_PACKET_CHECKSUM_FLAGS                Flags;
     XENVIF_TRANSMITTER_PACKET_COMPLETION_INFO   Completion;
+    ULONG                                       Class;
+    LONGLONG                                    QueueTime;
+    LONGLONG                                    PostTime;
+    LONGLONG                                    ResponseTime;
 } XENVIF_TRANSMITTER_PACKET, *PXENVIF_TRANSMITTER_PACKET;
 
-typedef struct _XENVIF_TRANSMITTER_REQUEST_ARP_PARAMETERS {
-    IPV4_ADDRESS    Address;
-} XENVIF_TRANSMITTER_REQUEST_ARP_PARAMETERS, *PXENVIF_TRANSMITTER_REQUEST_ARP_PARAMETERS;
+typedef struct _XENVIF_TRANSMITTER_BUFFER {
+    PMDL        Mdl;
+    PVOID       Context;
+    ULONG       Reference;
+} XENVIF_TRANSMITTER_BUFFER, *PXENVIF_TRANSMITTER_BUFFER;
 
-typedef struct _XENVIF_TRANSMITTER_REQUEST_NEIGHBOUR_ADVERTISEMENT_PARAMETERS {
-    IPV6_ADDRESS    Address;
-} XENVIF_TRANSMITTER_REQUEST_NEIGHBOUR_ADVERTISEMENT_PARAMETERS, *PXENVIF_TRANSMITTER_REQUEST_NEIGHBOUR_ADVERTISEMENT_PARAMETERS;
+// ARP and NA frames are built once into a buffer (holding a reference)
+// and then replayed Count times.
+typedef struct _XENVIF_TRANSMITTER_REQUEST_ADVERTISEMENT_PARAMETERS {
+    PXENVIF_TRANSMITTER_BUFFER  Buffer;
+    ULONG                       Count;
+} XENVIF_TRANSMITTER_REQUEST_ADVERTISEMENT_PARAMETERS, *PXENVIF_TRANSMITTER_REQUEST_ADVERTISEMENT_PARAMETERS;
 
 typedef struct _XENVIF_TRANSMITTER_REQUEST_MULTICAST_CONTROL_PARAMETERS {
     ETHERNET_ADDRESS    Address;
@@ -111,20 +121,13 @@ typedef struct _XENVIF_TRANSMITTER_REQUEST {
     LIST_ENTRY                      ListEntry;
     XENVIF_TRANSMITTER_REQUEST_TYPE Type;
     union {
-        XENVIF_TRANSMITTER_REQUEST_ARP_PARAMETERS                       Arp;
-        XENVIF_TRANSMITTER_REQUEST_NEIGHBOUR_ADVERTISEMENT_PARAMETERS   NeighbourAdvertisement;
-        XENVIF_TRANSMITTER_REQUEST_MULTICAST_CONTROL_PARAMETERS         MulticastControl;
+        XENVIF_TRANSMITTER_REQUEST_ADVERTISEMENT_PARAMETERS     Advertisement;
+        XENVIF_TRANSMITTER_REQUEST_MULTICAST_CONTROL_PARAMETERS MulticastControl;
     };
 } XENVIF_TRANSMITTER_REQUEST, *PXENVIF_TRANSMITTER_REQUEST;
 
 #pragma warning(pop)
 
-typedef struct _XENVIF_TRANSMITTER_BUFFER {
-    PMDL        Mdl;
-    PVOID       Context;
-    ULONG       Reference;
-} XENVIF_TRANSMITTER_BUFFER, *PXENVIF_TRANSMITTER_BUFFER;
-
 typedef enum _XENVIF_TRANSMITTER_MULTICAST_CONTROL_TYPE {
     XENVIF_TRANSMITTER_MULTICAST_CONTROL_TYPE_INVALID = 0,
     XENVIF_TRANSMITTER_MULTICAST_CONTROL_TYPE_ADD,
@@ -161,10 +164,48 @@ typedef struct _XENVIF_TRANSMITTER_STATE {
     PXENVIF_TRANSMITTER_PACKET          Packet;
     LIST_ENTRY                          List;
     ULONG                               Count;
+    PUSHORT                             Checksum;   // Checksum being emulated
+    PUCHAR                              ChecksumStartVa;
+    ULONG                               Accumulator;
+    ULONG                               ChecksumOffset;
+    ULONG                               ChecksumLength;
+    BOOLEAN                             ChecksumIsUdp;
 } XENVIF_TRANSMITTER_STATE, *PXENVIF_TRANSMITTER_STATE;
 
 #define XENVIF_TRANSMITTER_RING_SIZE   (__CONST_RING_SIZE(netif_tx, PAGE_SIZE))
 
+// Bounds on the number of bytes that may be posted to the backend but
+// not yet completed. The minimum always allows a full GSO packet.
+#define XENVIF_TRANSMITTER_INFLIGHT_LIMIT_MIN   (64 * 1024)
+#define XENVIF_TRANSMITTER_INFLIGHT_LIMIT_MAX   (4 * 1024 * 1024)
+
+// How long the limit must have been larger than necessary before it
+// is reduced
+#define XENVIF_TRANSMITTER_INFLIGHT_HOLD_TIME   1000    // ms
+
+// Packets may be sorted into classes by 802.1p priority or DSCP. The
+// classes are served by deficit round robin so that small packets in
+// one class do not wait behind large GSO packets in another.
+#define XENVIF_TRANSMITTER_CLASS_COUNT      4
+#define XENVIF_TRANSMITTER_CLASS_QUANTUM    4096    // bytes
+
+typedef struct _XENVIF_TRANSMITTER_CLASS {
+    LIST_ENTRY  PacketQueue;
+    ULONG       Deficit;
+    ULONG       Depth;
+    ULONG       MaximumDepth;
+    ULONGLONG   PacketsSent;
+    ULONGLONG   WaitTime;           // us
+    ULONGLONG   MaximumWaitTime;    // us
+} XENVIF_TRANSMITTER_CLASS, *PXENVIF_TRANSMITTER_CLASS;
+
+typedef enum _XENVIF_TRANSMITTER_MODE {
+    XENVIF_TRANSMITTER_MODE_INLINE = 0, // Poll in a DPC
+    XENVIF_TRANSMITTER_MODE_THREADED,   // Poll in a threaded DPC
+    XENVIF_TRANSMITTER_MODE_WORKER,     // Poll in a dedicated thread
+    XENVIF_TRANSMITTER_MODE_COUNT
+} XENVIF_TRANSMITTER_MODE, *PXENVIF_TRANSMITTER_MODE;
+
 typedef struct _XENVIF_TRANSMITTER_RING {
     PXENVIF_TRANSMITTER             Transmitter;
     ULONG                           Index;
@@ -188,13 +229,23 @@ typedef struct _XENVIF_TRANSMITTER_RING {
     BOOLEAN                         Stopped;
     PVOID                           Lock;
     PKTHREAD                        LockThread;
-    LIST_ENTRY                      PacketQueue;
+    XENVIF_TRANSMITTER_CLASS        Class[XENVIF_TRANSMITTER_CLASS_COUNT];
+    ULONG                           ClassIndex;
     LIST_ENTRY                      RequestQueue;
+    LIST_ENTRY                      AdvertisementQueue;
+    ULONG                           AdvertisementsSent;
     XENVIF_TRANSMITTER_STATE        State;
     ULONG                           PacketsQueued;
     ULONG                           PacketsGranted;
     ULONG                           PacketsCopied;
     ULONG                           PacketsFaked;
+    ULONG                           PacketsHybrid;
+    ULONGLONG                       BytesGranted;
+    ULONGLONG                       BytesCopied;
+    ULONGLONG                       PacketsUntagged;
+    ULONGLONG                       PacketsTagged;
+    ULONGLONG                       PacketsDoubleTagged;
+    ULONGLONG                       ChecksumsEmulated;
     ULONG                           PacketsUnprepared;
     ULONG                           PacketsPrepared;
     PXENVIF_TRANSMITTER_FRAGMENT    Pending[XENVIF_TRANSMITTER_MAXIMUM_FRAGMENT_ID + 1];
@@ -205,7 +256,29 @@ typedef struct _XENVIF_TRANSMITTER_RING {
     LIST_ENTRY                      PacketComplete;
     ULONG                           PacketsCompleted;
     PXENBUS_DEBUG_CALLBACK          DebugCallback;
-    PXENVIF_THREAD                  WatchdogThread;
+    ULONG                           WatchdogPacketsQueued;
+    ULONG                           StallResponses;
+    BOOLEAN                         StallSampled;
+    BOOLEAN                         Stalled;
+    ULONG                           Stalls;
+    ULONG                           InFlightBytes;
+    ULONG                           InFlightLimit;
+    ULONG                           InFlightSlack;
+    LONGLONG                        InFlightSlackStart;
+    BOOLEAN                         Throttled;
+    ULONGLONG                       Throttles;
+    ULONG                           InFlightLimitRaised;
+    ULONG                           InFlightLimitLowered;
+    BOOLEAN                         Rebalancing;
+    ULONG                           HashLoad[XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE];
+    PXENVIF_TRACE_LOG               TraceLog;
+    ULONGLONG                       Latency[XENVIF_VIF_LATENCY_COUNT][XENVIF_VIF_LATENCY_BUCKET_COUNT];
+    XENVIF_TRANSMITTER_MODE         Mode;
+    PXENVIF_THREAD                  WorkerThread;
+    LONGLONG                        Signalled;
+    ULONG                           Runs;
+    ULONGLONG                       DispatchTime;
+    ULONGLONG                       RunTime;
 } XENVIF_TRANSMITTER_RING, *PXENVIF_TRANSMITTER_RING;
 
 struct _XENVIF_TRANSMITTER {
@@ -216,11 +289,23 @@ struct _XENVIF_TRANSMITTER {
     XENBUS_EVTCHN_INTERFACE     EvtchnInterface;
     PXENVIF_TRANSMITTER_RING    *Ring;
     BOOLEAN                     MulticastControl;
+    BOOLEAN                     BackendIpVersion4Checksum;
+    BOOLEAN                     BackendIpVersion6Checksum;
     ULONG                       DisableIpVersion4Gso;
     ULONG                       DisableIpVersion6Gso;
     ULONG                       AlwaysCopy;
     ULONG                       ValidateChecksums;
+    ULONG                       EmulateChecksums;
     ULONG                       DisableMulticastControl;
+    ULONG                       DisableInFlightLimit;
+    ULONG                       PriorityClasses;
+    ULONG                       AdvertisementCount;
+    ULONG                       AdvertisementInterval;
+    ULONG                       AdvertisementNext;
+    PXENVIF_THREAD              AdvertisementThread;
+    ULONG                       TraceLogSize;
+    XENVIF_TRANSMITTER_MODE     Mode;
+    LARGE_INTEGER               Frequency;
     KSPIN_LOCK                  Lock;
     PXENBUS_CACHE               PacketCache;
     XENBUS_STORE_INTERFACE      StoreInterface;
@@ -356,6 +441,11 @@ __TransmitterPutPacket(
     Packet->Flags.Value = 0;
     RtlZeroMemory(&Packet->Completion, sizeof (XENVIF_TRANSMITTER_PACKET_COMPLETION_INFO));
 
+    Packet->Class = 0;
+    Packet->QueueTime = 0;
+    Packet->PostTime = 0;
+    Packet->ResponseTime = 0;
+
     XENBUS_CACHE(Put,
                  &Transmitter->CacheInterface,
                  Transmitter->PacketCache,
@@ -369,15 +459,15 @@ TransmitterBufferCtor(
     IN  PVOID                   Object
     )
 {
+    PXENVIF_TRANSMITTER_RING    Ring = Argument;
     PXENVIF_TRANSMITTER_BUFFER  Buffer = Object;
     PMDL		                Mdl;
     NTSTATUS	                status;
 
-    UNREFERENCED_PARAMETER(Argument);
-
     ASSERT(IsZeroMemory(Buffer, sizeof (XENVIF_TRANSMITTER_BUFFER)));
 
-    Mdl = __AllocatePage();
+    Mdl = __AllocatePageOnNode(FrontendGetRingNode(Ring->Transmitter->Frontend,
+                                                   Ring->Index));
 
     status = STATUS_NO_MEMORY;
     if (Mdl == NULL)
@@ -693,6 +783,50 @@ __TransmitterPutRequest(
                  TRUE);
 }
 
+static FORCEINLINE const CHAR *
+__TransmitterLatencyName(
+    IN  XENVIF_VIF_LATENCY  Latency
+    )
+{
+#define _TRANSMITTER_LATENCY_NAME(_Latency) \
+    case XENVIF_TRANSMITTER_LATENCY_ ## _Latency:   \
+        return #_Latency;
+
+    switch (Latency) {
+    _TRANSMITTER_LATENCY_NAME(QUEUE_TO_POST);
+    _TRANSMITTER_LATENCY_NAME(POST_TO_RESPONSE);
+    _TRANSMITTER_LATENCY_NAME(RESPONSE_TO_COMPLETION);
+    default:
+        break;
+    }
+
+    return "UNKNOWN";
+
+#undef  _TRANSMITTER_LATENCY_NAME
+}
+
+static FORCEINLINE const CHAR *
+__TransmitterModeName(
+    IN  XENVIF_TRANSMITTER_MODE Mode
+    )
+{
+#define _TRANSMITTER_MODE_NAME(_Mode)       \
+    case XENVIF_TRANSMITTER_MODE_ ## _Mode:     \
+        return #_Mode;
+
+    switch (Mode) {
+    _TRANSMITTER_MODE_NAME(INLINE);
+    _TRANSMITTER_MODE_NAME(THREADED);
+    _TRANSMITTER_MODE_NAME(WORKER);
+    default:
+        break;
+    }
+
+    return "UNKNOWN";
+
+#undef  _TRANSMITTER_MODE_NAME
+}
+
 static VOID
 TransmitterRingDebugCallback(
     IN  PVOID                   Argument,
@@ -702,8 +836,8 @@ TransmitterRingDebugCallback(
     PXENVIF_TRANSMITTER_RING    Ring = Argument;
     PXENVIF_TRANSMITTER         Transmitter;
     PXENVIF_FRONTEND            Frontend;
-
-    UNREFERENCED_PARAMETER(Crashing);
+    XENVIF_VIF_LATENCY          Latency;
+    ULONG                       Index;
 
     Transmitter = Ring->Transmitter;
     Frontend = Transmitter->Frontend;
@@ -739,6 +873,42 @@ TransmitterRingDebugCallback(
                  Ring->RequestsPushed,
                  Ring->ResponsesProcessed);
 
+    XENBUS_DEBUG(Printf,
+                 &Transmitter->DebugInterface,
+                 "AdvertisementsSent = %u\n",
+                 Ring->AdvertisementsSent);
+
+    XENBUS_DEBUG(Printf,
+                 &Transmitter->DebugInterface,
+                 "Stalls = %u [%s]\n",
+                 Ring->Stalls,
+                 (Ring->Stalled) ? "STALLED" : "OK");
+
+    XENBUS_DEBUG(Printf,
+                 &Transmitter->DebugInterface,
+                 "InFlightBytes = %u InFlightLimit = %u (Raised = %u Lowered = %u) Throttles = %llu [%s]\n",
+                 Ring->InFlightBytes,
+                 Ring->InFlightLimit,
+                 Ring->InFlightLimitRaised,
+                 Ring->InFlightLimitLowered,
+                 Ring->Throttles,
+                 (Ring->Throttled) ? "THROTTLED" : "OK");
+
+    for (Index = 0; Index < XENVIF_TRANSMITTER_CLASS_COUNT; Index++) {
+        PXENVIF_TRANSMITTER_CLASS   Class = &Ring->Class[Index];
+
+        XENBUS_DEBUG(Printf,
+                     &Transmitter->DebugInterface,
+                     "Class[%u]: Depth = %u (Maximum = %u) PacketsSent = %llu WaitTime = %llu us (Average = %llu us Maximum = %llu us)\n",
+                     Index,
+                     Class->Depth,
+                     Class->MaximumDepth,
+                     Class->PacketsSent,
+                     Class->WaitTime,
+                     (Class->PacketsSent != 0) ? Class->WaitTime / Class->PacketsSent : 0,
+                     Class->MaximumWaitTime);
+    }
+
     XENBUS_DEBUG(Printf,
                  &Transmitter->DebugInterface,
                  "State:\n");
@@ -755,11 +925,30 @@ TransmitterRingDebugCallback(
 
     XENBUS_DEBUG(Printf,
                  &Transmitter->DebugInterface,
-                 "PacketsGranted = %u PacketsCopied = %u PacketsFaked = %u\n",
+                 "PacketsGranted = %u PacketsCopied = %u PacketsHybrid = %u PacketsFaked = %u\n",
                  Ring->PacketsGranted,
                  Ring->PacketsCopied,
+                 Ring->PacketsHybrid,
                  Ring->PacketsFaked);
 
+    XENBUS_DEBUG(Printf,
+                 &Transmitter->DebugInterface,
+                 "BytesGranted = %llu BytesCopied = %llu\n",
+                 Ring->BytesGranted,
+                 Ring->BytesCopied);
+
+    XENBUS_DEBUG(Printf,
+                 &Transmitter->DebugInterface,
+                 "PacketsUntagged = %llu PacketsTagged = %llu PacketsDoubleTagged = %llu\n",
+                 Ring->PacketsUntagged,
+                 Ring->PacketsTagged,
+                 Ring->PacketsDoubleTagged);
+
+    XENBUS_DEBUG(Printf,
+                 &Transmitter->DebugInterface,
+                 "ChecksumsEmulated = %llu\n",
+                 Ring->ChecksumsEmulated);
+
     XENBUS_DEBUG(Printf,
                  &Transmitter->DebugInterface,
                  "PacketsQueued = %u PacketsPrepared = %u PacketsUnprepared = %u PacketsSent = %u PacketsCompleted = %u\n",
@@ -777,6 +966,40 @@ TransmitterRingDebugCallback(
                      Ring->Events,
                      Ring->PollDpcs);
     }
+
+    XENBUS_DEBUG(Printf,
+                 &Transmitter->DebugInterface,
+                 "MODE: %s Runs = %u DispatchTime = %lluus RunTime = %lluus\n",
+                 __TransmitterModeName(Ring->Mode),
+                 Ring->Runs,
+                 Ring->DispatchTime,
+                 Ring->RunTime);
+
+    for (Latency = XENVIF_TRANSMITTER_LATENCY_QUEUE_TO_POST;
+         Latency <= XENVIF_TRANSMITTER_LATENCY_RESPONSE_TO_COMPLETION;
+         Latency++) {
+        ULONG   Bucket;
+
+        XENBUS_DEBUG(Printf,
+                     &Transmitter->DebugInterface,
+                     "%s:\n",
+                     __TransmitterLatencyName(Latency));
+
+        // Bucket N counts intervals below 2^N us
+        for (Bucket = 0; Bucket < XENVIF_VIF_LATENCY_BUCKET_COUNT; Bucket++) {
+            if (Ring->Latency[Latency][Bucket] == 0)
+                continue;
+
+            XENBUS_DEBUG(Printf,
+                         &Transmitter->DebugInterface,
+                         "- %s%uus: %llu\n",
+                         (Bucket == XENVIF_VIF_LATENCY_BUCKET_COUNT - 1) ? ">=" : "<",
+                         (Bucket == XENVIF_VIF_LATENCY_BUCKET_COUNT - 1) ? 1u << (Bucket - 1) : 1u << Bucket,
+                         Ring->Latency[Latency][Bucket]);
+        }
+    }
+
+    __TraceLogDump(Ring->TraceLog, &Transmitter->DebugInterface, Crashing);
 }
 
 static BOOLEAN
@@ -838,6 +1061,196 @@ fail1:
     return FALSE;
 }
 
+// Start calculating a TCP or UDP checksum that the backend cannot fill
+// in. The header is summed here; the payload is added as it is copied
+// or, if it is granted, once it has all been prepared.
+static FORCEINLINE BOOLEAN
+__TransmitterRingStartChecksum(
+    IN  PXENVIF_TRANSMITTER_RING    Ring,
+    IN  PUCHAR                      StartVa,
+    IN  PXENVIF_PACKET_INFO         Info,
+    IN  PUSHORT                     Checksum,
+    IN  BOOLEAN                     IsUdp
+    )
+{
+    PXENVIF_TRANSMITTER             Transmitter;
+    PXENVIF_TRANSMITTER_STATE       State;
+    PXENVIF_TRANSMITTER_PACKET      Packet;
+    PIP_HEADER                      IpHeader;
+    PXENVIF_PACKET_INFO_ENTRY       Header;
+    PXENVIF_PACKET_INFO_ENTRY       Options;
+    ULONG                           Accumulator;
+    ULONG                           Length;
+
+    Transmitter = Ring->Transmitter;
+    State = &Ring->State;
+    Packet = State->Packet;
+
+    // The backend always fills in checksums for large packets
+    if (Packet->OffloadOptions.OffloadIpVersion4LargePacket ||
+        Packet->OffloadOptions.OffloadIpVersion6LargePacket)
+        return FALSE;
+
+    if (Packet->Info.IsAFragment)
+        return FALSE;
+
+    ASSERT(Info->IpHeader.Length != 0);
+    IpHeader = (PIP_HEADER)(StartVa + Info->IpHeader.Offset);
+
+    if (IpHeader->Version == 4) {
+        if (Transmitter->BackendIpVersion4Checksum)
+            return FALSE;
+
+        Length = NTOHS(IpHeader->Version4.PacketLength) -
+                 Info->IpHeader.Length -
+                 Info->IpOptions.Length;
+    } else {
+        ASSERT3U(IpHeader->Version, ==, 6);
+
+        if (Transmitter->BackendIpVersion6Checksum)
+            return FALSE;
+
+        Length = NTOHS(IpHeader->Version6.PayloadLength) -
+                 Info->IpOptions.Length;
+    }
+
+    Header = (IsUdp) ? &Info->UdpHeader : &Info->TcpHeader;
+    Options = (IsUdp) ? NULL : &Info->TcpOptions;
+
+    // The field currently holds the pseudo header checksum
+    Accumulator = *Checksum;
+    *Checksum = 0;
+
+    AccumulateChecksum(&Accumulator,
+                       StartVa + Header->Offset,
+                       Header->Length);
+    Length -= Header->Length;
+
+    if (Options != NULL && Options->Length != 0) {
+        AccumulateChecksum(&Accumulator,
+                           StartVa + Options->Offset,
+                           Options->Length);
+        Length -= Options->Length;
+    }
+
+    State->Checksum = Checksum;
+    State->ChecksumStartVa = StartVa;
+    State->Accumulator = Accumulator;
+    State->ChecksumOffset = 0;
+    State->ChecksumLength = __min(Length, Packet->Payload.Length);
+    State->ChecksumIsUdp = IsUdp;
+
+    return TRUE;
+}
+
+static FORCEINLINE VOID
+__TransmitterRingAccumulateChecksum(
+    IN  PXENVIF_TRANSMITTER_RING    Ring,
+    IN  PUCHAR                      BaseVa,
+    IN  ULONG                       Length
+    )
+{
+    PXENVIF_TRANSMITTER_STATE       State;
+
+    State = &Ring->State;
+
+    if (State->Checksum == NULL)
+        return;
+
+    Length = __min(Length, State->ChecksumLength);
+
+    // Chunks need not be of even length so track where each one starts
+    AccumulateChecksumAt(&State->Accumulator,
+                         BaseVa,
+                         Length,
+                         State->ChecksumOffset);
+
+    State->ChecksumOffset += Length;
+    State->ChecksumLength -= Length;
+}
+
+static FORCEINLINE VOID
+__TransmitterRingFinishChecksum(
+    IN  PXENVIF_TRANSMITTER_RING    Ring
+    )
+{
+    PXENVIF_TRANSMITTER             Transmitter;
+    PXENVIF_TRANSMITTER_STATE       State;
+    PXENVIF_TRANSMITTER_PACKET      Packet;
+    USHORT                          Checksum;
+
+    Transmitter = Ring->Transmitter;
+    State = &Ring->State;
+    Packet = State->Packet;
+
+    if (State->Checksum == NULL)
+        return;
+
+    // Anything that was not copied has to be read now
+    if (State->ChecksumLength != 0) {
+        PMDL    Mdl;
+        ULONG   Offset;
+
+        ASSERT3U(State->ChecksumLength, <=, Packet->Payload.Length);
+
+        Mdl = Packet->Payload.Mdl;
+        Offset = Packet->Payload.Offset;
+
+        while (State->ChecksumLength != 0) {
+            PUCHAR  BaseVa;
+            ULONG   Length;
+
+            ASSERT(Mdl != NULL);
+
+            BaseVa = MmGetSystemAddressForMdlSafe(Mdl, NormalPagePriority);
+            ASSERT(BaseVa != NULL);
+
+            ASSERT3U(Offset, <=, Mdl->ByteCount);
+            Length = Mdl->ByteCount - Offset;
+
+            __TransmitterRingAccumulateChecksum(Ring, BaseVa + Offset, Length);
+
+            Mdl = Mdl->Next;
+            Offset = 0;
+        }
+    }
+
+    Checksum = (USHORT)~State->Accumulator;
+
+    // A calculated UDP checksum of zero is transmitted as all ones
+    if (State->ChecksumIsUdp && Checksum == 0)
+        Checksum = 0xFFFF;
+
+    // Cross-check against a calculation over the whole packet
+    if (Transmitter->ValidateChecksums != 0) {
+        PUCHAR              StartVa = State->ChecksumStartVa;
+        PXENVIF_PACKET_INFO Info = &Packet->Info;
+        USHORT              Calculated;
+
+        Calculated = ChecksumPseudoHeader(StartVa, Info);
+
+        if (State->ChecksumIsUdp) {
+            Calculated = ChecksumUdpPacket(StartVa, Info, Calculated, &Packet->Payload);
+            if (Calculated == 0)
+                Calculated = 0xFFFF;
+        } else {
+            Calculated = ChecksumTcpPacket(StartVa, Info, Calculated, &Packet->Payload);
+        }
+
+        ASSERT3U(Calculated, ==, Checksum);
+    }
+
+    *State->Checksum = Checksum;
+
+    Ring->ChecksumsEmulated++;
+
+    State->Checksum = NULL;
+    State->ChecksumStartVa = NULL;
+    State->Accumulator = 0;
+    State->ChecksumOffset = 0;
+    State->ChecksumIsUdp = FALSE;
+}
+
 static FORCEINLINE NTSTATUS
 __TransmitterRingCopyPayload(
     IN  PXENVIF_TRANSMITTER_RING    Ring
@@ -887,6 +1300,9 @@ __TransmitterRingCopyPayload(
 
         (VOID) TransmitterPullup(Transmitter, BaseVa, &Payload, Length);
 
+        // Sum the data while it is still in cache
+        __TransmitterRingAccumulateChecksum(Ring, BaseVa, Length);
+
         Mdl->ByteCount = Length;
 
         Fragment = __TransmitterGetFragment(Ring);
@@ -923,6 +1339,8 @@ __TransmitterRingCopyPayload(
     }
 
     Ring->PacketsCopied++;
+    Ring->BytesCopied += Packet->Payload.Length;
+
     return STATUS_SUCCESS;
 
 fail3:
@@ -1093,6 +1511,8 @@ __TransmitterRingGrantPayload(
     }
 
     Ring->PacketsGranted++;
+    Ring->BytesGranted += Payload->Length;
+
     return STATUS_SUCCESS;
 
 fail3:
@@ -1152,75 +1572,45 @@ fail1:
 }
 
 static FORCEINLINE NTSTATUS
-__TransmitterRingPrepareHeader(
-    IN  PXENVIF_TRANSMITTER_RING    Ring
+__TransmitterRingAddBounceFragment(
+    IN  PXENVIF_TRANSMITTER_RING    Ring,
+    OUT PXENVIF_TRANSMITTER_BUFFER  *Buffer
     )
 {
     PXENVIF_TRANSMITTER             Transmitter;
     PXENVIF_FRONTEND                Frontend;
-    PXENVIF_MAC                     Mac;
     PXENVIF_TRANSMITTER_STATE       State;
     PXENVIF_TRANSMITTER_PACKET      Packet;
-    PXENVIF_PACKET_PAYLOAD          Payload;
-    PXENVIF_PACKET_INFO             Info;
     PXENVIF_TRANSMITTER_FRAGMENT    Fragment;
-    PXENVIF_TRANSMITTER_BUFFER      Buffer;
-    PMDL                            Mdl;
-    PUCHAR                          BaseVa;
     PFN_NUMBER                      Pfn;
-    PETHERNET_HEADER                EthernetHeader;
-    BOOLEAN                         SquashError;
     NTSTATUS                        status;
 
     Transmitter = Ring->Transmitter;
     Frontend = Transmitter->Frontend;
-    Mac = FrontendGetMac(Frontend);
 
     State = &Ring->State;
     Packet = State->Packet;
 
-    Payload = &Packet->Payload;
-    Info = &Packet->Info;
-
-    SquashError = FALSE;
-
-    status = STATUS_UNSUCCESSFUL;
-    if (Info->Length == 0)
-        goto fail1;
-
-    ASSERT3U(Packet->Reference, ==, 0);
-
-    Buffer = __TransmitterGetBuffer(Ring);
+    *Buffer = __TransmitterGetBuffer(Ring);
 
     status = STATUS_NO_MEMORY;
-    if (Buffer == NULL)
-        goto fail2;
+    if (*Buffer == NULL)
+        goto fail1;
 
-    Buffer->Context = Packet;
+    (*Buffer)->Context = Packet;
     Packet->Reference++;
 
-    Mdl = Buffer->Mdl;
-
-    ASSERT(Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
-    BaseVa = Mdl->MappedSystemVa;
-    ASSERT(BaseVa != NULL);
-
-    RtlCopyMemory(BaseVa, Packet->Header, Info->Length);
-
-    Mdl->ByteCount = Info->Length;
-
     Fragment = __TransmitterGetFragment(Ring);
 
     status = STATUS_NO_MEMORY;
     if (Fragment == NULL)
-        goto fail3;
+        goto fail2;
 
     Fragment->Type = XENVIF_TRANSMITTER_FRAGMENT_TYPE_BUFFER;
-    Fragment->Context = Buffer;
- 
-    Buffer->Reference++;
+    Fragment->Context = *Buffer;
+    (*Buffer)->Reference++;
 
-    Pfn = MmGetMdlPfnArray(Mdl)[0];
+    Pfn = MmGetMdlPfnArray((*Buffer)->Mdl)[0];
 
     status = XENBUS_GNTTAB(PermitForeignAccess,
                            &Transmitter->GnttabInterface,
@@ -1231,60 +1621,417 @@ __TransmitterRingPrepareHeader(
                            TRUE,
                            &Fragment->Entry);
     if (!NT_SUCCESS(status))
-        goto fail4;
+        goto fail3;
 
+    // The length grows as data is coalesced into the buffer
     Fragment->Offset = 0;
-    Fragment->Length = Mdl->ByteCount + Payload->Length;
+    Fragment->Length = 0;
 
     ASSERT(IsZeroMemory(&Fragment->ListEntry, sizeof (LIST_ENTRY)));
     InsertTailList(&State->List, &Fragment->ListEntry);
     State->Count++;
 
-    ASSERT(Info->EthernetHeader.Length != 0);
-    EthernetHeader = (PETHERNET_HEADER)(BaseVa + Info->EthernetHeader.Offset);
-
-    if (Packet->OffloadOptions.OffloadTagManipulation) {
-        ULONG   Offset;
+    return STATUS_SUCCESS;
 
-        Offset = FIELD_OFFSET(ETHERNET_TAGGED_HEADER, Tag);
+fail3:
+    Error("fail3\n");
 
-        RtlMoveMemory((PUCHAR)EthernetHeader + Offset + sizeof (ETHERNET_TAG),
-                      (PUCHAR)EthernetHeader + Offset,
-                      Mdl->ByteCount - Offset);
+    Fragment->Context = NULL;
+    Fragment->Type = XENVIF_TRANSMITTER_FRAGMENT_TYPE_INVALID;
 
-        // Insert the tag
-        EthernetHeader->Tagged.Tag.ProtocolID = HTONS(ETHERTYPE_TPID);
-        EthernetHeader->Tagged.Tag.ControlInformation = HTONS(Packet->TagControlInformation);
-        ASSERT(ETHERNET_HEADER_IS_TAGGED(EthernetHeader));
+    ASSERT((*Buffer)->Reference != 0);
+    --(*Buffer)->Reference;
 
-        Packet->Length += sizeof (ETHERNET_TAG);
-        Mdl->ByteCount += sizeof (ETHERNET_TAG);
-        Fragment->Length += sizeof (ETHERNET_TAG);
+    __TransmitterPutFragment(Ring, Fragment);
 
-        // Fix up the packet information
-        Info->EthernetHeader.Length += sizeof (ETHERNET_TAG);
-        Info->Length += sizeof (ETHERNET_TAG);
+fail2:
+    Error("fail2\n");
 
-        if (Info->IpHeader.Length != 0)
-            Info->IpHeader.Offset += sizeof (ETHERNET_TAG);
+    ASSERT3P((*Buffer)->Context, ==, Packet);
+    (*Buffer)->Context = NULL;
 
-        if (Info->IpOptions.Length != 0)
-            Info->IpOptions.Offset += sizeof (ETHERNET_TAG);
+    --Packet->Reference;
 
-        if (Info->UdpHeader.Length != 0)
-            Info->UdpHeader.Offset += sizeof (ETHERNET_TAG);
+    __TransmitterPutBuffer(Ring, *Buffer);
+    *Buffer = NULL;
 
-        if (Info->TcpHeader.Length != 0)
-            Info->TcpHeader.Offset += sizeof (ETHERNET_TAG);
+fail1:
+    Error("fail1 (%08x)\n", status);
 
-        if (Info->TcpOptions.Length != 0)
-            Info->TcpOptions.Offset += sizeof (ETHERNET_TAG);
-    }
+    return status;
+}
 
-    if (Packet->OffloadOptions.OffloadIpVersion4LargePacket) {
-        PIP_HEADER  IpHeader;
-        PTCP_HEADER TcpHeader;
-        ULONG       Length;
+// Chunks at least this long are granted directly by the hybrid path
+#define XENVIF_TRANSMITTER_HYBRID_GRANT_MIN (PAGE_SIZE / 2)
+
+static FORCEINLINE NTSTATUS
+__TransmitterRingHybridPayload(
+    IN  PXENVIF_TRANSMITTER_RING    Ring
+    )
+{
+    PXENVIF_TRANSMITTER             Transmitter;
+    PXENVIF_FRONTEND                Frontend;
+    PXENVIF_TRANSMITTER_STATE       State;
+    PXENVIF_TRANSMITTER_PACKET      Packet;
+    XENVIF_PACKET_PAYLOAD           Payload;
+    PXENVIF_TRANSMITTER_FRAGMENT    Fragment;
+    PXENVIF_TRANSMITTER_BUFFER      Buffer;
+    ULONG                           BytesGranted;
+    ULONG                           BytesCopied;
+    NTSTATUS                        status;
+
+    Transmitter = Ring->Transmitter;
+    Frontend = Transmitter->Frontend;
+
+    State = &Ring->State;
+    Packet = State->Packet;
+    Payload = Packet->Payload;
+
+    ASSERT(Packet != NULL);
+    ASSERT3U(Packet->Reference, ==, 1);
+
+    Fragment = NULL;
+    Buffer = NULL;
+    BytesGranted = 0;
+    BytesCopied = 0;
+
+    while (Payload.Length != 0) {
+        PMDL    Mdl;
+        ULONG   MdlOffset;
+        ULONG   PageOffset;
+        ULONG   PageLength;
+
+        Mdl = Payload.Mdl;
+        ASSERT(Mdl != NULL);
+
+        if (Payload.Offset == Mdl->ByteCount) {
+            Payload.Mdl = Mdl->Next;
+            Payload.Offset = 0;
+            continue;
+        }
+
+        MdlOffset = Mdl->ByteOffset + Payload.Offset;
+
+        PageOffset = MdlOffset & (PAGE_SIZE - 1);
+        PageLength = __min(Mdl->ByteCount - Payload.Offset, Payload.Length);
+        PageLength = __min(PageLength, PAGE_SIZE - PageOffset);
+
+        if (PageLength >= XENVIF_TRANSMITTER_HYBRID_GRANT_MIN) {
+            PFN_NUMBER  Pfn;
+
+            // Data following a granted chunk cannot share the current
+            // bounce buffer
+            Buffer = NULL;
+
+            Fragment = __TransmitterGetFragment(Ring);
+
+            status = STATUS_NO_MEMORY;
+            if (Fragment == NULL)
+                goto fail1;
+
+            Fragment->Type = XENVIF_TRANSMITTER_FRAGMENT_TYPE_PACKET;
+            Fragment->Context = Packet;
+            Packet->Reference++;
+
+            Pfn = MmGetMdlPfnArray(Mdl)[MdlOffset / PAGE_SIZE];
+
+            status = XENBUS_GNTTAB(PermitForeignAccess,
+                                   &Transmitter->GnttabInterface,
+                                   Ring->GnttabCache,
+                                   TRUE,
+                                   FrontendGetBackendDomain(Frontend),
+                                   Pfn,
+                                   TRUE,
+                                   &Fragment->Entry);
+            if (!NT_SUCCESS(status))
+                goto fail3;
+
+            Fragment->Offset = PageOffset;
+            Fragment->Length = PageLength;
+
+            ASSERT(IsZeroMemory(&Fragment->ListEntry, sizeof (LIST_ENTRY)));
+            InsertTailList(&State->List, &Fragment->ListEntry);
+            State->Count++;
+
+            Fragment = NULL;
+
+            Payload.Offset += PageLength;
+            Payload.Length -= PageLength;
+
+            BytesGranted += PageLength;
+        } else {
+            PMDL    BufferMdl;
+            PUCHAR  BaseVa;
+            ULONG   Length;
+
+            if (Buffer == NULL || Buffer->Mdl->ByteCount == PAGE_SIZE) {
+                status = __TransmitterRingAddBounceFragment(Ring, &Buffer);
+                if (!NT_SUCCESS(status))
+                    goto fail2;
+            }
+
+            BufferMdl = Buffer->Mdl;
+
+            Length = __min(PageLength, PAGE_SIZE - BufferMdl->ByteCount);
+
+            ASSERT(BufferMdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+            BaseVa = BufferMdl->MappedSystemVa;
+            ASSERT(BaseVa != NULL);
+
+            BaseVa += BufferMdl->ByteCount;
+
+            (VOID) TransmitterPullup(Transmitter, BaseVa, &Payload, Length);
+
+            BufferMdl->ByteCount += Length;
+
+            // The bounce fragment is always at the tail of the list
+            Fragment = CONTAINING_RECORD(State->List.Blink, XENVIF_TRANSMITTER_FRAGMENT, ListEntry);
+            ASSERT3U(Fragment->Type, ==, XENVIF_TRANSMITTER_FRAGMENT_TYPE_BUFFER);
+            ASSERT3P(Fragment->Context, ==, Buffer);
+
+            Fragment->Length += Length;
+            Fragment = NULL;
+
+            BytesCopied += Length;
+        }
+
+        // Give up and copy everything if we still need too many slots
+        status = STATUS_BUFFER_OVERFLOW;
+        if (State->Count > XEN_NETIF_NR_SLOTS_MIN)
+            goto fail1;
+    }
+
+    Ring->PacketsHybrid++;
+    Ring->BytesGranted += BytesGranted;
+    Ring->BytesCopied += BytesCopied;
+
+    return STATUS_SUCCESS;
+
+fail3:
+    Error("fail3\n");
+
+    ASSERT3P(Fragment->Context, ==, Packet);
+    Fragment->Context = NULL;
+    Fragment->Type = XENVIF_TRANSMITTER_FRAGMENT_TYPE_INVALID;
+
+    --Packet->Reference;
+
+    __TransmitterPutFragment(Ring, Fragment);
+    Fragment = NULL;
+
+fail2:
+    Error("fail2\n");
+
+fail1:
+    // Running out of slots is not an error; the caller copies instead
+    if (status != STATUS_BUFFER_OVERFLOW)
+        Error("fail1 (%08x)\n", status);
+
+    ASSERT3P(Fragment, ==, NULL);
+
+    while (Packet->Reference != 1) {
+        PLIST_ENTRY         ListEntry;
+
+        ASSERT(State->Count != 0);
+        --State->Count;
+
+        ListEntry = RemoveTailList(&State->List);
+        ASSERT3P(ListEntry, !=, &State->List);
+
+        RtlZeroMemory(ListEntry, sizeof (LIST_ENTRY));
+
+        Fragment = CONTAINING_RECORD(ListEntry, XENVIF_TRANSMITTER_FRAGMENT, ListEntry);
+
+        Fragment->Length = 0;
+        Fragment->Offset = 0;
+
+        (VOID) XENBUS_GNTTAB(RevokeForeignAccess,
+                             &Transmitter->GnttabInterface,
+                             Ring->GnttabCache,
+                             TRUE,
+                             Fragment->Entry);
+        Fragment->Entry = NULL;
+
+        switch (Fragment->Type) {
+        case XENVIF_TRANSMITTER_FRAGMENT_TYPE_BUFFER:
+            Buffer = Fragment->Context;
+            Fragment->Context = NULL;
+            Fragment->Type = XENVIF_TRANSMITTER_FRAGMENT_TYPE_INVALID;
+
+            ASSERT(Buffer->Reference != 0);
+            --Buffer->Reference;
+
+            ASSERT3P(Buffer->Context, ==, Packet);
+            Buffer->Context = NULL;
+
+            __TransmitterPutBuffer(Ring, Buffer);
+            break;
+
+        case XENVIF_TRANSMITTER_FRAGMENT_TYPE_PACKET:
+            ASSERT3P(Fragment->Context, ==, Packet);
+            Fragment->Context = NULL;
+            Fragment->Type = XENVIF_TRANSMITTER_FRAGMENT_TYPE_INVALID;
+            break;
+
+        default:
+            ASSERT(FALSE);
+            break;
+        }
+
+        --Packet->Reference;
+
+        __TransmitterPutFragment(Ring, Fragment);
+    }
+
+    return status;
+}
+
+static FORCEINLINE NTSTATUS
+__TransmitterRingPrepareHeader(
+    IN  PXENVIF_TRANSMITTER_RING    Ring
+    )
+{
+    PXENVIF_TRANSMITTER             Transmitter;
+    PXENVIF_FRONTEND                Frontend;
+    PXENVIF_MAC                     Mac;
+    PXENVIF_TRANSMITTER_STATE       State;
+    PXENVIF_TRANSMITTER_PACKET      Packet;
+    PXENVIF_PACKET_PAYLOAD          Payload;
+    PXENVIF_PACKET_INFO             Info;
+    PXENVIF_TRANSMITTER_FRAGMENT    Fragment;
+    PXENVIF_TRANSMITTER_BUFFER      Buffer;
+    PMDL                            Mdl;
+    PUCHAR                          BaseVa;
+    PFN_NUMBER                      Pfn;
+    PETHERNET_HEADER                EthernetHeader;
+    BOOLEAN                         SquashError;
+    NTSTATUS                        status;
+
+    Transmitter = Ring->Transmitter;
+    Frontend = Transmitter->Frontend;
+    Mac = FrontendGetMac(Frontend);
+
+    State = &Ring->State;
+    Packet = State->Packet;
+
+    Payload = &Packet->Payload;
+    Info = &Packet->Info;
+
+    SquashError = FALSE;
+
+    status = STATUS_UNSUCCESSFUL;
+    if (Info->Length == 0)
+        goto fail1;
+
+    ASSERT3U(Packet->Reference, ==, 0);
+
+    Buffer = __TransmitterGetBuffer(Ring);
+
+    status = STATUS_NO_MEMORY;
+    if (Buffer == NULL)
+        goto fail2;
+
+    Buffer->Context = Packet;
+    Packet->Reference++;
+
+    Mdl = Buffer->Mdl;
+
+    ASSERT(Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
+    BaseVa = Mdl->MappedSystemVa;
+    ASSERT(BaseVa != NULL);
+
+    if (Packet->OffloadOptions.OffloadTagManipulation) {
+        ULONG   Offset;
+
+        // Leave a gap for the tag rather than moving the header later
+        Offset = Info->EthernetHeader.Offset +
+                 FIELD_OFFSET(ETHERNET_TAGGED_HEADER, Tag);
+
+        RtlCopyMemory(BaseVa, Packet->Header, Offset);
+        RtlCopyMemory(BaseVa + Offset + sizeof (ETHERNET_TAG),
+                      Packet->Header + Offset,
+                      Info->Length - Offset);
+    } else {
+        RtlCopyMemory(BaseVa, Packet->Header, Info->Length);
+    }
+
+    Mdl->ByteCount = Info->Length;
+
+    Fragment = __TransmitterGetFragment(Ring);
+
+    status = STATUS_NO_MEMORY;
+    if (Fragment == NULL)
+        goto fail3;
+
+    Fragment->Type = XENVIF_TRANSMITTER_FRAGMENT_TYPE_BUFFER;
+    Fragment->Context = Buffer;
+ 
+    Buffer->Reference++;
+
+    Pfn = MmGetMdlPfnArray(Mdl)[0];
+
+    status = XENBUS_GNTTAB(PermitForeignAccess,
+                           &Transmitter->GnttabInterface,
+                           Ring->GnttabCache,
+                           TRUE,
+                           FrontendGetBackendDomain(Frontend),
+                           Pfn,
+                           TRUE,
+                           &Fragment->Entry);
+    if (!NT_SUCCESS(status))
+        goto fail4;
+
+    Fragment->Offset = 0;
+    Fragment->Length = Mdl->ByteCount + Payload->Length;
+
+    ASSERT(IsZeroMemory(&Fragment->ListEntry, sizeof (LIST_ENTRY)));
+    InsertTailList(&State->List, &Fragment->ListEntry);
+    State->Count++;
+
+    ASSERT(Info->EthernetHeader.Length != 0);
+    EthernetHeader = (PETHERNET_HEADER)(BaseVa + Info->EthernetHeader.Offset);
+
+    if (Packet->OffloadOptions.OffloadTagManipulation) {
+        // Fill in the gap left for the tag
+        EthernetHeader->Tagged.Tag.ProtocolID = HTONS(ETHERTYPE_TPID);
+        EthernetHeader->Tagged.Tag.ControlInformation = HTONS(Packet->TagControlInformation);
+        ASSERT(ETHERNET_HEADER_IS_TAGGED(EthernetHeader));
+
+        Packet->Length += sizeof (ETHERNET_TAG);
+        Mdl->ByteCount += sizeof (ETHERNET_TAG);
+        Fragment->Length += sizeof (ETHERNET_TAG);
+
+        // Fix up the packet information
+        Info->EthernetHeader.Length += sizeof (ETHERNET_TAG);
+        Info->Length += sizeof (ETHERNET_TAG);
+
+        if (Info->IpHeader.Length != 0)
+            Info->IpHeader.Offset += sizeof (ETHERNET_TAG);
+
+        if (Info->IpOptions.Length != 0)
+            Info->IpOptions.Offset += sizeof (ETHERNET_TAG);
+
+        if (Info->UdpHeader.Length != 0)
+            Info->UdpHeader.Offset += sizeof (ETHERNET_TAG);
+
+        if (Info->TcpHeader.Length != 0)
+            Info->TcpHeader.Offset += sizeof (ETHERNET_TAG);
+
+        if (Info->TcpOptions.Length != 0)
+            Info->TcpOptions.Offset += sizeof (ETHERNET_TAG);
+    }
+
+    if (ETHERNET_HEADER_IS_SERVICE_TAGGED(EthernetHeader))
+        Ring->PacketsDoubleTagged++;
+    else if (ETHERNET_HEADER_IS_TAGGED(EthernetHeader))
+        Ring->PacketsTagged++;
+    else
+        Ring->PacketsUntagged++;
+
+    if (Packet->OffloadOptions.OffloadIpVersion4LargePacket) {
+        PIP_HEADER  IpHeader;
+        PTCP_HEADER TcpHeader;
+        ULONG       Length;
 
         ASSERT(!Info->IsAFragment);
 
@@ -1406,6 +2153,15 @@ __TransmitterRingPrepareHeader(
             Packet->OffloadOptions.OffloadIpVersion6TcpChecksum) {
             TcpHeader->Checksum = ChecksumPseudoHeader(BaseVa, Info);
 
+            if (__TransmitterRingStartChecksum(Ring,
+                                               BaseVa,
+                                               Info,
+                                               &TcpHeader->Checksum,
+                                               FALSE)) {
+                Packet->OffloadOptions.OffloadIpVersion4TcpChecksum = 0;
+                Packet->OffloadOptions.OffloadIpVersion6TcpChecksum = 0;
+            }
+
             Packet->Flags.TcpChecksumNotValidated = 1;
         } else if (Transmitter->ValidateChecksums != 0) {
             USHORT      Embedded;
@@ -1434,6 +2190,15 @@ __TransmitterRingPrepareHeader(
             Packet->OffloadOptions.OffloadIpVersion6UdpChecksum) {
             UdpHeader->Checksum = ChecksumPseudoHeader(BaseVa, Info);
 
+            if (__TransmitterRingStartChecksum(Ring,
+                                               BaseVa,
+                                               Info,
+                                               &UdpHeader->Checksum,
+                                               TRUE)) {
+                Packet->OffloadOptions.OffloadIpVersion4UdpChecksum = 0;
+                Packet->OffloadOptions.OffloadIpVersion6UdpChecksum = 0;
+            }
+
             Packet->Flags.UdpChecksumNotValidated = 1;
         } else if (Transmitter->ValidateChecksums != 0) {
             PIP_HEADER  IpHeader;
@@ -1571,8 +2336,8 @@ __TransmitterRingUnprepareFragments(
             Buffer->Context = NULL;
 
             ASSERT(Buffer->Reference != 0);
-            --Buffer->Reference;
-            __TransmitterPutBuffer(Ring, Buffer);
+            if (--Buffer->Reference == 0)
+                __TransmitterPutBuffer(Ring, Buffer);
 
             break;
         }
@@ -1625,6 +2390,13 @@ __TransmitterRingUnprepareFragments(
         State->Count = 0;
     }
 
+    State->Checksum = NULL;
+    State->ChecksumStartVa = NULL;
+    State->Accumulator = 0;
+    State->ChecksumOffset = 0;
+    State->ChecksumLength = 0;
+    State->ChecksumIsUdp = FALSE;
+
     Packet = State->Packet;
 
     if (Packet != NULL) {
@@ -1723,6 +2495,15 @@ __TransmitterRingPreparePacket(
         if (Transmitter->AlwaysCopy == 0)
             status = __TransmitterRingGrantPayload(Ring);
 
+        // If the packet is too highly fragmented then try granting only
+        // the large chunks before resorting to copying all of it
+        if (Transmitter->AlwaysCopy == 0 &&
+            (!NT_SUCCESS(status) && status == STATUS_BUFFER_OVERFLOW)) {
+            ASSERT3U(State->Count, ==, Packet->Reference);
+
+            status = __TransmitterRingHybridPayload(Ring);
+        }
+
         if (Transmitter->AlwaysCopy != 0 ||
             (!NT_SUCCESS(status) && status == STATUS_BUFFER_OVERFLOW)) {
             ASSERT3U(State->Count, ==, Packet->Reference);
@@ -1734,6 +2515,8 @@ __TransmitterRingPreparePacket(
     if (!NT_SUCCESS(status))
         goto fail2;
 
+    __TransmitterRingFinishChecksum(Ring);
+
     ASSERT3U(State->Count, ==, Packet->Reference);
 
     Ring->PacketsPrepared++;
@@ -1753,8 +2536,8 @@ fail1:
     return status;
 }
 
-static FORCEINLINE NTSTATUS
-__TransmitterRingPrepareArp(
+static FORCEINLINE PXENVIF_TRANSMITTER_BUFFER
+__TransmitterRingBuildArp(
     IN  PXENVIF_TRANSMITTER_RING    Ring,
     IN  PIPV4_ADDRESS               Address
     )
@@ -1762,8 +2545,6 @@ __TransmitterRingPrepareArp(
     PXENVIF_TRANSMITTER             Transmitter;
     PXENVIF_FRONTEND                Frontend;
     PXENVIF_MAC                     Mac;
-    PXENVIF_TRANSMITTER_STATE       State;
-    PXENVIF_TRANSMITTER_FRAGMENT    Fragment;
     PXENVIF_TRANSMITTER_BUFFER      Buffer;
     PMDL                            Mdl;
     PUCHAR                          BaseVa;
@@ -1773,10 +2554,6 @@ __TransmitterRingPrepareArp(
     IPV4_ADDRESS                    SenderProtocolAddress;
     ETHERNET_ADDRESS                TargetHardwareAddress;
     IPV4_ADDRESS                    TargetProtocolAddress;
-    PFN_NUMBER                      Pfn;
-    NTSTATUS                        status;
-
-    ASSERT(IsZeroMemory(&Ring->State, sizeof (XENVIF_TRANSMITTER_STATE)));
 
     Transmitter = Ring->Transmitter;
     Frontend = Transmitter->Frontend;
@@ -1787,13 +2564,9 @@ __TransmitterRingPrepareArp(
     MacQueryCurrentAddress(Mac, &SenderHardwareAddress);
     MacQueryBroadcastAddress(Mac, &TargetHardwareAddress);
 
-    State = &Ring->State;
-
     Buffer = __TransmitterGetBuffer(Ring);
-
-    status = STATUS_NO_MEMORY;
     if (Buffer == NULL)
-        goto fail1;
+        return NULL;
 
     Mdl = Buffer->Mdl;
 
@@ -1833,70 +2606,11 @@ __TransmitterRingPrepareArp(
 
     Mdl->ByteCount = (ULONG)(BaseVa - (PUCHAR)(Mdl->MappedSystemVa));
 
-    Fragment = __TransmitterGetFragment(Ring);
-
-    status = STATUS_NO_MEMORY;
-    if (Fragment == NULL)
-        goto fail2;
-
-    Fragment->Context = Buffer;
-    Fragment->Type = XENVIF_TRANSMITTER_FRAGMENT_TYPE_BUFFER;
-    Buffer->Reference++;
-
-    Pfn = MmGetMdlPfnArray(Mdl)[0];
-
-    status = XENBUS_GNTTAB(PermitForeignAccess,
-                           &Transmitter->GnttabInterface,
-                           Ring->GnttabCache,
-                           TRUE,
-                           FrontendGetBackendDomain(Frontend),
-                           Pfn,
-                           TRUE,
-                           &Fragment->Entry);
-    if (!NT_SUCCESS(status))
-        goto fail3;
-
-    Fragment->Offset = 0;
-    Fragment->Length = Mdl->ByteCount;
-
-    InitializeListHead(&State->List);
-
-    ASSERT(IsZeroMemory(&Fragment->ListEntry, sizeof (LIST_ENTRY)));
-    InsertTailList(&State->List, &Fragment->ListEntry);
-    State->Count++;
-
-    return STATUS_SUCCESS;
-
-fail3:
-    Error("fail3\n");
-
-    ASSERT3U(Fragment->Type, ==, XENVIF_TRANSMITTER_FRAGMENT_TYPE_BUFFER);
-    ASSERT3P(Buffer, ==, Fragment->Context);
-    Fragment->Context = NULL;
-    Fragment->Type = XENVIF_TRANSMITTER_FRAGMENT_TYPE_INVALID;
-
-    ASSERT(Buffer->Reference != 0);
-    --Buffer->Reference;
-
-    __TransmitterPutFragment(Ring, Fragment);
-
-fail2:
-    Error("fail2\n");
-
-    Mdl->ByteCount = 0;
-
-    __TransmitterPutBuffer(Ring, Buffer);
-
-fail1:
-    Error("fail1 (%08x)\n", status);
-
-    ASSERT(IsZeroMemory(&Ring->State, sizeof (XENVIF_TRANSMITTER_STATE)));
-
-    return status;
+    return Buffer;
 }
 
-static FORCEINLINE NTSTATUS
-__TransmitterRingPrepareNeighbourAdvertisement(
+static FORCEINLINE PXENVIF_TRANSMITTER_BUFFER
+__TransmitterRingBuildNeighbourAdvertisement(
     IN  PXENVIF_TRANSMITTER_RING    Ring,
     IN  PIPV6_ADDRESS               Address
     )
@@ -1904,8 +2618,6 @@ __TransmitterRingPrepareNeighbourAdvertisement(
     PXENVIF_TRANSMITTER             Transmitter;
     PXENVIF_FRONTEND                Frontend;
     PXENVIF_MAC                     Mac;
-    PXENVIF_TRANSMITTER_STATE       State;
-    PXENVIF_TRANSMITTER_FRAGMENT    Fragment;
     PXENVIF_TRANSMITTER_BUFFER      Buffer;
     PMDL                            Mdl;
     PUCHAR                          BaseVa;
@@ -1916,10 +2628,6 @@ __TransmitterRingPrepareNeighbourAdvertisement(
     ETHERNET_ADDRESS                SenderHardwareAddress;
     USHORT                          PayloadLength;
     ULONG                           Accumulator;
-    PFN_NUMBER                      Pfn;
-    NTSTATUS                        status;
-
-    ASSERT(IsZeroMemory(&Ring->State, sizeof (XENVIF_TRANSMITTER_STATE)));
 
     Transmitter = Ring->Transmitter;
     Frontend = Transmitter->Frontend;
@@ -1928,13 +2636,9 @@ __TransmitterRingPrepareNeighbourAdvertisement(
     TargetProtocolAddress = *Address;
     MacQueryCurrentAddress(Mac, &SenderHardwareAddress);
 
-    State = &Ring->State;
-
     Buffer = __TransmitterGetBuffer(Ring);
-
-    status = STATUS_NO_MEMORY;
     if (Buffer == NULL)
-        goto fail1;
+        return NULL;
 
     Mdl = Buffer->Mdl;
 
@@ -2001,11 +2705,38 @@ __TransmitterRingPrepareNeighbourAdvertisement(
 
     IcmpHeader->Checksum = (USHORT)~Accumulator;
 
+    return Buffer;
+}
+
+static FORCEINLINE NTSTATUS
+__TransmitterRingPrepareAdvertisement(
+    IN  PXENVIF_TRANSMITTER_RING    Ring,
+    IN  PXENVIF_TRANSMITTER_BUFFER  Buffer
+    )
+{
+    PXENVIF_TRANSMITTER             Transmitter;
+    PXENVIF_FRONTEND                Frontend;
+    PXENVIF_TRANSMITTER_STATE       State;
+    PXENVIF_TRANSMITTER_FRAGMENT    Fragment;
+    PMDL                            Mdl;
+    PFN_NUMBER                      Pfn;
+    NTSTATUS                        status;
+
+    ASSERT(IsZeroMemory(&Ring->State, sizeof (XENVIF_TRANSMITTER_STATE)));
+
+    Transmitter = Ring->Transmitter;
+    Frontend = Transmitter->Frontend;
+
+    State = &Ring->State;
+
+    Mdl = Buffer->Mdl;
+    ASSERT(Mdl->ByteCount != 0);
+
     Fragment = __TransmitterGetFragment(Ring);
 
     status = STATUS_NO_MEMORY;
     if (Fragment == NULL)
-        goto fail2;
+        goto fail1;
 
     Fragment->Context = Buffer;
     Fragment->Type = XENVIF_TRANSMITTER_FRAGMENT_TYPE_BUFFER;
@@ -2022,7 +2753,7 @@ __TransmitterRingPrepareNeighbourAdvertisement(
                            TRUE,
                            &Fragment->Entry);
     if (!NT_SUCCESS(status))
-        goto fail3;
+        goto fail2;
 
     Fragment->Offset = 0;
     Fragment->Length = Mdl->ByteCount;
@@ -2033,28 +2764,23 @@ __TransmitterRingPrepareNeighbourAdvertisement(
     InsertTailList(&State->List, &Fragment->ListEntry);
     State->Count++;
 
+    Ring->AdvertisementsSent++;
+
     return STATUS_SUCCESS;
 
-fail3:
-    Error("fail3\n");
+fail2:
+    Error("fail2\n");
 
     ASSERT3U(Fragment->Type, ==, XENVIF_TRANSMITTER_FRAGMENT_TYPE_BUFFER);
     ASSERT3P(Buffer, ==, Fragment->Context);
     Fragment->Context = NULL;
     Fragment->Type = XENVIF_TRANSMITTER_FRAGMENT_TYPE_INVALID;
 
-    ASSERT(Buffer->Reference != 0);
+    ASSERT(Buffer->Reference > 1);
     --Buffer->Reference;
 
     __TransmitterPutFragment(Ring, Fragment);
 
-fail2:
-    Error("fail2\n");
-
-    Mdl->ByteCount = 0;
-
-    __TransmitterPutBuffer(Ring, Buffer);
-
 fail1:
     Error("fail1 (%08x)\n", status);
 
@@ -2063,6 +2789,64 @@ fail1:
     return status;
 }
 
+static FORCEINLINE VOID
+__TransmitterRingPutAdvertisement(
+    IN  PXENVIF_TRANSMITTER_RING    Ring,
+    IN  PXENVIF_TRANSMITTER_REQUEST Request
+    )
+{
+    PXENVIF_TRANSMITTER_BUFFER      Buffer;
+
+    ASSERT(Request->Type == XENVIF_TRANSMITTER_REQUEST_TYPE_ARP ||
+           Request->Type == XENVIF_TRANSMITTER_REQUEST_TYPE_NEIGHBOUR_ADVERTISEMENT);
+
+    Buffer = Request->Advertisement.Buffer;
+    Request->Advertisement.Buffer = NULL;
+    Request->Advertisement.Count = 0;
+
+    // Fragments still in flight hold their own references
+    ASSERT(Buffer->Reference != 0);
+    if (--Buffer->Reference == 0)
+        __TransmitterPutBuffer(Ring, Buffer);
+}
+
+static FORCEINLINE VOID
+__TransmitterRingReleaseAdvertisements(
+    IN  PXENVIF_TRANSMITTER_RING    Ring
+    )
+{
+    PLIST_ENTRY                     ListEntry;
+
+    if (IsListEmpty(&Ring->AdvertisementQueue))
+        return;
+
+    ListEntry = Ring->AdvertisementQueue.Flink;
+
+    RemoveEntryList(&Ring->AdvertisementQueue);
+    InitializeListHead(&Ring->AdvertisementQueue);
+    AppendTailList(&Ring->RequestQueue, ListEntry);
+}
+
+static FORCEINLINE VOID
+__TransmitterRingDiscardRequest(
+    IN  PXENVIF_TRANSMITTER_RING    Ring,
+    IN  PXENVIF_TRANSMITTER_REQUEST Request
+    )
+{
+    switch (Request->Type) {
+    case XENVIF_TRANSMITTER_REQUEST_TYPE_ARP:
+    case XENVIF_TRANSMITTER_REQUEST_TYPE_NEIGHBOUR_ADVERTISEMENT:
+        __TransmitterRingPutAdvertisement(Ring, Request);
+        break;
+
+    default:
+        break;
+    }
+
+    Request->Type = XENVIF_TRANSMITTER_REQUEST_TYPE_INVALID;
+    __TransmitterPutRequest(Ring, Request);
+}
+
 static FORCEINLINE NTSTATUS
 __TransmitterRingPrepareMulticastControl(
     IN  PXENVIF_TRANSMITTER_RING            Ring,
@@ -2121,6 +2905,65 @@ fail1:
     return status;
 }
 
+static FORCEINLINE VOID
+__TransmitterRingRecordLatency(
+    IN  PXENVIF_TRANSMITTER_RING    Ring,
+    IN  XENVIF_VIF_LATENCY          Latency,
+    IN  LONGLONG                    Start,
+    IN  LONGLONG                    End,
+    IN  BOOLEAN                     Locked
+    )
+{
+    PXENVIF_TRANSMITTER             Transmitter;
+    ULONGLONG                       Microseconds;
+    ULONG                           Bucket;
+
+    Transmitter = Ring->Transmitter;
+
+    if (Start == 0 || End < Start)
+        return;
+
+    Microseconds = ((ULONGLONG)(End - Start) * 1000000ull) /
+                   (ULONGLONG)Transmitter->Frequency.QuadPart;
+
+    Bucket = __Log2Bucket(Microseconds, XENVIF_VIF_LATENCY_BUCKET_COUNT);
+
+    // Under the ring lock there is only one updater. Completion latency
+    // is recorded outside the lock, possibly on several CPUs at once, so
+    // those counters must be interlocked.
+    if (Locked)
+        Ring->Latency[Latency][Bucket]++;
+    else
+        (VOID) InterlockedIncrement64((LONG64 *)&Ring->Latency[Latency][Bucket]);
+}
+
+static FORCEINLINE VOID
+__TransmitterRingClassPacketSent(
+    IN  PXENVIF_TRANSMITTER_RING    Ring,
+    IN  PXENVIF_TRANSMITTER_PACKET  Packet
+    )
+{
+    PXENVIF_TRANSMITTER             Transmitter;
+    PXENVIF_TRANSMITTER_CLASS       Class;
+    ULONGLONG                       Microseconds;
+
+    Transmitter = Ring->Transmitter;
+
+    ASSERT3U(Packet->Class, <, XENVIF_TRANSMITTER_CLASS_COUNT);
+    Class = &Ring->Class[Packet->Class];
+
+    Class->PacketsSent++;
+
+    if (Packet->QueueTime == 0 || Packet->PostTime < Packet->QueueTime)
+        return;
+
+    Microseconds = ((ULONGLONG)(Packet->PostTime - Packet->QueueTime) * 1000000ull) /
+                   (ULONGLONG)Transmitter->Frequency.QuadPart;
+
+    Class->WaitTime += Microseconds;
+    Class->MaximumWaitTime = __max(Class->MaximumWaitTime, Microseconds);
+}
+
 #define RING_SLOTS_AVAILABLE(_Front, _req_prod, _rsp_cons)   \
         (RING_SIZE(_Front) - ((_req_prod) - (_rsp_cons)))
 
@@ -2351,6 +3194,10 @@ __TransmitterRingPostFragments(
     ASSERT(req != NULL);
     req->flags &= ~NETTXF_more_data;
 
+    __TraceLogWrite(Ring->TraceLog,
+                    XENVIF_TRACE_EVENT_POST,
+                    req_prod - Ring->Front.req_prod_pvt);
+
     Ring->Front.req_prod_pvt = req_prod;
 
     ASSERT3U(State->Count, ==, 0);
@@ -2359,6 +3206,16 @@ __TransmitterRingPostFragments(
     if (Packet != NULL) {
         State->Packet = NULL;
 
+        Packet->PostTime = KeQueryPerformanceCounter(NULL).QuadPart;
+        __TransmitterRingRecordLatency(Ring,
+                                       XENVIF_TRANSMITTER_LATENCY_QUEUE_TO_POST,
+                                       Packet->QueueTime,
+                                       Packet->PostTime,
+                                       TRUE);
+
+        __TransmitterRingClassPacketSent(Ring, Packet);
+
+        Ring->InFlightBytes += Packet->Length;
         Ring->PacketsSent++;
     }
 
@@ -2452,6 +3309,55 @@ __TransmitterRingCompletePacket(
     Ring->PacketsCompleted++;
 }
 
+// Adjust the in-flight limit after a batch of completions. If the
+// backend ran dry while packets were being held back then the limit is
+// too low. If data has been left in flight throughout the hold time
+// then the limit can come down by that much.
+static FORCEINLINE VOID
+__TransmitterRingUpdateInFlightLimit(
+    IN  PXENVIF_TRANSMITTER_RING    Ring,
+    IN  LONGLONG                    Now
+    )
+{
+    PXENVIF_TRANSMITTER             Transmitter;
+    ULONGLONG                       Milliseconds;
+    ULONG                           Limit;
+
+    Transmitter = Ring->Transmitter;
+
+    if (Ring->Throttled && Ring->InFlightBytes == 0) {
+        Limit = Ring->InFlightLimit + (Ring->InFlightLimit / 2);
+        Ring->InFlightLimit = __min(Limit, XENVIF_TRANSMITTER_INFLIGHT_LIMIT_MAX);
+        Ring->InFlightLimitRaised++;
+
+        Ring->Throttled = FALSE;
+
+        Ring->InFlightSlack = MAXULONG;
+        Ring->InFlightSlackStart = Now;
+        return;
+    }
+
+    Ring->InFlightSlack = __min(Ring->InFlightSlack, Ring->InFlightBytes);
+
+    Milliseconds = ((ULONGLONG)(Now - Ring->InFlightSlackStart) * 1000ull) /
+                   (ULONGLONG)Transmitter->Frequency.QuadPart;
+
+    if (Milliseconds < XENVIF_TRANSMITTER_INFLIGHT_HOLD_TIME)
+        return;
+
+    if (Ring->InFlightSlack != 0 &&
+        Ring->InFlightLimit > XENVIF_TRANSMITTER_INFLIGHT_LIMIT_MIN) {
+        Limit = (Ring->InFlightLimit > Ring->InFlightSlack) ?
+                Ring->InFlightLimit - Ring->InFlightSlack :
+                0;
+        Ring->InFlightLimit = __max(Limit, XENVIF_TRANSMITTER_INFLIGHT_LIMIT_MIN);
+        Ring->InFlightLimitLowered++;
+    }
+
+    Ring->InFlightSlack = MAXULONG;
+    Ring->InFlightSlackStart = Now;
+}
+
 static DECLSPEC_NOINLINE ULONG
 TransmitterRingPoll(
     IN  PXENVIF_TRANSMITTER_RING    Ring
@@ -2473,6 +3379,7 @@ TransmitterRingPoll(
         RING_IDX    rsp_prod;
         RING_IDX    rsp_cons;
         ULONG       Extra;
+        LONGLONG    Now;
 
         KeMemoryBarrier();
 
@@ -2491,6 +3398,9 @@ TransmitterRingPoll(
             break;
         }
 
+        // One timestamp is good enough for the whole batch
+        Now = KeQueryPerformanceCounter(NULL).QuadPart;
+
         Extra = 0;
         while (rsp_cons != rsp_prod) {
             netif_tx_response_t             *rsp;
@@ -2503,6 +3413,11 @@ TransmitterRingPoll(
             Ring->ResponsesProcessed++;
             Count++;
 
+            if (Ring->Stopped)
+                __TraceLogWrite(Ring->TraceLog,
+                                XENVIF_TRACE_EVENT_STARTED,
+                                Ring->RequestsPosted);
+
             Ring->Stopped = FALSE;
 
             if (rsp->status == NETIF_RSP_NULL) {
@@ -2534,8 +3449,8 @@ TransmitterRingPoll(
                 Buffer->Context = NULL;
 
                 ASSERT(Buffer->Reference != 0);
-                --Buffer->Reference;
-                __TransmitterPutBuffer(Ring, Buffer);
+                if (--Buffer->Reference == 0)
+                    __TransmitterPutBuffer(Ring, Buffer);
 
                 break;
             }
@@ -2619,12 +3534,28 @@ TransmitterRingPoll(
             if (Packet->Completion.Status == 0)
                 Packet->Completion.Status = XENVIF_TRANSMITTER_PACKET_OK;
 
+            ASSERT3U(Ring->InFlightBytes, >=, Packet->Length);
+            Ring->InFlightBytes -= Packet->Length;
+
+            Packet->ResponseTime = Now;
+            __TransmitterRingRecordLatency(Ring,
+                                           XENVIF_TRANSMITTER_LATENCY_POST_TO_RESPONSE,
+                                           Packet->PostTime,
+                                           Packet->ResponseTime,
+                                           TRUE);
+
             __TransmitterRingCompletePacket(Ring, Packet);
         }
         ASSERT3U(Extra, ==, 0);
 
+        __TransmitterRingUpdateInFlightLimit(Ring, Now);
+
         KeMemoryBarrier();
 
+        __TraceLogWrite(Ring->TraceLog,
+                        XENVIF_TRACE_EVENT_RESPONSE,
+                        rsp_cons - Ring->Front.rsp_cons);
+
         Ring->Front.rsp_cons = rsp_cons;
     }
 
@@ -2672,6 +3603,10 @@ __TransmitterRingSend(
     if (!Ring->Connected)
         return;
 
+    __TraceLogWrite(Ring->TraceLog,
+                    XENVIF_TRACE_EVENT_NOTIFY,
+                    Ring->RequestsPosted);
+
     if (FrontendIsSplit(Frontend)) {
         ASSERT(Ring->Channel != NULL);
 
@@ -2702,6 +3637,10 @@ __TransmitterRingPushRequests(
 
 #pragma warning (pop)
 
+    __TraceLogWrite(Ring->TraceLog,
+                    XENVIF_TRACE_EVENT_PUSH,
+                    Ring->RequestsPosted - Ring->RequestsPushed);
+
     if (Notify)
         __TransmitterRingSend(Ring);
 
@@ -2720,12 +3659,17 @@ TransmitterRingSwizzle(
     ULONG_PTR                       Old;
     ULONG_PTR                       New;
     PLIST_ENTRY                     ListEntry;
-    LIST_ENTRY                      List;
+    LIST_ENTRY                      List[XENVIF_TRANSMITTER_CLASS_COUNT];
+    ULONG                           Depth[XENVIF_TRANSMITTER_CLASS_COUNT];
+    ULONG                           Index;
     ULONG                           Count;
 
     ASSERT3P(Ring->LockThread, ==, KeGetCurrentThread());
 
-    InitializeListHead(&List);
+    for (Index = 0; Index < XENVIF_TRANSMITTER_CLASS_COUNT; Index++) {
+        InitializeListHead(&List[Index]);
+        Depth[Index] = 0;
+    }
 
     New = XENVIF_TRANSMITTER_LOCK_BIT;    
     Old = (ULONG_PTR)InterlockedExchangePointer(&Ring->Lock, (PVOID)New);
@@ -2741,23 +3685,120 @@ TransmitterRingSwizzle(
     // necessary to allow addition to the list to be done atomically.
 
     for (Count = 0; ListEntry != NULL; ++Count) {
-        PLIST_ENTRY     NextEntry;
+        PLIST_ENTRY                 NextEntry;
+        PXENVIF_TRANSMITTER_PACKET  Packet;
 
         NextEntry = ListEntry->Blink;
         ListEntry->Flink = ListEntry->Blink = ListEntry;
 
-        InsertHeadList(&List, ListEntry);
+        Packet = CONTAINING_RECORD(ListEntry, XENVIF_TRANSMITTER_PACKET, ListEntry);
+        ASSERT3U(Packet->Class, <, XENVIF_TRANSMITTER_CLASS_COUNT);
+
+        InsertHeadList(&List[Packet->Class], ListEntry);
+        Depth[Packet->Class]++;
 
         ListEntry = NextEntry;
     }
 
-    if (!IsListEmpty(&List)) {
-        ListEntry = List.Flink;
+    for (Index = 0; Index < XENVIF_TRANSMITTER_CLASS_COUNT; Index++) {
+        PXENVIF_TRANSMITTER_CLASS   Class = &Ring->Class[Index];
+
+        if (IsListEmpty(&List[Index]))
+            continue;
+
+        ListEntry = List[Index].Flink;
+
+        RemoveEntryList(&List[Index]);
+        AppendTailList(&Class->PacketQueue, ListEntry);
+
+        Class->Depth += Depth[Index];
+        Class->MaximumDepth = __max(Class->MaximumDepth, Class->Depth);
+    }
+
+    Ring->PacketsQueued += Count;
+}
+
+static FORCEINLINE BOOLEAN
+__TransmitterRingHasQueuedPackets(
+    IN  PXENVIF_TRANSMITTER_RING    Ring
+    )
+{
+    ULONG                           Index;
+
+    for (Index = 0; Index < XENVIF_TRANSMITTER_CLASS_COUNT; Index++) {
+        if (!IsListEmpty(&Ring->Class[Index].PacketQueue))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static FORCEINLINE PXENVIF_TRANSMITTER_PACKET
+__TransmitterRingClassGetPacket(
+    IN  PXENVIF_TRANSMITTER_CLASS   Class
+    )
+{
+    PLIST_ENTRY                     ListEntry;
+
+    ListEntry = RemoveHeadList(&Class->PacketQueue);
+    ASSERT3P(ListEntry, !=, &Class->PacketQueue);
+
+    RtlZeroMemory(ListEntry, sizeof (LIST_ENTRY));
+
+    ASSERT(Class->Depth != 0);
+    --Class->Depth;
+
+    return CONTAINING_RECORD(ListEntry, XENVIF_TRANSMITTER_PACKET, ListEntry);
+}
+
+// Deficit round robin: each visit to a class tops up its deficit by
+// a quantum and the class may send its head packet once the deficit
+// covers it. A class that runs empty loses any remaining deficit.
+static FORCEINLINE PXENVIF_TRANSMITTER_PACKET
+__TransmitterRingGetQueuedPacket(
+    IN  PXENVIF_TRANSMITTER_RING    Ring
+    )
+{
+    PXENVIF_TRANSMITTER             Transmitter;
+    ULONG                           Empty;
+
+    Transmitter = Ring->Transmitter;
+
+    if (Transmitter->PriorityClasses == 0) {
+        PXENVIF_TRANSMITTER_CLASS   Class = &Ring->Class[0];
+
+        return (!IsListEmpty(&Class->PacketQueue)) ?
+               __TransmitterRingClassGetPacket(Class) :
+               NULL;
+    }
+
+    Empty = 0;
+
+    for (;;) {
+        PXENVIF_TRANSMITTER_CLASS   Class = &Ring->Class[Ring->ClassIndex];
+
+        if (!IsListEmpty(&Class->PacketQueue)) {
+            PXENVIF_TRANSMITTER_PACKET  Packet;
+
+            Packet = CONTAINING_RECORD(Class->PacketQueue.Flink,
+                                       XENVIF_TRANSMITTER_PACKET,
+                                       ListEntry);
+
+            if (Packet->Length <= Class->Deficit) {
+                Class->Deficit -= Packet->Length;
+                return __TransmitterRingClassGetPacket(Class);
+            }
+
+            Empty = 0;
+        } else {
+            Class->Deficit = 0;
 
-        RemoveEntryList(&List);
-        AppendTailList(&Ring->PacketQueue, ListEntry);
+            if (++Empty == XENVIF_TRANSMITTER_CLASS_COUNT)
+                return NULL;
+        }
 
-        Ring->PacketsQueued += Count;
+        Ring->ClassIndex = (Ring->ClassIndex + 1) % XENVIF_TRANSMITTER_CLASS_COUNT;
+        Ring->Class[Ring->ClassIndex].Deficit += XENVIF_TRANSMITTER_CLASS_QUANTUM;
     }
 }
 
@@ -2780,8 +3821,14 @@ TransmitterRingSchedule(
 
         if (State->Count != 0) {
             status = __TransmitterRingPostFragments(Ring);
-            if (!NT_SUCCESS(status))
+            if (!NT_SUCCESS(status)) {
+                __TraceLogWrite(Ring->TraceLog,
+                                XENVIF_TRACE_EVENT_STOPPED,
+                                Ring->RequestsPosted);
+
                 Ring->Stopped = TRUE;
+                FrontendWakeWatchdog(Ring->Transmitter->Frontend);
+            }
         }
 
         if (Ring->Stopped) {
@@ -2814,14 +3861,26 @@ TransmitterRingSchedule(
 
             switch (Request->Type) {
             case XENVIF_TRANSMITTER_REQUEST_TYPE_ARP:
-                (VOID) __TransmitterRingPrepareArp(Ring,
-                                                   &Request->Arp.Address);
-                break;
+            case XENVIF_TRANSMITTER_REQUEST_TYPE_NEIGHBOUR_ADVERTISEMENT: {
+                PXENVIF_TRANSMITTER Transmitter = Ring->Transmitter;
 
-            case XENVIF_TRANSMITTER_REQUEST_TYPE_NEIGHBOUR_ADVERTISEMENT:
-                (VOID) __TransmitterRingPrepareNeighbourAdvertisement(Ring,
-                                                                      &Request->NeighbourAdvertisement.Address);
-                break;
+                (VOID) __TransmitterRingPrepareAdvertisement(Ring,
+                                                             Request->Advertisement.Buffer);
+
+                if (--Request->Advertisement.Count == 0)
+                    break;
+
+                // Replay later, either immediately or when the
+                // advertisement thread next releases the queue
+                if (Transmitter->AdvertisementInterval == 0) {
+                    InsertTailList(&Ring->RequestQueue, &Request->ListEntry);
+                } else {
+                    InsertTailList(&Ring->AdvertisementQueue, &Request->ListEntry);
+                    ThreadWake(Transmitter->AdvertisementThread);
+                }
+
+                continue;
+            }
 
             case XENVIF_TRANSMITTER_REQUEST_TYPE_MULTICAST_CONTROL:
                 (VOID) __TransmitterRingPrepareMulticastControl(Ring,
@@ -2833,28 +3892,39 @@ TransmitterRingSchedule(
                 break;
             }
 
-            Request->Type = XENVIF_TRANSMITTER_REQUEST_TYPE_INVALID;
-            __TransmitterPutRequest(Ring, Request);
+            __TransmitterRingDiscardRequest(Ring, Request);
             continue;
         }
 
-        if (!IsListEmpty(&Ring->PacketQueue)) {
-            PLIST_ENTRY                 ListEntry;
+        if (__TransmitterRingHasQueuedPackets(Ring)) {
             PXENVIF_TRANSMITTER_PACKET  Packet;
 
-            ListEntry = RemoveHeadList(&Ring->PacketQueue);
-            ASSERT3P(ListEntry, !=, &Ring->PacketQueue);
+            // Leave packets queued while the backend already has
+            // enough to be getting on with
+            if (Ring->Transmitter->DisableInFlightLimit == 0 &&
+                Ring->InFlightBytes >= Ring->InFlightLimit) {
+                if (!Ring->Throttled) {
+                    Ring->Throttled = TRUE;
+                    Ring->Throttles++;
+                }
 
-            RtlZeroMemory(ListEntry, sizeof (LIST_ENTRY));
+                break;
+            }
 
-            Packet = CONTAINING_RECORD(ListEntry,
-                                       XENVIF_TRANSMITTER_PACKET,
-                                       ListEntry);
+            Ring->Throttled = FALSE;
+
+            Packet = __TransmitterRingGetQueuedPacket(Ring);
+            ASSERT(Packet != NULL);
 
             Packet->Reference = 0;
 
             ASSERT3U(Packet->Completion.Status, ==, 0);
 
+            if (Ring->Rebalancing &&
+                Packet->Hash.Algorithm == XENVIF_PACKET_HASH_ALGORITHM_TOEPLITZ)
+                Ring->HashLoad[Packet->Hash.Value % XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE] +=
+                    Packet->Length;
+
             status = __TransmitterRingPreparePacket(Ring, Packet);
             if (!NT_SUCCESS(status)) {
                 PXENVIF_TRANSMITTER Transmitter;
@@ -2875,7 +3945,7 @@ TransmitterRingSchedule(
                 __TransmitterRingCompletePacket(Ring, Packet);
             }
 
-            ASSERT3U(Ring->PacketsPrepared, ==, Ring->PacketsCopied + Ring->PacketsGranted + Ring->PacketsFaked);
+            ASSERT3U(Ring->PacketsPrepared, ==, Ring->PacketsCopied + Ring->PacketsGranted + Ring->PacketsHybrid + Ring->PacketsFaked);
             continue;
         }
 
@@ -3053,16 +4123,21 @@ __TransmitterSetCompletionInfo(
 
 static FORCEINLINE VOID
 __TransmitterReturnPackets(
-    IN  PXENVIF_TRANSMITTER Transmitter,
-    IN  PLIST_ENTRY         List
+    IN  PXENVIF_TRANSMITTER_RING    Ring,
+    IN  PLIST_ENTRY                 List
     )
 {
-    PXENVIF_FRONTEND        Frontend;
-    PXENVIF_VIF_CONTEXT     Context;
+    PXENVIF_TRANSMITTER             Transmitter;
+    PXENVIF_FRONTEND                Frontend;
+    PXENVIF_VIF_CONTEXT             Context;
+    LONGLONG                        Now;
 
+    Transmitter = Ring->Transmitter;
     Frontend = Transmitter->Frontend;
     Context = PdoGetVifContext(FrontendGetPdo(Frontend));
 
+    Now = KeQueryPerformanceCounter(NULL).QuadPart;
+
     while (!IsListEmpty(List)) {
         PLIST_ENTRY                 ListEntry;
         PXENVIF_TRANSMITTER_PACKET  Packet;
@@ -3078,6 +4153,13 @@ __TransmitterReturnPackets(
 
         __TransmitterSetCompletionInfo(Transmitter, Packet);
 
+        // This may run on several CPUs at once, outside the ring lock
+        __TransmitterRingRecordLatency(Ring,
+                                       XENVIF_TRANSMITTER_LATENCY_RESPONSE_TO_COMPLETION,
+                                       Packet->ResponseTime,
+                                       Now,
+                                       FALSE);
+
         VifTransmitterReturnPacket(Context,
                                    Packet->Cookie,
                                    &Packet->Completion);
@@ -3207,13 +4289,8 @@ __TransmitterRingReleaseLock(
         }
     } while (!__TransmitterRingTryReleaseLock(Ring));
 
-    if (!IsListEmpty(&List)) {
-        PXENVIF_TRANSMITTER Transmitter;
-
-        Transmitter = Ring->Transmitter;
-
-        __TransmitterReturnPackets(Transmitter, &List);
-    }
+    if (!IsListEmpty(&List))
+        __TransmitterReturnPackets(Ring, &List);
 }
 
 static DECLSPEC_NOINLINE VOID
@@ -3246,27 +4323,28 @@ __TransmitterRingUnmask(
                           Force);
 }
 
-__drv_functionClass(KDEFERRED_ROUTINE)
-__drv_maxIRQL(DISPATCH_LEVEL)
-__drv_minIRQL(DISPATCH_LEVEL)
-__drv_requiresIRQL(DISPATCH_LEVEL)
-__drv_sameIRQL
 static VOID
-TransmitterRingPollDpc(
-    IN  PKDPC                   Dpc,
-    IN  PVOID                   Context,
-    IN  PVOID                   Argument1,
-    IN  PVOID                   Argument2
+TransmitterRingService(
+    IN  PXENVIF_TRANSMITTER_RING    Ring
     )
 {
-    PXENVIF_TRANSMITTER_RING    Ring = Context;
-    ULONG                       Count;
+    PXENVIF_TRANSMITTER             Transmitter;
+    LARGE_INTEGER                   Start;
+    LARGE_INTEGER                   End;
+    LONGLONG                        Signalled;
+    KIRQL                           Irql;
+    ULONG                           Count;
 
-    UNREFERENCED_PARAMETER(Dpc);
-    UNREFERENCED_PARAMETER(Argument1);
-    UNREFERENCED_PARAMETER(Argument2);
+    Transmitter = Ring->Transmitter;
 
-    ASSERT(Ring != NULL);
+    Start = KeQueryPerformanceCounter(NULL);
+
+    __TraceLogWrite(Ring->TraceLog,
+                    XENVIF_TRACE_EVENT_DPC_ENTRY,
+                    Ring->PollDpcs);
+
+    // Threaded DPCs and the worker thread may run below DISPATCH_LEVEL
+    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
 
     Count = 0;
 
@@ -3279,46 +4357,56 @@ TransmitterRingPollDpc(
                                     (Count > XENVIF_TRANSMITTER_RING_SIZE)))
             break;
     }
-}
 
-KSERVICE_ROUTINE    TransmitterRingEvtchnCallback;
-
-BOOLEAN
-TransmitterRingEvtchnCallback(
-    IN  PKINTERRUPT             InterruptObject,
-    IN  PVOID                   Argument
-    )
-{
-    PXENVIF_TRANSMITTER_RING    Ring = Argument;
-    PXENVIF_TRANSMITTER         Transmitter;
-    PXENVIF_FRONTEND            Frontend;
+    KeLowerIrql(Irql);
 
-    UNREFERENCED_PARAMETER(InterruptObject);
+    __TraceLogWrite(Ring->TraceLog,
+                    XENVIF_TRACE_EVENT_DPC_EXIT,
+                    Count);
 
-    ASSERT(Ring != NULL);
+    End = KeQueryPerformanceCounter(NULL);
 
-    Transmitter = Ring->Transmitter;
-    Frontend = Transmitter->Frontend;
+    Signalled = InterlockedExchange64(&Ring->Signalled, 0);
+    if (Signalled != 0 && Start.QuadPart >= Signalled)
+        Ring->DispatchTime += ((ULONGLONG)(Start.QuadPart - Signalled) * 1000000ull) /
+                              (ULONGLONG)Transmitter->Frequency.QuadPart;
 
-    ASSERT(FrontendIsSplit(Frontend));
+    Ring->RunTime += ((ULONGLONG)(End.QuadPart - Start.QuadPart) * 1000000ull) /
+                     (ULONGLONG)Transmitter->Frequency.QuadPart;
+    Ring->Runs++;
+}
 
-    Ring->Events++;
+__drv_functionClass(KDEFERRED_ROUTINE)
+__drv_maxIRQL(DISPATCH_LEVEL)
+__drv_minIRQL(PASSIVE_LEVEL)
+__drv_sameIRQL
+static VOID
+TransmitterRingPollDpc(
+    IN  PKDPC                   Dpc,
+    IN  PVOID                   Context,
+    IN  PVOID                   Argument1,
+    IN  PVOID                   Argument2
+    )
+{
+    PXENVIF_TRANSMITTER_RING    Ring = Context;
 
-    if (KeInsertQueueDpc(&Ring->PollDpc, NULL, NULL))
-        Ring->PollDpcs++;
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(Argument1);
+    UNREFERENCED_PARAMETER(Argument2);
 
-    return TRUE;
-}
+    ASSERT(Ring != NULL);
 
-#define TIME_US(_us)        ((_us) * 10)
-#define TIME_MS(_ms)        (TIME_US((_ms) * 1000))
-#define TIME_S(_s)          (TIME_MS((_s) * 1000))
-#define TIME_RELATIVE(_t)   (-(_t))
+    // The event channel callback cannot wake a thread directly
+    if (Ring->Mode == XENVIF_TRANSMITTER_MODE_WORKER) {
+        ThreadWake(Ring->WorkerThread);
+        return;
+    }
 
-#define XENVIF_TRANSMITTER_WATCHDOG_PERIOD  30
+    TransmitterRingService(Ring);
+}
 
 static NTSTATUS
-TransmitterRingWatchdog(
+TransmitterRingWorker(
     IN  PXENVIF_THREAD          Self,
     IN  PVOID                   Context
     )
@@ -3326,9 +4414,7 @@ TransmitterRingWatchdog(
     PXENVIF_TRANSMITTER_RING    Ring = Context;
     PROCESSOR_NUMBER            ProcNumber;
     GROUP_AFFINITY              Affinity;
-    LARGE_INTEGER               Timeout;
-    ULONG                       PacketsQueued;
-    NTSTATUS                    status;
+    PKEVENT                     Event;
 
     Trace("====>\n");
 
@@ -3339,64 +4425,74 @@ TransmitterRingWatchdog(
         //
         // The following functions don't work before Windows 7
         //
-        status = KeGetProcessorNumberFromIndex(Ring->Index, &ProcNumber);
-        ASSERT(NT_SUCCESS(status));
+        FrontendGetRingProcessor(Ring->Transmitter->Frontend,
+                                 Ring->Index,
+                                 &ProcNumber);
 
         Affinity.Group = ProcNumber.Group;
         Affinity.Mask = (KAFFINITY)1 << ProcNumber.Number;
         KeSetSystemGroupAffinityThread(&Affinity, NULL);
     }
 
-    Timeout.QuadPart = TIME_RELATIVE(TIME_S(XENVIF_TRANSMITTER_WATCHDOG_PERIOD));
-    PacketsQueued = 0;
-
-    for (;;) { 
-        PKEVENT Event;
-        KIRQL   Irql;
-
-        Event = ThreadGetEvent(Self);
+    Event = ThreadGetEvent(Self);
 
+    for (;;) {
         (VOID) KeWaitForSingleObject(Event,
                                      Executive,
                                      KernelMode,
                                      FALSE,
-                                     &Timeout);
+                                     NULL);
         KeClearEvent(Event);
 
         if (ThreadIsAlerted(Self))
             break;
 
-        KeRaiseIrql(DISPATCH_LEVEL, &Irql);
-        __TransmitterRingAcquireLock(Ring);
+        TransmitterRingService(Ring);
+    }
 
-        if (Ring->Enabled) {
-            if (Ring->PacketsQueued == PacketsQueued &&
-                Ring->PacketsCompleted != PacketsQueued) {
-                PXENVIF_TRANSMITTER Transmitter;
+    Trace("<====\n");
 
-                Transmitter = Ring->Transmitter;
+    return STATUS_SUCCESS;
+}
 
-                XENBUS_DEBUG(Trigger,
-                             &Transmitter->DebugInterface,
-                             Ring->DebugCallback);
+KSERVICE_ROUTINE    TransmitterRingEvtchnCallback;
 
-                // Try to move things along
-                __TransmitterRingTrigger(Ring);
-                __TransmitterRingSend(Ring);
-            }
+BOOLEAN
+TransmitterRingEvtchnCallback(
+    IN  PKINTERRUPT             InterruptObject,
+    IN  PVOID                   Argument
+    )
+{
+    PXENVIF_TRANSMITTER_RING    Ring = Argument;
+    PXENVIF_TRANSMITTER         Transmitter;
+    PXENVIF_FRONTEND            Frontend;
 
-            PacketsQueued = Ring->PacketsQueued;
-        }
+    UNREFERENCED_PARAMETER(InterruptObject);
 
-        __TransmitterRingReleaseLock(Ring);
-        KeLowerIrql(Irql);
-    }
+    ASSERT(Ring != NULL);
 
-    Trace("<====\n");
+    Transmitter = Ring->Transmitter;
+    Frontend = Transmitter->Frontend;
 
-    return STATUS_SUCCESS;
+    ASSERT(FrontendIsSplit(Frontend));
+
+    Ring->Events++;
+
+    (VOID) InterlockedCompareExchange64(&Ring->Signalled,
+                                        KeQueryPerformanceCounter(NULL).QuadPart,
+                                        0);
+
+    if (KeInsertQueueDpc(&Ring->PollDpc, NULL, NULL))
+        Ring->PollDpcs++;
+
+    return TRUE;
 }
 
+#define TIME_US(_us)        ((_us) * 10)
+#define TIME_MS(_ms)        (TIME_US((_ms) * 1000))
+#define TIME_S(_s)          (TIME_MS((_s) * 1000))
+#define TIME_RELATIVE(_t)   (-(_t))
+
 static FORCEINLINE NTSTATUS
 __TransmitterRingInitialize(
     IN  PXENVIF_TRANSMITTER         Transmitter,
@@ -3406,6 +4502,7 @@ __TransmitterRingInitialize(
 {
     PXENVIF_FRONTEND                Frontend;
     CHAR                            Name[MAXNAMELEN];
+    ULONG                           ClassIndex;
     NTSTATUS                        status;
 
     Frontend = Transmitter->Frontend;
@@ -3418,16 +4515,24 @@ __TransmitterRingInitialize(
 
     (*Ring)->Transmitter = Transmitter;
     (*Ring)->Index = Index;
+    (*Ring)->Mode = Transmitter->Mode;
+    (*Ring)->Rebalancing = FrontendIsRebalancing(Frontend);
 
     (*Ring)->Path = FrontendFormatPath(Frontend, Index);
     if ((*Ring)->Path == NULL)
         goto fail2;
 
-    InitializeListHead(&(*Ring)->PacketQueue);
+    for (ClassIndex = 0; ClassIndex < XENVIF_TRANSMITTER_CLASS_COUNT; ClassIndex++)
+        InitializeListHead(&(*Ring)->Class[ClassIndex].PacketQueue);
+
     InitializeListHead(&(*Ring)->RequestQueue);
+    InitializeListHead(&(*Ring)->AdvertisementQueue);
     InitializeListHead(&(*Ring)->PacketComplete);
 
-    KeInitializeDpc(&(*Ring)->PollDpc, TransmitterRingPollDpc, *Ring);
+    if ((*Ring)->Mode == XENVIF_TRANSMITTER_MODE_THREADED)
+        KeInitializeThreadedDpc(&(*Ring)->PollDpc, TransmitterRingPollDpc, *Ring);
+    else
+        KeInitializeDpc(&(*Ring)->PollDpc, TransmitterRingPollDpc, *Ring);
 
     status = RtlStringCbPrintfA(Name,
                                 sizeof (Name),
@@ -3559,14 +4664,43 @@ __TransmitterRingInitialize(
     if (!NT_SUCCESS(status))
         goto fail13;
 
-    status = ThreadCreate(TransmitterRingWatchdog,
-                          *Ring,
-                          &(*Ring)->WatchdogThread);
-    if (!NT_SUCCESS(status))
+    (*Ring)->Mdl = __AllocatePageOnNode(FrontendGetRingNode(Frontend,
+                                                            (*Ring)->Index));
+
+    status = STATUS_NO_MEMORY;
+    if ((*Ring)->Mdl == NULL)
         goto fail14;
 
+    if (Transmitter->TraceLogSize != 0) {
+        (*Ring)->TraceLog = __TraceLogCreate(Transmitter->TraceLogSize);
+
+        status = STATUS_NO_MEMORY;
+        if ((*Ring)->TraceLog == NULL)
+            goto fail15;
+    }
+
+    if ((*Ring)->Mode == XENVIF_TRANSMITTER_MODE_WORKER) {
+        status = ThreadCreate(TransmitterRingWorker,
+                              *Ring,
+                              &(*Ring)->WorkerThread);
+        if (!NT_SUCCESS(status))
+            goto fail16;
+    }
+
     return STATUS_SUCCESS;
 
+fail16:
+    Error("fail16\n");
+
+    __TraceLogDestroy((*Ring)->TraceLog);
+    (*Ring)->TraceLog = NULL;
+
+fail15:
+    Error("fail15\n");
+
+    __FreePage((*Ring)->Mdl);
+    (*Ring)->Mdl = NULL;
+
 fail14:
     Error("fail14\n");
 
@@ -3637,8 +4771,9 @@ fail3:
     RtlZeroMemory(&(*Ring)->PollDpc, sizeof (KDPC));
 
     RtlZeroMemory(&(*Ring)->PacketComplete, sizeof (LIST_ENTRY));
+    RtlZeroMemory(&(*Ring)->AdvertisementQueue, sizeof (LIST_ENTRY));
     RtlZeroMemory(&(*Ring)->RequestQueue, sizeof (LIST_ENTRY));
-    RtlZeroMemory(&(*Ring)->PacketQueue, sizeof (LIST_ENTRY));
+    RtlZeroMemory(&(*Ring)->Class, sizeof ((*Ring)->Class));
 
     FrontendFreePath(Frontend, (*Ring)->Path);
     (*Ring)->Path = NULL;
@@ -3646,6 +4781,8 @@ fail3:
 fail2:
     Error("fail2\n");
 
+    (*Ring)->Rebalancing = FALSE;
+    (*Ring)->Mode = 0;
     (*Ring)->Index = 0;
     (*Ring)->Transmitter = NULL;
 
@@ -3699,12 +4836,6 @@ __TransmitterRingConnect(
     if (!NT_SUCCESS(status))
         goto fail2;
 
-    Ring->Mdl = __AllocatePage();
-
-    status = STATUS_NO_MEMORY;
-    if (Ring->Mdl == NULL)
-        goto fail3;
-
     ASSERT(Ring->Mdl->MdlFlags & MDL_MAPPED_TO_SYSTEM_VA);
     Ring->Shared = Ring->Mdl->MappedSystemVa;
     ASSERT(Ring->Shared != NULL);
@@ -3724,14 +4855,14 @@ __TransmitterRingConnect(
                            FALSE,
                            &Ring->Entry);
     if (!NT_SUCCESS(status))
-        goto fail4;
+        goto fail3;
 
     status = RtlStringCbPrintfA(Name,
                                 sizeof (Name),
                                 __MODULE__ "|TRANSMITTER[%u]",
                                 Ring->Index);
     if (!NT_SUCCESS(status))
-        goto fail5;
+        goto fail4;
 
     ASSERT3U(KeGetCurrentIrql(), ==, DISPATCH_LEVEL);
 
@@ -3746,10 +4877,9 @@ __TransmitterRingConnect(
 
         status = STATUS_UNSUCCESSFUL;
         if (Ring->Channel == NULL)
-            goto fail6;
+            goto fail5;
 
-        status = KeGetProcessorNumberFromIndex(Ring->Index, &ProcNumber);
-        ASSERT(NT_SUCCESS(status));
+        FrontendGetRingProcessor(Frontend, Ring->Index, &ProcNumber);
 
         KeSetTargetProcessorDpcEx(&Ring->PollDpc, &ProcNumber);
 
@@ -3773,14 +4903,14 @@ __TransmitterRingConnect(
                           Ring,
                           &Ring->DebugCallback);
     if (!NT_SUCCESS(status))
-        goto fail7;
+        goto fail6;
 
     Ring->Connected = TRUE;
 
     return STATUS_SUCCESS;
 
-fail7:
-    Error("fail7\n");
+fail6:
+    Error("fail6\n");
 
     XENBUS_EVTCHN(Close,
                   &Transmitter->EvtchnInterface,
@@ -3789,12 +4919,12 @@ fail7:
 
     Ring->Events = 0;
 
-fail6:
-    Error("fail6\n");
-
 fail5:
     Error("fail5\n");
 
+fail4:
+    Error("fail4\n");
+
     (VOID) XENBUS_GNTTAB(RevokeForeignAccess,
                          &Transmitter->GnttabInterface,
                          Ring->GnttabCache,
@@ -3802,18 +4932,13 @@ fail5:
                          Ring->Entry);
     Ring->Entry = NULL;
 
-fail4:
-    Error("fail4\n");
+fail3:
+    Error("fail3\n");
 
     RtlZeroMemory(&Ring->Front, sizeof (netif_tx_front_ring_t));
     RtlZeroMemory(Ring->Shared, PAGE_SIZE);
 
     Ring->Shared = NULL;
-    __FreePage(Ring->Mdl);
-    Ring->Mdl = NULL;
-
-fail3:
-    Error("fail3\n");
 
     XENBUS_GNTTAB(DestroyCache,
                   &Transmitter->GnttabInterface,
@@ -3909,6 +5034,11 @@ __TransmitterRingEnable(
     ASSERT(!Ring->Enabled);
     Ring->Enabled = TRUE;
 
+    ASSERT3U(Ring->InFlightBytes, ==, 0);
+    Ring->InFlightLimit = XENVIF_TRANSMITTER_INFLIGHT_LIMIT_MIN;
+    Ring->InFlightSlack = MAXULONG;
+    Ring->InFlightSlackStart = KeQueryPerformanceCounter(NULL).QuadPart;
+
     KeInsertQueueDpc(&Ring->PollDpc, NULL, NULL);
 
     __TransmitterRingReleaseLock(Ring);
@@ -3947,11 +5077,17 @@ __TransmitterRingDisable(
     // Release any fragments associated with a pending packet
     Packet = __TransmitterRingUnprepareFragments(Ring);
 
-    // Put any packet back on the head of the queue
-    if (Packet != NULL)
-        InsertHeadList(&Ring->PacketQueue, &Packet->ListEntry);
+    // Put any packet back on the head of its queue
+    if (Packet != NULL) {
+        PXENVIF_TRANSMITTER_CLASS   Class = &Ring->Class[Packet->Class];
+
+        InsertHeadList(&Class->PacketQueue, &Packet->ListEntry);
+        Class->Depth++;
+    }
 
     // Discard any pending requests
+    __TransmitterRingReleaseAdvertisements(Ring);
+
     while (!IsListEmpty(&Ring->RequestQueue)) {
         PLIST_ENTRY                 ListEntry;
         PXENVIF_TRANSMITTER_REQUEST Request;
@@ -3959,12 +5095,13 @@ __TransmitterRingDisable(
         ListEntry = RemoveHeadList(&Ring->RequestQueue);
         ASSERT3P(ListEntry, !=, &Ring->RequestQueue);
 
+        RtlZeroMemory(ListEntry, sizeof (LIST_ENTRY));
+
         Request = CONTAINING_RECORD(ListEntry,
                                     XENVIF_TRANSMITTER_REQUEST,
                                     ListEntry);
 
-        Request->Type = XENVIF_TRANSMITTER_REQUEST_TYPE_INVALID;
-        __TransmitterPutRequest(Ring, Request);
+        __TransmitterRingDiscardRequest(Ring, Request);
     }
 
     status = XENBUS_STORE(Read,
@@ -4004,6 +5141,12 @@ __TransmitterRingDisable(
         KeStallExecutionProcessor(1000);    // 1ms
     }
 
+    ASSERT3U(Ring->InFlightBytes, ==, 0);
+    Ring->InFlightLimit = 0;
+    Ring->InFlightSlack = 0;
+    Ring->InFlightSlackStart = 0;
+    Ring->Throttled = FALSE;
+
     Ring->Enabled = FALSE;
 
     __TransmitterRingReleaseLock(Ring);
@@ -4061,8 +5204,6 @@ __TransmitterRingDisconnect(
     RtlZeroMemory(Ring->Shared, PAGE_SIZE);
 
     Ring->Shared = NULL;
-    __FreePage(Ring->Mdl);
-    Ring->Mdl = NULL;
 
     XENBUS_GNTTAB(DestroyCache,
                   &Transmitter->GnttabInterface,
@@ -4077,31 +5218,70 @@ __TransmitterRingTeardown(
 {
     PXENVIF_TRANSMITTER             Transmitter;
     PXENVIF_FRONTEND                Frontend;
+    ULONG                           Index;
 
     Transmitter = Ring->Transmitter;
     Frontend = Transmitter->Frontend;
 
+    if (Ring->Mode == XENVIF_TRANSMITTER_MODE_WORKER) {
+        ThreadAlert(Ring->WorkerThread);
+        ThreadJoin(Ring->WorkerThread);
+        Ring->WorkerThread = NULL;
+    }
+
+    Ring->Signalled = 0;
+    Ring->Runs = 0;
+    Ring->DispatchTime = 0;
+    Ring->RunTime = 0;
+
     Ring->PollDpcs = 0;
 
     RtlZeroMemory(&Ring->PollDpc, sizeof (KDPC));
 
+    RtlZeroMemory(Ring->HashLoad, sizeof (Ring->HashLoad));
+    RtlZeroMemory(Ring->Latency, sizeof (Ring->Latency));
+
     ASSERT3U(Ring->PacketsCompleted, ==, Ring->PacketsSent);
     ASSERT3U(Ring->PacketsSent, ==, Ring->PacketsPrepared - Ring->PacketsUnprepared);
-    ASSERT3U(Ring->PacketsPrepared, ==, Ring->PacketsCopied + Ring->PacketsGranted + Ring->PacketsFaked);
+    ASSERT3U(Ring->PacketsPrepared, ==, Ring->PacketsCopied + Ring->PacketsGranted + Ring->PacketsHybrid + Ring->PacketsFaked);
     ASSERT3U(Ring->PacketsQueued, ==, Ring->PacketsPrepared - Ring->PacketsUnprepared);
 
     Ring->PacketsCompleted = 0;
     Ring->PacketsSent = 0;
     Ring->PacketsCopied = 0;
     Ring->PacketsGranted = 0;
+    Ring->PacketsHybrid = 0;
+    Ring->BytesGranted = 0;
+    Ring->BytesCopied = 0;
+    Ring->PacketsUntagged = 0;
+    Ring->PacketsTagged = 0;
+    Ring->PacketsDoubleTagged = 0;
+    Ring->ChecksumsEmulated = 0;
     Ring->PacketsFaked = 0;
     Ring->PacketsUnprepared = 0;
     Ring->PacketsPrepared = 0;
     Ring->PacketsQueued = 0;
 
-    ThreadAlert(Ring->WatchdogThread);
-    ThreadJoin(Ring->WatchdogThread);
-    Ring->WatchdogThread = NULL;
+    Ring->AdvertisementsSent = 0;
+
+    Ring->WatchdogPacketsQueued = 0;
+    Ring->StallResponses = 0;
+    Ring->StallSampled = FALSE;
+    Ring->Stalled = FALSE;
+    Ring->Stalls = 0;
+
+    Ring->Throttles = 0;
+    Ring->InFlightLimitRaised = 0;
+    Ring->InFlightLimitLowered = 0;
+
+    __TraceLogDestroy(Ring->TraceLog);
+    Ring->TraceLog = NULL;
+
+    __FreePage(Ring->Mdl);
+    Ring->Mdl = NULL;
+
+    Ring->Rebalancing = FALSE;
+    Ring->Mode = 0;
 
     XENBUS_CACHE(Destroy,
                  &Transmitter->CacheInterface,
@@ -4137,11 +5317,21 @@ __TransmitterRingTeardown(
     ASSERT(IsListEmpty(&Ring->PacketComplete));
     RtlZeroMemory(&Ring->PacketComplete, sizeof (LIST_ENTRY));
 
+    ASSERT(IsListEmpty(&Ring->AdvertisementQueue));
+    RtlZeroMemory(&Ring->AdvertisementQueue, sizeof (LIST_ENTRY));
+
     ASSERT(IsListEmpty(&Ring->RequestQueue));
     RtlZeroMemory(&Ring->RequestQueue, sizeof (LIST_ENTRY));
 
-    ASSERT(IsListEmpty(&Ring->PacketQueue));
-    RtlZeroMemory(&Ring->PacketQueue, sizeof (LIST_ENTRY));
+    for (Index = 0; Index < XENVIF_TRANSMITTER_CLASS_COUNT; Index++) {
+        PXENVIF_TRANSMITTER_CLASS   Class = &Ring->Class[Index];
+
+        ASSERT(IsListEmpty(&Class->PacketQueue));
+        ASSERT3U(Class->Depth, ==, 0);
+    }
+
+    RtlZeroMemory(Ring->Class, sizeof (Ring->Class));
+    Ring->ClassIndex = 0;
 
     FrontendFreePath(Frontend, Ring->Path);
     Ring->Path = NULL;
@@ -4153,26 +5343,26 @@ __TransmitterRingTeardown(
     __TransmitterFree(Ring);
 }
 
+// Head is the most recent packet of a chain linked back through Blink
+// to Tail, the oldest, so the whole chain is added in one go.
 static FORCEINLINE VOID
-__TransmitterRingQueuePacket(
+__TransmitterRingQueuePackets(
     IN  PXENVIF_TRANSMITTER_RING    Ring,
-    IN  PXENVIF_TRANSMITTER_PACKET  Packet,
+    IN  PLIST_ENTRY                 Head,
+    IN  PLIST_ENTRY                 Tail,
     IN  BOOLEAN                     More
     )
 {
-    PLIST_ENTRY                     ListEntry;
     ULONG_PTR                       Old;
     ULONG_PTR                       LockBit;
     ULONG_PTR                       New;
 
-    ListEntry = &Packet->ListEntry;
-
     do {
         Old = (ULONG_PTR)Ring->Lock;
         LockBit = Old & XENVIF_TRANSMITTER_LOCK_BIT;
 
-        ListEntry->Blink = (PVOID)(Old & ~XENVIF_TRANSMITTER_LOCK_BIT);
-        New = (ULONG_PTR)ListEntry;
+        Tail->Blink = (PVOID)(Old & ~XENVIF_TRANSMITTER_LOCK_BIT);
+        New = (ULONG_PTR)Head;
         ASSERT((New & XENVIF_TRANSMITTER_LOCK_BIT) == 0);
         New |= LockBit;
     } while ((ULONG_PTR)InterlockedCompareExchangePointer(&Ring->Lock, (PVOID)New, (PVOID)Old) != Old);
@@ -4196,6 +5386,7 @@ __TransmitterRingAbortPackets(
 {
     PXENVIF_TRANSMITTER             Transmitter;
     PXENVIF_FRONTEND                Frontend;
+    ULONG                           Index;
     ULONG                           Count;
 
     Transmitter = Ring->Transmitter;
@@ -4206,25 +5397,24 @@ __TransmitterRingAbortPackets(
     TransmitterRingSwizzle(Ring);
 
     Count = 0;
-    while (!IsListEmpty(&Ring->PacketQueue)) {
-        PLIST_ENTRY                 ListEntry;
-        PXENVIF_TRANSMITTER_PACKET  Packet;
-        
-        ListEntry = RemoveHeadList(&Ring->PacketQueue);
-        ASSERT3P(ListEntry, !=, &Ring->PacketQueue);
+    for (Index = 0; Index < XENVIF_TRANSMITTER_CLASS_COUNT; Index++) {
+        PXENVIF_TRANSMITTER_CLASS   Class = &Ring->Class[Index];
 
-        Packet = CONTAINING_RECORD(ListEntry, XENVIF_TRANSMITTER_PACKET, ListEntry);
-        Packet->ListEntry.Flink = Packet->ListEntry.Blink = NULL;
+        while (!IsListEmpty(&Class->PacketQueue)) {
+            PXENVIF_TRANSMITTER_PACKET  Packet;
 
-        // Fake that we prapared and sent this packet
-        Ring->PacketsPrepared++;
-        Ring->PacketsSent++;
-        Ring->PacketsFaked++;
+            Packet = __TransmitterRingClassGetPacket(Class);
 
-        Packet->Completion.Status = XENVIF_TRANSMITTER_PACKET_DROPPED;
+            // Fake that we prapared and sent this packet
+            Ring->PacketsPrepared++;
+            Ring->PacketsSent++;
+            Ring->PacketsFaked++;
 
-        __TransmitterRingCompletePacket(Ring, Packet);
-        Count++;
+            Packet->Completion.Status = XENVIF_TRANSMITTER_PACKET_DROPPED;
+
+            __TransmitterRingCompletePacket(Ring, Packet);
+            Count++;
+        }
     }
 
     Info("%s[%u]: aborted %u packets\n",
@@ -4233,7 +5423,7 @@ __TransmitterRingAbortPackets(
          Count);
 
     ASSERT3U(Ring->PacketsSent, ==, Ring->PacketsPrepared - Ring->PacketsUnprepared);
-    ASSERT3U(Ring->PacketsPrepared, ==, Ring->PacketsCopied + Ring->PacketsGranted + Ring->PacketsFaked);
+    ASSERT3U(Ring->PacketsPrepared, ==, Ring->PacketsCopied + Ring->PacketsGranted + Ring->PacketsHybrid + Ring->PacketsFaked);
     ASSERT3U(Ring->PacketsQueued, ==, Ring->PacketsPrepared - Ring->PacketsUnprepared);
 
     ASSERT3P((ULONG_PTR)Ring->Lock, ==, XENVIF_TRANSMITTER_LOCK_BIT);
@@ -4249,6 +5439,7 @@ __TransmitterRingQueueArp(
     PXENVIF_TRANSMITTER             Transmitter;
     PXENVIF_FRONTEND                Frontend;
     PXENVIF_TRANSMITTER_REQUEST     Request;
+    PXENVIF_TRANSMITTER_BUFFER      Buffer;
     NTSTATUS                        status;
 
     Transmitter = Ring->Transmitter;
@@ -4266,8 +5457,17 @@ __TransmitterRingQueueArp(
     if (Request == NULL)
         goto fail2;
 
+    Buffer = __TransmitterRingBuildArp(Ring, Address);
+
+    status = STATUS_NO_MEMORY;
+    if (Buffer == NULL)
+        goto fail3;
+
+    Buffer->Reference++;
+
     Request->Type = XENVIF_TRANSMITTER_REQUEST_TYPE_ARP;
-    Request->Arp.Address = *Address;
+    Request->Advertisement.Buffer = Buffer;
+    Request->Advertisement.Count = Transmitter->AdvertisementCount;
 
     InsertTailList(&Ring->RequestQueue, &Request->ListEntry);
 
@@ -4283,6 +5483,9 @@ __TransmitterRingQueueArp(
 
     return STATUS_SUCCESS;
 
+fail3:
+    __TransmitterPutRequest(Ring, Request);
+
 fail2:
 fail1:
     __TransmitterRingReleaseLock(Ring);
@@ -4299,6 +5502,7 @@ __TransmitterRingQueueNeighbourAdvertisement(
     PXENVIF_TRANSMITTER             Transmitter;
     PXENVIF_FRONTEND                Frontend;
     PXENVIF_TRANSMITTER_REQUEST     Request;
+    PXENVIF_TRANSMITTER_BUFFER      Buffer;
     NTSTATUS                        status;
 
     Transmitter = Ring->Transmitter;
@@ -4316,8 +5520,17 @@ __TransmitterRingQueueNeighbourAdvertisement(
     if (Request == NULL)
         goto fail2;
 
+    Buffer = __TransmitterRingBuildNeighbourAdvertisement(Ring, Address);
+
+    status = STATUS_NO_MEMORY;
+    if (Buffer == NULL)
+        goto fail3;
+
+    Buffer->Reference++;
+
     Request->Type = XENVIF_TRANSMITTER_REQUEST_TYPE_NEIGHBOUR_ADVERTISEMENT;
-    Request->NeighbourAdvertisement.Address = *Address;
+    Request->Advertisement.Buffer = Buffer;
+    Request->Advertisement.Count = Transmitter->AdvertisementCount;
 
     InsertTailList(&Ring->RequestQueue, &Request->ListEntry);
 
@@ -4337,6 +5550,9 @@ __TransmitterRingQueueNeighbourAdvertisement(
 
     return STATUS_SUCCESS;
 
+fail3:
+    __TransmitterPutRequest(Ring, Request);
+
 fail2:
 fail1:
     __TransmitterRingReleaseLock(Ring);
@@ -4431,6 +5647,84 @@ TransmitterDebugCallback(
     UNREFERENCED_PARAMETER(Crashing);
 }
 
+static NTSTATUS
+TransmitterAdvertise(
+    IN  PXENVIF_THREAD      Self,
+    IN  PVOID               Context
+    )
+{
+    PXENVIF_TRANSMITTER     Transmitter = Context;
+    PXENVIF_FRONTEND        Frontend = Transmitter->Frontend;
+
+    Trace("====>\n");
+
+    for (;;) {
+        PKEVENT     Event;
+        ULONGLONG   Deadline;
+        ULONG       Index;
+        KIRQL       Irql;
+
+        Event = ThreadGetEvent(Self);
+
+        // Wait for a ring to defer a replay...
+        (VOID) KeWaitForSingleObject(Event,
+                                     Executive,
+                                     KernelMode,
+                                     FALSE,
+                                     NULL);
+        KeClearEvent(Event);
+
+        if (ThreadIsAlerted(Self))
+            break;
+
+        // ...and then hold off for the configured interval. Further
+        // deferrals signal the event in the meantime so keep waiting
+        // until the deadline has actually passed.
+        Deadline = KeQueryInterruptTime() +
+                   TIME_MS((ULONGLONG)Transmitter->AdvertisementInterval);
+
+        for (;;) {
+            ULONGLONG       Now;
+            LARGE_INTEGER   Timeout;
+
+            if (ThreadIsAlerted(Self))
+                break;
+
+            Now = KeQueryInterruptTime();
+            if (Now >= Deadline)
+                break;
+
+            Timeout.QuadPart = TIME_RELATIVE((LONGLONG)(Deadline - Now));
+
+            (VOID) KeWaitForSingleObject(Event,
+                                         Executive,
+                                         KernelMode,
+                                         FALSE,
+                                         &Timeout);
+            KeClearEvent(Event);
+        }
+
+        if (ThreadIsAlerted(Self))
+            break;
+
+        KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+
+        for (Index = 0; Index < FrontendGetNumQueues(Frontend); Index++) {
+            PXENVIF_TRANSMITTER_RING    Ring = Transmitter->Ring[Index];
+
+            __TransmitterRingAcquireLock(Ring);
+            __TransmitterRingReleaseAdvertisements(Ring);
+            __TransmitterRingReleaseLock(Ring);
+        }
+
+        KeLowerIrql(Irql);
+    }
+
+    Trace("<====\n");
+
+    return STATUS_SUCCESS;
+}
+
 NTSTATUS
 TransmitterInitialize(
     IN  PXENVIF_FRONTEND    Frontend,
@@ -4455,14 +5749,28 @@ TransmitterInitialize(
     (*Transmitter)->DisableIpVersion6Gso = 0;
     (*Transmitter)->AlwaysCopy = 0;
     (*Transmitter)->ValidateChecksums = 0;
+    (*Transmitter)->EmulateChecksums = 1;
     (*Transmitter)->DisableMulticastControl = 0;
+    (*Transmitter)->DisableInFlightLimit = 0;
+    (*Transmitter)->PriorityClasses = 0;
+    (*Transmitter)->AdvertisementCount = XENVIF_TRANSMITTER_ADVERTISEMENT_COUNT;
+    (*Transmitter)->AdvertisementInterval = 0;
+    (*Transmitter)->TraceLogSize = 0;
+    (*Transmitter)->Mode = XENVIF_TRANSMITTER_MODE_INLINE;
 
     if (ParametersKey != NULL) {
         ULONG   TransmitterDisableIpVersion4Gso;
         ULONG   TransmitterDisableIpVersion6Gso;
         ULONG   TransmitterAlwaysCopy;
         ULONG   TransmitterValidateChecksums;
+        ULONG   TransmitterEmulateChecksums;
         ULONG   TransmitterDisableMulticastControl;
+        ULONG   TransmitterDisableInFlightLimit;
+        ULONG   TransmitterPriorityClasses;
+        ULONG   TransmitterAdvertisementCount;
+        ULONG   TransmitterAdvertisementInterval;
+        ULONG   TransmitterTraceLogSize;
+        ULONG   TransmitterRingMode;
 
         status = RegistryQueryDwordValue(ParametersKey,
                                          "TransmitterDisableIpVersion4Gso",
@@ -4488,13 +5796,57 @@ TransmitterInitialize(
         if (NT_SUCCESS(status))
             (*Transmitter)->ValidateChecksums = TransmitterValidateChecksums;
 
+        status = RegistryQueryDwordValue(ParametersKey,
+                                         "TransmitterEmulateChecksums",
+                                         &TransmitterEmulateChecksums);
+        if (NT_SUCCESS(status))
+            (*Transmitter)->EmulateChecksums = TransmitterEmulateChecksums;
+
         status = RegistryQueryDwordValue(ParametersKey,
                                          "TransmitterDisableMulticastControl",
                                          &TransmitterDisableMulticastControl);
         if (NT_SUCCESS(status))
             (*Transmitter)->DisableMulticastControl = TransmitterDisableMulticastControl;
+
+        status = RegistryQueryDwordValue(ParametersKey,
+                                         "TransmitterDisableInFlightLimit",
+                                         &TransmitterDisableInFlightLimit);
+        if (NT_SUCCESS(status))
+            (*Transmitter)->DisableInFlightLimit = TransmitterDisableInFlightLimit;
+
+        status = RegistryQueryDwordValue(ParametersKey,
+                                         "TransmitterPriorityClasses",
+                                         &TransmitterPriorityClasses);
+        if (NT_SUCCESS(status))
+            (*Transmitter)->PriorityClasses = TransmitterPriorityClasses;
+
+        status = RegistryQueryDwordValue(ParametersKey,
+                                         "TransmitterAdvertisementCount",
+                                         &TransmitterAdvertisementCount);
+        if (NT_SUCCESS(status) && TransmitterAdvertisementCount != 0)
+            (*Transmitter)->AdvertisementCount = TransmitterAdvertisementCount;
+
+        status = RegistryQueryDwordValue(ParametersKey,
+                                         "TransmitterAdvertisementInterval",
+                                         &TransmitterAdvertisementInterval);
+        if (NT_SUCCESS(status))
+            (*Transmitter)->AdvertisementInterval = TransmitterAdvertisementInterval;
+
+        status = RegistryQueryDwordValue(ParametersKey,
+                                         "TransmitterTraceLogSize",
+                                         &TransmitterTraceLogSize);
+        if (NT_SUCCESS(status))
+            (*Transmitter)->TraceLogSize = TransmitterTraceLogSize;
+
+        status = RegistryQueryDwordValue(ParametersKey,
+                                         "TransmitterRingMode",
+                                         &TransmitterRingMode);
+        if (NT_SUCCESS(status) && TransmitterRingMode < XENVIF_TRANSMITTER_MODE_COUNT)
+            (*Transmitter)->Mode = TransmitterRingMode;
     }
 
+    (VOID) KeQueryPerformanceCounter(&(*Transmitter)->Frequency);
+
     FdoGetDebugInterface(PdoGetFdo(FrontendGetPdo(Frontend)),
                          &(*Transmitter)->DebugInterface);
 
@@ -4570,8 +5922,21 @@ TransmitterInitialize(
         Index++;
     }
 
+    if ((*Transmitter)->AdvertisementInterval != 0) {
+        status = ThreadCreate(TransmitterAdvertise,
+                              *Transmitter,
+                              &(*Transmitter)->AdvertisementThread);
+        if (!NT_SUCCESS(status))
+            goto fail8;
+    }
+
     return STATUS_SUCCESS;
 
+fail8:
+    Error("fail8\n");
+
+    Index = MaxQueues;
+
 fail7:
     Error("fail7\n");
 
@@ -4633,7 +5998,16 @@ fail2:
     (*Transmitter)->DisableIpVersion6Gso = 0;
     (*Transmitter)->AlwaysCopy = 0;
     (*Transmitter)->ValidateChecksums = 0;
+    (*Transmitter)->EmulateChecksums = 0;
     (*Transmitter)->DisableMulticastControl = 0;
+    (*Transmitter)->DisableInFlightLimit = 0;
+    (*Transmitter)->PriorityClasses = 0;
+    (*Transmitter)->AdvertisementCount = 0;
+    (*Transmitter)->AdvertisementInterval = 0;
+    (*Transmitter)->AdvertisementNext = 0;
+    (*Transmitter)->TraceLogSize = 0;
+    (*Transmitter)->Mode = 0;
+    (*Transmitter)->Frequency.QuadPart = 0;
     
     ASSERT(IsZeroMemory(*Transmitter, sizeof (XENVIF_TRANSMITTER)));
     __TransmitterFree(*Transmitter);
@@ -4650,7 +6024,7 @@ TransmitterConnect(
     )
 {
     PXENVIF_FRONTEND            Frontend;
-    PCHAR                       Buffer;
+    ULONG                       Flag;
     LONG                        Index;
     NTSTATUS                    status;
 
@@ -4675,21 +6049,25 @@ TransmitterConnect(
         goto fail4;
 
     if (Transmitter->DisableMulticastControl == 0) {
-        status = XENBUS_STORE(Read,
-                              &Transmitter->StoreInterface,
-                              NULL,
-                              FrontendGetBackendPath(Frontend),
-                              "feature-dynamic-multicast-control",
-                              &Buffer);
-        if (NT_SUCCESS(status)) {
-            Transmitter->MulticastControl = (BOOLEAN)strtol(Buffer, NULL, 2);
+        ULONG   MulticastControl;
 
-            XENBUS_STORE(Free,
-                         &Transmitter->StoreInterface,
-                         Buffer);
-        }
+        if (FrontendGetBackendFeature(Frontend,
+                                      XENVIF_FRONTEND_FEATURE_DYNAMIC_MULTICAST_CONTROL,
+                                      &MulticastControl))
+            Transmitter->MulticastControl = (MulticastControl != 0) ? TRUE : FALSE;
     }
 
+    // Note which checksums the backend can fill in itself
+    (VOID) FrontendGetBackendFeature(Frontend,
+                                     XENVIF_FRONTEND_FEATURE_NO_CSUM_OFFLOAD,
+                                     &Flag);
+    Transmitter->BackendIpVersion4Checksum = (Flag != 0) ? FALSE : TRUE;
+
+    (VOID) FrontendGetBackendFeature(Frontend,
+                                     XENVIF_FRONTEND_FEATURE_IPV6_CSUM_OFFLOAD,
+                                     &Flag);
+    Transmitter->BackendIpVersion6Checksum = (Flag != 0) ? TRUE : FALSE;
+
     Index = 0;
     while (Index < (LONG)FrontendGetNumQueues(Frontend)) {
         PXENVIF_TRANSMITTER_RING    Ring = Transmitter->Ring[Index];
@@ -4730,6 +6108,8 @@ fail5:
     }
 
     Transmitter->MulticastControl = FALSE;
+    Transmitter->BackendIpVersion6Checksum = FALSE;
+    Transmitter->BackendIpVersion4Checksum = FALSE;
 
     XENBUS_GNTTAB(Release, &Transmitter->GnttabInterface);
 
@@ -4921,6 +6301,8 @@ TransmitterDisconnect(
     }
 
     Transmitter->MulticastControl = FALSE;
+    Transmitter->BackendIpVersion6Checksum = FALSE;
+    Transmitter->BackendIpVersion4Checksum = FALSE;
 
     XENBUS_GNTTAB(Release, &Transmitter->GnttabInterface);
 
@@ -4946,6 +6328,12 @@ TransmitterTeardown(
     ASSERT3U(KeGetCurrentIrql(), ==, PASSIVE_LEVEL);
     KeFlushQueuedDpcs();
 
+    if (Transmitter->AdvertisementInterval != 0) {
+        ThreadAlert(Transmitter->AdvertisementThread);
+        ThreadJoin(Transmitter->AdvertisementThread);
+        Transmitter->AdvertisementThread = NULL;
+    }
+
     Index = FrontendGetMaxQueues(Frontend);
     while (--Index >= 0) {
         PXENVIF_TRANSMITTER_RING    Ring = Transmitter->Ring[Index];
@@ -4993,7 +6381,16 @@ TransmitterTeardown(
     Transmitter->DisableIpVersion6Gso = 0;
     Transmitter->AlwaysCopy = 0;
     Transmitter->ValidateChecksums = 0;
+    Transmitter->EmulateChecksums = 0;
     Transmitter->DisableMulticastControl = 0;
+    Transmitter->DisableInFlightLimit = 0;
+    Transmitter->PriorityClasses = 0;
+    Transmitter->AdvertisementCount = 0;
+    Transmitter->AdvertisementInterval = 0;
+    Transmitter->AdvertisementNext = 0;
+    Transmitter->TraceLogSize = 0;
+    Transmitter->Mode = 0;
+    Transmitter->Frequency.QuadPart = 0;
 
     ASSERT(IsZeroMemory(Transmitter, sizeof (XENVIF_TRANSMITTER)));
     __TransmitterFree(Transmitter);
@@ -5091,20 +6488,154 @@ __TransmitterHashPacket(
     } else if (Info->UdpHeader.Length != 0) {
         PUDP_HEADER UdpHeader;
 
-        ASSERT(Info->UdpHeader.Length != 0);
+        ASSERT(Info->UdpHeader.Length != 0);
+
+        UdpHeader = (PUDP_HEADER)(BaseVa + Info->UdpHeader.Offset);
+
+        __TransmitterHashAccumulate(&Value,
+                                    (PUCHAR)&UdpHeader->SourcePort,
+                                    sizeof (USHORT));
+        __TransmitterHashAccumulate(&Value,
+                                    (PUCHAR)&UdpHeader->DestinationPort,
+                                    sizeof (USHORT));
+    }
+
+done:
+    return Value;
+}
+
+// Use the 802.1p priority if the packet is to be tagged, otherwise the
+// class selector bits of the DSCP.
+static FORCEINLINE ULONG
+__TransmitterClassifyPacket(
+    IN  PXENVIF_TRANSMITTER_PACKET  Packet
+    )
+{
+    PUCHAR                          BaseVa;
+    PXENVIF_PACKET_INFO             Info;
+    PIP_HEADER                      IpHeader;
+    ULONG                           Priority;
+
+    BaseVa = Packet->Header;
+    Info = &Packet->Info;
+
+    if (Packet->TagControlInformation != 0) {
+        USHORT  UserPriority;
+        USHORT  CanonicalFormatId;
+        USHORT  VlanId;
+
+        UNPACK_TAG_CONTROL_INFORMATION(Packet->TagControlInformation,
+                                       UserPriority,
+                                       CanonicalFormatId,
+                                       VlanId);
+
+        UNREFERENCED_PARAMETER(CanonicalFormatId);
+        UNREFERENCED_PARAMETER(VlanId);
+
+        Priority = UserPriority;
+    } else if (Info->IpHeader.Length != 0) {
+        UCHAR   Dscp;
+
+        IpHeader = (PIP_HEADER)(BaseVa + Info->IpHeader.Offset);
+
+        if (IpHeader->Version == 4) {
+            Dscp = IpHeader->Version4.TypeOfService >> 2;
+        } else {
+            ASSERT3U(IpHeader->Version, ==, 6);
+
+            Dscp = (UCHAR)(NTOHL(IpHeader->Version6.VCF) >> 22) & 0x3F;
+        }
+
+        Priority = Dscp >> 3;
+    } else {
+        Priority = 0;
+    }
+
+    ASSERT3U(Priority, <, 8);
+    return (Priority * XENVIF_TRANSMITTER_CLASS_COUNT) / 8;
+}
+
+static FORCEINLINE PXENVIF_TRANSMITTER_PACKET
+__TransmitterCreatePacket(
+    IN  PXENVIF_TRANSMITTER         Transmitter,
+    IN  PMDL                        Mdl,
+    IN  ULONG                       Offset,
+    IN  ULONG                       Length,
+    IN  XENVIF_VIF_OFFLOAD_OPTIONS  OffloadOptions,
+    IN  USHORT                      MaximumSegmentSize,
+    IN  USHORT                      TagControlInformation,
+    IN  PXENVIF_PACKET_HASH         Hash,
+    IN  PVOID                       Cookie
+    )
+{
+    PXENVIF_TRANSMITTER_PACKET      Packet;
+    PUCHAR                          BaseVa;
+    PXENVIF_PACKET_PAYLOAD          Payload;
+    PXENVIF_PACKET_INFO             Info;
+
+    Packet = __TransmitterGetPacket(Transmitter);
+    if (Packet == NULL)
+        return NULL;
+
+    Packet->Mdl = Mdl;
+    Packet->Offset = Offset;
+    Packet->Length = Length;
+    Packet->OffloadOptions = OffloadOptions;
+    Packet->MaximumSegmentSize = MaximumSegmentSize;
+    Packet->TagControlInformation = TagControlInformation;
+    Packet->Hash = *Hash;
+    Packet->Cookie = Cookie;
+
+    BaseVa = Packet->Header;
+
+    Payload = &Packet->Payload;
+    Payload->Mdl = Packet->Mdl;
+    Payload->Offset = Packet->Offset;
+    Payload->Length = Packet->Length;
+
+    Info = &Packet->Info;
+
+    (VOID) ParsePacket(BaseVa, TransmitterPullup, Transmitter, Payload, Info);
+
+    if (Transmitter->PriorityClasses != 0)
+        Packet->Class = __TransmitterClassifyPacket(Packet);
+
+    Packet->QueueTime = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    return Packet;
+}
+
+static FORCEINLINE PXENVIF_TRANSMITTER_RING
+__TransmitterGetPacketRing(
+    IN  PXENVIF_TRANSMITTER         Transmitter,
+    IN  PXENVIF_TRANSMITTER_PACKET  Packet
+    )
+{
+    XENVIF_PACKET_HASH_ALGORITHM    Algorithm;
+    ULONG                           Value;
+    ULONG                           Index;
+
+    Algorithm = Packet->Hash.Algorithm;
 
-        UdpHeader = (PUDP_HEADER)(BaseVa + Info->UdpHeader.Offset);
+    switch (Algorithm) {
+    case XENVIF_PACKET_HASH_ALGORITHM_NONE:
+        Value = __TransmitterHashPacket(Transmitter, Packet);
+        break;
 
-        __TransmitterHashAccumulate(&Value,
-                                    (PUCHAR)&UdpHeader->SourcePort,
-                                    sizeof (USHORT));
-        __TransmitterHashAccumulate(&Value,
-                                    (PUCHAR)&UdpHeader->DestinationPort,
-                                    sizeof (USHORT));
+    case XENVIF_PACKET_HASH_ALGORITHM_UNSPECIFIED:
+    case XENVIF_PACKET_HASH_ALGORITHM_TOEPLITZ:
+        Value = Packet->Hash.Value;
+        break;
+
+    default:
+        ASSERT(FALSE);
+        Value = 0;
+        break;
     }
 
-done:
-    return Value;
+    Index = FrontendGetQueue(Transmitter->Frontend, Algorithm, Value);
+
+    return Transmitter->Ring[Index];
 }
 
 NTSTATUS
@@ -5121,78 +6652,112 @@ TransmitterQueuePacket(
     IN  PVOID                       Cookie
     )
 {
-    PXENVIF_FRONTEND                Frontend;
     PXENVIF_TRANSMITTER_PACKET      Packet;
-    PUCHAR                          BaseVa;
-    PXENVIF_PACKET_PAYLOAD          Payload;
-    PXENVIF_PACKET_INFO             Info;
-    XENVIF_PACKET_HASH_ALGORITHM    Algorithm;
-    ULONG                           Value;
-    ULONG                           Index;
     PXENVIF_TRANSMITTER_RING        Ring;
     NTSTATUS                        status;
 
-    Frontend = Transmitter->Frontend;
-
-    Packet = __TransmitterGetPacket(Transmitter);
+    Packet = __TransmitterCreatePacket(Transmitter,
+                                       Mdl,
+                                       Offset,
+                                       Length,
+                                       OffloadOptions,
+                                       MaximumSegmentSize,
+                                       TagControlInformation,
+                                       Hash,
+                                       Cookie);
 
     status = STATUS_NO_MEMORY;
     if (Packet == NULL)
         goto fail1;
 
-    Packet->Mdl = Mdl;
-    Packet->Offset = Offset;
-    Packet->Length = Length;
-    Packet->OffloadOptions = OffloadOptions;
-    Packet->MaximumSegmentSize = MaximumSegmentSize;
-    Packet->TagControlInformation = TagControlInformation;
-    Packet->Hash = *Hash;
-    Packet->Cookie = Cookie;
+    // Only TOEPLITZ hashed packets are sure to hit the same ring as the
+    // next one so the kick cannot be deferred for anything else
+    if (Hash->Algorithm != XENVIF_PACKET_HASH_ALGORITHM_TOEPLITZ)
+        More = FALSE;
 
-    BaseVa = Packet->Header;
+    Ring = __TransmitterGetPacketRing(Transmitter, Packet);
 
-    Payload = &Packet->Payload;
-    Payload->Mdl = Packet->Mdl;
-    Payload->Offset = Packet->Offset;
-    Payload->Length = Packet->Length;
+    __TransmitterRingQueuePackets(Ring,
+                                  &Packet->ListEntry,
+                                  &Packet->ListEntry,
+                                  More);
 
-    Info = &Packet->Info;
+    return STATUS_SUCCESS;
 
-    (VOID) ParsePacket(BaseVa, TransmitterPullup, Transmitter, Payload, Info);
+fail1:
+    Error("fail1 (%08x)\n", status);
 
-    Algorithm = Hash->Algorithm;
+    return status;
+}
 
-    switch (Algorithm) {
-    case XENVIF_PACKET_HASH_ALGORITHM_NONE:
-        Value = __TransmitterHashPacket(Transmitter, Packet);
-        More = FALSE;
-        break;
+NTSTATUS
+TransmitterQueuePackets(
+    IN  PXENVIF_TRANSMITTER                     Transmitter,
+    IN  PXENVIF_TRANSMITTER_PACKET_DESCRIPTOR   Descriptor,
+    IN  ULONG                                   Count,
+    OUT PULONG                                  Queued
+    )
+{
+    PXENVIF_TRANSMITTER_RING                    Ring;
+    PLIST_ENTRY                                 Head;
+    PLIST_ENTRY                                 Tail;
+    ULONG                                       Index;
+    NTSTATUS                                    status;
+
+    Ring = NULL;
+    Head = Tail = NULL;
+
+    // Consecutive packets for the same ring are chained together and
+    // handed to the ring at once
+    for (Index = 0; Index < Count; Index++) {
+        PXENVIF_TRANSMITTER_PACKET  Packet;
+        PXENVIF_TRANSMITTER_RING    Next;
+
+        Packet = __TransmitterCreatePacket(Transmitter,
+                                           Descriptor[Index].Mdl,
+                                           Descriptor[Index].Offset,
+                                           Descriptor[Index].Length,
+                                           Descriptor[Index].OffloadOptions,
+                                           Descriptor[Index].MaximumSegmentSize,
+                                           Descriptor[Index].TagControlInformation,
+                                           &Descriptor[Index].Hash,
+                                           Descriptor[Index].Cookie);
 
-    case XENVIF_PACKET_HASH_ALGORITHM_UNSPECIFIED:
-        Value = Hash->Value;
-        More = FALSE;
-        break;
+        status = STATUS_NO_MEMORY;
+        if (Packet == NULL)
+            goto fail1;
 
-    case XENVIF_PACKET_HASH_ALGORITHM_TOEPLITZ:
-        Value = Hash->Value;
-        break;
+        Next = __TransmitterGetPacketRing(Transmitter, Packet);
 
-    default:
-        ASSERT(FALSE);
-        Value = 0;
-        break;
+        if (Next != Ring && Head != NULL) {
+            __TransmitterRingQueuePackets(Ring, Head, Tail, FALSE);
+            Head = Tail = NULL;
+        }
+
+        Ring = Next;
+
+        Packet->ListEntry.Blink = Head;
+        if (Tail == NULL)
+            Tail = &Packet->ListEntry;
+        Head = &Packet->ListEntry;
     }
 
-    Index = FrontendGetQueue(Frontend, Algorithm, Value);
-    Ring = Transmitter->Ring[Index];
+    if (Head != NULL)
+        __TransmitterRingQueuePackets(Ring, Head, Tail, FALSE);
 
-    __TransmitterRingQueuePacket(Ring, Packet, More);
+    *Queued = Count;
 
     return STATUS_SUCCESS;
 
 fail1:
     Error("fail1 (%08x)\n", status);
 
+    // Packets ahead of the failure stay queued
+    if (Head != NULL)
+        __TransmitterRingQueuePackets(Ring, Head, Tail, FALSE);
+
+    *Queued = Index;
+
     return status;
 }
 
@@ -5219,13 +6784,33 @@ TransmitterAbortPackets(
     KeLowerIrql(Irql);
 }
 
+static FORCEINLINE PXENVIF_TRANSMITTER_RING
+__TransmitterGetAdvertisementRing(
+    IN  PXENVIF_TRANSMITTER Transmitter
+    )
+{
+    PXENVIF_FRONTEND        Frontend;
+    ULONG                   NumQueues;
+    ULONG                   Index;
+
+    Frontend = Transmitter->Frontend;
+
+    // Spread advertisements round-robin across the transmit rings
+    NumQueues = FrontendGetNumQueues(Frontend);
+    Index = (ULONG)InterlockedIncrement((PLONG)&Transmitter->AdvertisementNext);
+
+    return Transmitter->Ring[(NumQueues != 0) ? Index % NumQueues : 0];
+}
+
 VOID
 TransmitterQueueArp(
     IN  PXENVIF_TRANSMITTER     Transmitter,
     IN  PIPV4_ADDRESS           Address
     )
 {
-    PXENVIF_TRANSMITTER_RING    Ring = Transmitter->Ring[0];
+    PXENVIF_TRANSMITTER_RING    Ring;
+
+    Ring = __TransmitterGetAdvertisementRing(Transmitter);
 
     (VOID) __TransmitterRingQueueArp(Ring, Address);
 }
@@ -5236,7 +6821,9 @@ TransmitterQueueNeighbourAdvertisement(
     IN  PIPV6_ADDRESS           Address
     )
 {
-    PXENVIF_TRANSMITTER_RING    Ring = Transmitter->Ring[0];
+    PXENVIF_TRANSMITTER_RING    Ring;
+
+    Ring = __TransmitterGetAdvertisementRing(Transmitter);
 
     (VOID) __TransmitterRingQueueNeighbourAdvertisement(Ring, Address);
 }
@@ -5264,6 +6851,166 @@ TransmitterQueryRingSize(
     *Size = XENVIF_TRANSMITTER_RING_SIZE;
 }
 
+VOID
+TransmitterQueryHashLoad(
+    IN      PXENVIF_TRANSMITTER Transmitter,
+    IN OUT  PULONG              Load
+    )
+{
+    PXENVIF_FRONTEND            Frontend;
+    LONG                        Index;
+
+    Frontend = Transmitter->Frontend;
+
+    for (Index = 0;
+         Index < (LONG)FrontendGetNumQueues(Frontend);
+         ++Index) {
+        PXENVIF_TRANSMITTER_RING    Ring;
+        ULONG                       Bucket;
+
+        Ring = Transmitter->Ring[Index];
+        if (Ring == NULL)
+            break;
+
+        // The counters are 32-bit so an unlocked read cannot tear. They
+        // wrap, so callers must only ever compare samples modulo 2^32.
+        for (Bucket = 0;
+             Bucket < XENVIF_FRONTEND_MAXIMUM_HASH_MAPPING_SIZE;
+             Bucket++)
+            Load[Bucket] += Ring->HashLoad[Bucket];
+    }
+}
+
+VOID
+TransmitterQueryLatencyHistogram(
+    IN      PXENVIF_TRANSMITTER Transmitter,
+    IN      XENVIF_VIF_LATENCY  Latency,
+    IN OUT  PULONGLONG          Histogram
+    )
+{
+    PXENVIF_FRONTEND            Frontend;
+    LONG                        Index;
+
+    ASSERT3U(Latency, <=, XENVIF_TRANSMITTER_LATENCY_RESPONSE_TO_COMPLETION);
+
+    Frontend = Transmitter->Frontend;
+
+    for (Index = 0;
+         Index < (LONG)FrontendGetNumQueues(Frontend);
+         ++Index) {
+        PXENVIF_TRANSMITTER_RING    Ring;
+        ULONG                       Bucket;
+
+        Ring = Transmitter->Ring[Index];
+        if (Ring == NULL)
+            break;
+
+        for (Bucket = 0;
+             Bucket < XENVIF_VIF_LATENCY_BUCKET_COUNT;
+             Bucket++)
+            Histogram[Bucket] += Ring->Latency[Latency][Bucket];
+    }
+}
+
+VOID
+TransmitterWatchdog(
+    IN  PXENVIF_TRANSMITTER Transmitter
+    )
+{
+    PXENVIF_FRONTEND        Frontend;
+    LONG                    Index;
+
+    Frontend = Transmitter->Frontend;
+
+    for (Index = 0;
+         Index < (LONG)FrontendGetNumQueues(Frontend);
+         ++Index) {
+        PXENVIF_TRANSMITTER_RING    Ring;
+        KIRQL                       Irql;
+
+        Ring = Transmitter->Ring[Index];
+        if (Ring == NULL)
+            break;
+
+        KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+        __TransmitterRingAcquireLock(Ring);
+
+        if (Ring->Enabled) {
+            if (Ring->PacketsQueued == Ring->WatchdogPacketsQueued &&
+                Ring->PacketsCompleted != Ring->WatchdogPacketsQueued) {
+                XENBUS_DEBUG(Trigger,
+                             &Transmitter->DebugInterface,
+                             Ring->DebugCallback);
+
+                // Try to move things along
+                __TransmitterRingTrigger(Ring);
+                __TransmitterRingSend(Ring);
+            }
+
+            Ring->WatchdogPacketsQueued = Ring->PacketsQueued;
+        }
+
+        __TransmitterRingReleaseLock(Ring);
+        KeLowerIrql(Irql);
+    }
+}
+
+BOOLEAN
+TransmitterCheckStall(
+    IN  PXENVIF_TRANSMITTER Transmitter
+    )
+{
+    PXENVIF_FRONTEND        Frontend;
+    LONG                    Index;
+    BOOLEAN                 Stopped;
+
+    Frontend = Transmitter->Frontend;
+    Stopped = FALSE;
+
+    for (Index = 0;
+         Index < (LONG)FrontendGetNumQueues(Frontend);
+         ++Index) {
+        PXENVIF_TRANSMITTER_RING    Ring;
+        KIRQL                       Irql;
+
+        Ring = Transmitter->Ring[Index];
+        if (Ring == NULL)
+            break;
+
+        KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+        __TransmitterRingAcquireLock(Ring);
+
+        if (Ring->Enabled && Ring->Stopped) {
+            // A ring that has stayed stopped since the last sample without
+            // consuming a single response has probably missed an event
+            if (Ring->StallSampled &&
+                Ring->ResponsesProcessed == Ring->StallResponses) {
+                if (!Ring->Stalled) {
+                    Ring->Stalled = TRUE;
+                    Ring->Stalls++;
+                }
+
+                __TransmitterRingTrigger(Ring);
+                __TransmitterRingSend(Ring);
+            } else {
+                Ring->Stalled = FALSE;
+            }
+
+            Ring->StallResponses = Ring->ResponsesProcessed;
+            Ring->StallSampled = TRUE;
+            Stopped = TRUE;
+        } else {
+            Ring->StallSampled = FALSE;
+            Ring->Stalled = FALSE;
+        }
+
+        __TransmitterRingReleaseLock(Ring);
+        KeLowerIrql(Irql);
+    }
+
+    return Stopped;
+}
+
 VOID
 TransmitterNotify(
     IN  PXENVIF_TRANSMITTER     Transmitter,
@@ -5279,6 +7026,10 @@ TransmitterNotify(
 
     Ring = Transmitter->Ring[Index];
 
+    (VOID) InterlockedCompareExchange64(&Ring->Signalled,
+                                        KeQueryPerformanceCounter(NULL).QuadPart,
+                                        0);
+
     if (KeInsertQueueDpc(&Ring->PollDpc, NULL, NULL))
         Ring->PollDpcs++;
 }
@@ -5290,8 +7041,7 @@ TransmitterQueryOffloadOptions(
     )
 {
     PXENVIF_FRONTEND                Frontend;
-    PCHAR                           Buffer;
-    NTSTATUS                        status;
+    ULONG                           Flag;
 
     Frontend = Transmitter->Frontend;
 
@@ -5299,95 +7049,45 @@ TransmitterQueryOffloadOptions(
 
     Options->OffloadTagManipulation = 1;
 
-    if (Transmitter->DisableIpVersion4Gso == 0) {
-        status = XENBUS_STORE(Read,
-                              &Transmitter->StoreInterface,
-                              NULL,
-                              FrontendGetBackendPath(Frontend),
-                              "feature-gso-tcpv4",
-                              &Buffer);
-    } else {
-        Buffer = NULL;
-        status = STATUS_NOT_SUPPORTED;
-    }
-
-    if (!NT_SUCCESS(status)) {
+    if (Transmitter->DisableIpVersion4Gso == 0 &&
+        FrontendGetBackendFeature(Frontend,
+                                  XENVIF_FRONTEND_FEATURE_GSO_TCPV4,
+                                  &Flag))
+        Options->OffloadIpVersion4LargePacket = (Flag != 0) ? 1 : 0;
+    else
         Options->OffloadIpVersion4LargePacket = 0;
-    } else {
-        Options->OffloadIpVersion4LargePacket = (USHORT)strtol(Buffer, NULL, 2);
-
-        XENBUS_STORE(Free,
-                     &Transmitter->StoreInterface,
-                     Buffer);
-    }
-
-    if (Transmitter->DisableIpVersion6Gso == 0) {
-        status = XENBUS_STORE(Read,
-                              &Transmitter->StoreInterface,
-                              NULL,
-                              FrontendGetBackendPath(Frontend),
-                              "feature-gso-tcpv6",
-                              &Buffer);
-    } else {
-        Buffer = NULL;
-        status = STATUS_NOT_SUPPORTED;
-    }
 
-    if (!NT_SUCCESS(status)) {
+    if (Transmitter->DisableIpVersion6Gso == 0 &&
+        FrontendGetBackendFeature(Frontend,
+                                  XENVIF_FRONTEND_FEATURE_GSO_TCPV6,
+                                  &Flag))
+        Options->OffloadIpVersion6LargePacket = (Flag != 0) ? 1 : 0;
+    else
         Options->OffloadIpVersion6LargePacket = 0;
-    } else {
-        Options->OffloadIpVersion6LargePacket = (USHORT)strtol(Buffer, NULL, 2);
-
-        XENBUS_STORE(Free,
-                     &Transmitter->StoreInterface,
-                     Buffer);
-    }
 
     Options->OffloadIpVersion4HeaderChecksum = 1;
 
-    status = XENBUS_STORE(Read,
-                          &Transmitter->StoreInterface,
-                          NULL,
-                          FrontendGetBackendPath(Frontend),
-                          "feature-no-csum-offload",
-                          &Buffer);
-    if (!NT_SUCCESS(status)) {
-        Options->OffloadIpVersion4TcpChecksum = 1;
-        Options->OffloadIpVersion4UdpChecksum = 1;
-    } else {
-        BOOLEAN Flag;
-
-        Flag = (BOOLEAN)strtol(Buffer, NULL, 2);
+    // An absent key reads as zero, which matches the backend default
+    (VOID) FrontendGetBackendFeature(Frontend,
+                                     XENVIF_FRONTEND_FEATURE_NO_CSUM_OFFLOAD,
+                                     &Flag);
 
-        Options->OffloadIpVersion4TcpChecksum = (Flag) ? 0 : 1;
-        Options->OffloadIpVersion4UdpChecksum = (Flag) ? 0 : 1;
-
-        XENBUS_STORE(Free,
-                     &Transmitter->StoreInterface,
-                     Buffer);
-    }
+    // Checksums the backend cannot fill in can be emulated
+    if (Transmitter->EmulateChecksums != 0)
+        Flag = 0;
 
-    status = XENBUS_STORE(Read,
-                          &Transmitter->StoreInterface,
-                          NULL,
-                          FrontendGetBackendPath(Frontend),
-                          "feature-ipv6-csum-offload",
-                          &Buffer);
-    if (!NT_SUCCESS(status)) {
-        Options->OffloadIpVersion6TcpChecksum = 0;
-        Options->OffloadIpVersion6UdpChecksum = 0;
-    } else {
-        BOOLEAN Flag;
+    Options->OffloadIpVersion4TcpChecksum = (Flag != 0) ? 0 : 1;
+    Options->OffloadIpVersion4UdpChecksum = (Flag != 0) ? 0 : 1;
 
-        Flag = (BOOLEAN)strtol(Buffer, NULL, 2);
+    (VOID) FrontendGetBackendFeature(Frontend,
+                                     XENVIF_FRONTEND_FEATURE_IPV6_CSUM_OFFLOAD,
+                                     &Flag);
 
-        Options->OffloadIpVersion6TcpChecksum = (Flag) ? 1 : 0;
-        Options->OffloadIpVersion6UdpChecksum = (Flag) ? 1 : 0;
+    if (Transmitter->EmulateChecksums != 0)
+        Flag = 1;
 
-        XENBUS_STORE(Free,
-                     &Transmitter->StoreInterface,
-                     Buffer);
-    }
+    Options->OffloadIpVersion6TcpChecksum = (Flag != 0) ? 1 : 0;
+    Options->OffloadIpVersion6UdpChecksum = (Flag != 0) ? 1 : 0;
 }
 
 #define XENVIF_TRANSMITTER_MAXIMUM_REQ_SIZE  ((1 << (RTL_FIELD_SIZE(netif_tx_request_t, size) * 8)) - 1)
@@ -5411,40 +7111,20 @@ TransmitterQueryLargePacketSize(
     )
 {
     PXENVIF_FRONTEND            Frontend;
-    PCHAR                       Buffer;
     ULONG                       OffloadIpLargePacket;
-    NTSTATUS                    status;
 
     Frontend = Transmitter->Frontend;
 
-    if (Version == 4) {
-        status = XENBUS_STORE(Read,
-                              &Transmitter->StoreInterface,
-                              NULL,
-                              FrontendGetBackendPath(Frontend),
-                              "feature-gso-tcpv4",
-                              &Buffer);
-    } else if (Version == 6) {
-        status = XENBUS_STORE(Read,
-                              &Transmitter->StoreInterface,
-                              NULL,
-                              FrontendGetBackendPath(Frontend),
-                              "feature-gso-tcpv6",
-                              &Buffer);
-    } else {
-        Buffer = NULL;
-        status = STATUS_UNSUCCESSFUL;
-    }
-
-    if (!NT_SUCCESS(status)) {
+    if (Version == 4)
+        (VOID) FrontendGetBackendFeature(Frontend,
+                                         XENVIF_FRONTEND_FEATURE_GSO_TCPV4,
+                                         &OffloadIpLargePacket);
+    else if (Version == 6)
+        (VOID) FrontendGetBackendFeature(Frontend,
+                                         XENVIF_FRONTEND_FEATURE_GSO_TCPV6,
+                                         &OffloadIpLargePacket);
+    else
         OffloadIpLargePacket = 0;
-    } else {
-        OffloadIpLargePacket = (ULONG)strtol(Buffer, NULL, 2);
-
-        XENBUS_STORE(Free,
-                     &Transmitter->StoreInterface,
-                     Buffer);
-    }
 
     // The OffloadParity certification test requires that we have a single LSO size for IPv4 and IPv6 packets
     *Size = (OffloadIpLargePacket) ?
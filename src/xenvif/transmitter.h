@@ -115,6 +115,29 @@ TransmitterQueryRingSize(
     OUT PULONG              Size
     );
 
+extern VOID
+TransmitterQueryHashLoad(
+    IN      PXENVIF_TRANSMITTER Transmitter,
+    IN OUT  PULONG              Load
+    );
+
+extern VOID
+TransmitterQueryLatencyHistogram(
+    IN      PXENVIF_TRANSMITTER Transmitter,
+    IN      XENVIF_VIF_LATENCY  Latency,
+    IN OUT  PULONGLONG          Histogram
+    );
+
+extern VOID
+TransmitterWatchdog(
+    IN  PXENVIF_TRANSMITTER Transmitter
+    );
+
+extern BOOLEAN
+TransmitterCheckStall(
+    IN  PXENVIF_TRANSMITTER Transmitter
+    );
+
 extern NTSTATUS
 TransmitterQueuePacket(
     IN  PXENVIF_TRANSMITTER         Transmitter,
@@ -129,6 +152,14 @@ TransmitterQueuePacket(
     IN  PVOID                       Cookie
     );
 
+extern NTSTATUS
+TransmitterQueuePackets(
+    IN  PXENVIF_TRANSMITTER                     Transmitter,
+    IN  PXENVIF_TRANSMITTER_PACKET_DESCRIPTOR   Descriptor,
+    IN  ULONG                                   Count,
+    OUT PULONG                                  Queued
+    );
+
 extern VOID
 TransmitterQueryOffloadOptions(
     IN  PXENVIF_TRANSMITTER         Transmitter,
@@ -138,6 +138,25 @@ __InterlockedSubtract(
     return New;
 }
 
+// Bucket 0 holds zero, bucket N holds [2^(N-1), 2^N) and the last
+// bucket also holds anything larger.
+static FORCEINLINE ULONG
+__Log2Bucket(
+    IN  ULONGLONG   Value,
+    IN  ULONG       Count
+    )
+{
+    ULONG           Index;
+
+    if (Value > MAXULONG)
+        Value = MAXULONG;
+
+    if (!_BitScanReverse(&Index, (ULONG)Value))
+        return 0;
+
+    return __min(Index + 1, Count - 1);
+}
+
 __checkReturn
 static FORCEINLINE PVOID
 __AllocatePoolWithTag(
@@ -170,8 +189,9 @@ __FreePoolWithTag(
 }
 
 static FORCEINLINE PMDL
-__AllocatePages(
-    IN  ULONG           Count
+__AllocatePagesOnNode(
+    IN  ULONG           Count,
+    IN  ULONG           Node
     )
 {
     PHYSICAL_ADDRESS    LowAddress;
@@ -187,12 +207,21 @@ __AllocatePages(
     SkipBytes.QuadPart = 0ull;
     TotalBytes = (SIZE_T)PAGE_SIZE * Count;
 
-    Mdl = MmAllocatePagesForMdlEx(LowAddress,
-                                  HighAddress,
-                                  SkipBytes,
-                                  TotalBytes,
-                                  MmCached,
-                                  MM_ALLOCATE_FULLY_REQUIRED);
+    if (Node == MM_ANY_NODE_OK)
+        Mdl = MmAllocatePagesForMdlEx(LowAddress,
+                                      HighAddress,
+                                      SkipBytes,
+                                      TotalBytes,
+                                      MmCached,
+                                      MM_ALLOCATE_FULLY_REQUIRED);
+    else
+        Mdl = MmAllocateNodePagesForMdlEx(LowAddress,
+                                          HighAddress,
+                                          SkipBytes,
+                                          TotalBytes,
+                                          MmCached,
+                                          Node,
+                                          MM_ALLOCATE_FULLY_REQUIRED);
 
     status = STATUS_NO_MEMORY;
     if (Mdl == NULL)
@@ -236,8 +265,14 @@ fail1:
     return NULL;
 }
 
+#define __AllocatePages(_Count) \
+        __AllocatePagesOnNode((_Count), MM_ANY_NODE_OK)
+
 #define __AllocatePage()    __AllocatePages(1)
 
+#define __AllocatePageOnNode(_Node) \
+        __AllocatePagesOnNode(1, (_Node))
+
 static FORCEINLINE VOID
 __FreePages(
     IN	PMDL	Mdl
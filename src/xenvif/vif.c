@@ -131,9 +131,8 @@ VifSuspendCallbackLate(
     status = FrontendSetState(Context->Frontend, FRONTEND_ENABLED);
     ASSERT(NT_SUCCESS(status));
 
-    // We do this three times to make sure switches take note
-    FrontendAdvertiseIpAddresses(Context->Frontend);
-    FrontendAdvertiseIpAddresses(Context->Frontend);
+    // The transmitter replays each advertisement (3 times by default)
+    // to make sure switches take note
     FrontendAdvertiseIpAddresses(Context->Frontend);
 }
 
@@ -318,6 +317,40 @@ done:
     return status;
 }
 
+static NTSTATUS
+VifQueryLatencyHistogram(
+    IN  PINTERFACE          Interface,
+    IN  XENVIF_VIF_LATENCY  Latency,
+    OUT PULONGLONG          Bucket
+    )
+{
+    PXENVIF_VIF_CONTEXT     Context = Interface->Context;
+    NTSTATUS                status;
+
+    status = STATUS_INVALID_PARAMETER;
+    if (Latency >= XENVIF_VIF_LATENCY_COUNT)
+        goto done;
+
+    RtlZeroMemory(Bucket, sizeof (ULONGLONG) * XENVIF_VIF_LATENCY_BUCKET_COUNT);
+
+    AcquireMrswLockShared(&Context->Lock);
+
+    if (Latency == XENVIF_RECEIVER_LATENCY_RESPONSE_TO_INDICATION)
+        ReceiverQueryLatencyHistogram(FrontendGetReceiver(Context->Frontend),
+                                      Latency,
+                                      Bucket);
+    else
+        TransmitterQueryLatencyHistogram(FrontendGetTransmitter(Context->Frontend),
+                                         Latency,
+                                         Bucket);
+
+    ReleaseMrswLockShared(&Context->Lock);
+    status = STATUS_SUCCESS;
+
+done:
+    return status;
+}
+
 static VOID
 VifQueryRingCount(
     IN  PINTERFACE      Interface,
@@ -333,6 +366,29 @@ VifQueryRingCount(
     ReleaseMrswLockShared(&Context->Lock);
 }
 
+static NTSTATUS
+VifSetActiveRingCount(
+    IN  PINTERFACE      Interface,
+    IN  ULONG           Count
+    )
+{
+    PXENVIF_VIF_CONTEXT Context = Interface->Context;
+    NTSTATUS            status;
+
+    AcquireMrswLockShared(&Context->Lock);
+
+    status = STATUS_UNSUCCESSFUL;
+    if (!Context->Enabled)
+        goto done;
+
+    status = FrontendSetActiveQueues(Context->Frontend, Count);
+
+done:
+    ReleaseMrswLockShared(&Context->Lock);
+
+    return status;
+}
+
 static NTSTATUS
 VifUpdateHashMapping(
     IN  PINTERFACE          Interface,
@@ -449,6 +505,36 @@ done:
     return status;
 }
 
+static NTSTATUS
+VifTransmitterQueuePackets(
+    IN  PINTERFACE                              Interface,
+    IN  PXENVIF_TRANSMITTER_PACKET_DESCRIPTOR   Packet,
+    IN  ULONG                                   Count,
+    OUT PULONG                                  Queued
+    )
+{
+    PXENVIF_VIF_CONTEXT                         Context = Interface->Context;
+    NTSTATUS                                    status;
+
+    AcquireMrswLockShared(&Context->Lock);
+
+    *Queued = 0;
+
+    status = STATUS_UNSUCCESSFUL;
+    if (!Context->Enabled)
+        goto done;
+
+    status = TransmitterQueuePackets(FrontendGetTransmitter(Context->Frontend),
+                                     Packet,
+                                     Count,
+                                     Queued);
+
+done:
+    ReleaseMrswLockShared(&Context->Lock);
+
+    return status;
+}
+
 static VOID
 VifTransmitterQueryOffloadOptions(
     IN  PINTERFACE                  Interface,
@@ -918,6 +1004,39 @@ static struct _XENVIF_VIF_INTERFACE_V8 VifInterfaceVersion8 = {
     VifMacQueryFilterLevel
 };
 
+static struct _XENVIF_VIF_INTERFACE_V9 VifInterfaceVersion9 = {
+    { sizeof (struct _XENVIF_VIF_INTERFACE_V9), 9, NULL, NULL, NULL },
+    VifAcquire,
+    VifRelease,
+    VifEnable,
+    VifDisable,
+    VifQueryStatistic,
+    VifQueryRingCount,
+    VifUpdateHashMapping,
+    VifReceiverReturnPacket,
+    VifReceiverSetOffloadOptions,
+    VifReceiverSetBackfillSize,
+    VifReceiverQueryRingSize,
+    VifReceiverSetHashAlgorithm,
+    VifReceiverQueryHashCapabilities,
+    VifReceiverUpdateHashParameters,
+    VifTransmitterQueuePacket,
+    VifTransmitterQueryOffloadOptions,
+    VifTransmitterQueryLargePacketSize,
+    VifTransmitterQueryRingSize,
+    VifMacQueryState,
+    VifMacQueryMaximumFrameSize,
+    VifMacQueryPermanentAddress,
+    VifMacQueryCurrentAddress,
+    VifMacQueryMulticastAddresses,
+    VifMacSetMulticastAddresses,
+    VifMacSetFilterLevel,
+    VifMacQueryFilterLevel,
+    VifQueryLatencyHistogram,
+    VifTransmitterQueuePackets,
+    VifSetActiveRingCount
+};
+
 NTSTATUS
 VifInitialize(
     IN  PXENVIF_PDO         Pdo,
@@ -1033,6 +1152,23 @@ VifGetInterface(
         status = STATUS_SUCCESS;
         break;
     }
+    case 9: {
+        struct _XENVIF_VIF_INTERFACE_V9 *VifInterface;
+
+        VifInterface = (struct _XENVIF_VIF_INTERFACE_V9 *)Interface;
+
+        status = STATUS_BUFFER_OVERFLOW;
+        if (Size < sizeof (struct _XENVIF_VIF_INTERFACE_V9))
+            break;
+
+        *VifInterface = VifInterfaceVersion9;
+
+        ASSERT3U(Interface->Version, ==, Version);
+        Interface->Context = Context;
+
+        status = STATUS_SUCCESS;
+        break;
+    }
     default:
         status = STATUS_NOT_SUPPORTED;
         break;
@@ -1164,70 +1300,115 @@ __VifReceiverQueuePacket(
 
 }
 
-VOID
-VifReceiverQueuePacket(
-    IN  PXENVIF_VIF_CONTEXT             Context,
-    IN  ULONG                           Index,
-    IN  PMDL                            Mdl,
-    IN  ULONG                           Offset,
-    IN  ULONG                           Length,
-    IN  XENVIF_PACKET_CHECKSUM_FLAGS    Flags,
-    IN  USHORT                          MaximumSegmentSize,
-    IN  USHORT                          TagControlInformation,
-    IN  PXENVIF_PACKET_INFO             Info,
-    IN  PXENVIF_PACKET_HASH             Hash,
-    IN  BOOLEAN                         More,
-    IN  PVOID                           Cookie
+static FORCEINLINE VOID
+__VifReceiverQueuePackets(
+    IN  PXENVIF_VIF_CONTEXT                 Context,
+    IN  ULONG                               Index,
+    IN  PXENVIF_RECEIVER_PACKET_DESCRIPTOR  Packet,
+    IN  ULONG                               Count,
+    IN  BOOLEAN                             More
     )
 {
-    KIRQL                               Irql;
-
-    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+    Context->Callback(Context->Argument,
+                      XENVIF_RECEIVER_QUEUE_PACKETS,
+                      Index,
+                      Packet,
+                      Count,
+                      More);
+}
 
+static FORCEINLINE VOID
+__VifReceiverQueuePacketDescriptor(
+    IN  PXENVIF_VIF_CONTEXT                 Context,
+    IN  ULONG                               Index,
+    IN  PXENVIF_RECEIVER_PACKET_DESCRIPTOR  Packet,
+    IN  BOOLEAN                             More
+    )
+{
     switch (Context->Version) {
     case 6:
         __VifReceiverQueuePacketVersion6(Context,
                                          Index,
-                                         Mdl,
-                                         Offset,
-                                         Length,
-                                         Flags,
-                                         MaximumSegmentSize,
-                                         TagControlInformation,
-                                         Info,
-                                         Hash,
+                                         Packet->Mdl,
+                                         Packet->Offset,
+                                         Packet->Length,
+                                         Packet->Flags,
+                                         Packet->MaximumSegmentSize,
+                                         Packet->TagControlInformation,
+                                         Packet->Info,
+                                         Packet->Hash,
                                          More,
-                                         Cookie);
+                                         Packet->Cookie);
         break;
 
     case 7:
         __VifReceiverQueuePacketVersion7(Context,
                                          Index,
-                                         Mdl,
-                                         Offset,
-                                         Length,
-                                         Flags,
-                                         MaximumSegmentSize,
-                                         TagControlInformation,
-                                         Info,
-                                         Hash,
+                                         Packet->Mdl,
+                                         Packet->Offset,
+                                         Packet->Length,
+                                         Packet->Flags,
+                                         Packet->MaximumSegmentSize,
+                                         Packet->TagControlInformation,
+                                         Packet->Info,
+                                         Packet->Hash,
                                          More,
-                                         Cookie);
+                                         Packet->Cookie);
         break;
 
     case 8:
         __VifReceiverQueuePacket(Context,
                                  Index,
-                                 Mdl,
-                                 Offset,
-                                 Length,
-                                 Flags,
-                                 MaximumSegmentSize,
-                                 TagControlInformation,
-                                 Info,
-                                 Hash,
+                                 Packet->Mdl,
+                                 Packet->Offset,
+                                 Packet->Length,
+                                 Packet->Flags,
+                                 Packet->MaximumSegmentSize,
+                                 Packet->TagControlInformation,
+                                 Packet->Info,
+                                 Packet->Hash,
                                  More,
-                                 Cookie);
+                                 Packet->Cookie);
+        break;
+
+    default:
+        ASSERT(FALSE);
+        break;
+    }
+}
+
+VOID
+VifReceiverQueuePackets(
+    IN  PXENVIF_VIF_CONTEXT                 Context,
+    IN  ULONG                               Index,
+    IN  PXENVIF_RECEIVER_PACKET_DESCRIPTOR  Packet,
+    IN  ULONG                               Count,
+    IN  BOOLEAN                             More
+    )
+{
+    KIRQL                                   Irql;
+    ULONG                                   Entry;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+
+    switch (Context->Version) {
+    case 6:
+    case 7:
+    case 8:
+        // Older subscribers take one packet per callback
+        for (Entry = 0; Entry < Count; Entry++)
+            __VifReceiverQueuePacketDescriptor(Context,
+                                               Index,
+                                               &Packet[Entry],
+                                               (Entry + 1 < Count) ? TRUE : More);
+        break;
+
+    case 9:
+        __VifReceiverQueuePackets(Context,
+                                  Index,
+                                  Packet,
+                                  Count,
+                                  More);
         break;
 
     default:
@@ -1249,6 +1430,7 @@ VifTransmitterReturnPacket(
     case 6:
     case 7:
     case 8:
+    case 9:
         Context->Callback(Context->Argument,
                           XENVIF_TRANSMITTER_RETURN_PACKET,
                           Cookie,
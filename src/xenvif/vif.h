@@ -63,19 +63,12 @@ VifTeardown(
 // CALLBACKS
 
 extern VOID
-VifReceiverQueuePacket(
-    IN  PXENVIF_VIF_CONTEXT             Context,
-    IN  ULONG                           Index,
-    IN  PMDL                            Mdl,
-    IN  ULONG                           Offset,
-    IN  ULONG                           Length,
-    IN  XENVIF_PACKET_CHECKSUM_FLAGS    Flags,
-    IN  USHORT                          MaximumSegmentSize,
-    IN  USHORT                          TagControlInformation,
-    IN  PXENVIF_PACKET_INFO             Info,
-    IN  PXENVIF_PACKET_HASH             Hash,
-    IN  BOOLEAN                         More,
-    IN  PVOID                           Cookie
+VifReceiverQueuePackets(
+    IN  PXENVIF_VIF_CONTEXT                 Context,
+    IN  ULONG                               Index,
+    IN  PXENVIF_RECEIVER_PACKET_DESCRIPTOR  Packet,
+    IN  ULONG                               Count,
+    IN  BOOLEAN                             More
     );
 
 extern VOID
@@ -0,0 +1,315 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// User-mode test of the incremental checksum update primitives.
+//
+// The driver's own checksum.c is built against the WDK stand-ins in
+// tools/include. Every update is checked against a full recalculation
+// by ChecksumIpVersion4Header() or ChecksumTcpPacket():
+//
+//   - ChecksumUpdateUshort() for every old and new IPv4 packet ID
+//   - ChecksumUpdateLength() for every old and new IPv4 packet length
+//   - ChecksumUpdateUlong() for random TCP sequence numbers, headers
+//     and payloads
+//
+// Build and run on Linux with:
+//
+//   cc -O2 -I../include -I../../include -o checksumtest checksumtest.c
+//   ./checksumtest [-n <random cases>] [-s <seed>]
+//
+// The two exhaustive tests make 2^32 full recalculations each and take
+// a minute or so apiece.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <ntddk.h>
+
+// Keep the kernel-only driver headers out and supply what checksum.c
+// needs from them instead
+#define _XENVIF_DBG_PRINT_H
+#define _XENVIF_ASSERT_H
+#define _XENVIF_UTIL_H
+
+#define ASSERT(_EXP)            assert(_EXP)
+#define ASSERT3U(_X, _OP, _Y)   assert((_X) _OP (_Y))
+
+#include "../../src/xenvif/checksum.c"
+
+#define PAYLOAD_SIZE    1460
+
+static unsigned long    Failures;
+
+static void
+Fail(
+    const char      *Name,
+    unsigned int    Checksum,
+    unsigned int    Old,
+    unsigned int    New,
+    unsigned int    Updated,
+    unsigned int    Expected
+    )
+{
+    if (Failures++ < 16)
+        fprintf(stderr,
+                "%s: checksum %04x old %08x new %08x: updated %04x expected %04x\n",
+                Name, Checksum, Old, New, Updated, Expected);
+}
+
+static void
+RandomFill(
+    PUCHAR          Buffer,
+    ULONG           Length,
+    unsigned int    *Seed
+    )
+{
+    while (Length-- != 0)
+        *Buffer++ = (UCHAR)rand_r(Seed);
+}
+
+static void
+IpVersion4HeaderInitialize(
+    PIPV4_HEADER        Header,
+    PXENVIF_PACKET_INFO Info,
+    unsigned int        *Seed
+    )
+{
+    RandomFill((PUCHAR)Header, sizeof (IPV4_HEADER), Seed);
+
+    Header->Version = 4;
+    Header->HeaderLength = sizeof (IPV4_HEADER) >> 2;
+
+    RtlZeroMemory(Info, sizeof (XENVIF_PACKET_INFO));
+    Info->IpHeader.Offset = 0;
+    Info->IpHeader.Length = sizeof (IPV4_HEADER);
+    Info->Length = sizeof (IPV4_HEADER);
+}
+
+// For each old packet ID the header is refreshed with random contents,
+// its checksum calculated in full, and then every new packet ID tried
+static void
+TestUshort(
+    unsigned int    *Seed
+    )
+{
+    XENVIF_PACKET_INFO  Info;
+    IPV4_HEADER         Header;
+    ULONG               Old;
+
+    for (Old = 0; Old <= 0xFFFF; Old++) {
+        USHORT  Checksum;
+        ULONG   New;
+
+        IpVersion4HeaderInitialize(&Header, &Info, Seed);
+
+        Header.PacketID = (USHORT)Old;
+        Checksum = ChecksumIpVersion4Header((PUCHAR)&Header, &Info);
+
+        for (New = 0; New <= 0xFFFF; New++) {
+            USHORT  Updated;
+            USHORT  Expected;
+
+            Updated = ChecksumUpdateUshort(Checksum,
+                                           (USHORT)Old,
+                                           (USHORT)New);
+
+            Header.PacketID = (USHORT)New;
+            Expected = ChecksumIpVersion4Header((PUCHAR)&Header, &Info);
+
+            if (Updated != Expected)
+                Fail("ChecksumUpdateUshort", Checksum, Old, New,
+                     Updated, Expected);
+        }
+    }
+}
+
+static void
+TestLength(
+    unsigned int    *Seed
+    )
+{
+    XENVIF_PACKET_INFO  Info;
+    IPV4_HEADER         Header;
+    ULONG               Old;
+
+    for (Old = 0; Old <= 0xFFFF; Old++) {
+        USHORT  Checksum;
+        ULONG   New;
+
+        IpVersion4HeaderInitialize(&Header, &Info, Seed);
+
+        Header.PacketLength = HTONS((USHORT)Old);
+        Checksum = ChecksumIpVersion4Header((PUCHAR)&Header, &Info);
+
+        for (New = 0; New <= 0xFFFF; New++) {
+            USHORT  Updated;
+            USHORT  Expected;
+
+            Updated = ChecksumUpdateLength(Checksum,
+                                           (USHORT)Old,
+                                           (USHORT)New);
+
+            Header.PacketLength = HTONS((USHORT)New);
+            Expected = ChecksumIpVersion4Header((PUCHAR)&Header, &Info);
+
+            if (Updated != Expected)
+                Fail("ChecksumUpdateLength", Checksum, Old, New,
+                     Updated, Expected);
+        }
+    }
+}
+
+static ULONG
+Random32(
+    unsigned int    *Seed
+    )
+{
+    return ((ULONG)rand_r(Seed) << 16) ^ (ULONG)rand_r(Seed);
+}
+
+static void
+TestUlong(
+    unsigned int    *Seed,
+    unsigned long   Count
+    )
+{
+    struct {
+        IPV4_HEADER Ip;
+        TCP_HEADER  Tcp;
+    } Header;
+    UCHAR                   Data[PAYLOAD_SIZE];
+    XENVIF_PACKET_INFO      Info;
+    XENVIF_PACKET_PAYLOAD   Payload;
+    MDL                     Mdl;
+
+    C_ASSERT(sizeof (Header) == sizeof (IPV4_HEADER) + sizeof (TCP_HEADER));
+
+    RtlZeroMemory(&Mdl, sizeof (MDL));
+    Mdl.MdlFlags = MDL_MAPPED_TO_SYSTEM_VA;
+    Mdl.MappedSystemVa = Data;
+
+    while (Count-- != 0) {
+        ULONG   Length;
+        ULONG   Old;
+        ULONG   New;
+        USHORT  Checksum;
+        USHORT  Updated;
+        USHORT  Expected;
+        int     Edge;
+
+        Length = (ULONG)rand_r(Seed) % (PAYLOAD_SIZE + 1);
+
+        IpVersion4HeaderInitialize(&Header.Ip, &Info, Seed);
+        Header.Ip.Protocol = IPPROTO_TCP;
+        Header.Ip.PacketLength = HTONS((USHORT)(sizeof (Header) + Length));
+
+        RandomFill((PUCHAR)&Header.Tcp, sizeof (TCP_HEADER), Seed);
+        Header.Tcp.HeaderLength = sizeof (TCP_HEADER) >> 2;
+
+        Info.TcpHeader.Offset = sizeof (IPV4_HEADER);
+        Info.TcpHeader.Length = sizeof (TCP_HEADER);
+        Info.Length = sizeof (Header);
+
+        RandomFill(Data, Length, Seed);
+        Mdl.ByteCount = Length;
+
+        Payload.Mdl = &Mdl;
+        Payload.Offset = 0;
+        Payload.Length = Length;
+
+        // Mix in values whose halves are all zeros or all ones
+        Edge = rand_r(Seed) % 16;
+        Old = (Edge & 1) ? ((Edge & 2) ? 0xFFFF0000 : 0x0000FFFF) : Random32(Seed);
+        New = (Edge & 4) ? ((Edge & 8) ? 0xFFFF0000 : 0x0000FFFF) : Random32(Seed);
+
+        Header.Tcp.Seq = Old;
+        Checksum = ChecksumTcpPacket((PUCHAR)&Header,
+                                     &Info,
+                                     ChecksumPseudoHeader((PUCHAR)&Header, &Info),
+                                     &Payload);
+
+        Updated = ChecksumUpdateUlong(Checksum, Old, New);
+
+        Header.Tcp.Seq = New;
+        Expected = ChecksumTcpPacket((PUCHAR)&Header,
+                                     &Info,
+                                     ChecksumPseudoHeader((PUCHAR)&Header, &Info),
+                                     &Payload);
+
+        if (Updated != Expected)
+            Fail("ChecksumUpdateUlong", Checksum, Old, New,
+                 Updated, Expected);
+    }
+}
+
+int
+main(
+    int     argc,
+    char    **argv
+    )
+{
+    unsigned long   Count = 1000000;
+    unsigned int    Seed = 1;
+    int             Option;
+
+    while ((Option = getopt(argc, argv, "n:s:")) != -1) {
+        switch (Option) {
+        case 'n':
+            Count = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            Seed = (unsigned int)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n random cases] [-s seed]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    TestUshort(&Seed);
+    printf("ChecksumUpdateUshort: done\n");
+
+    TestLength(&Seed);
+    printf("ChecksumUpdateLength: done\n");
+
+    TestUlong(&Seed, Count);
+    printf("ChecksumUpdateUlong: done\n");
+
+    if (Failures != 0) {
+        printf("%lu failure(s)\n", Failures);
+        return 1;
+    }
+
+    printf("passed\n");
+    return 0;
+}
@@ -0,0 +1,145 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// User-mode stand-ins for the few WDK types, macros and routines that
+// the driver sources used by the tools depend on. Only what those
+// sources actually need is provided.
+
+#ifndef _TOOLS_NTDDK_H
+#define _TOOLS_NTDDK_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define UNALIGNED
+
+#define FORCEINLINE inline __attribute__((always_inline))
+#define DECLSPEC_NOINLINE __attribute__((noinline))
+
+#define VOID    void
+
+typedef void            *PVOID;
+typedef char            CHAR, *PCHAR;
+typedef uint8_t         UCHAR, *PUCHAR;
+typedef uint16_t        USHORT, *PUSHORT;
+typedef int32_t         LONG, *PLONG;
+typedef uint32_t        ULONG, *PULONG;
+typedef int64_t         LONGLONG, *PLONGLONG;
+typedef uint64_t        ULONGLONG, *PULONGLONG;
+typedef uint64_t        ULONG64, *PULONG64;
+typedef uintptr_t       ULONG_PTR;
+typedef intptr_t        LONG_PTR;
+typedef uint8_t         BOOLEAN, *PBOOLEAN;
+typedef LONG            NTSTATUS;
+typedef uint16_t        WCHAR, *PWCHAR;
+
+#define TRUE    1
+#define FALSE   0
+
+#define STATUS_SUCCESS          ((NTSTATUS)0x00000000L)
+#define STATUS_UNSUCCESSFUL     ((NTSTATUS)0xC0000001L)
+#define NT_SUCCESS(_Status)     ((NTSTATUS)(_Status) >= 0)
+
+#define FIELD_OFFSET(_Type, _Field) offsetof(_Type, _Field)
+#define C_ASSERT(_Expr) _Static_assert(_Expr, #_Expr)
+
+#define __min(_X, _Y)   (((_X) < (_Y)) ? (_X) : (_Y))
+#define __max(_X, _Y)   (((_X) > (_Y)) ? (_X) : (_Y))
+
+#define _byteswap_ushort(_Value)    __builtin_bswap16(_Value)
+#define _byteswap_ulong(_Value)     __builtin_bswap32(_Value)
+
+#define RtlCopyMemory(_Destination, _Source, _Length)   \
+        memcpy((_Destination), (_Source), (_Length))
+#define RtlMoveMemory(_Destination, _Source, _Length)   \
+        memmove((_Destination), (_Source), (_Length))
+#define RtlZeroMemory(_Destination, _Length)            \
+        memset((_Destination), 0, (_Length))
+
+typedef struct _GUID {
+    ULONG   Data1;
+    USHORT  Data2;
+    USHORT  Data3;
+    UCHAR   Data4[8];
+} GUID;
+
+#define DEFINE_GUID(_Name, _L, _W1, _W2, _B1, _B2, _B3, _B4, _B5, _B6, _B7, _B8) \
+        static const GUID _Name __attribute__((unused)) =                          \
+            { _L, _W1, _W2, { _B1, _B2, _B3, _B4, _B5, _B6, _B7, _B8 } }
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY  *Flink;
+    struct _LIST_ENTRY  *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+typedef struct _PROCESSOR_NUMBER {
+    USHORT  Group;
+    UCHAR   Number;
+    UCHAR   Reserved;
+} PROCESSOR_NUMBER, *PPROCESSOR_NUMBER;
+
+typedef struct _INTERFACE {
+    USHORT  Size;
+    USHORT  Version;
+    PVOID   Context;
+    VOID    (*InterfaceReference)(PVOID);
+    VOID    (*InterfaceDereference)(PVOID);
+} INTERFACE, *PINTERFACE;
+
+// Only MappedSystemVa and ByteCount are used by user-mode callers, so
+// an MDL here is never more than a mapped buffer
+typedef struct _MDL {
+    struct _MDL *Next;
+    USHORT      Size;
+    USHORT      MdlFlags;
+    PVOID       MappedSystemVa;
+    PVOID       StartVa;
+    ULONG       ByteCount;
+    ULONG       ByteOffset;
+} MDL, *PMDL;
+
+#define MDL_MAPPED_TO_SYSTEM_VA 0x0001
+
+typedef enum _MM_PAGE_PRIORITY {
+    LowPagePriority,
+    NormalPagePriority = 16,
+    HighPagePriority = 32
+} MM_PAGE_PRIORITY;
+
+#define MmGetSystemAddressForMdlSafe(_Mdl, _Priority)   \
+        ((PUCHAR)(_Mdl)->MappedSystemVa)
+
+#endif  // _TOOLS_NTDDK_H
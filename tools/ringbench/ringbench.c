@@ -0,0 +1,774 @@
+/* Copyright (c) Citrix Systems Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms,
+ * with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * *   Redistributions of source code must retain the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer.
+ * *   Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the
+ *     following disclaimer in the documentation and/or other
+ *     materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+// User-mode benchmark of the netif shared ring protocol.
+//
+// Each queue has a transmit and a receive ring laid out exactly as the
+// driver shares them with netback (netif_tx_sring_t/netif_rx_sring_t from
+// include/xen/public/io/netif.h) and driven through the same ring.h
+// macros, including event suppression. A frontend and a simulated
+// backend thread run per ring; event channels are modelled by a
+// condition variable so the number of notifications is counted too.
+//
+// It measures the ring protocol only. Grant mapping, copying and the
+// driver's own packet handling are not simulated. TransmitterRingSchedule()
+// and ReceiverRingFill() are not built here: they call into the frontend
+// and the XENBUS cache, gnttab, evtchn, debug and store interfaces and
+// rely on MDLs, DPCs and spin locks, so stand-ins for all of that would
+// be a second driver and the numbers would mostly reflect the stand-ins.
+//
+// Build and run on Linux with:
+//
+//   cc -O2 -pthread -I../../include -o ringbench ringbench.c
+//   ./ringbench -q 2 -t 5 -s 64:7,576:4,1514:1
+//
+// Options:
+//
+//   -q <n>         number of queues (default 1)
+//   -t <seconds>   duration (default 5)
+//   -s <mix>       packet size mix as size:weight,... (default IMIX)
+//   -g             allow sizes above 1514 and send them as GSO packets
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Shims for the few Windows types and barriers the Xen headers expect
+typedef intptr_t    LONG_PTR;
+typedef uintptr_t   ULONG_PTR;
+
+#define __XEN_INTERFACE_VERSION__   0x00040700
+
+#define xen_mb()    __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define xen_rmb()   __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define xen_wmb()   __atomic_thread_fence(__ATOMIC_RELEASE)
+
+#include <xen/public/io/netif.h>
+
+#define PAGE_SIZE           4096
+#define MAXIMUM_FRAME_SIZE  1514
+#define MAXIMUM_GSO_SIZE    65535
+#define MAXIMUM_MIX         16
+#define LATENCY_BUCKETS     32
+#define RX_BATCH            64
+
+#define NETIF_TX_RING_SIZE  __CONST_RING_SIZE(netif_tx, PAGE_SIZE)
+#define NETIF_RX_RING_SIZE  __CONST_RING_SIZE(netif_rx, PAGE_SIZE)
+
+typedef struct _EVENT {
+    pthread_mutex_t Lock;
+    pthread_cond_t  Cond;
+    int             Pending;
+    uint64_t        Count;
+} EVENT;
+
+typedef struct _MIX {
+    unsigned int    Size[MAXIMUM_MIX];
+    unsigned int    Weight[MAXIMUM_MIX];
+    unsigned int    Count;
+    unsigned int    Total;
+} MIX;
+
+typedef struct _STATS {
+    uint64_t        Packets;
+    uint64_t        Bytes;
+    uint64_t        Latency[LATENCY_BUCKETS];
+    uint64_t        LatencyTotal;
+} STATS;
+
+typedef struct _QUEUE {
+    unsigned int        Index;
+    unsigned int        Seed;
+
+    netif_tx_sring_t    *TxShared;
+    netif_tx_front_ring_t TxFront;
+    netif_tx_back_ring_t TxBack;
+    EVENT               TxFrontEvent;
+    EVENT               TxBackEvent;
+    uint64_t            TxTime[NETIF_TX_RING_SIZE];
+    unsigned int        TxSize[NETIF_TX_RING_SIZE];
+    uint16_t            TxFree[NETIF_TX_RING_SIZE];
+    unsigned int        TxFreeCount;
+    STATS               TxStats;
+
+    netif_rx_sring_t    *RxShared;
+    netif_rx_front_ring_t RxFront;
+    netif_rx_back_ring_t RxBack;
+    EVENT               RxFrontEvent;
+    EVENT               RxBackEvent;
+    uint64_t            RxTime[NETIF_RX_RING_SIZE];
+    STATS               RxStats;
+
+    pthread_t           Thread[4];
+} QUEUE;
+
+static volatile int Stopping;
+static MIX          Mix;
+static int          Gso;
+
+static uint64_t
+Now(
+    void
+    )
+{
+    struct timespec Time;
+
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    return ((uint64_t)Time.tv_sec * 1000000000ull) + Time.tv_nsec;
+}
+
+static void
+EventInitialize(
+    EVENT   *Event
+    )
+{
+    pthread_mutex_init(&Event->Lock, NULL);
+    pthread_cond_init(&Event->Cond, NULL);
+    Event->Pending = 0;
+    Event->Count = 0;
+}
+
+static void
+EventSignal(
+    EVENT   *Event
+    )
+{
+    pthread_mutex_lock(&Event->Lock);
+    Event->Pending = 1;
+    Event->Count++;
+    pthread_cond_signal(&Event->Cond);
+    pthread_mutex_unlock(&Event->Lock);
+}
+
+static void
+EventWait(
+    EVENT   *Event
+    )
+{
+    pthread_mutex_lock(&Event->Lock);
+    while (!Event->Pending && !Stopping)
+        pthread_cond_wait(&Event->Cond, &Event->Lock);
+    Event->Pending = 0;
+    pthread_mutex_unlock(&Event->Lock);
+}
+
+static unsigned int
+MixChoose(
+    unsigned int    *Seed
+    )
+{
+    unsigned int    Value = rand_r(Seed) % Mix.Total;
+    unsigned int    Index;
+
+    for (Index = 0; Index < Mix.Count; Index++) {
+        if (Value < Mix.Weight[Index])
+            return Mix.Size[Index];
+
+        Value -= Mix.Weight[Index];
+    }
+
+    return Mix.Size[Mix.Count - 1];
+}
+
+static unsigned int
+SlotsNeeded(
+    unsigned int    Size
+    )
+{
+    // Data slots plus an extra info slot for a GSO packet
+    return ((Size + PAGE_SIZE - 1) / PAGE_SIZE) +
+           ((Size > MAXIMUM_FRAME_SIZE) ? 1 : 0);
+}
+
+static void
+StatsRecord(
+    STATS       *Stats,
+    unsigned int Size,
+    uint64_t    Latency
+    )
+{
+    unsigned int Bucket = 0;
+
+    while (Bucket < LATENCY_BUCKETS - 1 && (1ull << (Bucket + 1)) <= Latency)
+        Bucket++;
+
+    Stats->Packets++;
+    Stats->Bytes += Size;
+    Stats->Latency[Bucket]++;
+    Stats->LatencyTotal += Latency;
+}
+
+static uint64_t
+StatsPercentile(
+    const STATS *Stats,
+    unsigned int Percent
+    )
+{
+    uint64_t    Target = (Stats->Packets * Percent) / 100;
+    uint64_t    Count = 0;
+    unsigned int Bucket;
+
+    for (Bucket = 0; Bucket < LATENCY_BUCKETS; Bucket++) {
+        Count += Stats->Latency[Bucket];
+        if (Count > Target)
+            break;
+    }
+
+    return 1ull << (Bucket + 1);
+}
+
+// Transmit frontend: post packets while there is room, reap responses
+// and only sleep when nothing could be posted until the backend responds.
+static void *
+TxFrontend(
+    void    *Context
+    )
+{
+    QUEUE   *Queue = Context;
+    netif_tx_front_ring_t *Front = &Queue->TxFront;
+
+    while (!Stopping) {
+        unsigned int    Posted = 0;
+        int             Notify;
+        int             More;
+
+        for (;;) {
+            unsigned int    Size = MixChoose(&Queue->Seed);
+            unsigned int    Slots = SlotsNeeded(Size);
+            unsigned int    Remaining = Size;
+            netif_tx_request_t *Request;
+            uint16_t        Id;
+
+            if (RING_FREE_REQUESTS(Front) < Slots ||
+                Queue->TxFreeCount < Slots)
+                break;
+
+            Id = Queue->TxFree[--Queue->TxFreeCount];
+            Queue->TxTime[Id] = Now();
+            Queue->TxSize[Id] = Size;
+
+            Request = RING_GET_REQUEST(Front, Front->req_prod_pvt++);
+            Request->id = Id;
+            Request->gref = Id;
+            Request->offset = 0;
+            Request->size = (uint16_t)Size;
+            Request->flags = (Size > PAGE_SIZE) ? NETTXF_more_data : 0;
+            Remaining -= (Size > PAGE_SIZE) ? PAGE_SIZE : Size;
+
+            if (Size > MAXIMUM_FRAME_SIZE) {
+                netif_extra_info_t *Extra;
+
+                Request->flags |= NETTXF_extra_info | NETTXF_csum_blank;
+
+                Extra = (netif_extra_info_t *)RING_GET_REQUEST(Front,
+                                                               Front->req_prod_pvt++);
+                memset(Extra, 0, sizeof (*Extra));
+                Extra->type = XEN_NETIF_EXTRA_TYPE_GSO;
+                Extra->u.gso.size = MAXIMUM_FRAME_SIZE - 54;
+                Extra->u.gso.type = XEN_NETIF_GSO_TYPE_TCPV4;
+            }
+
+            while (Remaining != 0) {
+                unsigned int Length = (Remaining > PAGE_SIZE) ? PAGE_SIZE : Remaining;
+
+                Id = Queue->TxFree[--Queue->TxFreeCount];
+                Queue->TxTime[Id] = 0;
+
+                Remaining -= Length;
+
+                Request = RING_GET_REQUEST(Front, Front->req_prod_pvt++);
+                Request->id = Id;
+                Request->gref = Id;
+                Request->offset = 0;
+                Request->size = (uint16_t)Length;
+                Request->flags = (Remaining != 0) ? NETTXF_more_data : 0;
+            }
+
+            Posted++;
+        }
+
+        if (Posted != 0) {
+            RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(Front, Notify);
+            if (Notify)
+                EventSignal(&Queue->TxBackEvent);
+        }
+
+        do {
+            RING_IDX    Prod = Front->sring->rsp_prod;
+            RING_IDX    Cons;
+
+            xen_rmb();
+
+            for (Cons = Front->rsp_cons; Cons != Prod; Cons++) {
+                netif_tx_response_t *Response = RING_GET_RESPONSE(Front, Cons);
+
+                if (Response->status == NETIF_RSP_NULL)
+                    continue;
+
+                if (Queue->TxTime[Response->id] != 0)
+                    StatsRecord(&Queue->TxStats,
+                                Queue->TxSize[Response->id],
+                                Now() - Queue->TxTime[Response->id]);
+
+                Queue->TxFree[Queue->TxFreeCount++] = Response->id;
+            }
+
+            Front->rsp_cons = Cons;
+
+            RING_FINAL_CHECK_FOR_RESPONSES(Front, More);
+        } while (More);
+
+        // Nothing could be posted so wait for the backend to free slots
+        if (Posted == 0 && Front->req_prod_pvt != Front->rsp_cons)
+            EventWait(&Queue->TxFrontEvent);
+    }
+
+    return NULL;
+}
+
+// Transmit backend: consume whole packets and respond to every slot,
+// with NETIF_RSP_NULL for extra info slots as netback does.
+static void *
+TxBackend(
+    void    *Context
+    )
+{
+    QUEUE   *Queue = Context;
+    netif_tx_back_ring_t *Back = &Queue->TxBack;
+
+    while (!Stopping) {
+        int     More;
+        int     Notify;
+
+        RING_FINAL_CHECK_FOR_REQUESTS(Back, More);
+        if (!More) {
+            EventWait(&Queue->TxBackEvent);
+            continue;
+        }
+
+        while (RING_HAS_UNCONSUMED_REQUESTS(Back)) {
+            netif_tx_request_t  Request;
+            netif_tx_response_t *Response;
+            int                 Extra;
+
+            xen_rmb();
+
+            Request = *RING_GET_REQUEST(Back, Back->req_cons++);
+            Extra = (Request.flags & NETTXF_extra_info) ? 1 : 0;
+
+            for (;;) {
+                Response = RING_GET_RESPONSE(Back, Back->rsp_prod_pvt++);
+                Response->id = Request.id;
+                Response->status = NETIF_RSP_OKAY;
+
+                if (Extra) {
+                    (void) RING_GET_REQUEST(Back, Back->req_cons++);
+
+                    Response = RING_GET_RESPONSE(Back, Back->rsp_prod_pvt++);
+                    Response->status = NETIF_RSP_NULL;
+                    Extra = 0;
+                }
+
+                if (!(Request.flags & NETTXF_more_data))
+                    break;
+
+                Request = *RING_GET_REQUEST(Back, Back->req_cons++);
+            }
+        }
+
+        RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(Back, Notify);
+        if (Notify)
+            EventSignal(&Queue->TxFrontEvent);
+    }
+
+    return NULL;
+}
+
+// Receive frontend: keep the ring full of buffers and account each
+// packet, which may span several slots, when its last slot arrives.
+static void *
+RxFrontend(
+    void    *Context
+    )
+{
+    QUEUE   *Queue = Context;
+    netif_rx_front_ring_t *Front = &Queue->RxFront;
+    unsigned int    Size = 0;
+    uint64_t        Time = 0;
+    int             Extra = 0;
+
+    while (!Stopping) {
+        RING_IDX    Cons;
+        int         Notify;
+        int         More;
+
+        while (RING_FREE_REQUESTS(Front) != 0) {
+            netif_rx_request_t *Request;
+            uint16_t    Id = Front->req_prod_pvt & (NETIF_RX_RING_SIZE - 1);
+
+            Request = RING_GET_REQUEST(Front, Front->req_prod_pvt++);
+            Request->id = Id;
+            Request->gref = Id;
+        }
+
+        RING_PUSH_REQUESTS_AND_CHECK_NOTIFY(Front, Notify);
+        if (Notify)
+            EventSignal(&Queue->RxBackEvent);
+
+        RING_FINAL_CHECK_FOR_RESPONSES(Front, More);
+        if (!More) {
+            EventWait(&Queue->RxFrontEvent);
+            continue;
+        }
+
+        xen_rmb();
+
+        for (Cons = Front->rsp_cons; Cons != Front->sring->rsp_prod; Cons++) {
+            netif_rx_response_t *Response = RING_GET_RESPONSE(Front, Cons);
+
+            if (Extra) {
+                Extra = 0;
+                continue;
+            }
+
+            if (Size == 0)
+                Time = Queue->RxTime[Response->id];
+
+            Size += (unsigned int)Response->status;
+            Extra = (Response->flags & NETRXF_extra_info) ? 1 : 0;
+
+            if (!(Response->flags & NETRXF_more_data)) {
+                StatsRecord(&Queue->RxStats, Size, Now() - Time);
+                Size = 0;
+            }
+        }
+
+        Front->rsp_cons = Cons;
+    }
+
+    return NULL;
+}
+
+// Receive backend: fill every posted buffer with packets from the mix.
+static void *
+RxBackend(
+    void    *Context
+    )
+{
+    QUEUE   *Queue = Context;
+    netif_rx_back_ring_t *Back = &Queue->RxBack;
+    unsigned int    Seed = Queue->Seed ^ 0x5a5a5a5a;
+
+    while (!Stopping) {
+        unsigned int Batch;
+        int     More;
+        int     Notify;
+
+        RING_FINAL_CHECK_FOR_REQUESTS(Back, More);
+        if (!More) {
+            EventWait(&Queue->RxBackEvent);
+            continue;
+        }
+
+        // Respond in batches so that the frontend sees packets promptly
+        for (Batch = 0; Batch < RX_BATCH; Batch++) {
+            unsigned int    Size = MixChoose(&Seed);
+            unsigned int    Slots = SlotsNeeded(Size);
+            unsigned int    Remaining = Size;
+            uint64_t        Time = Now();
+            RING_IDX        Prod = Back->sring->req_prod;
+            int             First = 1;
+
+            xen_rmb();
+
+            if (Prod - Back->req_cons < Slots)
+                break;
+
+            while (Remaining != 0) {
+                netif_rx_request_t  Request;
+                netif_rx_response_t *Response;
+                unsigned int        Length;
+
+                Length = (Remaining > PAGE_SIZE) ? PAGE_SIZE : Remaining;
+                Remaining -= Length;
+
+                Request = *RING_GET_REQUEST(Back, Back->req_cons++);
+                Queue->RxTime[Request.id] = Time;
+
+                Response = RING_GET_RESPONSE(Back, Back->rsp_prod_pvt++);
+                Response->id = Request.id;
+                Response->offset = 0;
+                Response->status = (int16_t)Length;
+                Response->flags = NETRXF_data_validated;
+                if (Remaining != 0)
+                    Response->flags |= NETRXF_more_data;
+
+                if (First && Size > MAXIMUM_FRAME_SIZE) {
+                    netif_extra_info_t *Extra;
+
+                    Response->flags |= NETRXF_extra_info | NETRXF_csum_blank;
+
+                    (void) RING_GET_REQUEST(Back, Back->req_cons++);
+
+                    Extra = (netif_extra_info_t *)RING_GET_RESPONSE(Back,
+                                                                    Back->rsp_prod_pvt++);
+                    memset(Extra, 0, sizeof (*Extra));
+                    Extra->type = XEN_NETIF_EXTRA_TYPE_GSO;
+                    Extra->u.gso.size = MAXIMUM_FRAME_SIZE - 54;
+                    Extra->u.gso.type = XEN_NETIF_GSO_TYPE_TCPV4;
+                }
+
+                First = 0;
+            }
+        }
+
+        RING_PUSH_RESPONSES_AND_CHECK_NOTIFY(Back, Notify);
+        if (Notify)
+            EventSignal(&Queue->RxFrontEvent);
+    }
+
+    return NULL;
+}
+
+static int
+MixParse(
+    const char  *String
+    )
+{
+    char        *Copy = strdup(String);
+    char        *Save = NULL;
+    char        *Token;
+
+    if (Copy == NULL)
+        return -1;
+
+    Mix.Count = 0;
+    Mix.Total = 0;
+
+    for (Token = strtok_r(Copy, ",", &Save);
+         Token != NULL;
+         Token = strtok_r(NULL, ",", &Save)) {
+        unsigned int    Size;
+        unsigned int    Weight = 1;
+
+        if (Mix.Count == MAXIMUM_MIX ||
+            sscanf(Token, "%u:%u", &Size, &Weight) < 1 ||
+            Size < 14 || Size > MAXIMUM_GSO_SIZE ||
+            (Size > MAXIMUM_FRAME_SIZE && !Gso) ||
+            Weight == 0)
+            goto fail;
+
+        Mix.Size[Mix.Count] = Size;
+        Mix.Weight[Mix.Count] = Weight;
+        Mix.Total += Weight;
+        Mix.Count++;
+    }
+
+    free(Copy);
+    return (Mix.Count != 0) ? 0 : -1;
+
+fail:
+    free(Copy);
+    return -1;
+}
+
+static void
+Report(
+    const char  *Name,
+    const STATS *Stats,
+    double      Seconds
+    )
+{
+    printf("%s: %.0f pkt/s %.3f Gbit/s latency avg %.0fns p50 <%lluns p99 <%lluns\n",
+           Name,
+           Stats->Packets / Seconds,
+           (Stats->Bytes * 8.0) / (Seconds * 1e9),
+           (Stats->Packets != 0) ? (double)Stats->LatencyTotal / Stats->Packets : 0.0,
+           (unsigned long long)StatsPercentile(Stats, 50),
+           (unsigned long long)StatsPercentile(Stats, 99));
+}
+
+static void
+StatsAdd(
+    STATS       *Total,
+    const STATS *Stats
+    )
+{
+    unsigned int Bucket;
+
+    Total->Packets += Stats->Packets;
+    Total->Bytes += Stats->Bytes;
+    Total->LatencyTotal += Stats->LatencyTotal;
+    for (Bucket = 0; Bucket < LATENCY_BUCKETS; Bucket++)
+        Total->Latency[Bucket] += Stats->Latency[Bucket];
+}
+
+int
+main(
+    int     argc,
+    char    **argv
+    )
+{
+    const char  *MixString = "64:7,576:4,1514:1";
+    unsigned int Count = 1;
+    unsigned int Duration = 5;
+    QUEUE       *Queue;
+    STATS       TxTotal;
+    STATS       RxTotal;
+    uint64_t    Start;
+    double      Seconds;
+    unsigned int Index;
+    int         Option;
+
+    while ((Option = getopt(argc, argv, "q:t:s:g")) != -1) {
+        switch (Option) {
+        case 'q':
+            Count = (unsigned int)strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            Duration = (unsigned int)strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            MixString = optarg;
+            break;
+        case 'g':
+            Gso = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-q queues] [-t seconds] [-s size:weight,...] [-g]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    if (Count == 0 || Duration == 0 || MixParse(MixString) != 0) {
+        fprintf(stderr, "%s: bad arguments\n", argv[0]);
+        return 1;
+    }
+
+    Queue = calloc(Count, sizeof (QUEUE));
+    if (Queue == NULL)
+        return 1;
+
+    for (Index = 0; Index < Count; Index++) {
+        QUEUE   *Q = &Queue[Index];
+        unsigned int Id;
+
+        Q->Index = Index;
+        Q->Seed = Index + 1;
+
+        if (posix_memalign((void **)&Q->TxShared, PAGE_SIZE, PAGE_SIZE) != 0 ||
+            posix_memalign((void **)&Q->RxShared, PAGE_SIZE, PAGE_SIZE) != 0)
+            return 1;
+
+        SHARED_RING_INIT(Q->TxShared);
+        FRONT_RING_INIT(&Q->TxFront, Q->TxShared, PAGE_SIZE);
+        BACK_RING_INIT(&Q->TxBack, Q->TxShared, PAGE_SIZE);
+
+        SHARED_RING_INIT(Q->RxShared);
+        FRONT_RING_INIT(&Q->RxFront, Q->RxShared, PAGE_SIZE);
+        BACK_RING_INIT(&Q->RxBack, Q->RxShared, PAGE_SIZE);
+
+        for (Id = 0; Id < NETIF_TX_RING_SIZE; Id++)
+            Q->TxFree[Q->TxFreeCount++] = (uint16_t)Id;
+
+        EventInitialize(&Q->TxFrontEvent);
+        EventInitialize(&Q->TxBackEvent);
+        EventInitialize(&Q->RxFrontEvent);
+        EventInitialize(&Q->RxBackEvent);
+    }
+
+    Start = Now();
+
+    for (Index = 0; Index < Count; Index++) {
+        QUEUE   *Q = &Queue[Index];
+
+        pthread_create(&Q->Thread[0], NULL, TxFrontend, Q);
+        pthread_create(&Q->Thread[1], NULL, TxBackend, Q);
+        pthread_create(&Q->Thread[2], NULL, RxFrontend, Q);
+        pthread_create(&Q->Thread[3], NULL, RxBackend, Q);
+    }
+
+    sleep(Duration);
+    Stopping = 1;
+
+    for (Index = 0; Index < Count; Index++) {
+        QUEUE   *Q = &Queue[Index];
+        unsigned int Thread;
+
+        EventSignal(&Q->TxFrontEvent);
+        EventSignal(&Q->TxBackEvent);
+        EventSignal(&Q->RxFrontEvent);
+        EventSignal(&Q->RxBackEvent);
+
+        for (Thread = 0; Thread < 4; Thread++)
+            pthread_join(Q->Thread[Thread], NULL);
+    }
+
+    Seconds = (Now() - Start) / 1e9;
+
+    memset(&TxTotal, 0, sizeof (TxTotal));
+    memset(&RxTotal, 0, sizeof (RxTotal));
+
+    for (Index = 0; Index < Count; Index++) {
+        QUEUE   *Q = &Queue[Index];
+        char    Name[32];
+
+        snprintf(Name, sizeof (Name), "queue %u tx", Index);
+        Report(Name, &Q->TxStats, Seconds);
+        snprintf(Name, sizeof (Name), "queue %u rx", Index);
+        Report(Name, &Q->RxStats, Seconds);
+
+        printf("queue %u notifications: tx %llu/%llu rx %llu/%llu (front/back)\n",
+               Index,
+               (unsigned long long)Q->TxFrontEvent.Count,
+               (unsigned long long)Q->TxBackEvent.Count,
+               (unsigned long long)Q->RxFrontEvent.Count,
+               (unsigned long long)Q->RxBackEvent.Count);
+
+        StatsAdd(&TxTotal, &Q->TxStats);
+        StatsAdd(&RxTotal, &Q->RxStats);
+
+        free(Q->TxShared);
+        free(Q->RxShared);
+    }
+
+    Report("total tx", &TxTotal, Seconds);
+    Report("total rx", &RxTotal, Seconds);
+
+    free(Queue);
+    return 0;
+}